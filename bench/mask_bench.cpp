@@ -0,0 +1,48 @@
+#include "../inc/Mask.hpp"
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+//Microbenchmark for the compiled mask matcher: every pattern is run over the
+//same batch of synthetic nick!user@host subjects and the rate is reported.
+//usage: ./mask_bench [subjects] [rounds]
+
+static std::vector<std::string> makeSubjects(size_t count) {
+    static const char* domains[] = { "example.com", "irc.libera.chat", "users.undernet.org", "10.0.3.7", "dsl.provider.net" };
+    std::vector<std::string> subjects;
+    subjects.reserve(count);
+    std::srand(42);
+    for (size_t i = 0; i < count; ++i) {
+        std::ostringstream oss;
+        oss << "Nick" << i << "!~user" << (std::rand() % 1000) << "@host" << (std::rand() % 500)
+            << "." << domains[std::rand() % 5];
+        subjects.push_back(oss.str());
+    }
+    return subjects;
+}
+
+int main(int ac, char** av) {
+    size_t count = (ac > 1) ? std::strtoul(av[1], NULL, 10) : 10000;
+    size_t rounds = (ac > 2) ? std::strtoul(av[2], NULL, 10) : 200;
+    std::vector<std::string> subjects = makeSubjects(count);
+    static const char* patterns[] = {
+        "*", "nick42!~user1@host1.example.com", "NICK1*", "*.EXAMPLE.COM",
+        "nick*!*@*.undernet.org", "*!~user?2*@*", "*1*2*3*", "n?ck*!*user*@host4*.*.net"
+    };
+    std::vector<bool> verdicts;
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+        Mask mask(patterns[p]);
+        size_t hits = 0;
+        std::clock_t start = std::clock();
+        for (size_t r = 0; r < rounds; ++r) {
+            hits += mask.matchBatch(subjects, verdicts);
+        }
+        double seconds = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+        double total = static_cast<double>(count) * rounds;
+        std::cout << patterns[p] << ": " << hits / rounds << " hits, "
+                  << static_cast<long>(seconds > 0 ? total / seconds / 1e6 : 0) << "."
+                  << static_cast<long>(seconds > 0 ? total / seconds / 1e5 : 0) % 10 << " M matches/s" << std::endl;
+    }
+    return 0;
+}
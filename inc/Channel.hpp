@@ -2,6 +2,11 @@
 
 #include "Client.hpp"
 #include "Server.hpp"
+#include "SharedBuffer.hpp"
+#include "MaskSet.hpp"
+#include "History.hpp"
+#include "HistoryStore.hpp"
+#include "ChannelJournal.hpp"
 #include <set>
 #include <stack>
 
@@ -25,11 +30,33 @@ private:
     size_t _userLimit;
     bool _inviteOnly;
     bool _topicLocked;
+    std::time_t _createdAt;
+    std::time_t _topicTime;          // 0 while no topic was ever set
+    static unsigned long _metadataVersion; // bumped on anything LIST shows: channels, user counts, topics
 
     std::vector<Client *> _clients;
     std::set<std::string> _operators; // the operator's nickname
     std::set<std::string> _invited;   // list of invited nicknames
+    std::vector<std::string> _nameChunks; // RPL_NAMEREPLY payloads, patched on every membership/op change
+    std::map<std::string, size_t> _nameChunkOf; // member nick -> chunk holding its token
+    MaskSet _bans;                   // +b
+    MaskSet _banExceptions;          // +e
+    MaskSet _inviteExceptions;       // +I
+    mutable std::map<const Client*, bool> _banCache; // members' ban verdicts, dropped on list or nick changes
+    ChannelHistory _history;         // recent PRIVMSG lines for CHATHISTORY
+    HistoryStore *_store;            // everything ever recorded, NULL without persistence
+    ChannelJournal *_journal;        // where metadata changes are recorded, NULL while restoring
+
+    size_t _namesBudget() const;
+    bool _namesFind(const std::string &nickname, size_t &chunk, size_t &pos, size_t &len) const;
+    void _namesAdd(const std::string &token);
+    void _namesRemove(const std::string &nickname);
+    void _namesIndexChunk(size_t chunk);
+    void _namesSetOperator(const std::string &nickname, bool on);
+    bool _computeBanned(const Client &client) const;
 public:
+    static const size_t MAX_LIST_ENTRIES = 5000; // per list mode, advertised as MAXLIST
+
     Channel(const std::string &name);
     ~Channel();
 
@@ -37,16 +64,28 @@ public:
     const std::string &getName() const;
     const std::string &getTopic() const;
     size_t getUserLimit() const;
-    std::vector<Client*> getUsers() const;
+    const std::vector<Client*>& getUsers() const;
+    std::time_t getCreationTime() const;
+    std::time_t getTopicTime() const;
+    static unsigned long getMetadataVersion();
+    const std::string &getPassword() const;
+    size_t getHistoryLength() const;
     
     // Topic control
     void setTopic(const std::string &topic, const std::string &setter);
     bool isTopicLocked() const;
+
+    // Restart restore, these are not journaled again
+    void setJournal(ChannelJournal *journal);
+    void restoreCreationTime(std::time_t createdAt);
+    void restoreTopic(const std::string &topic, std::time_t topicTime);
+    void restoreListEntry(char mode, const std::string &mask, const std::string &setter, std::time_t setAt);
     
     // Client control
     void addClient(Client *client);
     void removeClient(const std::string &nickname);
     bool hasClient(const std::string &nickname) const;
+    void renameClient(const std::string &oldNick, const std::string &newNick);
     
     // Operators control
     void addOperator(const std::string &nickname);
@@ -64,9 +103,24 @@ public:
     void setUserLimit(size_t limit);
     void setInviteOnly(bool on);
     void setTopicLock(bool on);
+    void setHistoryLength(size_t length); // +H
+
+    // List modes, mode is 'b', 'e' or 'I'
+    const MaskSet &getList(char mode) const;
+    bool addListEntry(char mode, const std::string &mask, const std::string &setter);
+    bool removeListEntry(char mode, const std::string &mask);
+    bool isBanned(const Client &client) const;
+    bool isInviteException(const Client &client) const;
+
+    // History
+    ChannelHistory &getHistory();
+    const HistoryStore *getStore() const;
+    void attachStore(HistoryStore *store); // takes ownership, refills the ring from it
+    void recordMessage(const SharedBuffer &line, unsigned long timeMs);
 
     // Messaging
     void broadcast(const std::string &message, const std::string &senderNick = "");
+    void broadcast(const SharedBuffer &message, const std::string &senderNick = "");
     // !!! the ="" means the parameter is optional , which works great in this case(see setTopic)
     // the feature is called default parameter and it is available in C++98
 
@@ -77,5 +131,5 @@ public:
     bool isFull() const;
     bool hasPassword() const;
     bool verifyPassword(const std::string& password) const;
-    std::string getNameList() const;
+    const std::vector<std::string>& getNameChunks() const;
 };
@@ -0,0 +1,62 @@
+#pragma once
+#include "Mask.hpp"
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+class Channel;
+
+//What one LIST asked for (ELIST C, M, N, T, U); an unset bound is 0
+struct ListFilter {
+    std::vector<Mask> masks;    // channel name must match one of them, when there are any
+    std::vector<Mask> excludes; // "!mask": channel name must match none of them
+    size_t minUsers;            // ">n": more than n users
+    size_t maxUsers;            // "<n": fewer than n users
+    std::time_t topicAfter;     // "T<n": topic set less than n minutes ago
+    std::time_t topicBefore;    // "T>n": topic set more than n minutes ago
+    std::time_t createdAfter;   // "C<n"
+    std::time_t createdBefore;  // "C>n"
+    std::string resumeAfter;    // last name sent, the next page starts behind it
+    bool started;
+
+    ListFilter();
+    //parses the comma separated LIST parameter, false on an unknown condition
+    bool parse(const std::string& conditions, std::time_t now);
+};
+
+//Read-only copy of what LIST shows, sorted by channel name. Names and topics
+//live in one text block, so a rebuild is one pass over the channels and a few
+//allocations, and serving a page never touches the channels themselves.
+class ChannelDirectory {
+    public:
+        struct Entry {
+            size_t nameOffset;
+            size_t nameLength;
+            size_t topicOffset;
+            size_t topicLength;
+            size_t users;
+            std::time_t topicTime;
+            std::time_t created;
+        };
+    private:
+        std::string _text;
+        std::vector<Entry> _entries;
+        unsigned long _version;     // Channel::getMetadataVersion() when built
+        std::time_t _builtAt;
+        bool _built;
+
+        int _compareName(size_t i, const std::string& name) const;
+    public:
+        ChannelDirectory();
+
+        //rebuilds when channels changed since the last build and that build is at least maxAge seconds old
+        void refresh(const std::set<Channel*>& channels, std::time_t now, std::time_t maxAge);
+        size_t size() const;
+        const Entry& at(size_t i) const;
+        std::string name(size_t i) const;
+        std::string topic(size_t i) const;
+        //first entry whose name sorts after the given one
+        size_t upperBound(const std::string& name) const;
+        bool accepts(size_t i, const ListFilter& filter) const;
+};
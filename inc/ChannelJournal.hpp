@@ -0,0 +1,84 @@
+#pragma once
+#include <ctime>
+#include <pthread.h>
+#include <set>
+#include <string>
+
+class Channel;
+class Server;
+
+//Crash-safe channel metadata: a snapshot file plus a journal of the changes
+//made since, both in the same record format:
+//  [u32 body length][u8 record type][fields...]
+//numbers are 8 bytes, strings a u32 length and the bytes (host byte order).
+//Channels report every change here; the event loop only appends the encoded
+//record to a buffer, a background thread writes and fdatasync()s it in batches.
+//Once the journal passes a size the server hands over a new snapshot, which the
+//thread writes next to the old one and renames over it before resetting the
+//journal. Each journal starts with the sequence number of the snapshot it
+//follows, so a journal left behind by a crash mid-rotation is never replayed
+//on top of the newer snapshot.
+//Operators and invites are keyed by nickname only, so they are not kept: after
+//a restart whoever took the nick first would inherit them. The first client to
+//join a restored channel is its operator, as for a new one. The files are
+//0600, they hold the channel keys.
+class ChannelJournal {
+    public:
+        enum RecordType {
+            REC_CREATE = 1,   // name, creation time
+            REC_DROP,         // name
+            REC_TOPIC,        // name, topic, topic time
+            REC_FLAGS,        // name, invite only, topic lock, user limit, history length
+            REC_KEY,          // name, key ("" for none)
+            REC_OPERATOR,     // no longer written, skipped by replay
+            REC_INVITE,       // no longer written, skipped by replay
+            REC_LIST          // name, mode, mask, setter, set time, on
+        };
+    private:
+        std::string _dir;
+        int _journalFd;
+        unsigned long _seq;           // snapshot the journal on disk follows
+        size_t _journalBytes;         // appended since the last snapshot
+        size_t _snapshotThreshold;
+        bool _replaying;              // restore in progress, changes are not recorded
+        bool _open;                   // what the loop checks, _journalFd belongs to the writer
+
+        pthread_t _thread;
+        pthread_mutex_t _mutex;
+        pthread_cond_t _wake;
+        std::string _pending;         // records not yet handed to the disk
+        std::string _snapshotJob;     // encoded snapshot waiting to be written
+        bool _hasSnapshotJob;
+        bool _running;
+        bool _stopping;
+
+        static void* _run(void* self);
+        void _loop();
+        void _writeSnapshot(const std::string& body, unsigned long seq);
+        void _writeJournal(const std::string& records);
+        void _append(const std::string& record);
+        static void _encodeChannel(std::string& out, const Channel& channel);
+        bool _replay(Server& server, const char* data, size_t len);
+
+        ChannelJournal(const ChannelJournal& other);
+        ChannelJournal& operator=(const ChannelJournal& other);
+    public:
+        ChannelJournal();
+        ~ChannelJournal();
+
+        //loads snapshot and journal into live channels, then starts the writer
+        bool open(const std::string& dir, Server& server);
+        void close();
+        bool isOpen() const;
+
+        //called from the loop: writes a new snapshot once the journal grew enough
+        void maybeSnapshot(const std::set<Channel*>& channels);
+
+        void recordCreate(const Channel& channel);
+        void recordDrop(const std::string& name);
+        void recordTopic(const Channel& channel);
+        void recordFlags(const Channel& channel);
+        void recordKey(const Channel& channel);
+        void recordListEntry(const Channel& channel, char mode, const std::string& mask,
+                             const std::string& setter, std::time_t setAt, bool on);
+};
@@ -1,40 +1,172 @@
 #pragma once
 #include "Server.hpp"
+#include "SharedBuffer.hpp"
+#include "TimerWheel.hpp"
+#include "HostTable.hpp"
 
 class Server;
+class Client;
+class Channel;
+struct ListFilter;
+
+//the one wheel entry of a client, due at the earliest of its armed deadlines
+//(see Server::clientDeadline)
+struct ClientTimer : public Timer {
+    Client* client;
+    void expire();
+};
+
+//hostname/ident lookups of a connection, allocated when they start and freed
+//at the welcome, so a registered client holds none of it
+struct ClientLookups {
+    unsigned long id;               // the resolver answers for this connection carry it
+    unsigned char pending;          // LOOKUP_* still running; the welcome waits for them
+    std::string identUser;          // from the ident lookup, empty when there was no answer
+};
+
+//cold part of a connection that every client has from accept on, all that a
+//client still registering holds besides the Client record
+struct ClientConnection {
+    std::string hostname;
+    size_t recvqMax;                // from the connection class, 0 for no limit
+    HostKey address;                // binary peer address, and its network, for the accept limits
+    HostKey network;
+    ClientTimer timer;
+    unsigned long deadlines[3];     // monotonic ms per DEADLINE_*, 0 when not armed
+    unsigned long pingSentMs;       // monotonic time of the unanswered PING, 0 when none is out
+    long lagMs;                     // round trip of the last answered PING, -1 before the first
+    unsigned long floodDeferrals;   // times input was held back
+    ClientLookups* lookups;         // NULL unless lookups ran and the client is not welcomed yet
+    unsigned int connectionId;      // numbers the connection in the event log
+    std::string quitReason;         // for the event log, empty when the connection just closed
+};
+
+//who the client says it is and where it is, allocated when USER arrives so an
+//idle connection never has one; only read when building prefixes and WHO/WHOIS replies
+struct ClientIdentity {
+    std::string username;
+    std::string realname;
+    std::time_t signOnTime;
+    std::vector<Channel*> channels; // channels this client is a member of, kept by Channel
+    ListFilter* pendingList;        // LIST still being paged out, owned
+};
 
 class Client {
     private:
+        enum {
+            FLAG_AUTHORIZED = 1 << 0,
+            FLAG_NICK = 1 << 1,
+            FLAG_USER = 1 << 2,
+            FLAG_INVISIBLE = 1 << 3,
+            FLAG_WELCOME = 1 << 4,
+            FLAG_LISTING = 1 << 5, // pendingList is set, checked on every send
+            FLAG_OPER = 1 << 6,    // IRC operator (OPER)
+            FLAG_DROPPED = 1 << 7  // over its sendq, the server closes it at the end of the pass
+        };
+        //hot part: everything the poll loop touches, so a pass over the clients
+        //never follows _connection or _identity; 224 bytes on LP64, Client.cpp keeps it
+        //within four cache lines
         Server* _serv_ref;
+        ClientConnection* _connection;
+        ClientIdentity* _identity;             // NULL until USER
+        std::time_t _lastActivityTime;
         int _client_fd;
+        unsigned char _flags;
+        unsigned char _caps;                   // CAP_* the client enabled
+        bool _capNegotiating;                  // CAP LS or REQ before registration, the welcome waits for CAP END
         std::string _nickname;
-        std::string _username;
-        std::string _realname;
-        std::string _hostname;
-        std::string _send_buffer;
         std::string _recv_buffer;
-        bool _authorized;
-        bool _nickFlag;
-        bool _userFlag;
-        bool _invisible;
-        bool _welcomeMsg;
-        std::time_t _signOnTime;
-        std::time_t _lastActivityTime;
+        std::vector<SharedBuffer> _send_queue; // entries before _send_head are already sent
+        size_t _send_head;
+        size_t _send_offset;                   // bytes of _send_queue[_send_head] already sent
+        size_t _send_bytes;                    // bytes still waiting in the queue
+        size_t _sendq_max;                     // from the connection class, 0 for no limit
+        unsigned long _lastHeardMs;            // monotonic time of the last bytes received
+        long _floodTokens;                     // flood bucket, in thousandths of a command
+        unsigned long _floodRefilledMs;
+        unsigned long _floodSinceMs;           // when input was first held back, 0 while the client keeps within its bucket
+        unsigned long _msgsIn;                 // traffic for STATS l: lines read, bytes received,
+        unsigned long _bytesIn;
+        unsigned long _msgsOut;                // lines queued and bytes actually written
+        unsigned long _bytesOut;
+
+        static unsigned long _queuedTotal;     // bytes queued to any client since startup
+        static unsigned long _linesTotal;      // lines queued to any client since startup
+        static unsigned long _backlogBytes;    // bytes queued and not yet written, all clients
+        static unsigned long _backlogClients;  // clients with anything queued
+
+        void _setFlag(unsigned char flag, bool on);
+        ClientIdentity& _identityForUpdate();
+        void _checkSendQueue();
+        Client(const Client& other);
+        Client& operator=(const Client& other);
+        friend struct ClientTimer;
     public:
+        enum {
+            LOOKUP_DNS = 1 << 0,
+            LOOKUP_IDENT = 1 << 1
+        };
+        //what the client's timer may be waiting for: the registration deadline
+        //and then the keepalive, the flood bucket refilled, the lookups timing out
+        enum {
+            DEADLINE_KEEPALIVE,
+            DEADLINE_FLOOD,
+            DEADLINE_LOOKUP,
+            DEADLINE_COUNT
+        };
+        //IRCv3 capabilities, see the table in CapCommand
+        enum {
+            CAP_BATCH = 1 << 0,
+            CAP_SERVER_TIME = 1 << 1,
+            CAP_MESSAGE_TAGS = 1 << 2,
+            CAP_CHATHISTORY = 1 << 3
+        };
         //getters
         int getClientFd(void) const;
         const std::string& getNickname(void) const;
         const std::string& getUsername(void) const;
         const std::string& getRealname(void) const;
         const std::string& getHostname(void) const;
-        std::string& getSendBuf(void) ;
         bool getAuth(void) const;
         bool getNickFlag(void) const;
         bool getUserFlag(void) const;
         bool getInvisible(void) const;
         bool getWelcomeMsg(void) const;
+        bool hasCap(unsigned char cap) const;
+        unsigned char getCaps(void) const;
+        bool isNegotiatingCaps(void) const;
         std::time_t getSignOnTime(void) const;
         std::time_t getIdleTime(void) const;
+        const std::vector<Channel*>& getJoinedChannels(void) const;
+        bool sharesChannelWith(const Client& other) const;
+        bool hasPendingList(void) const;
+        ListFilter* getPendingList(void) const;
+        bool isServerOperator(void) const;
+        bool isRecvQueueExceeded(void) const;
+        unsigned long getLastHeardMs(void) const;
+        unsigned long getPingSentMs(void) const;
+        long getLagMs(void) const;
+        ClientTimer& getTimer(void);
+        unsigned long getDeadline(int which) const;
+        unsigned long nextDeadline(void) const; // earliest armed one, 0 with none
+        const HostKey& getAddress(void) const;
+        const HostKey& getNetwork(void) const;
+        unsigned long getLookupId(void) const;
+        unsigned char getPendingLookups(void) const;
+        const std::string& getIdentUser(void) const;
+        long getFloodTokens(void) const;
+        unsigned long getFloodSinceMs(void) const;
+        unsigned long getFloodDeferrals(void) const;
+        unsigned int getConnectionId(void) const;
+        const std::string& getQuitReason(void) const;
+        unsigned long getMsgsIn(void) const;
+        unsigned long getBytesIn(void) const;
+        unsigned long getMsgsOut(void) const;
+        unsigned long getBytesOut(void) const;
+        static unsigned long getQueuedTotal(void);
+        static unsigned long getLinesTotal(void);
+        static unsigned long getBacklogBytes(void);
+        static unsigned long getBacklogClients(void);
 
         //setters
         void setNickname(const std::string& nickname);
@@ -45,17 +177,52 @@ class Client {
         void setUserFlag(bool flag);
         void setInvisible(bool flag);
         void setWelcomeMsg(bool flag);
+        void setCaps(unsigned char caps);
+        void setNegotiatingCaps(bool flag);
         void setSigOnTime(std::time_t signOnTime);
         void setLastActivityTime(std::time_t lastActivityTime);
+        void addJoinedChannel(Channel* channel);
+        void removeJoinedChannel(Channel* channel);
+        void setPendingList(ListFilter* filter); // takes ownership, NULL ends the listing
+        void setServerOperator(bool flag);
+        void setQueueLimits(size_t sendq, size_t recvq);
+        void setLastHeardMs(unsigned long nowMs);
+        void setPingSent(unsigned long nowMs);
+        void setPongReceived(unsigned long nowMs);
+        void setAddress(const HostKey& address, const HostKey& network);
+        void setFloodSince(unsigned long nowMs); // 0 once the deferred input is done
+        void setDeadline(int which, unsigned long dueMs); // use Server::_armDeadline, it keeps the wheel in step
+        void setLookups(unsigned long id, unsigned char pending);
+        void clearLookups(unsigned char done);
+        void setIdentUser(const std::string& user);
+        void releaseLookups(void); // at the welcome, the ident answer has been used
+        void setHostname(const std::string& hostname); // use Server::setClientHost, it keeps the host indexes
+        void setConnectionId(unsigned int id);
+        void setQuitReason(const std::string& reason);
+        //flood bucket: burst commands at once, ratePerSec after that; a command is
+        //charged once parsed, so the balance may dip below zero
+        void resetFlood(unsigned long burst, unsigned long nowMs);
+        bool refillFlood(unsigned long burst, unsigned long ratePerSec, unsigned long nowMs);
+        void chargeFlood(unsigned int cost);
+        unsigned long floodWaitMs(unsigned long ratePerSec) const; // until the balance is positive again
 
         Client(int client_fd, const std::string& hostname, Server* server);
         ~Client();
         //recv functions
         void appendRecvData(const char *buf, size_t len);
         std::string extractLineFromRecv();
+        bool extractLine(std::string& line); // false when no complete line is buffered
+        bool hasLine(void) const;
         //send functions
         bool hasData() const;
         void queueMessage(const std::string& msg);
+        std::string& prepareSend(size_t len);
+        void queueShared(const SharedBuffer& buf, bool endsLine = true); // false for a prefix the next buffer completes
+        size_t fillIovec(struct iovec* iov, size_t max) const;
+        size_t getSendQueueBytes(void) const;
+        size_t getRecvQueueBytes(void) const;
         void helpSenderEvent(size_t len);
         bool checkRegistered(void);
+        //bytes held by this connection (record, identity and heap buffers)
+        size_t getMemoryFootprint(void) const;
 };
@@ -0,0 +1,21 @@
+#pragma once
+#include <ctime>
+
+//The loop's notion of "now", read from the kernel once per pass (after poll()
+//returns) instead of by every command, idle check and timer that needs it.
+//monotonicMs() drives timers and never jumps; now() is wall-clock seconds for
+//what clients see (signon, idle, topic and ban times), wallMs() the same in
+//milliseconds for records that outlive the process. nanos() is the exception:
+//it reads the monotonic clock on every call, for timing work within a pass.
+class Clock {
+    private:
+        static unsigned long _monotonicMs;
+        static std::time_t _wall;
+        static unsigned long _wallMs;
+    public:
+        static void update();
+        static unsigned long monotonicMs();
+        static std::time_t now();
+        static unsigned long wallMs();
+        static unsigned long nanos();
+};
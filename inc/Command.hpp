@@ -1,82 +1,21 @@
 #pragma once
 #include "Server.hpp"
+#include "Reply.hpp"
+#include "Fanout.hpp"
+#include "Mask.hpp"
+#include "History.hpp"
+#include "Histogram.hpp"
 #include <set>
 
 class Server;
 class Client;
 
-template<typename T>
-std::string toString(T value) {
-    std::ostringstream oss;
-    oss << value;
-    return oss.str();
-}
-
-//macros for error codes
-#define RPL_WELCOME(nick, user, host) (std::string(":ircserver 001 ") + nick + " :Welcome to the server, " + nick + "[!" + user + "@" + host + "]\r\n")
-#define RPL_TOPIC(client, channel, topic) (std::string(":ircserver 332 ") + client + " " + channel + " :" + topic + "\r\n")
-#define RPL_NOTOPIC(client, channel) (std::string(":ircserver 331 ") + client + " " + channel + " :No topic is set\r\n")
-#define RPL_INVITING(client, target, channel) (std::string(":ircserver 341 ") + client + " " + target + " " + channel + "\r\n")
-#define RPL_NAMEREPLY(client, channel, list) (std::string(":ircserver 353 ") + client + " = " + channel + " :" + list + "\r\n")
-#define RPL_ENDOFNAMES(client, channel) (std::string(":ircserver 366 ") + client + " " + channel + " :End of /NAMES list.\r\n")
-#define ERR_NEEDMOREPARAMS(client, command) (std::string(":ircserver 461 ") + client + " " + command + " :Not enough parameters\r\n")
-#define ERR_ALREADYREGISTERED(client) (std::string(":ircserver 462 ") + client + " :You may not reregister\r\n")
-#define ERR_PASSWDMISMATCH(client) (std::string(":ircserver 464 ") + client + " :Password incorrect\r\n")
-#define ERR_NONICKNAMEGIVEN(client) (std::string(":ircserver 431 ") + client + " :No nickname given\r\n")
-#define ERR_ERRONEUSNICKNAME(client, nick) (std::string(":ircserver 432 ") + client + " " + nick + " :Erroneus nickname\r\n")
-#define ERR_NICKNAMEINUSE(client, nick) (std::string(":ircserver 433 ") + client + " " + nick + " :Nickname is already in use\r\n")
-#define ERR_NOORIGIN(client) (std::string("ircserver 409 ") + client + " :No origin specified\r\n")
-#define ERR_NOTEXTTOSEND(client) (std::string("ircserver 412 ") + client + " :No text to send\r\n")
-#define ERR_NOSUCHCHANNEL(client, channel) (std::string(":ircserver 403 ") + client + " " + channel + " :No such channel\r\n")
-#define ERR_NOSUCHNICK(client, target) (std::string(":ircserver 401 ") + client + " " + target + " :No such nick\r\n")
-#define ERR_NORECIPIENT(client, command) (std::string(":ircserver 411 ") + client + " :No recipient given (" + command + ")\r\n")
-#define ERR_CANNOTSENDTOCHAN(client, channel) (std::string(":ircserver 404 ") + client + " " + channel + " :Cannot send to channel\r\n")
-#define ERR_USRNOTINCHANNEL(client, target, channel) (std::string(":ircserver 441 ") + client + " " + target + " " + channel + " :Theu aren't on that channel\r\n")
-#define ERR_NOTONCHANNEL(client, channel) (std::string(":ircserver 442 ") + client + " " + channel + " :You're not on that channel\r\n")
-#define ERR_USERONCHANNEL(client, target, channel) (std::string(":ircserver 443 ") + client + " " + target + " " + channel + " :is already on channel\r\n")
-#define ERR_CHANOPRIVSNEEDED(client, channel) (std::string(":ircserver 482 ") + client + " " + channel + " :You're not channel operator\r\n")
-#define ERR_BADCHANMASK(client, channel) (std::string(":ircserver 476 ") + client + " " + channel + " :Bad Channel Mask\r\n")
-#define ERR_INVITEONLYCHAN(client, channel) (std::string(":ircserver 473 ") + client + " " + channel + " :Cannot join channel (+i)\r\n")
-#define ERR_CHANNELISFULL(client, channel) (std::string(":ircserver 471 ") + client + " " + channel + " :Cannot join channel (+l)\r\n")
-#define ERR_BADCHANNELKEY(client, channel) (std::string(":ircserver 475 ") + client + " " + channel + " :Cannot join channel (+k)\r\n")
-#define ERR_NOTREGISTERED(client) (std::string("ircserver 451 ") + client + " :You have not registered\r\n");
-#define ERR_USERDONTMATCH(client) (std::string("ircserver 502 ") + client + " :Cant change mode for other users\r\n")
-#define RPL_WHOISUSER(client, nick, username, host, realname) (std::string(":ircserver 311 ") + client + " " + nick + " " + username + " " + host + " * :" + realname + "\r\n")
-#define RPL_WHOISSERVER(client, nick) (std::string(":ircserver 312 ") + client + " " + nick + " ircserver :IRC server\r\n")
-#define RPL_WHOISCHANNELS(client, nick, channels) (std::string(":ircserver 319 ") + client + " " + nick + " :" + channels + "\r\n")
-#define RPL_WHOISIDLE(client, nick, idleTime, signon)(std::string(":ircserver 317 ") + client + " " + nick + " " + toString(idleTime) + " " + toString(signon) + " :seconds idle, signon time\r\n")
-#define RPL_ENDOFWHOIS(client, nick) (std::string(":ircserver 318 ") + client + " " + nick + " :End of /WHOIS list\r\n")
-#define RPL_WHOREPLY(client, channel, username, host, nick, c_op, realname) (std::string(":ircserver 352 ") + client + " " + channel + " " + username + " " + host + " ircserver " + nick + " H" + c_op + " :0 " + realname + "\r\n")
-#define RPL_ENDOFWHO(client) (std::string(":ircserver 315 ") + client + " :End of WHO list\r\n")
-#define RPL_UMODEIS(target, flags) (std::string(":ircserver 221 ") + target + " " + flags + "\r\n")
-#define RPL_CHANNELMODEIS(client, channel, flags) (std::string(":ircserver 324 ") + client + " " + channel + " " + flags + "\r\n")
-
 struct parsedCmd {
     std::string cmd;  //command itself
     std::vector<std::string> args;  // all arguments, including channel names and trailing messages
     Client* srcClient; // who sent the command
 };
 
-enum cmds {
-    PASS,
-    NICK,
-    USER,
-    JOIN,
-    PART,
-    PRIVMSG,
-    QUIT,
-    KICK,
-    INVITE,
-    TOPIC,
-    MODE,
-    PING,
-    CAP,
-    WHO,
-    WHOIS,
-    UNKNOWN
-};
-
-cmds getCommandEnum(const std::string& cmd);
 parsedCmd parseInput(const std::string& input, Client* client);
 bool _handleClientMessage(Server& server, Client* client, const std::string& cmd);
 class ICommand {
@@ -85,6 +24,35 @@ class ICommand {
         virtual void execute(Server& server, const parsedCmd& _parsedCmd) const = 0;
 };
 
+//one row per command in the dispatch table (see g_commands in Command.cpp)
+struct CommandEntry {
+    const char* name;
+    const ICommand* handler;
+    size_t minParams;        // fewer args -> ERR_NEEDMOREPARAMS before the handler runs
+    bool needsRegistration;  // refused with ERR_NOTREGISTERED until the client was welcomed
+    bool countsActivity;     // resets the idle time shown in WHOIS
+    bool closesConnection;   // the handler already disconnected the client
+    unsigned char cost;        // flood bucket tokens taken per use
+    unsigned char channelCost; // plus this much per channel named in the first argument
+};
+
+const CommandEntry* findCommand(const std::string& verb);
+unsigned int commandCost(const CommandEntry* entry, const parsedCmd& parsed);
+
+//what _handleClientMessage measured for one command since startup (STATS m);
+//bytes out is everything queued to any client while the command ran
+struct CommandStats {
+    const char* name;
+    unsigned long calls;
+    unsigned long bytesIn;   // the lines, without their line ending
+    unsigned long bytesOut;
+    LatencyHistogram latency; // nanoseconds, only while command_stats is on
+};
+
+//one per row of the dispatch table, then one for unknown commands
+size_t commandStatsCount();
+const CommandStats& commandStatsAt(size_t i);
+
 //next encapsulated command which we are going to do with polymorphism (just more classes)
 //and they are going to be without constructor so we can just call them
 //also in the parsing we can just maybe make switch case using enum
@@ -120,11 +88,11 @@ class PartCommand : public ICommand {
 
 class PrivmsgCommand : public ICommand {
 private:
-    void handleChannelMessage(Server& server, Client* sender, const std::string& channelName , const std::string& messgae) const;
-    void handlePrivateMessage(Server& server, Client* sender, const std::string& targetNickname , const std::string& message) const;
+    void handleChannelMessage(Server& server, FanoutPlan& plan, Client* sender, const std::string& prefix, const std::string& channelName , const std::string& messgae) const;
+    void handlePrivateMessage(Server& server, FanoutPlan& plan, Client* sender, const std::string& prefix, const std::string& targetNickname , const std::string& message) const;
     std::vector<std::string> parseTargets(const std::string& targetsString) const;
     void infoDCC(const std::string& message) const;
-    std::vector<std::string> splitMessage(const std::string& prefix, const std::string& message) const;
+    std::vector<SharedBuffer> splitMessage(const std::string& prefix, const std::string& message, size_t maxLength) const;
 public:
     void execute(Server& server, const parsedCmd& _parsedCmd) const;
 };
@@ -164,16 +132,65 @@ class PingCommand : public ICommand {
         void execute(Server& server, const parsedCmd& _parsedCmd) const;
 };
 
+class StatsCommand : public ICommand {
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
+class PongCommand : public ICommand {
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
 class CapCommand : public ICommand {
     public:
         void execute(Server& server, const parsedCmd& _parsedCmd) const;
 };
 
-std::string getClientAllChannels(Client& targetClient, Client& srcClient, Server& server);
+class OperCommand : public ICommand {
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
+class RehashCommand : public ICommand {
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
+std::string getClientAllChannels(Client& targetClient, Client& srcClient);
+
+//one WHO request: which field the mask is matched against and how many replies are left
+struct WhoQuery {
+    enum Field { MATCH_NICK, MATCH_HOST, MATCH_FULL };
+    Client* src;
+    Mask mask;
+    Field field;
+    bool opsOnly;
+    size_t limit;
+    size_t sent;
+    bool truncated;
+};
 
 class WhoCommand : public ICommand {
     private:
-        void showUserInfo(Client& srcClient, Client& targetClient, Server& server, bool isChannel) const;
+        bool offer(WhoQuery& query, Client& targetClient, const Channel* channel) const;
+        template <typename Index>
+        void walkIndex(const Index& index, const std::string& keyPrefix, WhoQuery& query) const;
+        void whoMask(Server& server, WhoQuery& query) const;
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
+class ListCommand : public ICommand {
+    public:
+        void execute(Server& server, const parsedCmd& _parsedCmd) const;
+};
+
+class ChathistoryCommand : public ICommand {
+    private:
+        void fail(Client& client, const std::string& code, const std::string& context, const std::string& description) const;
+        template <typename Source>
+        void sendBatch(Client& client, const std::string& target, const Source& source, size_t from, size_t to) const;
     public:
         void execute(Server& server, const parsedCmd& _parsedCmd) const;
 };
@@ -185,6 +202,7 @@ class WhoIsCommand : public ICommand {
 
 std::vector<std::string> splitByComma(const std::string& arg);
 
-bool isValidChannelName(const std::string& name);
+bool isValidChannelName(const std::string& name, size_t maxLength);
+
 
 bool isNum(const char* input);
\ No newline at end of file
@@ -0,0 +1,110 @@
+#pragma once
+#include "Mask.hpp"
+#include "Log.hpp"
+#include <string>
+#include <vector>
+
+//limits for the clients whose host matches; the first matching class wins
+struct ConnectionClass {
+    std::string name;
+    Mask hosts;
+    size_t sendq;  // pending output before the client is dropped, 0 for no limit
+    size_t recvq;  // unprocessed input before the client is dropped, 0 for no limit
+};
+
+//who may become an IRC operator with OPER <name> <password>
+struct OperBlock {
+    std::string name;
+    std::string password;
+    Mask hosts;
+};
+
+//Everything the configuration file can set, with the built-in defaults.
+//A reload parses into a fresh Config and the server only swaps it in once the
+//whole file was read without error, so a typo never leaves half a config live.
+//
+//File format, one setting per line, '#' starts a comment:
+//  poll_timeout_ms 100
+//  class trusted {
+//      hosts 10.*
+//      sendq 4194304
+//  }
+//  oper admin {
+//      password secret
+//  }
+struct Config {
+    //listeners, startup only
+    size_t listenBacklog;
+    std::string metricsListen; // port, address:port or UNIX socket path, empty for no metrics
+    //logging
+    LogLevel logLevel;
+    std::string logFile;     // startup only, empty for stdout
+    //event loop and parsing
+    size_t pollTimeoutMs;    // longest poll() sleep, 0 sleeps until the next timer or event
+    size_t loopBudgetMs;     // a pass taking longer is logged, 0 for no budget
+    size_t statsIntervalMs;  // how often the shared memory stats are rewritten
+    size_t recvChunk;        // bytes asked from each recv()
+    size_t maxLineLength;    // longer PRIVMSG text is split into several lines
+    size_t channelNameMax;
+    size_t pingFrequency;    // seconds of silence before the server PINGs a client
+    size_t pingTimeout;      // seconds a PINGed client has to answer
+    size_t floodBurst;       // command tokens a client may spend at once, 0 turns flood control off
+    size_t floodRate;        // tokens given back per second
+    size_t floodDisconnect;  // seconds a client may stay throttled before it is dropped
+    //accept path, per host and per network (CIDR)
+    size_t maxPerHost;
+    size_t maxPerNetwork;
+    size_t networkV4Bits;       // /24
+    size_t networkV6Bits;       // /64
+    size_t throttleBurst;       // connections a host may open at once, 0 for no throttle
+    size_t throttlePeriod;      // seconds for the throttle to refill
+    size_t hostTableSize;       // startup only, distinct hosts and networks tracked
+    //hostname and ident lookups, the welcome waits for them up to lookupTimeout
+    bool dnsLookup;
+    bool identLookup;
+    size_t identPort;
+    size_t lookupTimeout;       // seconds
+    size_t dnsCacheTtl;         // seconds a hostname (or the lack of one) is remembered
+    size_t dnsCacheSize;
+    size_t resolverThreads;     // startup only
+    std::string dnsStub;        // startup only, file of ptr/a records answering instead of DNS
+    //connections that have not completed PASS/NICK/USER
+    size_t registrationTimeout; // seconds to register before the connection is closed
+    size_t maxUnregistered;
+    size_t maxUnregisteredPerHost;
+    size_t unregisteredSendq;   // queue limits until registered, the class limits apply after
+    size_t unregisteredRecvq;
+    //commands
+    size_t whoMaxReplies;
+    size_t privmsgTargetMax;
+    bool privmsgDedupe;
+    bool commandStats;       // time every command for STATS m
+    //history
+    size_t historyLength;    // lines kept per channel unless the channel sets +H
+    size_t historyMemoryCap; // bytes all channel histories may hold together
+    size_t chathistoryMax;   // most lines one CHATHISTORY request returns
+    size_t historySegmentBytes;
+    unsigned long historyRetentionMs;
+    std::string historyDir;  // startup only, empty to keep history in memory only
+    size_t historySyncMs;    // startup only
+    std::string stateDir;    // startup only, empty to forget channels on restart
+    //event log
+    std::string eventDir;    // startup only, empty to record nothing
+    size_t eventSegmentBytes;
+    size_t eventSegments;    // segments kept, 0 keeps them all
+    //shared memory stats for ircstat
+    std::string statsShm;    // startup only, the segment is /<statsShm>-<port>, empty for none
+
+    std::vector<ConnectionClass> classes; // never empty, the last one matches everybody
+    std::vector<OperBlock> opers;
+
+    Config();
+
+    bool load(const std::string& path, std::string& error);
+    //settings a running server cannot change are taken over from the live config,
+    //each one reported in changed
+    void keepStartupSettings(const Config& live, std::vector<std::string>& changed);
+
+    const ConnectionClass& classFor(const std::string& host) const;
+    const OperBlock* findOper(const std::string& name) const;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+//On-disk layout of the event log, shared by the server and ircserv-logdump.
+//A segment file is a 64 byte header followed by 32 byte records, host byte
+//order. Strings are interned per segment: the first use of a string writes an
+//EV_STRING record giving it an id, the string bytes follow in the next
+//(len + 31) / 32 slots, and every later record refers to it by that id, 0
+//being the empty string. A segment therefore decodes on its own. The file is
+//sized up front and mapped, so a record of type 0 (or the end of the file)
+//ends it.
+static const char EVENT_MAGIC[8] = { 'I', 'R', 'C', 'E', 'V', 'N', 'T', '1' };
+static const unsigned int EVENT_VERSION = 1;
+static const unsigned int EVENT_STRING_MAX = 512; // longer strings are cut
+
+struct EventHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned long seq;          // segment number, the file name carries it too
+    unsigned long createdMs;    // wall clock
+    char reserved[32];
+};
+
+struct EventRecord {
+    unsigned long timeMs;       // wall clock
+    unsigned int conn;          // connection number since startup, 0 for the server itself
+    unsigned short type;
+    unsigned short len;         // EV_STRING: bytes that follow
+    unsigned int args[4];       // string ids; EV_STRING: args[0] is the id being defined
+};
+
+//the arguments of each type, in args order
+enum EventType {
+    EV_STRING = 1,
+    EV_START,       // port
+    EV_STOP,
+    EV_CONNECT,     // address
+    EV_REGISTER,    // nick, user, host
+    EV_NICK,        // old nick, new nick
+    EV_JOIN,        // nick, channel
+    EV_PART,        // nick, channel, reason
+    EV_KICK,        // nick, channel, kicked nick, reason
+    EV_MODE,        // nick, channel, modes and their parameters
+    EV_DISCONNECT,  // nick, reason
+    EV_TYPE_COUNT
+};
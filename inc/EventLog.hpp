@@ -0,0 +1,46 @@
+#pragma once
+#include "EventFormat.hpp"
+#include <map>
+#include <string>
+
+//Audit trail of connections and channel membership for capacity planning:
+//connects, registrations, nick changes, joins, parts, kicks, mode changes and
+//disconnects, written by the loop straight into a memory mapped segment file
+//(events-<seq>.bin under the event directory). Recording is a map lookup per
+//string and a 32 byte copy, nothing is formatted or written out by hand; the
+//kernel flushes the pages. A full segment is cut to its used length and a new
+//one started, the oldest beyond the kept count are deleted.
+//ircserv-logdump turns the files back into text or JSON.
+class EventLog {
+    private:
+        std::string _dir;
+        int _fd;
+        char* _map;
+        size_t _mapped;                          // segment size
+        size_t _used;                            // bytes written, header included
+        unsigned long _seq;
+        size_t _segmentBytes;                    // applies from the next segment on
+        size_t _segmentsKept;                    // 0 keeps them all
+        std::map<std::string, unsigned int> _strings; // interned in the current segment
+        unsigned int _nextString;
+
+        bool _startSegment();
+        void _seal();
+        void _prune();
+        unsigned int _intern(const std::string& str);
+        EventRecord* _slot();
+
+        EventLog(const EventLog& other);
+        EventLog& operator=(const EventLog& other);
+    public:
+        EventLog();
+        ~EventLog();
+
+        bool open(const std::string& dir);
+        void close();
+        bool isOpen() const;
+        void setLimits(size_t segmentBytes, size_t segmentsKept);
+
+        void record(EventType type, unsigned int conn, const std::string& a = "", const std::string& b = "",
+                    const std::string& c = "", const std::string& d = "");
+};
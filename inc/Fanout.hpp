@@ -0,0 +1,35 @@
+#pragma once
+#include "SharedBuffer.hpp"
+#include <vector>
+
+class Client;
+class Channel;
+
+//Delivery plan for one message with several targets (PRIVMSG #a,#b,nick :text).
+//Every target's lines are serialized once into a group; recipients are collected
+//from all targets and each gets its group's lines as shared buffers.
+class FanoutPlan {
+    public:
+        enum DuplicateMode {
+            DELIVER_ONCE,       // a client reached through several targets gets the first one only
+            DELIVER_PER_TARGET  // one copy per target, like sending the targets one by one
+        };
+    private:
+        struct Recipient {
+            Client* client;
+            size_t group;
+            size_t order;
+        };
+        DuplicateMode _mode;
+        std::vector<std::vector<SharedBuffer> > _groups;
+        std::vector<Recipient> _recipients;
+        static bool _byClientThenOrder(const Recipient& a, const Recipient& b);
+    public:
+        explicit FanoutPlan(DuplicateMode mode);
+
+        size_t addGroup(const std::vector<SharedBuffer>& lines);
+        void addRecipient(Client* client, size_t group);
+        void addChannel(const Channel& channel, size_t group, const Client* except);
+        size_t getRecipientCount() const;
+        void deliver();
+};
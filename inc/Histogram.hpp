@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+
+//Latency histogram in the HDR style: buckets are exact below 16 and above
+//that each power of two is split in 8, so any recorded value is known to
+//within 12.5% whatever its magnitude. Recording is a count-leading-zeros and
+//an increment, no allocation; values past the last bucket land in it.
+//Loop only, like everything it measures.
+class LatencyHistogram {
+    public:
+        static const unsigned int SUB_BITS = 3;
+        static const size_t BUCKETS = 272;     // up to 2^36, about 68 seconds in nanoseconds
+    private:
+        unsigned long _counts[BUCKETS];
+        unsigned long _total;
+        unsigned long _sum;
+        unsigned long _max;
+    public:
+        LatencyHistogram();
+        void record(unsigned long value);
+        void reset();
+        unsigned long count() const;
+        unsigned long sum() const;
+        unsigned long max() const;
+        //smallest bucket bound at or below which a fraction q of the values lie
+        unsigned long percentile(double q) const;
+        unsigned long bucketCount(size_t i) const;
+        static size_t bucketOf(unsigned long value);
+        static unsigned long bucketUpperBound(size_t i);
+};
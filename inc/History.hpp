@@ -0,0 +1,111 @@
+#pragma once
+#include "SharedBuffer.hpp"
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+//one recorded channel line; the line is the same block that was broadcast
+struct HistoryEntry {
+    unsigned long msgid;  // unique and increasing, derived from the time
+    unsigned long timeMs; // server-time, milliseconds since the epoch
+    SharedBuffer line;
+};
+
+//what one CHATHISTORY request selects; the reference is a msgid or a server-time
+struct HistoryQuery {
+    enum Kind { LATEST, BEFORE, AFTER, AROUND };
+    Kind kind;
+    bool anchored;      // false for LATEST *
+    bool byTime;
+    unsigned long key;
+    size_t limit;
+};
+
+//Fixed size ring of a channel's recent messages, oldest first. All rings share
+//one memory budget, an entry costing its line, its ring slot and the shared
+//block header. Past it the oldest entries go first, whichever channel holds
+//them: every entry is also queued in one global recording order, and an entry
+//a ring already dropped on its own is skipped when the queue reaches it.
+class ChannelHistory {
+    private:
+        struct Recorded {
+            ChannelHistory* ring;
+            unsigned long serial; // tells a ring from a later one at the same address
+            unsigned long msgid;
+        };
+        std::vector<HistoryEntry> _ring;
+        size_t _head;   // index of the oldest entry
+        size_t _count;
+        size_t _bytes;  // what its entries cost against the budget
+        unsigned long _serial;
+
+        static size_t _totalBytes;
+        static size_t _memoryCap;
+        static unsigned long _lastMsgId;
+        static unsigned long _serials;
+        static size_t _entries;                    // in all rings
+        static std::deque<Recorded> _order;        // oldest first, may hold entries already dropped
+        static std::set<const ChannelHistory*> _live;
+
+        void _dropOldest();
+        static size_t _cost(const HistoryEntry& entry);
+        static bool _holds(const Recorded& recorded);
+        static void _evict();
+        ChannelHistory(const ChannelHistory& other);
+        ChannelHistory& operator=(const ChannelHistory& other);
+    public:
+        static const size_t MAX_CAPACITY = 10000;
+
+        explicit ChannelHistory(size_t capacity);
+        ~ChannelHistory();
+
+        void setCapacity(size_t capacity); // keeps the newest entries
+        size_t getCapacity() const;
+        size_t size() const;
+        const HistoryEntry& at(size_t i) const; // 0 is the oldest
+        //first entry whose msgid (or time) is >= key
+        size_t lowerBound(unsigned long key, bool byTime) const;
+        //first entry whose msgid (or time) is > key
+        size_t upperBound(unsigned long key, bool byTime) const;
+
+        void read(size_t i, HistoryEntry& out) const;
+
+        HistoryEntry record(const SharedBuffer& line, unsigned long timeMs);
+        void restore(const HistoryEntry& entry); // re-adds a persisted entry, keeping its msgid
+
+        static std::string formatTime(unsigned long timeMs);  // 2026-01-31T12:00:00.000Z
+        static bool parseTime(const std::string& str, unsigned long& timeMs);
+        static void setMemoryCap(size_t bytes);
+        static size_t getTotalBytes();
+};
+
+//The [from, to) range of a history source, the in-memory ring or the persistent
+//store, that a query selects. Both are sorted by msgid and by time
+template <typename Source>
+void selectHistory(const Source& source, const HistoryQuery& query, size_t& from, size_t& to) {
+    from = 0;
+    to = source.size();
+    switch (query.kind) {
+        case HistoryQuery::LATEST: {
+            size_t first = query.anchored ? source.upperBound(query.key, query.byTime) : 0;
+            from = (to - first > query.limit) ? to - query.limit : first;
+            break;
+        }
+        case HistoryQuery::BEFORE:
+            to = source.lowerBound(query.key, query.byTime);
+            from = to - std::min(to, query.limit);
+            break;
+        case HistoryQuery::AFTER:
+            from = source.upperBound(query.key, query.byTime);
+            to = std::min(to, from + query.limit);
+            break;
+        case HistoryQuery::AROUND: {
+            size_t middle = source.lowerBound(query.key, query.byTime);
+            from = middle - std::min(middle, query.limit / 2);
+            to = std::min(to, from + query.limit);
+            break;
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "History.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+class HistorySyncer;
+
+//The segments the history directory holds, by channel (hex name). The
+//directory is read once at startup; a store takes its channel's list when it
+//opens and hands back what is left on disk when it closes, so a channel is
+//never looked up with a directory scan.
+class HistoryCatalog {
+    private:
+        std::string _dir;
+        std::map<std::string, std::vector<unsigned long> > _segments;
+    public:
+        //creates the directory if needed and lists it, false if it is unusable
+        bool scan(const std::string& dir);
+        bool isOpen() const;
+        const std::string& getDir() const;
+        std::vector<unsigned long> take(const std::string& prefix);
+        void put(const std::string& prefix, const std::vector<unsigned long>& seqs);
+};
+
+//Persistent, append-only history of one channel, split into segments.
+//Every segment is a pair of files under the history directory:
+//  <hex channel>-<seq>.log  the recorded lines back to back
+//  <hex channel>-<seq>.idx  one fixed size IndexRecord per line
+//Both grow only at the end. Reads mmap them and binary search the index,
+//so an old range costs a few page faults instead of loading the files.
+//The newest segment is opened for writing on the first append, so a channel
+//that records nothing costs no file and no descriptor. Merging two sealed
+//segments copies and syncs them both; it runs on the syncer thread and the
+//store picks up the result on a later append or compact.
+class HistoryStore {
+    public:
+        struct Limits {
+            size_t segmentBytes;        // a segment is sealed once its log reaches this
+            unsigned long retentionMs;  // sealed segments older than this are deleted
+        };
+    private:
+        struct IndexRecord {
+            unsigned long msgid;
+            unsigned long timeMs;
+            unsigned long offset;
+            unsigned long length;
+        };
+        struct Segment {
+            unsigned long seq;
+            std::string base;                  // path without extension
+            int logFd;                         // -1 while not open for appending
+            int idxFd;
+            size_t count;                      // index records written
+            size_t logBytes;
+            mutable const IndexRecord* index;  // read mappings, refreshed when the segment grew
+            mutable size_t indexMapped;
+            mutable const char* log;
+            mutable size_t logMapped;
+        };
+        HistoryCatalog* _catalog;
+        std::string _prefix;                   // hex encoded channel name
+        Limits _limits;
+        HistorySyncer* _syncer;
+        std::vector<Segment> _segments;        // oldest first, the last one is appended to
+        std::vector<size_t> _starts;           // logical index of each segment's first record
+        size_t _count;
+        bool _failed;
+        std::string _mergeBase;                // first segment of the merge in flight, empty for none
+
+        HistoryStore(HistoryCatalog& catalog, const std::string& prefix, const Limits& limits, HistorySyncer* syncer);
+        void _load(const std::vector<unsigned long>& seqs);
+        bool _openForAppend(Segment& segment);
+        bool _startSegment(unsigned long seq);
+        void _seal(Segment& segment);
+        static void _unmap(const Segment& segment);
+        static bool _map(const Segment& segment);
+        static void _trim(Segment& segment);
+        void _removeSegment(size_t i);
+        void _startMerge(size_t first);
+        void _finishMerge(bool ok);
+        void _reindex();
+        size_t _segmentOf(size_t i) const;
+        unsigned long _keyAt(size_t i, bool byTime) const;
+
+        HistoryStore(const HistoryStore& other);
+        HistoryStore& operator=(const HistoryStore& other);
+    public:
+        ~HistoryStore();
+        //opens the store of one channel; nothing is created before the first append
+        static HistoryStore* open(HistoryCatalog& catalog, const std::string& channel,
+                                  const Limits& limits, HistorySyncer* syncer);
+        //appends segment second to segment first on disk and removes it, off the loop
+        static bool mergeFiles(const std::string& first, const std::string& second);
+
+        void append(const HistoryEntry& entry);
+        size_t size() const;
+        size_t lowerBound(unsigned long key, bool byTime) const;
+        size_t upperBound(unsigned long key, bool byTime) const;
+        void read(size_t i, HistoryEntry& out) const;
+        //drops sealed segments past retention and starts merging neighbours that fit in one segment
+        void compact(unsigned long nowMs);
+};
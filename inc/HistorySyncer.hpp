@@ -0,0 +1,41 @@
+#pragma once
+#include <pthread.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Background thread that fdatasync()s history files in batches, so the event loop
+//only ever write()s into the page cache. Segment files handed over with
+//closeLater() are synced one last time and closed by the thread as well, and
+//segment merges (HistoryStore::mergeFiles) run here too; the loop picks their
+//results up with takeMerged().
+class HistorySyncer {
+    private:
+        pthread_t _thread;
+        pthread_mutex_t _mutex;
+        pthread_cond_t _wake;
+        std::vector<int> _dirty;
+        std::vector<int> _closing;
+        std::vector<std::pair<std::string, std::string> > _merges;
+        std::vector<std::pair<std::string, bool> > _merged;
+        std::vector<std::string> _forgotten;
+        unsigned int _intervalMs;
+        bool _running;
+        bool _stopping;
+
+        static void* _run(void* self);
+        void _loop();
+        HistorySyncer(const HistorySyncer& other);
+        HistorySyncer& operator=(const HistorySyncer& other);
+    public:
+        HistorySyncer();
+        ~HistorySyncer();
+
+        bool start(unsigned int intervalMs);
+        void stop(); // syncs and closes everything still pending
+        void markDirty(int fd);
+        void closeLater(int fd);
+        bool mergeLater(const std::string& first, const std::string& second); // false if the thread is not running
+        bool takeMerged(const std::string& first, bool& ok);                  // false while it still runs
+        void forgetMerge(const std::string& first);                           // nobody will take the result
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <sys/socket.h>
+
+//A peer address in binary form, IPv4 stored v4-mapped (::ffff:a.b.c.d), plus
+//the prefix length it stands for: 128 for the host itself, less for a network
+struct HostKey {
+    unsigned char bytes[16];
+    unsigned char prefix;
+
+    static HostKey fromSockaddr(const struct sockaddr* addr);
+    bool isV4() const;
+    //the network around this host, v4Bits/v6Bits counted the usual way (/24, /64)
+    HostKey network(unsigned int v4Bits, unsigned int v6Bits) const;
+    bool operator==(const HostKey& other) const;
+};
+
+//Connection counters per host and per network, looked up on every accept.
+//Open addressing with linear probing over a table sized once at startup;
+//removal shifts the following entries back instead of leaving tombstones, so
+//a lookup never walks further than the cluster it lands in. Entries that
+//lost their last connection while still throttled wait on a FIFO ring and
+//are dropped from its front once they refilled. Nothing here allocates after
+//reserve(), refusing a flood costs a hash and a few compares.
+class HostTable {
+    public:
+        struct Entry {
+            HostKey key;
+            unsigned int connections;   // open sockets
+            unsigned int unregistered;  // of those, still registering (hosts only)
+            unsigned long tokens;       // connect throttle, in thousandths of a connection
+            unsigned long refilledMs;   // when tokens were last topped up
+            bool used;
+            bool lingering;             // on the ring of released, still throttled entries
+        };
+    private:
+        std::vector<Entry> _slots;
+        size_t _mask;
+        size_t _used;
+        std::vector<HostKey> _lingering; // ring, oldest release first
+        size_t _lingerHead;
+        size_t _lingerCount;
+        unsigned long _burst;     // connect throttle: connections allowed at once
+        unsigned long _periodMs;  // and the time the bucket takes to refill
+
+        static size_t _hash(const HostKey& key);
+        size_t _home(const HostKey& key) const;
+        void _erase(size_t slot);
+        void _refill(Entry& entry, unsigned long nowMs) const;
+        bool _idle(Entry& entry, unsigned long nowMs) const;
+
+        HostTable(const HostTable& other);
+        HostTable& operator=(const HostTable& other);
+    public:
+        HostTable();
+
+        void reserve(size_t capacity); // rounded up to a power of two
+        void setThrottle(unsigned long burst, unsigned long periodMs);
+        Entry* find(const HostKey& key);
+        //makes sure count new entries fit, dropping released entries that
+        //refilled by now; entry pointers taken before are invalid afterwards
+        bool makeRoom(size_t count, unsigned long nowMs);
+        //finds or adds the entry, NULL when the table is full; never moves other entries
+        Entry* acquire(const HostKey& key, unsigned long nowMs);
+        //drops the entry once it counts nothing and its throttle has refilled
+        void release(const HostKey& key, unsigned long nowMs);
+        //token bucket: false when the host connected too often lately
+        bool takeToken(Entry& entry, unsigned long nowMs) const;
+        size_t size() const;
+        size_t capacity() const;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+enum LogLevel {
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG
+};
+
+//Leveled logging that keeps the event loop off the terminal and the disk. A
+//call site formats its line on its own stack and copies it into a slot of a
+//fixed ring shared by every thread; claiming a slot is one compare-and-swap,
+//nothing takes a lock or blocks. A writer thread drains the ring in batches,
+//one write() per batch, to the log file or stdout. A full ring drops lines
+//(and says so later) rather than stalling the loop.
+//
+//  LOG(LOG_INFO, "Client " << fd << " dropped: " << reason);
+//
+//The arguments are not even evaluated below the configured level, so a debug
+//line on a hot path costs one compare. Before start() and after stop() lines
+//are written synchronously, errors and warnings to stderr.
+class Log {
+    public:
+        static const size_t LINE_MAX = 256; // longer lines are cut
+    private:
+        static volatile int _level;
+    public:
+        static bool start(const std::string& path); // empty path: stdout, false if the file cannot be opened
+        static void stop();                        // writes out whatever is queued
+        static void setLevel(LogLevel level);
+        static bool parseLevel(const std::string& name, LogLevel& level);
+        static bool enabled(LogLevel level) { return static_cast<int>(level) <= _level; }
+        static void push(LogLevel level, const char* text, size_t len);
+};
+
+//one line being formatted, queued when it goes out of scope
+class LogLine {
+    private:
+        LogLevel _level;
+        size_t _len;
+        char _buf[Log::LINE_MAX];
+
+        LogLine& _append(const char* data, size_t len);
+        LogLine(const LogLine& other);
+        LogLine& operator=(const LogLine& other);
+    public:
+        explicit LogLine(LogLevel level);
+        ~LogLine();
+        LogLine& operator<<(const char* str);
+        LogLine& operator<<(const std::string& str);
+        LogLine& operator<<(char c);
+        LogLine& operator<<(int value);
+        LogLine& operator<<(long value);
+        LogLine& operator<<(unsigned int value);
+        LogLine& operator<<(unsigned long value);
+};
+
+#define LOG(level, args) do { \
+        if (Log::enabled(level)) { \
+            LogLine logLine_(level); \
+            logLine_ << args; \
+        } \
+    } while (0)
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+
+//How busy the event loop is, pass by pass. A pass is one return from poll():
+//the timers, new connections and lookups, then every ready client's recv,
+//dispatch (running its commands) and send. Each pass is timed and folded into
+//a slot per second; the last minute of complete seconds is kept, so STATS e
+//can show the last second, ten seconds and minute side by side. The outbound
+//backlog (bytes queued to clients and clients with anything queued) is sampled
+//at the end of every pass.
+class LoopStats {
+    public:
+        struct Window {
+            unsigned long passes;
+            unsigned long wakeups;         // passes poll() returned events for
+            unsigned long events;          // ready descriptors, summed
+            unsigned long maxEvents;
+            unsigned long busyNs;          // time from wakeup to the end of the pass, summed
+            unsigned long maxPassNs;
+            unsigned long timersNs;
+            unsigned long acceptNs;        // new connections and resolver answers
+            unsigned long recvNs;
+            unsigned long dispatchNs;
+            unsigned long sendNs;
+            unsigned long overBudget;      // passes longer than loop_budget_ms
+            unsigned long maxBacklogBytes;
+            unsigned long maxBacklogClients;
+        };
+        static const size_t SECONDS = 61;          // a minute plus the second in progress
+        //filled in by the loop during the pass
+        struct Pass {
+            unsigned long startNs;
+            unsigned long events;
+            unsigned long timersNs;
+            unsigned long acceptNs;
+            unsigned long recvNs;
+            unsigned long dispatchNs;
+            unsigned long sendNs;
+        };
+    private:
+        Window _slots[SECONDS];
+        unsigned long _slotSecond[SECONDS];  // monotonic second each slot holds
+        unsigned long _lastBacklogBytes;
+        unsigned long _lastBacklogClients;
+        unsigned long _lastWarnSecond;
+        unsigned long _suppressed;            // over budget passes not warned about
+        Pass _pass;
+
+        Window& _slotFor(unsigned long second);
+    public:
+        LoopStats();
+        Pass& begin(unsigned long nowNs, int events);
+        Pass& pass();
+        //folds the pass in; warns (at most once a second) when it took over budgetNs, 0 for no budget
+        void end(unsigned long nowNs, unsigned long nowMs, unsigned long budgetNs,
+                 unsigned long backlogBytes, unsigned long backlogClients);
+        //the last complete seconds added together, at most SECONDS - 1
+        Window sum(size_t seconds, unsigned long nowMs) const;
+        unsigned long getBacklogBytes() const;
+        unsigned long getBacklogClients() const;
+};
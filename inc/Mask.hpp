@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+
+//A '*'/'?' glob compiled once and matched many times. Pattern and subjects are
+//compared under rfc1459 casemapping (A-Z [ ] \ ~ fold to a-z { } | ^).
+//The literal text before the first and after the last wildcard is checked with
+//plain compares first, so only the middle of the pattern ever needs the glob walk.
+class Mask {
+    private:
+        enum Kind {
+            MATCH_ALL,    // "*"
+            MATCH_EXACT,  // no wildcard at all
+            MATCH_PREFIX, // "abc*"
+            MATCH_SUFFIX, // "*abc"
+            MATCH_GLOB    // anything else
+        };
+        std::string _pattern;  // as given, for replies
+        std::string _folded;   // casemapped, runs of '*' collapsed
+        std::string _prefix;   // literal head of _folded
+        std::string _suffix;   // literal tail of _folded
+        std::string _middle;   // what is left between them, starts and ends with a wildcard
+        size_t _minLength;     // subjects shorter than this can never match
+        Kind _kind;
+
+        bool _matchMiddle(const char* str, size_t len) const;
+    public:
+        Mask();
+        explicit Mask(const std::string& pattern);
+
+        void compile(const std::string& pattern);
+        const std::string& getPattern() const;
+        const std::string& getLiteralPrefix() const;
+        const std::string& getLiteralSuffix() const;
+        bool hasWildcards() const;
+
+        bool matches(const char* str, size_t len) const;
+        bool matches(const std::string& str) const;
+        //one verdict per subject; returns how many matched
+        size_t matchBatch(const std::vector<std::string>& subjects, std::vector<bool>& verdicts) const;
+
+        static char fold(char c);
+        static std::string fold(const std::string& str);
+};
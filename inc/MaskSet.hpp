@@ -0,0 +1,48 @@
+#pragma once
+#include "Mask.hpp"
+#include <ctime>
+#include <string>
+#include <vector>
+
+//One channel list mode (+b, +e or +I). Masks are kept in the order they were set
+//for listing; for matching, masks of the form <nick>!<user>@<literal host> sit in
+//hash buckets keyed by the casemapped host, so a client only ever tests the masks
+//naming its own host plus the remainder that has a wildcard in the host part.
+class MaskSet {
+    public:
+        struct Entry {
+            Mask mask;
+            std::string setter;
+            std::time_t setAt;
+            bool exactHost;
+        };
+    private:
+        std::vector<Entry*> _entries;                // in insertion order
+        std::vector<std::vector<Entry*> > _buckets;  // exact host masks, by host hash
+        std::vector<Entry*> _wildcards;              // everything else
+        size_t _exactCount;
+
+        static size_t _hash(const std::string& foldedHost);
+        static bool _exactHostOf(const Mask& mask, std::string& host);
+        void _rehash(size_t bucketCount);
+        std::vector<Entry*>& _bucketFor(const std::string& foldedHost);
+
+        MaskSet(const MaskSet& other);
+        MaskSet& operator=(const MaskSet& other);
+    public:
+        MaskSet();
+        ~MaskSet();
+
+        //false if an equal mask (under casemapping) is already there
+        bool add(const std::string& pattern, const std::string& setter, std::time_t setAt);
+        bool remove(const std::string& pattern);
+        const std::vector<Entry*>& getEntries() const;
+        size_t size() const;
+        bool empty() const;
+
+        //fullName is nick!user@host as given, foldedHost the casemapped host part
+        bool matches(const std::string& fullName, const std::string& foldedHost) const;
+
+        //completes a partial mask the usual way: nick -> nick!*@*, user@host -> *!user@host
+        static std::string normalize(const std::string& pattern);
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+class Server;
+
+//Second listener for Prometheus scrapes, on loopback TCP ("127.0.0.1:9100",
+//or just a port) or a UNIX socket (a path starting with '/'). It speaks just
+//enough HTTP/1.1 for a scraper: one GET per connection, answered and closed.
+//The sockets sit in the server's poll set like clients do; the server reads
+//and writes them through serve() and closes them itself. A scrape that stalls
+//is dropped once it is older than SESSION_TIMEOUT_MS and a new one comes in.
+class MetricsListener {
+    public:
+        static const size_t MAX_SESSIONS = 8;
+        static const size_t MAX_REQUEST = 8192;
+        static const unsigned long SESSION_TIMEOUT_MS = 10000;
+    private:
+        struct Session {
+            std::string request;
+            std::string response;  // empty until the request headers are in
+            size_t sent;
+            unsigned long openedMs;
+        };
+        int _fd;
+        std::string _path;         // UNIX socket to unlink on close
+        std::map<int, Session> _sessions;
+
+        bool _listenTcp(const std::string& spec);
+        bool _listenUnix(const std::string& path);
+
+        MetricsListener(const MetricsListener& other);
+        MetricsListener& operator=(const MetricsListener& other);
+    public:
+        MetricsListener();
+        ~MetricsListener();
+
+        bool open(const std::string& spec);
+        void close();
+        int getFd() const;
+        //a new session's fd, -1 when there was none or no room for it
+        int accept(unsigned long nowMs);
+        //sessions past their timeout, for the server to close
+        void expired(unsigned long nowMs, std::vector<int>& fds) const;
+        //false once the session is done with, answered or broken
+        bool serve(int fd, short revents, const Server& server);
+        bool wantsWrite(int fd) const;
+        //the server closed fd
+        void forget(int fd);
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+
+class Client;
+
+//Every numeric reply, one row each: enum name, code and format (%1..%7 are
+//the arguments). The Numeric enum and the format table in Reply.cpp are both
+//expanded from this list, so they cannot get out of step.
+#define NUMERIC_TABLE(X) \
+    X(RPL_WELCOME,           "001", "%1 :Welcome to the server, %1[!%2@%3]") \
+    X(RPL_ISUPPORT,          "005", "%1 %2 :are supported by this server") \
+    X(RPL_ENDOFSTATS,        "219", "%1 %2 :End of /STATS report") \
+    X(RPL_UMODEIS,           "221", "%1 %2") \
+    X(RPL_STATSDEBUG,        "249", "%1 %2 :%3") \
+    X(RPL_WHOISUSER,         "311", "%1 %2 %3 %4 * :%5") \
+    X(RPL_WHOISSERVER,       "312", "%1 %2 ircserver :IRC server") \
+    X(RPL_ENDOFWHO,          "315", "%1 %2 :End of WHO list") \
+    X(RPL_WHOISIDLE,         "317", "%1 %2 %3 %4 :seconds idle, signon time") \
+    X(RPL_ENDOFWHOIS,        "318", "%1 %2 :End of /WHOIS list") \
+    X(RPL_WHOISCHANNELS,     "319", "%1 %2 :%3") \
+    X(RPL_LISTSTART,         "321", "%1 Channel :Users  Name") \
+    X(RPL_LIST,              "322", "%1 %2 %3 :%4") \
+    X(RPL_LISTEND,           "323", "%1 :End of /LIST") \
+    X(RPL_CHANNELMODEIS,     "324", "%1 %2 %3") \
+    X(RPL_NOTOPIC,           "331", "%1 %2 :No topic is set") \
+    X(RPL_TOPIC,             "332", "%1 %2 :%3") \
+    X(RPL_INVITING,          "341", "%1 %2 %3") \
+    X(RPL_INVITELIST,        "346", "%1 %2 %3 %4 %5") \
+    X(RPL_ENDOFINVITELIST,   "347", "%1 %2 :End of channel invite list") \
+    X(RPL_EXCEPTLIST,        "348", "%1 %2 %3 %4 %5") \
+    X(RPL_ENDOFEXCEPTLIST,   "349", "%1 %2 :End of channel exception list") \
+    X(RPL_WHOREPLY,          "352", "%1 %2 %3 %4 ircserver %5 H%6 :0 %7") \
+    X(RPL_NAMEREPLY,         "353", "%1 = %2 :%3") \
+    X(RPL_ENDOFNAMES,        "366", "%1 %2 :End of /NAMES list.") \
+    X(RPL_BANLIST,           "367", "%1 %2 %3 %4 %5") \
+    X(RPL_ENDOFBANLIST,      "368", "%1 %2 :End of channel ban list") \
+    X(RPL_YOUREOPER,         "381", "%1 :You are now an IRC operator") \
+    X(RPL_REHASHING,         "382", "%1 %2 :Rehashing") \
+    X(ERR_NOSUCHNICK,        "401", "%1 %2 :No such nick") \
+    X(ERR_NOSUCHCHANNEL,     "403", "%1 %2 :No such channel") \
+    X(ERR_CANNOTSENDTOCHAN,  "404", "%1 %2 :Cannot send to channel") \
+    X(ERR_TOOMANYTARGETS,    "407", "%1 %2 :Too many targets") \
+    X(ERR_NOORIGIN,          "409", "%1 :No origin specified") \
+    X(ERR_INVALIDCAPCMD,     "410", "%1 %2 :Invalid CAP command") \
+    X(ERR_NORECIPIENT,       "411", "%1 :No recipient given (%2)") \
+    X(ERR_NOTEXTTOSEND,      "412", "%1 :No text to send") \
+    X(ERR_NONICKNAMEGIVEN,   "431", "%1 :No nickname given") \
+    X(ERR_ERRONEUSNICKNAME,  "432", "%1 %2 :Erroneus nickname") \
+    X(ERR_NICKNAMEINUSE,     "433", "%1 %2 :Nickname is already in use") \
+    X(ERR_TOOMANYMATCHES,    "416", "%1 %2 %3 :Output too long (try locally)") \
+    X(ERR_USRNOTINCHANNEL,   "441", "%1 %2 %3 :They aren't on that channel") \
+    X(ERR_NOTONCHANNEL,      "442", "%1 %2 :You're not on that channel") \
+    X(ERR_USERONCHANNEL,     "443", "%1 %2 %3 :is already on channel") \
+    X(ERR_NOTREGISTERED,     "451", "%1 :You have not registered") \
+    X(ERR_NEEDMOREPARAMS,    "461", "%1 %2 :Not enough parameters") \
+    X(ERR_ALREADYREGISTERED, "462", "%1 :You may not reregister") \
+    X(ERR_PASSWDMISMATCH,    "464", "%1 :Password incorrect") \
+    X(ERR_CHANNELISFULL,     "471", "%1 %2 :Cannot join channel (+l)") \
+    X(ERR_INVITEONLYCHAN,    "473", "%1 %2 :Cannot join channel (+i)") \
+    X(ERR_BANNEDFROMCHAN,    "474", "%1 %2 :Cannot join channel (+b)") \
+    X(ERR_BADCHANNELKEY,     "475", "%1 %2 :Cannot join channel (+k)") \
+    X(ERR_BADCHANMASK,       "476", "%1 %2 :Bad Channel Mask") \
+    X(ERR_BANLISTFULL,       "478", "%1 %2 %3 :Channel list is full") \
+    X(ERR_NOPRIVILEGES,      "481", "%1 :Permission Denied- You're not an IRC operator") \
+    X(ERR_CHANOPRIVSNEEDED,  "482", "%1 %2 :You're not channel operator") \
+    X(ERR_CANNOTKICKSELF,    "482", "%1 %2 :You can't kick yourself, use PART instead") \
+    X(ERR_NOOPERHOST,        "491", "%1 :No O-lines for your host") \
+    X(ERR_USERDONTMATCH,     "502", "%1 :Cant change mode for other users")
+
+#define NUMERIC_ENUM(id, code, format) id,
+enum Numeric {
+    NUMERIC_TABLE(NUMERIC_ENUM)
+    NUMERIC_COUNT
+};
+#undef NUMERIC_ENUM
+
+//one reply parameter: a view on a string, or a number formatted in place
+class ReplyArg {
+    private:
+        const char* _data;
+        size_t _len;
+        char _digits[24];
+    public:
+        ReplyArg();
+        ReplyArg(const std::string& str);
+        ReplyArg(const char* str);
+        ReplyArg(long value);
+        ReplyArg(const ReplyArg& other);
+        const char* data() const;
+        size_t length() const;
+    private:
+        ReplyArg& operator=(const ReplyArg& other);
+};
+
+//formats ":ircserver <code> <params>\r\n" straight into the client's send buffer;
+//%1..%7 in the format are replaced by the matching argument
+void sendReply(Client& to, Numeric id,
+               const ReplyArg& a1 = ReplyArg(), const ReplyArg& a2 = ReplyArg(),
+               const ReplyArg& a3 = ReplyArg(), const ReplyArg& a4 = ReplyArg(),
+               const ReplyArg& a5 = ReplyArg(), const ReplyArg& a6 = ReplyArg(),
+               const ReplyArg& a7 = ReplyArg());
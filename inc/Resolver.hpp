@@ -0,0 +1,102 @@
+#pragma once
+#include <pthread.h>
+#include <netinet/in.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+//Where hostnames come from. The worker threads call it concurrently, so an
+//implementation must not keep per-call state in members.
+class ResolverBackend {
+    public:
+        virtual ~ResolverBackend();
+        virtual bool reverse(const in_addr& addr, std::string& hostname) = 0;
+        virtual bool forward(const std::string& hostname, std::vector<in_addr>& addrs) = 0;
+};
+
+//getnameinfo()/getaddrinfo(), so whatever /etc/nsswitch.conf says
+class SystemResolver : public ResolverBackend {
+    public:
+        bool reverse(const in_addr& addr, std::string& hostname);
+        bool forward(const std::string& hostname, std::vector<in_addr>& addrs);
+};
+
+//Answers from a file instead of DNS, read once, for tests:
+//  ptr 127.0.0.1 client.example.org    reverse lookup
+//  a client.example.org 127.0.0.1      forward lookup, leave it out to fail the confirmation
+class StubResolver : public ResolverBackend {
+    private:
+        std::map<in_addr_t, std::string> _names;
+        std::multimap<std::string, in_addr_t> _addrs;
+    public:
+        bool load(const std::string& path, std::string& error);
+        bool reverse(const in_addr& addr, std::string& hostname);
+        bool forward(const std::string& hostname, std::vector<in_addr>& addrs);
+};
+
+//Reverse DNS (forward confirmed) and ident (RFC 1413) lookups for new
+//connections, run on a pool of worker threads so the event loop never waits
+//on the network. Finished lookups are queued and a byte is written to a pipe
+//the loop polls; the loop then collects them with takeAnswers(). The cache is
+//only touched by the loop.
+class Resolver {
+    public:
+        enum Kind { DNS, IDENT };
+        struct Query {
+            Kind kind;
+            unsigned long id;       // the caller's, handed back with the answer
+            int fd;
+            sockaddr_in peer;
+            sockaddr_in local;      // our end of the connection, for the ident request
+            unsigned int identPort;
+            unsigned int timeoutMs; // ident only, a DNS lookup cannot be cut short
+        };
+        struct Answer {
+            Kind kind;
+            unsigned long id;
+            int fd;
+            in_addr_t addr;
+            bool found;
+            std::string value;      // confirmed hostname, or the ident user id
+        };
+    private:
+        struct CacheEntry {
+            std::string hostname;   // empty: the address has no (confirmed) name
+            unsigned long expiresMs;
+        };
+        std::vector<pthread_t> _threads;
+        pthread_mutex_t _mutex;
+        pthread_cond_t _wake;
+        std::deque<Query> _queries;
+        std::vector<Answer> _answers;
+        bool _stopping;
+        int _pipe[2];               // workers write, the loop reads
+        ResolverBackend* _backend;  // owned
+        std::map<in_addr_t, CacheEntry> _cache;
+
+        static void* _run(void* self);
+        void _loop();
+        Answer _resolve(const Query& query);
+        bool _lookupHost(const in_addr& addr, std::string& hostname);
+        bool _lookupIdent(const Query& query, std::string& user);
+        Resolver(const Resolver& other);
+        Resolver& operator=(const Resolver& other);
+    public:
+        Resolver();
+        ~Resolver();
+
+        //takes ownership of backend
+        bool start(size_t threads, ResolverBackend* backend);
+        void stop();
+        bool isRunning() const;
+        int getWakeFd() const;
+        void submit(const Query& query);
+        //drains the wake pipe and appends every finished lookup
+        void takeAnswers(std::vector<Answer>& out);
+
+        //loop only: hostnames seen lately, including addresses without one
+        bool cached(in_addr_t addr, unsigned long nowMs, std::string& hostname);
+        void remember(in_addr_t addr, const std::string& hostname, unsigned long nowMs,
+                      unsigned long ttlMs, size_t maxEntries);
+};
@@ -15,29 +15,112 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <set>
 #include "Client.hpp"
 #include "Channel.hpp"
 #include "Command.hpp"
+#include "ChannelDirectory.hpp"
+#include "HistoryStore.hpp"
+#include "HistorySyncer.hpp"
+#include "ChannelJournal.hpp"
+#include "Config.hpp"
+#include "TimerWheel.hpp"
+#include "HostTable.hpp"
+#include "Resolver.hpp"
+#include "EventLog.hpp"
+#include "LoopStats.hpp"
+#include "MetricsListener.hpp"
+#include "StatsSegment.hpp"
+#include "Clock.hpp"
 #include <csignal>
+#include <cerrno>
 #include <ctime>
 
 extern volatile sig_atomic_t sig_received;//exter for visab across files
+extern volatile sig_atomic_t rehash_received; // SIGHUP, the loop reloads the config
 class Client;
 class Channel;
+class Server;
+
+//a timer of the server's own, calls back into it
+struct ServerTimer : public Timer {
+    Server* server;
+    void (Server::*action)();
+    void expire();
+};
+
+//flood control totals since startup, for STATS f
+struct FloodStats {
+    unsigned long deferred;    // times a client's input was held back
+    unsigned long excessFlood; // clients dropped for staying throttled
+};
 
 class Server
 {
 private:
+    //_poll_fds starts with the listener, the resolver's wake pipe and the metrics
+    //listener (fd -1 when there is none), clients and metrics scrapes follow
+    static const size_t FIRST_CLIENT_SLOT = 3;
     int _port;
     std::string _pass;
     int _listening_socket;
     std::vector<pollfd> _poll_fds;
+    std::vector<int> _poll_slot; // fd -> index in _poll_fds, -1 when the fd is not polled
     std::map<int, Client*> _clients;
+    std::map<std::string, Client*> _nicks;              // casemapped nickname -> client, ordered for nick* masks
+    std::multimap<std::string, Client*> _hosts;         // casemapped hostname -> client, for 10.0.* masks
+    std::multimap<std::string, Client*> _reversedHosts; // reversed hostname -> client, for *.domain masks
+    HostTable _hostTable;                               // connection counts per binary address and per network
+    size_t _unregistered;
     std::set<Channel*> _channels;
+    ChannelDirectory _directory; // what LIST serves, rebuilt lazily
+    Config _config;            // every tunable, replaced as a whole on reload
+    std::string _configPath;   // empty when started without a config file
+    std::vector<char> _recvChunk;
+    std::vector<std::pair<int, std::string> > _drops; // fd and reason, closed at the end of the loop pass
+    std::vector<int> _resumes;  // throttled clients whose flood deadline passed, run after the timers
+    FloodStats _floodStats;
+    LoopStats _loopStats;
+    HistoryStore::Limits _historyLimits;
+    HistoryCatalog _historyCatalog; // history_dir, listed once at startup
+    HistorySyncer _historySyncer;
+    ChannelJournal _journal;
+    EventLog _events;
+    MetricsListener _metrics;
+    unsigned int _connectionSerial; // numbers connections in the event log
+    TimerWheel _timers;
+    StatsSegment _statsSegment;
+    ServerTimer _statsTimer;   // rewrites the stats segment
+    Resolver _resolver;
+    unsigned long _lookupSerial;
+    std::vector<Resolver::Answer> _answers; // reused by every _collectLookups()
+    sigset_t _pollMask;        // signal mask while in poll(), the rest of the time they are blocked
     void _makeNonBlock(int sock_fd);
+    void _addPollSlot(int fd);
+    void _removePollSlot(size_t i);
+    void _indexClient(Client* client);
+    void _unindexClient(Client* client);
+    Channel* _newChannel(const std::string& name);
+    void _applyConfig();
+    void _applyClass(Client* client);
+    void _reapDrops();
+    bool _processInput(Client* client);
+    bool _runInput(Client* client, unsigned long now);
+    void _armDeadline(Client* client, int which, unsigned long nowMs, unsigned long delayMs);
+    void _disarmDeadline(Client* client, int which);
+    void _scheduleClientTimer(Client* client, unsigned long nowMs);
+    void _resumeDeferred();
+    void _startResolver();
+    void _startLookups(Client* client, const sockaddr_in& peer);
+    void _collectLookups();
+    void _finishLookups(Client* client, unsigned char done);
+    void _acceptMetrics();
+    bool _serveMetrics(size_t i);
+    void _publishStats();
+    const char* _admit(const HostKey& host, const HostKey& network, unsigned long nowMs);
 public:
     void setPort(int port);
     void setPass(const std::string& pass);
@@ -63,12 +146,39 @@ public:
     bool addChannel(const std::string& channel);
     // void _handleClientMessage(Client* client, const std::string& cmd);
     Client* getClientByNick(const std::string& nickname);
+    void setClientNick(Client* client, const std::string& nickname);
+    const std::map<std::string, Client*>& getNickIndex() const;
+    const std::multimap<std::string, Client*>& getHostIndex() const;
+    const std::multimap<std::string, Client*>& getReversedHostIndex() const;
+    size_t getWhoMaxReplies() const;
+    void pumpList(Client* client);
     Client* findSecondClient(int sock_src);
     void requestPollOut(int client_fd, bool enable);
     void disconnectClient(int client_fd);
     const std::string& getPass();
     std::vector<Client*> getAllClients() const;
     bool isOpOnAnyChannel(const std::string& nick) const;
+    size_t getPrivmsgTargetMax() const;
+    bool getPrivmsgDedupe() const;
+    std::string getISupport() const;
+    size_t getHistoryLength() const;
+    size_t getChathistoryMax() const;
+    const Config& getConfig() const;
+    const std::string& getConfigPath() const;
+    bool loadConfig(const std::string& path);
+    bool rehash(std::string& error);
+    void scheduleDrop(Client* client, const std::string& reason);
+    void clientDeadline(Client* client);
+    void keepalive(Client* client);
+    void resumeInput(Client* client);
+    const FloodStats& getFloodStats() const;
+    const LoopStats& getLoopStats() const;
+    void registerClient(Client* client);
+    void lookupTimeout(Client* client);
+    void setClientHost(Client* client, const std::string& hostname);
+    TimerWheel& getTimers();
+    EventLog& getEventLog();
+    std::string renderMetrics() const;
     Server();
     ~Server();
 };
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+
+//Reference counted, serialized protocol line(s). A broadcast is formatted once
+//and the same block is queued on every recipient instead of being copied.
+class SharedBuffer {
+    private:
+        struct Block {
+            size_t refs;
+            bool writable; // private reply buffer of one client, may still be appended to
+            std::string data;
+        };
+        Block* _block;
+        void _release();
+    public:
+        SharedBuffer();
+        explicit SharedBuffer(const std::string& data);
+        SharedBuffer(const SharedBuffer& other);
+        SharedBuffer& operator=(const SharedBuffer& other);
+        ~SharedBuffer();
+
+        static const size_t BLOCK_OVERHEAD; // heap bytes of a buffer besides its data
+
+        static SharedBuffer makeWritable(size_t reserve);
+
+        const std::string& data() const;
+        size_t size() const;
+        bool empty() const;
+        bool isWritable() const;
+        std::string& writableData();
+};
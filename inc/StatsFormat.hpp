@@ -0,0 +1,72 @@
+#pragma once
+
+//Layout of the shared memory stats segment (/<stats_shm>-<port>), shared by
+//the server and ircstat. One StatsPage, host byte order, rewritten in place
+//every stats_interval_ms under a seqlock: the server makes sequence odd,
+//writes, then makes it even again. A reader copies the page and keeps the
+//copy only if sequence was even and unchanged across the copy. The server
+//never waits for readers, and readers map the segment read-only.
+//A reader refuses a page whose magic, version or size it does not know.
+static const char STATS_MAGIC[8] = { 'I', 'R', 'C', 'S', 'T', 'A', 'T', '1' };
+static const unsigned int STATS_VERSION = 1;
+static const unsigned int STATS_COMMAND_MAX = 64;
+static const unsigned int STATS_NAME_MAX = 16;
+
+//totals since startup, latency only while command_stats is on
+struct StatsCommandSlot {
+    char name[STATS_NAME_MAX];
+    unsigned long calls;
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    unsigned long latencyCount;
+    unsigned long latencySumNs;
+    unsigned long p50Ns;
+    unsigned long p99Ns;
+    unsigned long maxNs;
+};
+
+//the event loop over the last complete second
+struct StatsLoop {
+    unsigned long passes;
+    unsigned long wakeups;
+    unsigned long events;
+    unsigned long busyNs;
+    unsigned long maxPassNs;
+    unsigned long timersNs;
+    unsigned long acceptNs;
+    unsigned long recvNs;
+    unsigned long dispatchNs;
+    unsigned long sendNs;
+    unsigned long overBudget;
+    unsigned long maxBacklogBytes;
+};
+
+struct StatsPage {
+    char magic[8];
+    unsigned int version;
+    unsigned int size;              // sizeof(StatsPage)
+    volatile unsigned long sequence; // odd while the server writes
+    unsigned long pid;
+    unsigned long port;
+    unsigned long startedMs;        // wall clock
+    unsigned long updatedMs;        // wall clock of the last publish
+    unsigned long intervalMs;       // stats_interval_ms when it was published
+    //connections and channels, now
+    unsigned long connections;
+    unsigned long registered;
+    unsigned long channels;
+    //totals since startup
+    unsigned long accepted;
+    unsigned long messagesIn;
+    unsigned long bytesIn;
+    unsigned long messagesOut;      // lines and bytes queued to clients
+    unsigned long bytesOut;
+    unsigned long floodDeferred;
+    unsigned long floodDisconnects;
+    //outbound queues, now
+    unsigned long sendqBytes;
+    unsigned long sendqClients;
+    StatsLoop loop;
+    unsigned long commandCount;
+    StatsCommandSlot commands[STATS_COMMAND_MAX];
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include "StatsFormat.hpp"
+#include <string>
+
+//The server's side of the shared memory stats segment: creates and maps it,
+//and brackets each rewrite of the page with the seqlock. Loop only.
+class StatsSegment {
+    private:
+        std::string _name;
+        StatsPage* _page;
+
+        StatsSegment(const StatsSegment& other);
+        StatsSegment& operator=(const StatsSegment& other);
+    public:
+        StatsSegment();
+        ~StatsSegment();
+
+        //name as for shm_open, "/ircserv-6667"
+        bool open(const std::string& name, unsigned long port, unsigned long startedMs);
+        //removes the segment; readers still attached keep their last page
+        void close();
+        bool isOpen() const;
+        //the page to fill in, between begin() and commit() readers retry
+        StatsPage& begin();
+        void commit();
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+
+class TimerWheel;
+
+//list node shared by timers and the wheel's slot heads
+struct TimerLink {
+    TimerLink* prev;
+    TimerLink* next;
+};
+
+//Something that fires once at a given time. Owners derive from it (or keep a
+//small subclass as a member) and implement expire(); a timer unlinks itself
+//from the wheel before expire() runs, so expire() may schedule it again.
+//Destroying a pending timer cancels it.
+class Timer : private TimerLink {
+    private:
+        friend class TimerWheel;
+        TimerWheel* _wheel;     // NULL while not scheduled
+        unsigned long _expires; // wheel tick
+        unsigned char _level;   // slot it is linked into
+        unsigned char _slot;
+
+        Timer(const Timer& other);
+        Timer& operator=(const Timer& other);
+    public:
+        Timer();
+        virtual ~Timer();
+        virtual void expire() = 0;
+        bool isPending() const;
+        void cancel();
+};
+
+//Hierarchical timing wheel, 4 levels of 64 slots at 10ms per tick: level 0
+//covers the next 640ms, level 1 41s, level 2 44min, level 3 46h (longer delays
+//are clamped). Scheduling and cancelling are O(1) list operations; a level-0
+//slot holds only timers due on that tick, a higher slot is pushed one level
+//down whenever the level below wraps around. A bitmap per level tells which
+//slots are used, so the next wakeup is found without walking empty slots.
+class TimerWheel {
+    public:
+        static const unsigned long TICK_MS = 10;
+    private:
+        static const unsigned int LEVELS = 4;
+        static const unsigned int SLOT_BITS = 6;
+        static const unsigned int SLOTS = 1 << SLOT_BITS;
+
+        TimerLink _slots[LEVELS][SLOTS];
+        unsigned long _occupied[LEVELS]; // bit i set when _slots[level][i] is not empty
+        unsigned long _now;              // last tick processed
+        size_t _count;
+
+        void _insert(Timer& timer);
+        void _remove(Timer& timer);
+        void _cascade(unsigned int level);
+        size_t _fireSlot(unsigned int slot);
+
+        TimerWheel(const TimerWheel& other);
+        TimerWheel& operator=(const TimerWheel& other);
+    public:
+        TimerWheel();
+
+        //starts the wheel at a monotonic time, before anything is scheduled
+        void start(unsigned long nowMs);
+        void schedule(Timer& timer, unsigned long nowMs, unsigned long delayMs);
+        //runs every timer due at nowMs, returns how many fired
+        size_t advance(unsigned long nowMs);
+        //milliseconds until the next timer may be due, -1 with nothing scheduled
+        long nextTimeout(unsigned long nowMs) const;
+        size_t size() const;
+        void cancel(Timer& timer);
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include "../../inc/StatsFormat.hpp"
+#include <iostream>
+#include <string>
+
+//Reads the stats segment an ircserv publishes, without ever writing to it or
+//talking to the server, and prints a top-style screen: totals, per second
+//rates since the previous screen (since startup on the first one), the loop
+//over its last complete second and the busiest commands.
+class IrcStat {
+    private:
+        std::string _name;
+        const StatsPage* _page;
+        StatsPage _previous;
+        bool _havePrevious;
+
+        IrcStat(const IrcStat& other);
+        IrcStat& operator=(const IrcStat& other);
+    public:
+        IrcStat();
+        ~IrcStat();
+
+        //name as for shm_open, "/ircserv-6667"; false with a message on error
+        bool attach(const std::string& name, std::string& error);
+        //a consistent copy of the page, false when the server kept writing
+        bool snapshot(StatsPage& out) const;
+        //prints one screen, at most top commands
+        void print(std::ostream& out, const StatsPage& now, size_t top);
+};
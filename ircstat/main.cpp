@@ -0,0 +1,64 @@
+#include "inc/IrcStat.hpp"
+#include <cstdlib>
+#include <unistd.h>
+
+static void usage() {
+    std::cerr << "Error: try ./ircstat [-b] [-d MS] [-n COUNT] [-t TOP] PORT|SEGMENT" << std::endl;
+}
+
+//"6667" is the segment of a server on that port with stats_shm ircserv
+static std::string segmentName(const std::string& arg) {
+    if (arg.find_first_not_of("0123456789") == std::string::npos) {
+        return "/ircserv-" + arg;
+    }
+    return arg[0] == '/' ? arg : "/" + arg;
+}
+
+int main(int ac, char **av) {
+    bool batch = false;  // no screen clearing, one screen after another, like top -b
+    long delayMs = 1000;
+    long count = 0;      // 0 runs until interrupted
+    long top = 20;
+    int opt;
+    while ((opt = getopt(ac, av, "bd:n:t:")) != -1) {
+        if (opt == 'b') {
+            batch = true;
+        } else if (opt == 'd') {
+            delayMs = std::atol(optarg);
+        } else if (opt == 'n') {
+            count = std::atol(optarg);
+        } else if (opt == 't') {
+            top = std::atol(optarg);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (optind + 1 != ac || delayMs <= 0 || count < 0 || top < 0) {
+        usage();
+        return 1;
+    }
+    IrcStat stat;
+    std::string error;
+    if (!stat.attach(segmentName(av[optind]), error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    for (long shown = 0; count == 0 || shown < count; ++shown) {
+        if (shown != 0) {
+            usleep(static_cast<useconds_t>(delayMs) * 1000);
+        }
+        StatsPage page;
+        if (!stat.snapshot(page)) {
+            std::cerr << "Error: the stats kept changing while being read" << std::endl;
+            return 1;
+        }
+        if (!batch) {
+            std::cout << "\033[H\033[2J";
+        } else if (shown != 0) {
+            std::cout << '\n';
+        }
+        stat.print(std::cout, page, static_cast<size_t>(top));
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "../inc/IrcStat.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+IrcStat::IrcStat() : _page(NULL), _havePrevious(false) {}
+
+IrcStat::~IrcStat() {
+    if (_page) {
+        munmap(const_cast<StatsPage*>(_page), sizeof(StatsPage));
+    }
+}
+
+bool IrcStat::attach(const std::string& name, std::string& error) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        error = name + ": " + strerror(errno) + " (is the server running with stats_shm set?)";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) != sizeof(StatsPage)) {
+        ::close(fd);
+        error = name + ": not a stats segment this ircstat can read";
+        return false;
+    }
+    void* map = mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        error = name + ": " + strerror(errno);
+        return false;
+    }
+    const StatsPage* page = static_cast<const StatsPage*>(map);
+    if (std::memcmp(page->magic, STATS_MAGIC, sizeof(STATS_MAGIC)) != 0 || page->version != STATS_VERSION
+        || page->size != sizeof(StatsPage)) {
+        munmap(map, sizeof(StatsPage));
+        error = name + ": stats segment of another version";
+        return false;
+    }
+    _name = name;
+    _page = page;
+    return true;
+}
+
+//seqlock read: the copy counts only if no write started or ended during it
+bool IrcStat::snapshot(StatsPage& out) const {
+    for (int tries = 0; tries < 1000; ++tries) {
+        unsigned long sequence = _page->sequence;
+        if (sequence & 1) {
+            sched_yield();
+            continue;
+        }
+        __sync_synchronize();
+        std::memcpy(&out, const_cast<const StatsPage*>(_page), sizeof(out));
+        __sync_synchronize();
+        if (_page->sequence == sequence) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static double perSecond(unsigned long now, unsigned long before, double seconds) {
+    return seconds > 0 ? (now - before) / seconds : 0.0;
+}
+
+//"1d 02:03:04"
+static std::string duration(unsigned long ms) {
+    unsigned long s = ms / 1000;
+    char text[32];
+    if (s >= 86400) {
+        std::snprintf(text, sizeof(text), "%lud %02lu:%02lu:%02lu", s / 86400, s / 3600 % 24, s / 60 % 60, s % 60);
+    } else {
+        std::snprintf(text, sizeof(text), "%02lu:%02lu:%02lu", s / 3600, s / 60 % 60, s % 60);
+    }
+    return text;
+}
+
+static std::string clock(unsigned long wallMs) {
+    std::time_t seconds = static_cast<std::time_t>(wallMs / 1000);
+    std::tm local;
+    localtime_r(&seconds, &local);
+    char text[16];
+    std::strftime(text, sizeof(text), "%H:%M:%S", &local);
+    return text;
+}
+
+//a command and its calls per second, for sorting
+struct CommandRow {
+    size_t index;
+    double rate;
+    bool operator<(const CommandRow& other) const {
+        return rate != other.rate ? rate > other.rate : index < other.index;
+    }
+};
+
+void IrcStat::print(std::ostream& out, const StatsPage& now, size_t top) {
+    //rates since the previous screen, since startup on the first one
+    StatsPage zero;
+    std::memset(&zero, 0, sizeof(zero));
+    zero.updatedMs = now.startedMs;
+    const StatsPage& before = (_havePrevious && _previous.pid == now.pid) ? _previous : zero;
+    double seconds = now.updatedMs > before.updatedMs ? (now.updatedMs - before.updatedMs) / 1000.0 : 0.0;
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    unsigned long wallMs = static_cast<unsigned long>(wall.tv_sec) * 1000 + wall.tv_nsec / 1000000;
+    unsigned long age = wallMs > now.updatedMs ? wallMs - now.updatedMs : 0;
+    bool gone = kill(static_cast<pid_t>(now.pid), 0) == -1 && errno == ESRCH;
+    char line[256];
+
+    std::snprintf(line, sizeof(line), "ircserv pid %lu port %lu, up %s, updated %lu ms ago%s  %s",
+                  now.pid, now.port, duration(now.updatedMs - now.startedMs).c_str(), age,
+                  gone ? " (server gone)" : age > 5 * now.intervalMs + 1000 ? " (stale)" : "", clock(wallMs).c_str());
+    out << line << '\n';
+    std::snprintf(line, sizeof(line), "clients %lu (%lu registered), channels %lu, accepted %lu, %.1f/s",
+                  now.connections, now.registered, now.channels, now.accepted,
+                  perSecond(now.accepted, before.accepted, seconds));
+    out << line << '\n';
+    std::snprintf(line, sizeof(line), "in  %9.1f msg/s %10.1f KiB/s    out %9.1f msg/s %10.1f KiB/s",
+                  perSecond(now.messagesIn, before.messagesIn, seconds),
+                  perSecond(now.bytesIn, before.bytesIn, seconds) / 1024,
+                  perSecond(now.messagesOut, before.messagesOut, seconds),
+                  perSecond(now.bytesOut, before.bytesOut, seconds) / 1024);
+    out << line << '\n';
+    std::snprintf(line, sizeof(line), "sendq %lu bytes in %lu clients (up to %lu), flood deferred %.1f/s, dropped %lu",
+                  now.sendqBytes, now.sendqClients, now.loop.maxBacklogBytes,
+                  perSecond(now.floodDeferred, before.floodDeferred, seconds), now.floodDisconnects);
+    out << line << '\n';
+    const StatsLoop& loop = now.loop;
+    std::snprintf(line, sizeof(line), "loop %lu passes/s, %.1f events/wakeup, busy %.1f%% (timers %.1f accept %.1f "
+                  "recv %.1f dispatch %.1f send %.1f ms), longest %.2f ms, %lu over budget",
+                  loop.passes, loop.wakeups ? static_cast<double>(loop.events) / loop.wakeups : 0.0,
+                  loop.busyNs / 1e7, loop.timersNs / 1e6, loop.acceptNs / 1e6, loop.recvNs / 1e6,
+                  loop.dispatchNs / 1e6, loop.sendNs / 1e6, loop.maxPassNs / 1e6, loop.overBudget);
+    out << line << "\n\n";
+
+    std::vector<CommandRow> rows;
+    for (size_t i = 0; i < now.commandCount && i < STATS_COMMAND_MAX; ++i) {
+        if (now.commands[i].calls == 0) {
+            continue;
+        }
+        CommandRow row = { i, perSecond(now.commands[i].calls, before.commands[i].calls, seconds) };
+        rows.push_back(row);
+    }
+    std::sort(rows.begin(), rows.end());
+    std::snprintf(line, sizeof(line), "%-12s %10s %12s %11s %11s %9s %9s %9s",
+                  "COMMAND", "CALLS/S", "CALLS", "IN B/S", "OUT B/S", "P50 us", "P99 us", "MAX us");
+    out << line << '\n';
+    for (size_t r = 0; r < rows.size() && r < top; ++r) {
+        const StatsCommandSlot& command = now.commands[rows[r].index];
+        const StatsCommandSlot& earlier = before.commands[rows[r].index];
+        char name[STATS_NAME_MAX];
+        std::memcpy(name, command.name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+        std::snprintf(line, sizeof(line), "%-12s %10.1f %12lu %11.0f %11.0f %9.1f %9.1f %9.1f",
+                      name, rows[r].rate, command.calls, perSecond(command.bytesIn, earlier.bytesIn, seconds),
+                      perSecond(command.bytesOut, earlier.bytesOut, seconds), command.p50Ns / 1e3,
+                      command.p99Ns / 1e3, command.maxNs / 1e3);
+        out << line << '\n';
+    }
+    out.flush();
+    std::memcpy(&_previous, &now, sizeof(_previous));
+    _havePrevious = true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "../../inc/EventFormat.hpp"
+#include <iostream>
+#include <map>
+#include <string>
+
+//Decodes event log segments written by ircserv, one event per line:
+//  2026-01-31 23:59:59.123 #12 join nick=alice channel=#chan
+//or, with json set, one JSON object per line:
+//  {"time_ms":1769900399123,"conn":12,"event":"join","nick":"alice","channel":"#chan"}
+class LogDump {
+    private:
+        std::ostream& _out;
+        bool _json;
+        std::map<unsigned int, std::string> _strings; // of the segment being read
+
+        void _print(const EventRecord& record);
+        const std::string& _string(unsigned int id);
+    public:
+        LogDump(std::ostream& out, bool json);
+        //a segment file, or a directory of them in order; false with a message on error
+        bool dump(const std::string& path, std::string& error);
+        bool dumpSegment(const std::string& path, std::string& error);
+};
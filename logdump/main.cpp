@@ -0,0 +1,23 @@
+#include "inc/LogDump.hpp"
+
+int main(int ac, char **av) {
+    bool json = false;
+    int first = 1;
+    if (ac > 1 && std::string(av[1]) == "--json") {
+        json = true;
+        first = 2;
+    }
+    if (first >= ac) {
+        std::cerr << "Error: invalid amount of arguments: try ./ircserv-logdump [--json] EVENT_DIR|SEGMENT..." << std::endl;
+        return 1;
+    }
+    LogDump dump(std::cout, json);
+    for (int i = first; i < ac; ++i) {
+        std::string error;
+        if (!dump.dump(av[i], error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "../inc/LogDump.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+//name of each event type and of its arguments, indexed by EventType
+struct EventLayout {
+    const char* name;
+    const char* args[4];
+};
+
+static const EventLayout g_layouts[EV_TYPE_COUNT] = {
+    { "unknown",    { NULL, NULL, NULL, NULL } },
+    { "string",     { NULL, NULL, NULL, NULL } },
+    { "start",      { "port", NULL, NULL, NULL } },
+    { "stop",       { NULL, NULL, NULL, NULL } },
+    { "connect",    { "address", NULL, NULL, NULL } },
+    { "register",   { "nick", "user", "host", NULL } },
+    { "nick",       { "nick", "new", NULL, NULL } },
+    { "join",       { "nick", "channel", NULL, NULL } },
+    { "part",       { "nick", "channel", "reason", NULL } },
+    { "kick",       { "nick", "channel", "target", "reason" } },
+    { "mode",       { "nick", "channel", "modes", NULL } },
+    { "disconnect", { "nick", "reason", NULL, NULL } }
+};
+
+static const size_t RECORD_SIZE = sizeof(EventRecord);
+
+LogDump::LogDump(std::ostream& out, bool json) : _out(out), _json(json) {}
+
+const std::string& LogDump::_string(unsigned int id) {
+    static const std::string empty;
+    std::map<unsigned int, std::string>::const_iterator it = _strings.find(id);
+    return it != _strings.end() ? it->second : empty;
+}
+
+static void printJsonString(std::ostream& out, const std::string& str) {
+    out << '"';
+    for (size_t i = 0; i < str.length(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+//"2026-01-31 23:59:59.123", local time like the server's text log
+static std::string formatTime(unsigned long timeMs) {
+    time_t sec = static_cast<time_t>(timeMs / 1000);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char stamp[40];
+    size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    std::snprintf(stamp + n, sizeof(stamp) - n, ".%03lu", timeMs % 1000);
+    return stamp;
+}
+
+void LogDump::_print(const EventRecord& record) {
+    const EventLayout& layout = g_layouts[record.type < EV_TYPE_COUNT ? record.type : 0];
+    if (_json) {
+        _out << "{\"time_ms\":" << record.timeMs << ",\"conn\":" << record.conn << ",\"event\":\"" << layout.name << '"';
+        if (record.type >= EV_TYPE_COUNT) {
+            _out << ",\"type\":" << record.type;
+        }
+        for (size_t i = 0; i < 4 && layout.args[i]; ++i) {
+            _out << ",\"" << layout.args[i] << "\":";
+            printJsonString(_out, _string(record.args[i]));
+        }
+        _out << "}\n";
+        return;
+    }
+    _out << formatTime(record.timeMs) << " #" << record.conn << ' ' << layout.name;
+    if (record.type >= EV_TYPE_COUNT) {
+        _out << ' ' << record.type;
+    }
+    for (size_t i = 0; i < 4 && layout.args[i]; ++i) {
+        const std::string& value = _string(record.args[i]);
+        _out << ' ' << layout.args[i] << '=';
+        if (value.empty() || value.find_first_of(" \"\\") != std::string::npos) {
+            printJsonString(_out, value);
+        } else {
+            _out << value;
+        }
+    }
+    _out << '\n';
+}
+
+bool LogDump::dumpSegment(const std::string& path, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(EventHeader)) {
+        close(fd);
+        error = path + ": not an event log";
+        return false;
+    }
+    size_t size = st.st_size;
+    void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    const char* data = static_cast<const char*>(addr);
+    const EventHeader* header = reinterpret_cast<const EventHeader*>(data);
+    if (std::memcmp(header->magic, EVENT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != EVENT_VERSION || header->recordSize != RECORD_SIZE) {
+        munmap(addr, size);
+        error = path + ": not an event log of this version";
+        return false;
+    }
+    _strings.clear();
+    size_t pos = sizeof(EventHeader);
+    while (pos + RECORD_SIZE <= size) {
+        const EventRecord* record = reinterpret_cast<const EventRecord*>(data + pos);
+        pos += RECORD_SIZE;
+        if (record->type == 0) { // rest of a segment the server did not get to trim
+            break;
+        }
+        if (record->type == EV_STRING) {
+            size_t len = std::min<size_t>(record->len, size - pos);
+            _strings[record->args[0]] = std::string(data + pos, len);
+            pos += (len + RECORD_SIZE - 1) / RECORD_SIZE * RECORD_SIZE;
+            continue;
+        }
+        _print(*record);
+    }
+    munmap(addr, size);
+    _out.flush();
+    return true;
+}
+
+bool LogDump::dump(const std::string& path, std::string& error) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return dumpSegment(path, error);
+    }
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 7, "events-") == 0 && name.length() > 4 && name.compare(name.length() - 4, 4, ".bin") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end()); // the sequence number is zero padded
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!dumpSegment(path + "/" + names[i], error)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -2,18 +2,13 @@
 #include "inc/Command.hpp"
 
 volatile sig_atomic_t sig_received = 0;
-
-bool isNum(const char* input) {
-    for (size_t i = 0; input[i] != '\0'; i++) {
-        if (!std::isdigit(input[i])) {
-            return false;
-        }
-    }
-    return true;
-}
+volatile sig_atomic_t rehash_received = 0;
 
 void handle_sig(int signal) {
-    (void)signal;
+    if (signal == SIGHUP) {
+        rehash_received = 1;
+        return;
+    }
     sig_received = 1;
 }
 
@@ -22,9 +17,10 @@ int main(int ac, char **av) {
     std::string pass;
     std::signal(SIGINT, handle_sig);
     std::signal(SIGTERM, handle_sig);
+    std::signal(SIGHUP, handle_sig);
 
-    if (ac != 3) {
-        std::cerr << "Error: invalid amount of arguments: try ./ircserv PORT PASSWORD" << std::endl;
+    if (ac != 3 && ac != 4) {
+        std::cerr << "Error: invalid amount of arguments: try ./ircserv PORT PASSWORD [CONFIG]" << std::endl;
         return 1;
     }
     pass = av[2];
@@ -35,6 +31,9 @@ int main(int ac, char **av) {
     }
     
     Server server;
+    if (ac == 4 && !server.loadConfig(av[3])) {
+        return 1;
+    }
     server.setPass(pass);
     server.setPort(port);
     server.startServer();
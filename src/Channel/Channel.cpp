@@ -1,15 +1,23 @@
 #include "../../inc/Channel.hpp"
 
 
-Channel::Channel(const std::string& name) : _name(name), _userLimit(0), _inviteOnly(false), _topicLocked(false) {
+unsigned long Channel::_metadataVersion = 0;
+
+Channel::Channel(const std::string& name) : _name(name), _userLimit(0), _inviteOnly(false), _topicLocked(false),
+    _createdAt(Clock::now()), _topicTime(0), _history(0), _store(NULL), _journal(NULL) {
+    ++_metadataVersion;
     // std::cout << PURPLE << "Channel " << this->_name << " has been created!" << RESET << std::endl;
 }
 
 Channel::~Channel() {
-    std::cout << ORANGE << "Channel " << this->_name << " has been deleted!" << RESET << std::endl;
+    ++_metadataVersion;
+    delete _store;
+    LOG(LOG_DEBUG, "Channel " << this->_name << " has been deleted!");
     _clients.clear();
     _operators.clear();
     _invited.clear();
+    _nameChunks.clear();
+    _nameChunkOf.clear();
     //here only the clients continer should be removed not the clients pointers, bcs the channel doesn't own the client
 }
 
@@ -17,51 +25,171 @@ const std::string& Channel::getName() const { return this->_name; }
 
 const std::string& Channel::getTopic() const { return this->_topic; }
 
-std::string Channel::getNameList() const {
-    std::string list;
-    for (std::vector<Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        Client* client = *it;
-        std::string nick = client->getNickname();
-        if (isOperator(nick)) {
-            list += "@" + nick + " ";
-        } else {
-            list += nick + " ";
+std::time_t Channel::getCreationTime() const { return _createdAt; }
+
+std::time_t Channel::getTopicTime() const { return _topicTime; }
+
+unsigned long Channel::getMetadataVersion() { return _metadataVersion; }
+
+const std::string& Channel::getPassword() const { return _password; }
+
+size_t Channel::getHistoryLength() const { return _history.getCapacity(); }
+
+//Longest payload that still fits a 353 line for any recipient:
+//":ircserver 353 <nick> = <channel> :<payload>\r\n" <= 512, with nicks of up to 30 chars
+size_t Channel::_namesBudget() const {
+    const size_t IRC_MAX_SIZE = 512;
+    const size_t MAX_NICK_LEN = 30;
+    const size_t fixed = std::strlen(":ircserver 353 ") + MAX_NICK_LEN + std::strlen(" = ") + std::strlen(" :") + 2;
+    return IRC_MAX_SIZE - fixed - _name.length();
+}
+
+//finds the "nick" or "@nick" token of a member; the index names its chunk,
+//so only that one line is scanned
+bool Channel::_namesFind(const std::string& nickname, size_t& chunk, size_t& pos, size_t& len) const {
+    std::map<std::string, size_t>::const_iterator it = _nameChunkOf.find(nickname);
+    if (it == _nameChunkOf.end()) {
+        return false;
+    }
+    chunk = it->second;
+    const std::string& names = _nameChunks[chunk];
+    pos = 0;
+    while (pos < names.length()) {
+        size_t end = names.find(' ', pos);
+        if (end == std::string::npos) {
+            end = names.length();
+        }
+        size_t start = (names[pos] == '@') ? pos + 1 : pos;
+        if (end - start == nickname.length() && names.compare(start, nickname.length(), nickname) == 0) {
+            len = end - pos;
+            return true;
         }
+        pos = end + 1;
     }
-    if (!list.empty() && list[list.length() - 1] == ' ') { // remove any trailing spaces, if present
-        list.erase(list.length() - 1, 1);
+    return false;
+}
+
+//points every member of a chunk at it, after the chunk moved
+void Channel::_namesIndexChunk(size_t chunk) {
+    const std::string& names = _nameChunks[chunk];
+    size_t pos = 0;
+    while (pos < names.length()) {
+        size_t end = names.find(' ', pos);
+        if (end == std::string::npos) {
+            end = names.length();
+        }
+        size_t start = (names[pos] == '@') ? pos + 1 : pos;
+        _nameChunkOf[names.substr(start, end - start)] = chunk;
+        pos = end + 1;
     }
-    return list;
 }
 
-std::vector<Client*> Channel::getUsers() const { return this->_clients; }
+void Channel::_namesAdd(const std::string& token) {
+    if (_nameChunks.empty() || _nameChunks.back().length() + 1 + token.length() > _namesBudget()) {
+        _nameChunks.push_back(token);
+    } else {
+        if (!_nameChunks.back().empty()) {
+            _nameChunks.back() += ' ';
+        }
+        _nameChunks.back() += token;
+    }
+    _nameChunkOf[token[0] == '@' ? token.substr(1) : token] = _nameChunks.size() - 1;
+}
+
+//an emptied chunk is replaced by the last one, so only that chunk's members
+//need their index entries rewritten
+void Channel::_namesRemove(const std::string& nickname) {
+    size_t chunk, pos, len;
+    if (!_namesFind(nickname, chunk, pos, len)) {
+        return;
+    }
+    _nameChunkOf.erase(nickname);
+    std::string& names = _nameChunks[chunk];
+    if (pos + len < names.length()) {
+        names.erase(pos, len + 1); // token and the space after it
+    } else {
+        names.erase(pos > 0 ? pos - 1 : 0); // last token and the space before it
+    }
+    if (names.empty()) {
+        if (chunk + 1 != _nameChunks.size()) {
+            names.swap(_nameChunks.back());
+            _namesIndexChunk(chunk);
+        }
+        _nameChunks.pop_back();
+    }
+}
+
+void Channel::_namesSetOperator(const std::string& nickname, bool on) {
+    size_t chunk, pos, len;
+    if (!_namesFind(nickname, chunk, pos, len) || (_nameChunks[chunk][pos] == '@') == on) {
+        return;
+    }
+    if (!on) {
+        _nameChunks[chunk].erase(pos, 1);
+    } else if (_nameChunks[chunk].length() + 1 <= _namesBudget()) {
+        _nameChunks[chunk].insert(pos, 1, '@');
+    } else { // the '@' would overflow this chunk, move the member to the end instead
+        _namesRemove(nickname);
+        _namesAdd("@" + nickname);
+    }
+}
+
+const std::vector<std::string>& Channel::getNameChunks() const { return _nameChunks; }
+
+const std::vector<Client*>& Channel::getUsers() const { return this->_clients; }
 
 void Channel::setTopic(const std::string& topic, const std::string& setter) {
     this->_topic = topic;
+    _topicTime = Clock::now();
+    ++_metadataVersion;
+    if (_journal) {
+        _journal->recordTopic(*this);
+    }
     //optional for server console
-    std::cout << GREEN << "Topic for channel " << _name << " changed to: " << topic << " by " << setter  << "." << RESET << std::endl;
+    LOG(LOG_DEBUG, "Topic for channel " << _name << " changed to: " << topic << " by " << setter  << ".");
 }
 
 bool Channel::isTopicLocked() const { return this->_topicLocked; }
 
+void Channel::setJournal(ChannelJournal* journal) { _journal = journal; }
+
+void Channel::restoreCreationTime(std::time_t createdAt) { _createdAt = createdAt; }
+
+void Channel::restoreTopic(const std::string& topic, std::time_t topicTime) {
+    _topic = topic;
+    _topicTime = topicTime;
+    ++_metadataVersion;
+}
+
+void Channel::restoreListEntry(char mode, const std::string& mask, const std::string& setter, std::time_t setAt) {
+    const_cast<MaskSet&>(getList(mode)).add(mask, setter, setAt);
+}
+
 
 void Channel::addClient(Client* client) {
     //add the client to the channel
     _clients.push_back(client);
+    client->addJoinedChannel(this);
+    ++_metadataVersion;
+    _namesAdd(isOperator(client->getNickname()) ? "@" + client->getNickname() : client->getNickname());
 }
 
 void Channel::removeClient(const std::string& nickname) {
     std::vector<Client*>::iterator it;
     for (it = _clients.begin(); it != _clients.end(); ++it) {
         if ((*it)->getNickname() == nickname) {
+            (*it)->removeJoinedChannel(this);
+            _banCache.erase(*it);
+            ++_metadataVersion;
             _clients.erase(it); // removes the pointer from vector, but not the object itself(client)
+            _namesRemove(nickname);
             break;
         }
     }
     _operators.erase(nickname);   // for both sets, if nickname is not there 
     _invited.erase(nickname);
     //msg to server
-    std::cout << ORANGE << "Client " << nickname << " removed from channel " << _name << RESET << std::endl;
+    LOG(LOG_DEBUG, "Client " << nickname << " removed from channel " << _name);
 }
 
 bool Channel::hasClient(const std::string& nickname) const {
@@ -74,12 +202,33 @@ bool Channel::hasClient(const std::string& nickname) const {
     return false;
 }
 
+void Channel::renameClient(const std::string& oldNick, const std::string& newNick) {
+    for (std::vector<Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if ((*it)->getNickname() == oldNick) {
+            _banCache.erase(*it); // bans may name the old nick but not the new one
+            break;
+        }
+    }
+    bool op = isOperator(oldNick);
+    _namesRemove(oldNick);
+    _namesAdd(op ? "@" + newNick : newNick);
+    if (op) {
+        _operators.erase(oldNick);
+        _operators.insert(newNick);
+    }
+    if (_invited.erase(oldNick)) {
+        _invited.insert(newNick);
+    }
+}
+
 void Channel::addOperator(const std::string& nickname) {
     _operators.insert(nickname);
+    _namesSetOperator(nickname, true);
 }
 
 void Channel::removeOperator(const std::string& nickname) {
     _operators.erase(nickname);
+    _namesSetOperator(nickname, false);
 }
 
 bool Channel::isOperator(const std::string& nickname) const {
@@ -101,21 +250,157 @@ bool Channel::isInviteOnly() const {
     return _inviteOnly;
 }
 
-void Channel::setPassword(const std::string& password) { _password = password;}
+void Channel::setPassword(const std::string& password) {
+    _password = password;
+    if (_journal) {
+        _journal->recordKey(*this);
+    }
+}
+
+void Channel::removePassword() {
+    _password.clear();
+    if (_journal) {
+        _journal->recordKey(*this);
+    }
+}
+
+void Channel::setUserLimit(size_t limit) {
+    _userLimit = limit;
+    if (_journal) {
+        _journal->recordFlags(*this);
+    }
+}
 
-void Channel::removePassword() { _password.clear(); }
+void Channel::setInviteOnly(bool on) {
+    _inviteOnly = on;
+    if (_journal) {
+        _journal->recordFlags(*this);
+    }
+}
 
-void Channel::setUserLimit(size_t limit) { _userLimit = limit; }
+void Channel::setTopicLock(bool on) {
+    _topicLocked = on;
+    if (_journal) {
+        _journal->recordFlags(*this);
+    }
+}
+
+void Channel::setHistoryLength(size_t length) {
+    _history.setCapacity(length);
+    if (_journal) {
+        _journal->recordFlags(*this);
+    }
+}
 
-void Channel::setInviteOnly(bool on) { _inviteOnly = on; }
+const size_t Channel::MAX_LIST_ENTRIES;
 
-void Channel::setTopicLock(bool on) { _topicLocked = on; }
+const MaskSet& Channel::getList(char mode) const {
+    if (mode == 'e') {
+        return _banExceptions;
+    }
+    if (mode == 'I') {
+        return _inviteExceptions;
+    }
+    return _bans;
+}
+
+bool Channel::addListEntry(char mode, const std::string& mask, const std::string& setter) {
+    MaskSet& list = const_cast<MaskSet&>(getList(mode));
+    if (!list.add(mask, setter, Clock::now())) {
+        return false;
+    }
+    if (_journal) {
+        const MaskSet::Entry& entry = *list.getEntries().back();
+        _journal->recordListEntry(*this, mode, entry.mask.getPattern(), entry.setter, entry.setAt, true);
+    }
+    if (mode != 'I') {
+        _banCache.clear();
+    }
+    return true;
+}
+
+bool Channel::removeListEntry(char mode, const std::string& mask) {
+    MaskSet& list = const_cast<MaskSet&>(getList(mode));
+    if (!list.remove(mask)) {
+        return false;
+    }
+    if (_journal) {
+        _journal->recordListEntry(*this, mode, mask, "", 0, false);
+    }
+    if (mode != 'I') {
+        _banCache.clear();
+    }
+    return true;
+}
+
+bool Channel::_computeBanned(const Client& client) const {
+    std::string fullName = client.getNickname() + "!" + client.getUsername() + "@" + client.getHostname();
+    std::string host = Mask::fold(client.getHostname());
+    return _bans.matches(fullName, host) && !_banExceptions.matches(fullName, host);
+}
+
+//Every channel message asks this, so a member's verdict is kept until the lists
+//change, the member changes nick or leaves. Joining clients are not cached, they
+//may be gone (and their address reused) before the verdict would be dropped
+bool Channel::isBanned(const Client& client) const {
+    if (_bans.empty()) {
+        return false;
+    }
+    std::map<const Client*, bool>::const_iterator cached = _banCache.find(&client);
+    if (cached != _banCache.end()) {
+        return cached->second;
+    }
+    bool banned = _computeBanned(client);
+    const std::vector<Channel*>& joined = client.getJoinedChannels();
+    if (std::find(joined.begin(), joined.end(), this) != joined.end()) {
+        _banCache[&client] = banned;
+    }
+    return banned;
+}
+
+ChannelHistory& Channel::getHistory() { return _history; }
+
+const HistoryStore* Channel::getStore() const { return _store; }
+
+void Channel::attachStore(HistoryStore* store) {
+    delete _store;
+    _store = store;
+    if (_store == NULL) {
+        return;
+    }
+    size_t count = _store->size();
+    HistoryEntry entry;
+    for (size_t i = count - std::min(count, _history.getCapacity()); i < count; ++i) {
+        _store->read(i, entry);
+        _history.restore(entry);
+    }
+}
+
+void Channel::recordMessage(const SharedBuffer& line, unsigned long timeMs) {
+    HistoryEntry entry = _history.record(line, timeMs); // keeps a reference, not a copy
+    if (_store) {
+        _store->append(entry);
+    }
+}
+
+bool Channel::isInviteException(const Client& client) const {
+    if (_inviteExceptions.empty()) {
+        return false;
+    }
+    std::string fullName = client.getNickname() + "!" + client.getUsername() + "@" + client.getHostname();
+    return _inviteExceptions.matches(fullName, Mask::fold(client.getHostname()));
+}
 
 
 void Channel::broadcast(const std::string& message, const std::string& senderNick) {
+    broadcast(SharedBuffer(message), senderNick);
+}
+
+//the line is serialized once and every member queues a reference to it
+void Channel::broadcast(const SharedBuffer& message, const std::string& senderNick) {
     for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
         if (*it && (*it)->getNickname() != senderNick) {  // so we dont send to the user that is broadcasting the message (irc behavior)
-            (*it)->queueMessage(message);
+            (*it)->queueShared(message);
         }
     }
 }
@@ -0,0 +1,151 @@
+#include "../../inc/ChannelDirectory.hpp"
+#include "../../inc/Channel.hpp"
+#include <cstdlib>
+
+ListFilter::ListFilter() : minUsers(0), maxUsers(0), topicAfter(0), topicBefore(0),
+    createdAfter(0), createdBefore(0), started(false) {}
+
+//reads the number behind a '<' or '>'; conditions with anything else in them are rejected
+static bool parseCount(const std::string& str, size_t& out) {
+    if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    out = std::strtoul(str.c_str(), NULL, 10);
+    return true;
+}
+
+bool ListFilter::parse(const std::string& conditions, std::time_t now) {
+    size_t start = 0;
+    while (start <= conditions.length()) {
+        size_t end = conditions.find(',', start);
+        if (end == std::string::npos) {
+            end = conditions.length();
+        }
+        std::string cond = conditions.substr(start, end - start);
+        start = end + 1;
+        size_t value;
+        if (cond.empty()) {
+            continue;
+        } else if (cond[0] == '>' || cond[0] == '<') {
+            if (!parseCount(cond.substr(1), value)) {
+                return false;
+            }
+            if (cond[0] == '>') {
+                minUsers = value + 1;
+            } else {
+                maxUsers = value;
+            }
+        } else if ((cond[0] == 'T' || cond[0] == 'C') && cond.length() > 1 && (cond[1] == '<' || cond[1] == '>')) {
+            if (!parseCount(cond.substr(2), value)) {
+                return false;
+            }
+            std::time_t edge = now - static_cast<std::time_t>(value) * 60;
+            if (cond[0] == 'T') {
+                (cond[1] == '<' ? topicAfter : topicBefore) = edge;
+            } else {
+                (cond[1] == '<' ? createdAfter : createdBefore) = edge;
+            }
+        } else if (cond[0] == '!') {
+            excludes.push_back(Mask(cond.substr(1)));
+        } else {
+            masks.push_back(Mask(cond));
+        }
+    }
+    return true;
+}
+
+ChannelDirectory::ChannelDirectory() : _version(0), _builtAt(0), _built(false) {}
+
+static bool channelNameLess(const Channel* a, const Channel* b) {
+    return a->getName() < b->getName();
+}
+
+void ChannelDirectory::refresh(const std::set<Channel*>& channels, std::time_t now, std::time_t maxAge) {
+    if (_built && (_version == Channel::getMetadataVersion() || now - _builtAt < maxAge)) {
+        return;
+    }
+    std::vector<Channel*> sorted(channels.begin(), channels.end());
+    std::sort(sorted.begin(), sorted.end(), channelNameLess);
+
+    size_t textSize = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        textSize += sorted[i]->getName().length() + sorted[i]->getTopic().length();
+    }
+    std::string text;
+    text.reserve(textSize);
+    std::vector<Entry> entries(sorted.size());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        Entry& entry = entries[i];
+        entry.nameOffset = text.length();
+        entry.nameLength = sorted[i]->getName().length();
+        text += sorted[i]->getName();
+        entry.topicOffset = text.length();
+        entry.topicLength = sorted[i]->getTopic().length();
+        text += sorted[i]->getTopic();
+        entry.users = sorted[i]->getClientCount();
+        entry.topicTime = sorted[i]->getTopicTime();
+        entry.created = sorted[i]->getCreationTime();
+    }
+    _text.swap(text);
+    _entries.swap(entries);
+    _version = Channel::getMetadataVersion();
+    _builtAt = now;
+    _built = true;
+}
+
+size_t ChannelDirectory::size() const { return _entries.size(); }
+
+const ChannelDirectory::Entry& ChannelDirectory::at(size_t i) const { return _entries[i]; }
+
+std::string ChannelDirectory::name(size_t i) const {
+    return _text.substr(_entries[i].nameOffset, _entries[i].nameLength);
+}
+
+std::string ChannelDirectory::topic(size_t i) const {
+    return _text.substr(_entries[i].topicOffset, _entries[i].topicLength);
+}
+
+int ChannelDirectory::_compareName(size_t i, const std::string& name) const {
+    return _text.compare(_entries[i].nameOffset, _entries[i].nameLength, name);
+}
+
+size_t ChannelDirectory::upperBound(const std::string& name) const {
+    size_t low = 0;
+    size_t high = _entries.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (_compareName(mid, name) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool ChannelDirectory::accepts(size_t i, const ListFilter& filter) const {
+    const Entry& entry = _entries[i];
+    if ((filter.minUsers && entry.users < filter.minUsers) || (filter.maxUsers && entry.users >= filter.maxUsers)) {
+        return false;
+    }
+    if ((filter.topicAfter && entry.topicTime <= filter.topicAfter)
+        || (filter.topicBefore && (entry.topicTime == 0 || entry.topicTime >= filter.topicBefore))) {
+        return false;
+    }
+    if ((filter.createdAfter && entry.created <= filter.createdAfter)
+        || (filter.createdBefore && entry.created >= filter.createdBefore)) {
+        return false;
+    }
+    const char* text = _text.data() + entry.nameOffset;
+    for (size_t m = 0; m < filter.excludes.size(); ++m) {
+        if (filter.excludes[m].matches(text, entry.nameLength)) {
+            return false;
+        }
+    }
+    for (size_t m = 0; m < filter.masks.size(); ++m) {
+        if (filter.masks[m].matches(text, entry.nameLength)) {
+            return true;
+        }
+    }
+    return filter.masks.empty();
+}
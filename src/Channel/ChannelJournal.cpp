@@ -0,0 +1,497 @@
+#include "../../inc/ChannelJournal.hpp"
+#include "../../inc/Server.hpp"
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char SNAPSHOT_MAGIC[8] = { 'I', 'R', 'C', 'S', 'N', 'A', 'P', '1' };
+static const char JOURNAL_MAGIC[8] = { 'I', 'R', 'C', 'J', 'R', 'N', 'L', '1' };
+static const size_t HEADER_SIZE = 16; // magic + sequence number
+
+//encoding
+
+static void putNumber(std::string& out, unsigned long value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(std::string& out, const std::string& str) {
+    unsigned int len = static_cast<unsigned int>(str.length());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out += str;
+}
+
+//starts a record; finishRecord() patches its length once the fields are in
+static size_t beginRecord(std::string& out, ChannelJournal::RecordType type, const std::string& name) {
+    size_t start = out.length();
+    out.append(sizeof(unsigned int), '\0');
+    out += static_cast<char>(type);
+    putString(out, name);
+    return start;
+}
+
+static void finishRecord(std::string& out, size_t start) {
+    unsigned int len = static_cast<unsigned int>(out.length() - start - sizeof(unsigned int));
+    std::memcpy(&out[start], &len, sizeof(len));
+}
+
+static void header(std::string& out, const char* magic, unsigned long seq) {
+    out.append(magic, 8);
+    putNumber(out, seq);
+}
+
+//decoding, over the mapped file; any field running past the record marks it bad
+struct RecordCursor {
+    const char* pos;
+    const char* end;
+    bool ok;
+
+    unsigned long number() {
+        unsigned long value = 0;
+        if (end - pos < static_cast<long>(sizeof(value))) {
+            ok = false;
+            return 0;
+        }
+        std::memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+    std::string string() {
+        unsigned int len = 0;
+        if (end - pos < static_cast<long>(sizeof(len))) {
+            ok = false;
+            return "";
+        }
+        std::memcpy(&len, pos, sizeof(len));
+        pos += sizeof(len);
+        if (static_cast<unsigned long>(end - pos) < len) {
+            ok = false;
+            return "";
+        }
+        std::string res(pos, len);
+        pos += len;
+        return res;
+    }
+};
+
+ChannelJournal::ChannelJournal() : _journalFd(-1), _seq(0), _journalBytes(0), _snapshotThreshold(1024 * 1024),
+    _replaying(false), _open(false), _hasSnapshotJob(false), _running(false), _stopping(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_wake, NULL);
+}
+
+ChannelJournal::~ChannelJournal() {
+    close();
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool ChannelJournal::isOpen() const { return _open; }
+
+//maps a whole file read-only; an empty or missing file maps to nothing
+static const char* mapWhole(const std::string& path, size_t& len) {
+    len = 0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        ::close(fd);
+        return NULL;
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    len = st.st_size;
+    return static_cast<const char*>(addr);
+}
+
+bool ChannelJournal::open(const std::string& dir, Server& server) {
+    if (mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) {
+        LOG(LOG_ERROR, "state: cannot create " << dir << ": " << strerror(errno));
+        return false;
+    }
+    _dir = dir;
+    struct timeval start;
+    gettimeofday(&start, NULL);
+
+    //snapshot first, then the journal written after it
+    _replaying = true;
+    size_t restored = 0;
+    size_t len;
+    const char* snap = mapWhole(_dir + "/channels.snap", len);
+    if (snap && len >= HEADER_SIZE && std::memcmp(snap, SNAPSHOT_MAGIC, 8) == 0) {
+        std::memcpy(&_seq, snap + 8, sizeof(_seq));
+        _replay(server, snap + HEADER_SIZE, len - HEADER_SIZE);
+        restored = server.getChannels().size();
+    }
+    if (snap) {
+        munmap(const_cast<char*>(snap), len);
+    }
+    const char* journal = mapWhole(_dir + "/channels.journal", len);
+    unsigned long journalSeq = 0;
+    if (journal && len >= HEADER_SIZE && std::memcmp(journal, JOURNAL_MAGIC, 8) == 0) {
+        std::memcpy(&journalSeq, journal + 8, sizeof(journalSeq));
+        if (journalSeq == _seq) {
+            _replay(server, journal + HEADER_SIZE, len - HEADER_SIZE);
+        }
+    }
+    if (journal) {
+        munmap(const_cast<char*>(journal), len);
+    }
+    _replaying = false;
+
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    long micros = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+    LOG(LOG_INFO, "Restored " << server.getChannels().size() << " channels (" << restored << " from snapshot) in "
+              << micros / 1000 << "." << (micros % 1000) / 100 << " ms");
+
+    //fold what was replayed into a fresh snapshot, the journal starts empty behind it
+    std::string body;
+    const std::set<Channel*> channels = server.getChannels();
+    for (std::set<Channel*>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        _encodeChannel(body, **it);
+    }
+    _writeSnapshot(body, _seq + 1);
+    if (_journalFd == -1) {
+        return false;
+    }
+    _open = true;
+    _stopping = false;
+    _running = (pthread_create(&_thread, NULL, &ChannelJournal::_run, this) == 0);
+    if (!_running) {
+        LOG(LOG_WARN, "state: writer thread failed to start, writing from the event loop");
+    }
+    return true;
+}
+
+void ChannelJournal::close() {
+    _open = false;
+    if (_running) {
+        pthread_mutex_lock(&_mutex);
+        _stopping = true;
+        pthread_cond_signal(&_wake);
+        pthread_mutex_unlock(&_mutex);
+        pthread_join(_thread, NULL);
+        _running = false;
+    }
+    if (_journalFd != -1) {
+        _writeJournal(_pending);
+        _pending.clear();
+        ::close(_journalFd);
+        _journalFd = -1;
+    }
+}
+
+//applies records to the live channels; stops at the first torn record, which
+//is where a crash interrupted the last append
+bool ChannelJournal::_replay(Server& server, const char* data, size_t len) {
+    const char* pos = data;
+    const char* end = data + len;
+    while (end - pos >= static_cast<long>(sizeof(unsigned int)) + 1) {
+        unsigned int recordLen;
+        std::memcpy(&recordLen, pos, sizeof(recordLen));
+        if (static_cast<unsigned long>(end - pos - sizeof(recordLen)) < recordLen || recordLen == 0) {
+            return false;
+        }
+        RecordCursor cur = { pos + sizeof(recordLen) + 1, pos + sizeof(recordLen) + recordLen, true };
+        RecordType type = static_cast<RecordType>(static_cast<unsigned char>(pos[sizeof(recordLen)]));
+        pos += sizeof(recordLen) + recordLen;
+
+        std::string name = cur.string();
+        if (!cur.ok) {
+            return false;
+        }
+        if (type == REC_CREATE) {
+            std::time_t created = static_cast<std::time_t>(cur.number());
+            if (cur.ok) {
+                server.getOrCreateChannel(name)->restoreCreationTime(created);
+            }
+            continue;
+        }
+        if (type == REC_DROP) {
+            server.removeChannel(name);
+            continue;
+        }
+        Channel* channel = server.getChannel(name);
+        if (channel == NULL) {
+            continue;
+        }
+        switch (type) {
+            case REC_TOPIC: {
+                std::string topic = cur.string();
+                std::time_t when = static_cast<std::time_t>(cur.number());
+                if (cur.ok) {
+                    channel->restoreTopic(topic, when);
+                }
+                break;
+            }
+            case REC_FLAGS: {
+                bool inviteOnly = cur.number() != 0;
+                bool topicLock = cur.number() != 0;
+                size_t limit = cur.number();
+                size_t historyLength = cur.number();
+                if (cur.ok) {
+                    channel->setInviteOnly(inviteOnly);
+                    channel->setTopicLock(topicLock);
+                    channel->setUserLimit(limit);
+                    channel->setHistoryLength(historyLength);
+                }
+                break;
+            }
+            case REC_KEY: {
+                std::string key = cur.string();
+                if (cur.ok) {
+                    if (key.empty()) {
+                        channel->removePassword();
+                    } else {
+                        channel->setPassword(key);
+                    }
+                }
+                break;
+            }
+            case REC_LIST: {
+                char mode = static_cast<char>(cur.number());
+                std::string mask = cur.string();
+                std::string setter = cur.string();
+                std::time_t setAt = static_cast<std::time_t>(cur.number());
+                bool on = cur.number() != 0;
+                if (cur.ok && on) {
+                    channel->restoreListEntry(mode, mask, setter, setAt);
+                } else if (cur.ok) {
+                    channel->removeListEntry(mode, mask);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return pos == end;
+}
+
+//a channel as the records that recreate it
+void ChannelJournal::_encodeChannel(std::string& out, const Channel& channel) {
+    size_t rec = beginRecord(out, REC_CREATE, channel.getName());
+    putNumber(out, static_cast<unsigned long>(channel.getCreationTime()));
+    finishRecord(out, rec);
+    if (channel.getTopicTime() != 0) {
+        rec = beginRecord(out, REC_TOPIC, channel.getName());
+        putString(out, channel.getTopic());
+        putNumber(out, static_cast<unsigned long>(channel.getTopicTime()));
+        finishRecord(out, rec);
+    }
+    rec = beginRecord(out, REC_FLAGS, channel.getName());
+    putNumber(out, channel.isInviteOnly());
+    putNumber(out, channel.isTopicLocked());
+    putNumber(out, channel.getUserLimit());
+    putNumber(out, channel.getHistoryLength());
+    finishRecord(out, rec);
+    if (channel.hasPassword()) {
+        rec = beginRecord(out, REC_KEY, channel.getName());
+        putString(out, channel.getPassword());
+        finishRecord(out, rec);
+    }
+    static const char modes[] = { 'b', 'e', 'I' };
+    for (size_t m = 0; m < sizeof(modes); ++m) {
+        const std::vector<MaskSet::Entry*>& entries = channel.getList(modes[m]).getEntries();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            rec = beginRecord(out, REC_LIST, channel.getName());
+            putNumber(out, static_cast<unsigned long>(modes[m]));
+            putString(out, entries[i]->mask.getPattern());
+            putString(out, entries[i]->setter);
+            putNumber(out, static_cast<unsigned long>(entries[i]->setAt));
+            putNumber(out, 1);
+            finishRecord(out, rec);
+        }
+    }
+}
+
+//snapshot.tmp is synced before it replaces the old snapshot; the journal is
+//reset behind it only then, tagged with the new sequence
+void ChannelJournal::_writeSnapshot(const std::string& body, unsigned long seq) {
+    std::string tmpPath = _dir + "/channels.snap.tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1) {
+        fchmod(fd, 0600); // files from before they were made private
+    }
+    std::string head;
+    header(head, SNAPSHOT_MAGIC, seq);
+    bool ok = fd != -1
+        && write(fd, head.data(), head.size()) == static_cast<ssize_t>(head.size())
+        && write(fd, body.data(), body.size()) == static_cast<ssize_t>(body.size())
+        && fdatasync(fd) == 0;
+    if (fd != -1) {
+        ::close(fd);
+    }
+    if (!ok || rename(tmpPath.c_str(), (_dir + "/channels.snap").c_str()) == -1) {
+        LOG(LOG_ERROR, "state: snapshot failed: " << strerror(errno));
+        unlink(tmpPath.c_str());
+        if (_journalFd != -1) {
+            return; // keep appending to the journal that follows the old snapshot
+        }
+    }
+    if (_journalFd != -1) {
+        ::close(_journalFd);
+    }
+    _journalFd = ::open((_dir + "/channels.journal").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (_journalFd == -1) {
+        LOG(LOG_ERROR, "state: cannot open journal: " << strerror(errno));
+        return;
+    }
+    fchmod(_journalFd, 0600);
+    _seq = ok ? seq : _seq;
+    head.clear();
+    header(head, JOURNAL_MAGIC, _seq);
+    if (write(_journalFd, head.data(), head.size()) != static_cast<ssize_t>(head.size()) || fdatasync(_journalFd) == -1) {
+        LOG(LOG_ERROR, "state: cannot write journal: " << strerror(errno));
+    }
+}
+
+void ChannelJournal::_writeJournal(const std::string& records) {
+    if (records.empty() || _journalFd == -1) {
+        return;
+    }
+    if (write(_journalFd, records.data(), records.size()) != static_cast<ssize_t>(records.size())
+        || fdatasync(_journalFd) == -1) {
+        LOG(LOG_ERROR, "state: journal write failed: " << strerror(errno));
+    }
+}
+
+void* ChannelJournal::_run(void* self) {
+    static_cast<ChannelJournal*>(self)->_loop();
+    return NULL;
+}
+
+//one batch every 200ms: a pending snapshot goes first, then the records
+//appended after it was taken
+void ChannelJournal::_loop() {
+    std::string records;
+    std::string snapshot;
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        if (!_stopping) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            unsigned long usec = now.tv_usec + 200000UL;
+            deadline.tv_sec = now.tv_sec + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            pthread_cond_timedwait(&_wake, &_mutex, &deadline);
+        }
+        records.swap(_pending);
+        bool writeSnapshot = _hasSnapshotJob;
+        snapshot.swap(_snapshotJob);
+        _hasSnapshotJob = false;
+        bool stopping = _stopping;
+        unsigned long seq = _seq + 1;
+        pthread_mutex_unlock(&_mutex);
+
+        if (writeSnapshot) {
+            _writeSnapshot(snapshot, seq);
+            snapshot.clear();
+        }
+        _writeJournal(records);
+        records.clear();
+        if (stopping) {
+            return;
+        }
+        pthread_mutex_lock(&_mutex);
+    }
+}
+
+void ChannelJournal::_append(const std::string& record) {
+    if (_replaying || !_open) {
+        return;
+    }
+    _journalBytes += record.size();
+    if (!_running) {
+        _writeJournal(record);
+        return;
+    }
+    pthread_mutex_lock(&_mutex);
+    _pending += record;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void ChannelJournal::maybeSnapshot(const std::set<Channel*>& channels) {
+    if (_journalBytes < _snapshotThreshold || !_open) {
+        return;
+    }
+    std::string body;
+    for (std::set<Channel*>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        _encodeChannel(body, **it);
+    }
+    _journalBytes = 0;
+    if (!_running) {
+        _writeSnapshot(body, _seq + 1);
+        return;
+    }
+    //records pending now are already in this snapshot, the new journal must not repeat them
+    pthread_mutex_lock(&_mutex);
+    _pending.clear();
+    _snapshotJob.swap(body);
+    _hasSnapshotJob = true;
+    pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void ChannelJournal::recordCreate(const Channel& channel) {
+    if (_replaying) {
+        return;
+    }
+    std::string out;
+    _encodeChannel(out, channel);
+    _append(out);
+}
+
+void ChannelJournal::recordDrop(const std::string& name) {
+    std::string out;
+    finishRecord(out, beginRecord(out, REC_DROP, name));
+    _append(out);
+}
+
+void ChannelJournal::recordTopic(const Channel& channel) {
+    std::string out;
+    size_t rec = beginRecord(out, REC_TOPIC, channel.getName());
+    putString(out, channel.getTopic());
+    putNumber(out, static_cast<unsigned long>(channel.getTopicTime()));
+    finishRecord(out, rec);
+    _append(out);
+}
+
+void ChannelJournal::recordFlags(const Channel& channel) {
+    std::string out;
+    size_t rec = beginRecord(out, REC_FLAGS, channel.getName());
+    putNumber(out, channel.isInviteOnly());
+    putNumber(out, channel.isTopicLocked());
+    putNumber(out, channel.getUserLimit());
+    putNumber(out, channel.getHistoryLength());
+    finishRecord(out, rec);
+    _append(out);
+}
+
+void ChannelJournal::recordKey(const Channel& channel) {
+    std::string out;
+    size_t rec = beginRecord(out, REC_KEY, channel.getName());
+    putString(out, channel.hasPassword() ? channel.getPassword() : std::string());
+    finishRecord(out, rec);
+    _append(out);
+}
+
+void ChannelJournal::recordListEntry(const Channel& channel, char mode, const std::string& mask,
+                                     const std::string& setter, std::time_t setAt, bool on) {
+    std::string out;
+    size_t rec = beginRecord(out, REC_LIST, channel.getName());
+    putNumber(out, static_cast<unsigned long>(mode));
+    putString(out, mask);
+    putString(out, setter);
+    putNumber(out, static_cast<unsigned long>(setAt));
+    putNumber(out, on);
+    finishRecord(out, rec);
+    _append(out);
+}
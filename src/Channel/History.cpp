@@ -0,0 +1,186 @@
+#include "../../inc/History.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+
+size_t ChannelHistory::_totalBytes = 0;
+size_t ChannelHistory::_memoryCap = 16 * 1024 * 1024;
+unsigned long ChannelHistory::_lastMsgId = 0;
+unsigned long ChannelHistory::_serials = 0;
+size_t ChannelHistory::_entries = 0;
+std::deque<ChannelHistory::Recorded> ChannelHistory::_order;
+std::set<const ChannelHistory*> ChannelHistory::_live;
+
+const size_t ChannelHistory::MAX_CAPACITY;
+
+ChannelHistory::ChannelHistory(size_t capacity) : _head(0), _count(0), _bytes(0), _serial(++_serials) {
+    _live.insert(this);
+    setCapacity(capacity);
+}
+
+ChannelHistory::~ChannelHistory() {
+    _totalBytes -= _bytes;
+    _entries -= _count;
+    _live.erase(this);
+}
+
+//the line is shared with the broadcast, but once that went out the ring
+//holds the last reference
+size_t ChannelHistory::_cost(const HistoryEntry& entry) {
+    return entry.line.size() + sizeof(HistoryEntry) + SharedBuffer::BLOCK_OVERHEAD;
+}
+
+void ChannelHistory::_dropOldest() {
+    HistoryEntry& oldest = _ring[_head];
+    _bytes -= _cost(oldest);
+    _totalBytes -= _cost(oldest);
+    oldest.line = SharedBuffer();
+    _head = (_head + 1) % _ring.size();
+    --_count;
+    --_entries;
+}
+
+//a ring's entries are sorted by msgid, it still has this one if its oldest is not newer
+bool ChannelHistory::_holds(const Recorded& recorded) {
+    const ChannelHistory* ring = recorded.ring;
+    return _live.count(ring) != 0 && ring->_serial == recorded.serial && ring->_count != 0
+        && ring->at(0).msgid <= recorded.msgid;
+}
+
+void ChannelHistory::_evict() {
+    while (_totalBytes > _memoryCap && !_order.empty()) {
+        const Recorded& oldest = _order.front();
+        if (_holds(oldest)) {
+            //restored entries may be queued after newer ones, the ring's oldest goes first
+            bool reached = oldest.ring->at(0).msgid == oldest.msgid;
+            oldest.ring->_dropOldest();
+            if (!reached) {
+                continue;
+            }
+        }
+        _order.pop_front();
+    }
+    //entries the rings dropped on their own pile up behind a long lived one
+    if (_order.size() > 2 * _entries + 64) {
+        std::deque<Recorded> kept;
+        for (size_t i = 0; i < _order.size(); ++i) {
+            if (_holds(_order[i])) {
+                kept.push_back(_order[i]);
+            }
+        }
+        _order.swap(kept);
+    }
+}
+
+void ChannelHistory::setCapacity(size_t capacity) {
+    capacity = std::min(capacity, MAX_CAPACITY);
+    if (capacity == _ring.size()) {
+        return;
+    }
+    while (_count > capacity) {
+        _dropOldest();
+    }
+    std::vector<HistoryEntry> ring(capacity);
+    for (size_t i = 0; i < _count; ++i) {
+        ring[i] = at(i);
+    }
+    _ring.swap(ring);
+    _head = 0;
+}
+
+size_t ChannelHistory::getCapacity() const { return _ring.size(); }
+
+size_t ChannelHistory::size() const { return _count; }
+
+const HistoryEntry& ChannelHistory::at(size_t i) const {
+    return _ring[(_head + i) % _ring.size()];
+}
+
+void ChannelHistory::read(size_t i, HistoryEntry& out) const {
+    out = at(i);
+}
+
+size_t ChannelHistory::lowerBound(unsigned long key, bool byTime) const {
+    size_t low = 0;
+    size_t high = _count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        unsigned long value = byTime ? at(mid).timeMs : at(mid).msgid;
+        if (value < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t ChannelHistory::upperBound(unsigned long key, bool byTime) const {
+    return (key == static_cast<unsigned long>(-1)) ? _count : lowerBound(key + 1, byTime);
+}
+
+//msgids are the time in milliseconds shifted by 10 bits plus a counter, so they
+//stay unique and increasing across restarts as long as the clock does
+HistoryEntry ChannelHistory::record(const SharedBuffer& line, unsigned long timeMs) {
+    HistoryEntry entry;
+    entry.msgid = std::max(_lastMsgId + 1, timeMs << 10);
+    entry.timeMs = timeMs;
+    entry.line = line;
+    restore(entry);
+    return entry;
+}
+
+void ChannelHistory::restore(const HistoryEntry& entry) {
+    _lastMsgId = std::max(_lastMsgId, entry.msgid);
+    if (_ring.empty()) {
+        return;
+    }
+    if (_count == _ring.size()) {
+        _dropOldest();
+    }
+    _ring[(_head + _count) % _ring.size()] = entry;
+    ++_count;
+    ++_entries;
+    _bytes += _cost(entry);
+    _totalBytes += _cost(entry);
+    Recorded recorded = { this, _serial, entry.msgid };
+    _order.push_back(recorded);
+    _evict();
+}
+
+std::string ChannelHistory::formatTime(unsigned long timeMs) {
+    std::time_t seconds = static_cast<std::time_t>(timeMs / 1000);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    char buf[32];
+    size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(buf + len, sizeof(buf) - len, ".%03luZ", timeMs % 1000);
+    return buf;
+}
+
+bool ChannelHistory::parseTime(const std::string& str, unsigned long& timeMs) {
+    struct tm utc;
+    unsigned int millis = 0;
+    std::memset(&utc, 0, sizeof(utc));
+    int parsed = std::sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3uZ", &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+                             &utc.tm_hour, &utc.tm_min, &utc.tm_sec, &millis);
+    if (parsed < 6) {
+        return false;
+    }
+    utc.tm_year -= 1900;
+    utc.tm_mon -= 1;
+    std::time_t seconds = timegm(&utc);
+    if (seconds < 0) {
+        return false;
+    }
+    timeMs = static_cast<unsigned long>(seconds) * 1000 + millis;
+    return true;
+}
+
+void ChannelHistory::setMemoryCap(size_t bytes) {
+    _memoryCap = bytes;
+    _evict();
+}
+
+size_t ChannelHistory::getTotalBytes() { return _totalBytes; }
@@ -0,0 +1,497 @@
+#include "../../inc/HistoryStore.hpp"
+#include "../../inc/Clock.hpp"
+#include "../../inc/HistorySyncer.hpp"
+#include "../../inc/Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool HistoryCatalog::scan(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        LOG(LOG_ERROR, "history: cannot create " << dir << ": " << strerror(errno));
+        return false;
+    }
+    DIR* handle = opendir(dir.c_str());
+    if (handle == NULL) {
+        LOG(LOG_ERROR, "history: cannot read " << dir << ": " << strerror(errno));
+        return false;
+    }
+    _dir = dir;
+    _segments.clear();
+    while (struct dirent* ent = readdir(handle)) {
+        std::string name = ent->d_name;
+        std::string::size_type dash = name.rfind('-');
+        if (name.length() > 4 && name.compare(name.length() - 4, 4, ".tmp") == 0) {
+            unlink((dir + "/" + name).c_str()); // a merge a crash interrupted
+        } else if (dash != std::string::npos && name.length() > 4 && name.compare(name.length() - 4, 4, ".idx") == 0) {
+            _segments[name.substr(0, dash)].push_back(std::strtoul(name.c_str() + dash + 1, NULL, 10));
+        }
+    }
+    closedir(handle);
+    for (std::map<std::string, std::vector<unsigned long> >::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+        std::sort(it->second.begin(), it->second.end());
+    }
+    return true;
+}
+
+bool HistoryCatalog::isOpen() const { return !_dir.empty(); }
+
+const std::string& HistoryCatalog::getDir() const { return _dir; }
+
+std::vector<unsigned long> HistoryCatalog::take(const std::string& prefix) {
+    std::vector<unsigned long> seqs;
+    std::map<std::string, std::vector<unsigned long> >::iterator it = _segments.find(prefix);
+    if (it != _segments.end()) {
+        seqs.swap(it->second);
+        _segments.erase(it);
+    }
+    return seqs;
+}
+
+void HistoryCatalog::put(const std::string& prefix, const std::vector<unsigned long>& seqs) {
+    if (!seqs.empty()) {
+        _segments[prefix] = seqs;
+    }
+}
+
+HistoryStore::HistoryStore(HistoryCatalog& catalog, const std::string& prefix, const Limits& limits, HistorySyncer* syncer)
+    : _catalog(&catalog), _prefix(prefix), _limits(limits), _syncer(syncer), _count(0), _failed(false) {}
+
+//segments with nothing in them are deleted, the rest go back to the catalog
+//for the next time the channel is created; a merge still running finishes on
+//its own, _load() sorts out whichever state it leaves
+HistoryStore::~HistoryStore() {
+    if (!_mergeBase.empty() && _syncer) {
+        _syncer->forgetMerge(_mergeBase);
+    }
+    std::vector<unsigned long> kept;
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        _unmap(_segments[i]);
+        _seal(_segments[i]);
+        if (_segments[i].count == 0) {
+            unlink((_segments[i].base + ".idx").c_str());
+            unlink((_segments[i].base + ".log").c_str());
+        } else {
+            kept.push_back(_segments[i].seq);
+        }
+    }
+    _catalog->put(_prefix, kept);
+}
+
+//channel names may hold anything a file name may not, hex keeps them safe
+static std::string hexName(const std::string& name) {
+    static const char digits[] = "0123456789abcdef";
+    std::string res;
+    for (size_t i = 0; i < name.length(); ++i) {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        res += digits[c >> 4];
+        res += digits[c & 15];
+    }
+    return res;
+}
+
+static std::string segmentBase(const std::string& dir, const std::string& prefix, unsigned long seq) {
+    char num[24];
+    std::snprintf(num, sizeof(num), "%08lu", seq);
+    return dir + "/" + prefix + "-" + num;
+}
+
+static size_t fileSize(const std::string& path) {
+    struct stat st;
+    return (stat(path.c_str(), &st) == 0) ? static_cast<size_t>(st.st_size) : 0;
+}
+
+HistoryStore* HistoryStore::open(HistoryCatalog& catalog, const std::string& channel,
+                                 const Limits& limits, HistorySyncer* syncer) {
+    HistoryStore* store = new HistoryStore(catalog, hexName(channel), limits, syncer);
+    store->_load(catalog.take(store->_prefix));
+    store->compact(Clock::wallMs());
+    return store;
+}
+
+//maps a segment as found on disk and drops index records a crash left
+//without their line; logBytes ends up where the last indexed line ends
+void HistoryStore::_trim(Segment& segment) {
+    segment.count = fileSize(segment.base + ".idx") / sizeof(IndexRecord);
+    segment.logBytes = fileSize(segment.base + ".log");
+    size_t logEnd = 0;
+    if (segment.count != 0 && _map(segment)) {
+        while (segment.count > 0) {
+            const IndexRecord& last = segment.index[segment.count - 1];
+            if (last.offset + last.length <= segment.logBytes) {
+                logEnd = last.offset + last.length;
+                break;
+            }
+            --segment.count;
+        }
+    } else {
+        segment.count = 0;
+    }
+    _unmap(segment);
+    segment.logBytes = logEnd;
+}
+
+//takes the channel's segments from the catalog, oldest first. A segment whose
+//lines all sit in the one before it is what a crash between the two steps of
+//a merge leaves behind, it is deleted
+void HistoryStore::_load(const std::vector<unsigned long>& seqs) {
+    unsigned long lastMsgid = 0;
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        Segment segment;
+        segment.seq = seqs[i];
+        segment.base = segmentBase(_catalog->getDir(), _prefix, seqs[i]);
+        segment.logFd = -1;
+        segment.idxFd = -1;
+        segment.index = NULL;
+        segment.indexMapped = 0;
+        segment.log = NULL;
+        segment.logMapped = 0;
+        _trim(segment);
+        if (segment.count != 0 && (!_map(segment) || segment.index[segment.count - 1].msgid <= lastMsgid)) {
+            segment.count = 0;
+        }
+        if (segment.count == 0) {
+            _unmap(segment);
+            unlink((segment.base + ".idx").c_str());
+            unlink((segment.base + ".log").c_str());
+            continue;
+        }
+        lastMsgid = segment.index[segment.count - 1].msgid;
+        _segments.push_back(segment);
+    }
+    _reindex();
+}
+
+bool HistoryStore::_openForAppend(Segment& segment) {
+    segment.logFd = ::open((segment.base + ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    segment.idxFd = ::open((segment.base + ".idx").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (segment.logFd == -1 || segment.idxFd == -1) {
+        LOG(LOG_ERROR, "history: cannot open " << segment.base << ": " << strerror(errno));
+        _seal(segment);
+        return false;
+    }
+    //cut what a crash left half written, appends then continue from clean ends
+    _unmap(segment);
+    if (ftruncate(segment.idxFd, segment.count * sizeof(IndexRecord)) == -1
+        || ftruncate(segment.logFd, segment.logBytes) == -1) {
+        LOG(LOG_ERROR, "history: cannot repair " << segment.base << ": " << strerror(errno));
+    }
+    return true;
+}
+
+bool HistoryStore::_startSegment(unsigned long seq) {
+    Segment segment;
+    segment.seq = seq;
+    segment.base = segmentBase(_catalog->getDir(), _prefix, seq);
+    segment.count = 0;
+    segment.logBytes = 0;
+    segment.index = NULL;
+    segment.indexMapped = 0;
+    segment.log = NULL;
+    segment.logMapped = 0;
+    if (!_openForAppend(segment)) {
+        return false;
+    }
+    _segments.push_back(segment);
+    _reindex();
+    return true;
+}
+
+//the write descriptors go to the syncer for a last fdatasync and close
+void HistoryStore::_seal(Segment& segment) {
+    int fds[2] = { segment.logFd, segment.idxFd };
+    for (int i = 0; i < 2; ++i) {
+        if (fds[i] == -1) {
+            continue;
+        }
+        if (_syncer) {
+            _syncer->closeLater(fds[i]);
+        } else {
+            close(fds[i]);
+        }
+    }
+    segment.logFd = -1;
+    segment.idxFd = -1;
+}
+
+void HistoryStore::_unmap(const Segment& segment) {
+    if (segment.index) {
+        munmap(const_cast<IndexRecord*>(segment.index), segment.indexMapped * sizeof(IndexRecord));
+    }
+    if (segment.log) {
+        munmap(const_cast<char*>(segment.log), segment.logMapped);
+    }
+    segment.index = NULL;
+    segment.indexMapped = 0;
+    segment.log = NULL;
+    segment.logMapped = 0;
+}
+
+static const void* mapFile(const std::string& path, size_t bytes) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    void* addr = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file
+    return (addr == MAP_FAILED) ? NULL : addr;
+}
+
+//(re)maps a segment when records were appended since the last mapping
+bool HistoryStore::_map(const Segment& segment) {
+    if (segment.index && segment.indexMapped == segment.count && segment.logMapped == segment.logBytes) {
+        return true;
+    }
+    _unmap(segment);
+    if (segment.count == 0) {
+        return false;
+    }
+    segment.index = static_cast<const IndexRecord*>(mapFile(segment.base + ".idx", segment.count * sizeof(IndexRecord)));
+    segment.log = segment.logBytes ? static_cast<const char*>(mapFile(segment.base + ".log", segment.logBytes)) : NULL;
+    if (segment.index == NULL || (segment.logBytes && segment.log == NULL)) {
+        _unmap(segment);
+        return false;
+    }
+    segment.indexMapped = segment.count;
+    segment.logMapped = segment.logBytes;
+    return true;
+}
+
+void HistoryStore::_reindex() {
+    _starts.resize(_segments.size());
+    _count = 0;
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        _starts[i] = _count;
+        _count += _segments[i].count;
+    }
+}
+
+//the newest segment is opened here the first time, and a new one started
+//here once the previous one was sealed full
+void HistoryStore::append(const HistoryEntry& entry) {
+    if (_failed) {
+        return;
+    }
+    if (!_mergeBase.empty()) {
+        bool ok;
+        if (_syncer->takeMerged(_mergeBase, ok)) {
+            _finishMerge(ok);
+        }
+    }
+    if (_segments.empty() || _segments.back().logBytes >= _limits.segmentBytes) {
+        if (!_startSegment(_segments.empty() ? 1 : _segments.back().seq + 1)) {
+            _failed = true;
+            return;
+        }
+    } else if (_segments.back().logFd == -1 && !_openForAppend(_segments.back())) {
+        _failed = true;
+        return;
+    }
+    Segment& segment = _segments.back();
+    const std::string& line = entry.line.data();
+    IndexRecord record;
+    record.msgid = entry.msgid;
+    record.timeMs = entry.timeMs;
+    record.offset = segment.logBytes;
+    record.length = line.size();
+    if (write(segment.logFd, line.data(), line.size()) != static_cast<ssize_t>(line.size())
+        || write(segment.idxFd, &record, sizeof(record)) != static_cast<ssize_t>(sizeof(record))) {
+        LOG(LOG_ERROR, "history: write to " << segment.base << " failed, persistence stopped: " << strerror(errno));
+        _failed = true;
+        return;
+    }
+    segment.logBytes += line.size();
+    ++segment.count;
+    ++_count;
+    if (_syncer) {
+        _syncer->markDirty(segment.logFd);
+        _syncer->markDirty(segment.idxFd);
+    }
+    if (segment.logBytes >= _limits.segmentBytes) {
+        _seal(segment);
+        compact(entry.timeMs);
+    }
+}
+
+size_t HistoryStore::size() const { return _count; }
+
+size_t HistoryStore::_segmentOf(size_t i) const {
+    return std::upper_bound(_starts.begin(), _starts.end(), i) - _starts.begin() - 1;
+}
+
+unsigned long HistoryStore::_keyAt(size_t i, bool byTime) const {
+    const Segment& segment = _segments[_segmentOf(i)];
+    if (!_map(segment)) {
+        return 0;
+    }
+    const IndexRecord& record = segment.index[i - _starts[_segmentOf(i)]];
+    return byTime ? record.timeMs : record.msgid;
+}
+
+//binary search over the logical index; keys grow across segments as well
+size_t HistoryStore::lowerBound(unsigned long key, bool byTime) const {
+    size_t low = 0;
+    size_t high = _count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (_keyAt(mid, byTime) < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t HistoryStore::upperBound(unsigned long key, bool byTime) const {
+    return (key == static_cast<unsigned long>(-1)) ? _count : lowerBound(key + 1, byTime);
+}
+
+void HistoryStore::read(size_t i, HistoryEntry& out) const {
+    size_t s = _segmentOf(i);
+    const Segment& segment = _segments[s];
+    if (!_map(segment)) {
+        out = HistoryEntry();
+        return;
+    }
+    const IndexRecord& record = segment.index[i - _starts[s]];
+    out.msgid = record.msgid;
+    out.timeMs = record.timeMs;
+    out.line = SharedBuffer(std::string(segment.log + record.offset, record.length));
+}
+
+void HistoryStore::_removeSegment(size_t i) {
+    _unmap(_segments[i]);
+    _seal(_segments[i]);
+    unlink((_segments[i].base + ".idx").c_str());
+    unlink((_segments[i].base + ".log").c_str());
+    _segments.erase(_segments.begin() + i);
+}
+
+//Copies segment second onto the end of segment first through temporary
+//files, synced before they are renamed over first's, then deletes second.
+//A crash part way is repaired by the next load: a log renamed without its
+//index only has unindexed bytes at the end, and a second segment still there
+//after first took its lines is dropped as a duplicate.
+bool HistoryStore::mergeFiles(const std::string& first, const std::string& second) {
+    Segment a;
+    Segment b;
+    a.base = first;
+    b.base = second;
+    a.index = b.index = NULL;
+    a.indexMapped = b.indexMapped = 0;
+    a.log = b.log = NULL;
+    a.logMapped = b.logMapped = 0;
+    _trim(a);
+    _trim(b);
+    if (a.count == 0 || b.count == 0 || !_map(a) || !_map(b)) {
+        _unmap(a);
+        _unmap(b);
+        return false;
+    }
+    std::string tmpLog = first + ".log.tmp";
+    std::string tmpIdx = first + ".idx.tmp";
+    FILE* log = std::fopen(tmpLog.c_str(), "wb");
+    FILE* idx = std::fopen(tmpIdx.c_str(), "wb");
+    bool ok = log && idx;
+    if (ok) {
+        ok = std::fwrite(a.log, 1, a.logBytes, log) == a.logBytes
+            && std::fwrite(b.log, 1, b.logBytes, log) == b.logBytes
+            && std::fwrite(a.index, sizeof(IndexRecord), a.count, idx) == a.count;
+        for (size_t r = 0; ok && r < b.count; ++r) {
+            IndexRecord moved = b.index[r];
+            moved.offset += a.logBytes;
+            ok = std::fwrite(&moved, sizeof(moved), 1, idx) == 1;
+        }
+    }
+    _unmap(a);
+    _unmap(b);
+    ok = (log && std::fflush(log) == 0 && fdatasync(fileno(log)) == 0 && ok);
+    ok = (idx && std::fflush(idx) == 0 && fdatasync(fileno(idx)) == 0 && ok);
+    if (log) {
+        std::fclose(log);
+    }
+    if (idx) {
+        std::fclose(idx);
+    }
+    //the log goes first: until the index is swapped too the old index still fits it
+    if (!ok || rename(tmpLog.c_str(), (first + ".log").c_str()) == -1) {
+        LOG(LOG_ERROR, "history: merge into " << first << " failed: " << strerror(errno));
+        unlink(tmpLog.c_str());
+        unlink(tmpIdx.c_str());
+        return false;
+    }
+    if (rename(tmpIdx.c_str(), (first + ".idx").c_str()) == -1) {
+        LOG(LOG_ERROR, "history: merge into " << first << " failed: " << strerror(errno));
+        unlink(tmpIdx.c_str());
+        return false;
+    }
+    unlink((second + ".idx").c_str());
+    unlink((second + ".log").c_str());
+    return true;
+}
+
+//Both segments stay mapped while the merge runs: the files may be replaced
+//or deleted under them, the mappings keep the old ones readable. Without a
+//syncer thread the merge runs right here.
+void HistoryStore::_startMerge(size_t first) {
+    if (!_map(_segments[first]) || !_map(_segments[first + 1])) {
+        return;
+    }
+    _mergeBase = _segments[first].base;
+    if (_syncer && _syncer->mergeLater(_segments[first].base, _segments[first + 1].base)) {
+        return;
+    }
+    _finishMerge(mergeFiles(_segments[first].base, _segments[first + 1].base));
+}
+
+//takes the finished merge into the segment list
+void HistoryStore::_finishMerge(bool ok) {
+    size_t first = 0;
+    while (first < _segments.size() && _segments[first].base != _mergeBase) {
+        ++first;
+    }
+    _mergeBase.clear();
+    if (!ok || first + 1 >= _segments.size()) {
+        return;
+    }
+    Segment& a = _segments[first];
+    Segment& b = _segments[first + 1];
+    _unmap(a);
+    a.count += b.count;
+    a.logBytes += b.logBytes;
+    _unmap(b);
+    _segments.erase(_segments.begin() + first + 1);
+    _reindex();
+}
+
+//one merge at a time, and nothing is dropped while it runs since it holds
+//segment indexes
+void HistoryStore::compact(unsigned long nowMs) {
+    if (!_mergeBase.empty()) {
+        bool ok;
+        if (!_syncer->takeMerged(_mergeBase, ok)) {
+            return;
+        }
+        _finishMerge(ok);
+    }
+    //only sealed segments are touched, the last one may still be written
+    while (_segments.size() > 1 && _limits.retentionMs && _map(_segments[0])
+           && _segments[0].index[_segments[0].count - 1].timeMs + _limits.retentionMs < nowMs) {
+        _removeSegment(0);
+    }
+    for (size_t i = 0; i + 2 < _segments.size(); ++i) {
+        if (_segments[i].logBytes + _segments[i + 1].logBytes <= _limits.segmentBytes) {
+            _startMerge(i);
+            break;
+        }
+    }
+    _reindex();
+}
@@ -0,0 +1,168 @@
+#include "../../inc/HistorySyncer.hpp"
+#include "../../inc/HistoryStore.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <sys/time.h>
+#include <unistd.h>
+
+HistorySyncer::HistorySyncer() : _intervalMs(1000), _running(false), _stopping(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_wake, NULL);
+}
+
+HistorySyncer::~HistorySyncer() {
+    stop();
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool HistorySyncer::start(unsigned int intervalMs) {
+    if (_running) {
+        return true;
+    }
+    _intervalMs = intervalMs;
+    _stopping = false;
+    _running = (pthread_create(&_thread, NULL, &HistorySyncer::_run, this) == 0);
+    return _running;
+}
+
+void HistorySyncer::stop() {
+    if (_running) {
+        pthread_mutex_lock(&_mutex);
+        _stopping = true;
+        pthread_cond_signal(&_wake);
+        pthread_mutex_unlock(&_mutex);
+        pthread_join(_thread, NULL);
+        _running = false;
+    }
+    //whatever is left (or everything, if the thread never ran) is finished here
+    for (size_t i = 0; i < _closing.size(); ++i) {
+        fdatasync(_closing[i]);
+        close(_closing[i]);
+    }
+    _closing.clear();
+    _dirty.clear();
+    _merges.clear();
+    _merged.clear();
+    _forgotten.clear();
+}
+
+void HistorySyncer::markDirty(int fd) {
+    pthread_mutex_lock(&_mutex);
+    if (std::find(_dirty.begin(), _dirty.end(), fd) == _dirty.end()) {
+        _dirty.push_back(fd);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void HistorySyncer::closeLater(int fd) {
+    if (!_running) {
+        fdatasync(fd);
+        close(fd);
+        return;
+    }
+    pthread_mutex_lock(&_mutex);
+    _closing.push_back(fd);
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool HistorySyncer::mergeLater(const std::string& first, const std::string& second) {
+    if (!_running) {
+        return false;
+    }
+    pthread_mutex_lock(&_mutex);
+    _merges.push_back(std::make_pair(first, second));
+    pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+bool HistorySyncer::takeMerged(const std::string& first, bool& ok) {
+    bool found = false;
+    pthread_mutex_lock(&_mutex);
+    for (size_t i = 0; i < _merged.size(); ++i) {
+        if (_merged[i].first == first) {
+            ok = _merged[i].second;
+            _merged.erase(_merged.begin() + i);
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+    return found;
+}
+
+void HistorySyncer::forgetMerge(const std::string& first) {
+    pthread_mutex_lock(&_mutex);
+    bool done = false;
+    for (size_t i = 0; i < _merged.size() && !done; ++i) {
+        if (_merged[i].first == first) {
+            _merged.erase(_merged.begin() + i);
+            done = true;
+        }
+    }
+    if (!done) {
+        _forgotten.push_back(first);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void* HistorySyncer::_run(void* self) {
+    static_cast<HistorySyncer*>(self)->_loop();
+    return NULL;
+}
+
+//takes the pending lists under the lock and syncs without it, so markDirty()
+//never waits for the disk
+void HistorySyncer::_loop() {
+    std::vector<int> dirty;
+    std::vector<int> closing;
+    std::vector<std::pair<std::string, std::string> > merges;
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        if (!_stopping && _merges.empty()) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            unsigned long usec = now.tv_usec + (_intervalMs % 1000) * 1000UL;
+            deadline.tv_sec = now.tv_sec + _intervalMs / 1000 + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            pthread_cond_timedwait(&_wake, &_mutex, &deadline);
+        }
+        dirty.swap(_dirty);
+        closing.swap(_closing);
+        merges.swap(_merges);
+        bool stopping = _stopping;
+        pthread_mutex_unlock(&_mutex);
+
+        for (size_t i = 0; i < dirty.size(); ++i) {
+            if (std::find(closing.begin(), closing.end(), dirty[i]) == closing.end()) {
+                fdatasync(dirty[i]);
+            }
+        }
+        for (size_t i = 0; i < closing.size(); ++i) {
+            fdatasync(closing[i]);
+            close(closing[i]);
+        }
+        std::vector<bool> results;
+        for (size_t i = 0; i < merges.size(); ++i) {
+            results.push_back(HistoryStore::mergeFiles(merges[i].first, merges[i].second));
+        }
+        dirty.clear();
+        closing.clear();
+        pthread_mutex_lock(&_mutex);
+        for (size_t i = 0; i < merges.size(); ++i) {
+            std::vector<std::string>::iterator it = std::find(_forgotten.begin(), _forgotten.end(), merges[i].first);
+            if (it != _forgotten.end()) {
+                _forgotten.erase(it);
+            } else {
+                _merged.push_back(std::make_pair(merges[i].first, static_cast<bool>(results[i])));
+            }
+        }
+        merges.clear();
+        if (stopping) {
+            pthread_mutex_unlock(&_mutex);
+            return;
+        }
+    }
+}
@@ -1,9 +1,37 @@
 #include "../../inc/Client.hpp"
 #include "../../inc/Channel.hpp"
 #include "../../inc/Server.hpp"
+#include "../../inc/ChannelDirectory.hpp"
 
-Client::Client(int client_fd, const std::string& hostname, Server* server) : _serv_ref(server), _client_fd(client_fd), _hostname(hostname), _authorized(false), _nickFlag(false), _userFlag(false), _invisible(false), _welcomeMsg(false) {
-    std::cout << "new client connection " << _client_fd << std::endl;
+unsigned long Client::_queuedTotal = 0;
+unsigned long Client::_linesTotal = 0;
+unsigned long Client::_backlogBytes = 0;
+unsigned long Client::_backlogClients = 0;
+
+//fails to compile once the hot record outgrows four 64 byte cache lines
+typedef char clientFitsFourCacheLines[sizeof(Client) <= 4 * 64 ? 1 : -1];
+typedef char deadlinesMatchEnum[sizeof(static_cast<ClientConnection*>(0)->deadlines) / sizeof(unsigned long) == Client::DEADLINE_COUNT ? 1 : -1];
+
+//what the getters see before USER: no names, no channels, no listing
+static const ClientIdentity g_noIdentity = ClientIdentity();
+
+static const ClientIdentity& identityOf(const ClientIdentity* identity) {
+    return identity ? *identity : g_noIdentity;
+}
+
+Client::Client(int client_fd, const std::string& hostname, Server* server) : _serv_ref(server), _connection(new ClientConnection()), _identity(NULL), _lastActivityTime(Clock::now()), _client_fd(client_fd), _flags(0), _caps(0), _capNegotiating(false), _send_head(0), _send_offset(0), _send_bytes(0), _sendq_max(0), _lastHeardMs(Clock::monotonicMs()), _floodTokens(0), _floodRefilledMs(_lastHeardMs), _floodSinceMs(0), _msgsIn(0), _bytesIn(0), _msgsOut(0), _bytesOut(0) {
+    _connection->hostname = hostname;
+    _connection->recvqMax = 0;
+    _connection->timer.client = this;
+    for (int i = 0; i < DEADLINE_COUNT; ++i) {
+        _connection->deadlines[i] = 0;
+    }
+    _connection->pingSentMs = 0;
+    _connection->lagMs = -1;
+    _connection->floodDeferrals = 0;
+    _connection->lookups = NULL;
+    _connection->connectionId = 0;
+    LOG(LOG_DEBUG, "new client connection " << _client_fd);
 }
 
 int Client::getClientFd(void) const {
@@ -15,47 +43,191 @@ const std::string& Client::getNickname(void) const {
 }
 
 const std::string& Client::getUsername(void) const {
-    return _username;
+    return identityOf(_identity).username;
 }
 
 const std::string& Client::getRealname(void) const {
-    return _realname;
+    return identityOf(_identity).realname;
 }
 
 const std::string& Client::getHostname(void) const {
-    return _hostname;
-}
-
-std::string& Client::getSendBuf(void) {
-    return _send_buffer;
+    return _connection->hostname;
 }
 
 bool Client::getAuth(void) const {
-    return _authorized;
+    return (_flags & FLAG_AUTHORIZED) != 0;
 }
 
 bool Client::getNickFlag(void) const {
-    return _nickFlag;
+    return (_flags & FLAG_NICK) != 0;
 }
 
 bool Client::getUserFlag(void) const {
-    return _userFlag;
+    return (_flags & FLAG_USER) != 0;
 }
 
 bool Client::getInvisible(void) const {
-    return _invisible;
+    return (_flags & FLAG_INVISIBLE) != 0;
 }
 
 bool Client::getWelcomeMsg(void) const {
-    return _welcomeMsg;
+    return (_flags & FLAG_WELCOME) != 0;
+}
+
+bool Client::hasCap(unsigned char cap) const {
+    return (_caps & cap) != 0;
+}
+
+unsigned char Client::getCaps(void) const {
+    return _caps;
+}
+
+bool Client::isNegotiatingCaps(void) const {
+    return _capNegotiating;
 }
 
 std::time_t Client::getSignOnTime(void) const {
-    return _signOnTime;
+    return identityOf(_identity).signOnTime;
 }
 
 std::time_t Client::getIdleTime(void) const {
-    return std::time(NULL) - _lastActivityTime;
+    return Clock::now() - _lastActivityTime;
+}
+
+const std::vector<Channel*>& Client::getJoinedChannels(void) const {
+    return identityOf(_identity).channels;
+}
+
+//both membership lists are short, a pointer compare per pair is enough
+bool Client::sharesChannelWith(const Client& other) const {
+    const std::vector<Channel*>& mine = identityOf(_identity).channels;
+    const std::vector<Channel*>& theirs = identityOf(other._identity).channels;
+    for (size_t i = 0; i < mine.size(); ++i) {
+        if (std::find(theirs.begin(), theirs.end(), mine[i]) != theirs.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Client::hasPendingList(void) const {
+    return (_flags & FLAG_LISTING) != 0;
+}
+
+ListFilter* Client::getPendingList(void) const {
+    return identityOf(_identity).pendingList;
+}
+
+bool Client::isServerOperator(void) const {
+    return (_flags & FLAG_OPER) != 0;
+}
+
+bool Client::isRecvQueueExceeded(void) const {
+    return _connection->recvqMax != 0 && _recv_buffer.size() > _connection->recvqMax;
+}
+
+unsigned long Client::getLastHeardMs(void) const {
+    return _lastHeardMs;
+}
+
+unsigned long Client::getPingSentMs(void) const {
+    return _connection->pingSentMs;
+}
+
+long Client::getLagMs(void) const {
+    return _connection->lagMs;
+}
+
+ClientTimer& Client::getTimer(void) {
+    return _connection->timer;
+}
+
+unsigned long Client::getDeadline(int which) const {
+    return _connection->deadlines[which];
+}
+
+unsigned long Client::nextDeadline(void) const {
+    unsigned long next = 0;
+    for (int i = 0; i < DEADLINE_COUNT; ++i) {
+        unsigned long due = _connection->deadlines[i];
+        if (due != 0 && (next == 0 || due < next)) {
+            next = due;
+        }
+    }
+    return next;
+}
+
+const HostKey& Client::getAddress(void) const {
+    return _connection->address;
+}
+
+const HostKey& Client::getNetwork(void) const {
+    return _connection->network;
+}
+
+unsigned long Client::getLookupId(void) const {
+    return _connection->lookups ? _connection->lookups->id : 0;
+}
+
+unsigned char Client::getPendingLookups(void) const {
+    return _connection->lookups ? _connection->lookups->pending : 0;
+}
+
+const std::string& Client::getIdentUser(void) const {
+    static const std::string none;
+    return _connection->lookups ? _connection->lookups->identUser : none;
+}
+
+long Client::getFloodTokens(void) const {
+    return _floodTokens;
+}
+
+unsigned long Client::getFloodSinceMs(void) const {
+    return _floodSinceMs;
+}
+
+unsigned long Client::getFloodDeferrals(void) const {
+    return _connection->floodDeferrals;
+}
+
+unsigned int Client::getConnectionId(void) const {
+    return _connection->connectionId;
+}
+
+const std::string& Client::getQuitReason(void) const {
+    return _connection->quitReason;
+}
+
+unsigned long Client::getMsgsIn(void) const {
+    return _msgsIn;
+}
+
+unsigned long Client::getBytesIn(void) const {
+    return _bytesIn;
+}
+
+unsigned long Client::getMsgsOut(void) const {
+    return _msgsOut;
+}
+
+unsigned long Client::getBytesOut(void) const {
+    return _bytesOut;
+}
+
+unsigned long Client::getQueuedTotal(void) {
+    return _queuedTotal;
+}
+
+unsigned long Client::getLinesTotal(void) {
+    return _linesTotal;
+}
+
+unsigned long Client::getBacklogBytes(void) {
+    return _backlogBytes;
+}
+
+unsigned long Client::getBacklogClients(void) {
+    return _backlogClients;
 }
 
 void Client::setNickname(const std::string& nickname) {
@@ -63,42 +235,207 @@ void Client::setNickname(const std::string& nickname) {
 }
 
 void Client::setUsername(const std::string& username) {
-    _username = username;
+    _identityForUpdate().username = username;
 }
 
 void Client::setRealname(const std::string& realname) {
-    _realname = realname;
+    _identityForUpdate().realname = realname;
 }
 
 void Client::setAuth(bool authorized) {
-    _authorized = authorized;
+    _setFlag(FLAG_AUTHORIZED, authorized);
 }
 
 void Client::setNickFlag(bool flag) {
-    _nickFlag = flag;
+    _setFlag(FLAG_NICK, flag);
 }
 
 void Client::setUserFlag(bool flag) {
-    _userFlag = flag;
+    _setFlag(FLAG_USER, flag);
 }
 
 void Client::setInvisible(bool flag) {
-    _invisible = flag;
+    _setFlag(FLAG_INVISIBLE, flag);
 }
 
 void Client::setWelcomeMsg(bool flag) {
-    _welcomeMsg = flag;
+    _setFlag(FLAG_WELCOME, flag);
+}
+
+void Client::setCaps(unsigned char caps) {
+    _caps = caps;
+}
+
+void Client::setNegotiatingCaps(bool flag) {
+    _capNegotiating = flag;
 }
 
 void Client::setSigOnTime(std::time_t signOnTime) {
-    _signOnTime = signOnTime;
+    _identityForUpdate().signOnTime = signOnTime;
+}
+
+ClientIdentity& Client::_identityForUpdate() {
+    if (_identity == NULL) {
+        _identity = new ClientIdentity();
+        _identity->signOnTime = 0;
+        _identity->pendingList = NULL;
+    }
+    return *_identity;
 }
 
 void Client::setLastActivityTime(std::time_t lastActivityTime) {
     _lastActivityTime = lastActivityTime;
 }
 
+void Client::addJoinedChannel(Channel* channel) {
+    _identityForUpdate().channels.push_back(channel);
+}
+
+void Client::removeJoinedChannel(Channel* channel) {
+    if (_identity == NULL) {
+        return;
+    }
+    std::vector<Channel*>& channels = _identity->channels;
+    std::vector<Channel*>::iterator it = std::find(channels.begin(), channels.end(), channel);
+    if (it != channels.end()) {
+        channels.erase(it);
+    }
+}
+
+void Client::setPendingList(ListFilter* filter) {
+    ClientIdentity& identity = _identityForUpdate();
+    delete identity.pendingList;
+    identity.pendingList = filter;
+    _setFlag(FLAG_LISTING, filter != NULL);
+}
+
+void Client::setServerOperator(bool flag) {
+    _setFlag(FLAG_OPER, flag);
+}
+
+//applied on connect and again after every config reload
+void Client::setQueueLimits(size_t sendq, size_t recvq) {
+    _sendq_max = sendq;
+    _connection->recvqMax = recvq;
+    _checkSendQueue();
+}
+
+//a peer that stopped reading is reported once; the server closes it after the
+//current pass, so nobody holding this client is left with a dangling pointer
+void Client::_checkSendQueue() {
+    if (_sendq_max != 0 && _send_bytes > _sendq_max && !(_flags & FLAG_DROPPED)) {
+        _setFlag(FLAG_DROPPED, true);
+        _serv_ref->scheduleDrop(this, "SendQ exceeded");
+    }
+}
+
+void Client::setLastHeardMs(unsigned long nowMs) {
+    _lastHeardMs = nowMs;
+}
+
+void Client::setPingSent(unsigned long nowMs) {
+    _connection->pingSentMs = nowMs;
+}
+
+void Client::setPongReceived(unsigned long nowMs) {
+    _connection->lagMs = static_cast<long>(nowMs - _connection->pingSentMs);
+    _connection->pingSentMs = 0;
+}
+
+void Client::setAddress(const HostKey& address, const HostKey& network) {
+    _connection->address = address;
+    _connection->network = network;
+}
+
+void Client::setFloodSince(unsigned long nowMs) {
+    if (nowMs != 0 && _floodSinceMs == 0) {
+        ++_connection->floodDeferrals;
+    }
+    _floodSinceMs = nowMs;
+}
+
+void Client::setDeadline(int which, unsigned long dueMs) {
+    _connection->deadlines[which] = dueMs;
+}
+
+void Client::setLookups(unsigned long id, unsigned char pending) {
+    if (!_connection->lookups) {
+        _connection->lookups = new ClientLookups();
+    }
+    _connection->lookups->id = id;
+    _connection->lookups->pending = pending;
+}
+
+void Client::clearLookups(unsigned char done) {
+    if (_connection->lookups) {
+        _connection->lookups->pending &= ~done;
+    }
+}
+
+void Client::setIdentUser(const std::string& user) {
+    if (_connection->lookups) {
+        _connection->lookups->identUser = user;
+    }
+}
+
+void Client::releaseLookups(void) {
+    delete _connection->lookups;
+    _connection->lookups = NULL;
+}
+
+void Client::setHostname(const std::string& hostname) {
+    _connection->hostname = hostname;
+}
+
+void Client::setConnectionId(unsigned int id) {
+    _connection->connectionId = id;
+}
+
+void Client::setQuitReason(const std::string& reason) {
+    _connection->quitReason = reason;
+}
+
+void Client::resetFlood(unsigned long burst, unsigned long nowMs) {
+    _floodTokens = static_cast<long>(burst * 1000);
+    _floodRefilledMs = nowMs;
+}
+
+//ratePerSec commands a second are ratePerSec thousandths a millisecond
+bool Client::refillFlood(unsigned long burst, unsigned long ratePerSec, unsigned long nowMs) {
+    long full = static_cast<long>(burst * 1000);
+    unsigned long earned = (nowMs - _floodRefilledMs) * ratePerSec;
+    _floodRefilledMs = nowMs;
+    if (_floodTokens < full) {
+        _floodTokens = (earned >= static_cast<unsigned long>(full - _floodTokens)) ? full : _floodTokens + static_cast<long>(earned);
+    }
+    return _floodTokens > 0;
+}
+
+void Client::chargeFlood(unsigned int cost) {
+    _floodTokens -= static_cast<long>(cost) * 1000;
+}
+
+unsigned long Client::floodWaitMs(unsigned long ratePerSec) const {
+    if (_floodTokens > 0) {
+        return 0;
+    }
+    return static_cast<unsigned long>(1 - _floodTokens) / ratePerSec + 1;
+}
+
+void ClientTimer::expire() {
+    client->_serv_ref->clientDeadline(client);
+}
+
+void Client::_setFlag(unsigned char flag, bool on) {
+    if (on) {
+        _flags |= flag;
+    } else {
+        _flags &= ~flag;
+    }
+}
+
 void Client::appendRecvData(const char *buf, size_t len) {
+    _bytesIn += len;
     _recv_buffer += std::string(buf, len);
 }
 
@@ -113,9 +450,16 @@ void Client::appendRecvData(const char *buf, size_t len) {
 // }
 
 std::string Client::extractLineFromRecv() {
+    std::string res;
+    extractLine(res);
+    return res;
+}
+
+bool Client::extractLine(std::string& res) {
     size_t end = _recv_buffer.find("\n");
     if (end != std::string::npos) {
-        std::string res = _recv_buffer.substr(0, end);
+        res = _recv_buffer.substr(0, end);
+        ++_msgsIn;
         // if (res.length() > 512) {
         //     std::cerr << "Error: Received oversized line (" << res.length() << " bytes). Discarding." << std::endl;
         //     _recv_buffer.erase(0, end + 1);
@@ -126,33 +470,100 @@ std::string Client::extractLineFromRecv() {
             res = res.substr(0, res.length() - 1);
         }
         _recv_buffer.erase(0, end + 1);
-        return res;
+        if (_recv_buffer.empty()) {
+            std::string().swap(_recv_buffer); // idle connections should not keep the last burst allocated
+        }
+        return true;
     }
-    return "";
+    return false;
+}
+
+bool Client::hasLine(void) const {
+    return _recv_buffer.find('\n') != std::string::npos;
 }
 
 //It's for determing if we have data to send as client
 bool Client::hasData() const {
-    return !_send_buffer.empty();
+    return _send_bytes != 0;
+}
+
+size_t Client::getSendQueueBytes(void) const {
+    return _send_bytes;
+}
+
+size_t Client::getRecvQueueBytes(void) const {
+    return _recv_buffer.size();
 }
 
 void Client::queueMessage(const std::string& msg) {
-    // std::cout << "DEBUG: Queueing message: [" << msg << "]" << std::endl;
-    
-    // bool buff_empty = _send_buffer.empty();
+    prepareSend(msg.size()).append(msg);
+}
+
+//Returns this client's private reply buffer at the tail of the send queue, grown
+//so the next len bytes fit. The caller must append exactly len bytes.
+//Growth is geometric: reserve(size + len) alone would reallocate on every reply
+std::string& Client::prepareSend(size_t len) {
+    if (_send_bytes == 0) {
+        _serv_ref->requestPollOut(_client_fd, true);
+        //This is callback for the server to add the event POLLOUT
+        ++_backlogClients;
+    }
+    _send_bytes += len;
+    _queuedTotal += len;
+    _backlogBytes += len;
+    ++_msgsOut;
+    ++_linesTotal;
+    _checkSendQueue();
+    if (_send_head == _send_queue.size() || !_send_queue.back().isWritable()) {
+        _send_queue.push_back(SharedBuffer::makeWritable(len));
+        return _send_queue.back().writableData();
+    }
+    std::string& buf = _send_queue.back().writableData();
+    size_t needed = buf.size() + len;
+    if (needed > buf.capacity()) {
+        buf.reserve(std::max(needed, buf.capacity() * 2));
+    }
+    return buf;
+}
 
-    _send_buffer += msg;
-    // std::cout << "DEBUG: Current _send_buffer content: [" << _send_buffer << "]" << std::endl;
-    _serv_ref->requestPollOut(_client_fd, true);
-    //This is callback for the server to add the event POLLOUT
+//queues a line that other clients (or the channel history) hold as well, without copying it
+void Client::queueShared(const SharedBuffer& buf, bool endsLine) {
+    if (buf.empty()) {
+        return;
+    }
+    if (_send_bytes == 0) {
+        _serv_ref->requestPollOut(_client_fd, true);
+        ++_backlogClients;
+    }
+    _send_bytes += buf.size();
+    _queuedTotal += buf.size();
+    _backlogBytes += buf.size();
+    if (endsLine) {
+        ++_msgsOut;
+        ++_linesTotal;
+    }
+    _send_queue.push_back(buf);
+    _checkSendQueue();
+}
+
+//describes the pending output for writev(), starting at the unsent part of the first entry
+size_t Client::fillIovec(struct iovec* iov, size_t max) const {
+    size_t count = 0;
+    for (size_t i = _send_head; i < _send_queue.size() && count < max; ++i) {
+        const std::string& data = _send_queue[i].data();
+        size_t skip = (i == _send_head) ? _send_offset : 0;
+        iov[count].iov_base = const_cast<char*>(data.data()) + skip;
+        iov[count].iov_len = data.size() - skip;
+        ++count;
+    }
+    return count;
 }
 
-//This a helper function for send() method in server
+//This a helper function for writev() in server
 //Example:
 // if (cur_client->hasData()) {
-//     const std::string& data_to_send = cur_client->getSendBuf();
-//     ssize_t bytes = send(client_fd, data_to_send.data(), data_to_send.length(), 0)
-
+//     struct iovec iov[64];
+//     ssize_t bytes = writev(client_fd, iov, cur_client->fillIovec(iov, 64));
 //     if (bytes > 0) {
 //         cur_client->helpSenderEvent(bytes);
 //         //calls the callback for ending the POLLOUT
@@ -160,23 +571,84 @@ void Client::queueMessage(const std::string& msg) {
 // }
 
 void Client::helpSenderEvent(size_t len) {
-    if (len >= _send_buffer.length()) {
-        _send_buffer.clear();
-    } else {
-        _send_buffer.erase(0, len);
+    _bytesOut += len;
+    size_t written = std::min(len, _send_bytes);
+    _backlogBytes -= written;
+    if (written != 0 && written == _send_bytes) {
+        --_backlogClients;
+    }
+    _send_bytes -= written;
+    while (len > 0 && _send_head < _send_queue.size()) {
+        size_t left = _send_queue[_send_head].size() - _send_offset;
+        if (len < left) {
+            _send_offset += len;
+            break;
+        }
+        len -= left;
+        _send_queue[_send_head] = SharedBuffer(); // drop our reference as soon as the line is out
+        ++_send_head;
+        _send_offset = 0;
     }
-    
-    //if buf empty after proccesing buf, disable POLLOUT
-    if (_send_buffer.empty()) {
+
+    //if queue empty after proccesing it, disable POLLOUT
+    if (_send_bytes == 0) {
+        std::vector<SharedBuffer>().swap(_send_queue); // drop the capacity as well, not only the content
+        _send_head = 0;
+        _send_offset = 0;
         _serv_ref->requestPollOut(_client_fd, false);
+    } else if (_send_head > _send_queue.size() / 2) {
+        //a client that never drains fully would otherwise keep every sent slot
+        _send_queue.erase(_send_queue.begin(), _send_queue.begin() + _send_head);
+        _send_head = 0;
     }
 }
 
 bool Client::checkRegistered(void) {
-    if (_authorized && _nickFlag && _userFlag) {
+    const unsigned char registered = FLAG_AUTHORIZED | FLAG_NICK | FLAG_USER;
+    if ((_flags & registered) == registered) {
         return true;
     }
     return false;
 }
 
-Client::~Client(){}
+//heap bytes of a string, 0 when it still fits in the small string buffer
+static size_t heapBytes(const std::string& str) {
+    const char* data = str.data();
+    const char* self = reinterpret_cast<const char*>(&str);
+    if (data >= self && data < self + sizeof(str)) {
+        return 0;
+    }
+    return str.capacity() + 1;
+}
+
+size_t Client::getMemoryFootprint(void) const {
+    size_t bytes = sizeof(Client) + sizeof(ClientConnection)
+        + heapBytes(_nickname) + heapBytes(_recv_buffer) + heapBytes(_connection->hostname)
+        + _send_queue.capacity() * sizeof(SharedBuffer);
+    if (_identity) {
+        bytes += sizeof(ClientIdentity) + heapBytes(_identity->username) + heapBytes(_identity->realname)
+            + _identity->channels.capacity() * sizeof(Channel*);
+    }
+    if (_connection->lookups) {
+        bytes += sizeof(ClientLookups) + heapBytes(_connection->lookups->identUser);
+    }
+    for (size_t i = _send_head; i < _send_queue.size(); ++i) {
+        if (_send_queue[i].isWritable()) { // shared lines are owned by all their recipients
+            bytes += _send_queue[i].data().capacity();
+        }
+    }
+    return bytes;
+}
+
+Client::~Client() {
+    if (_send_bytes != 0) {
+        _backlogBytes -= _send_bytes;
+        --_backlogClients;
+    }
+    if (_identity) {
+        delete _identity->pendingList;
+        delete _identity;
+    }
+    delete _connection->lookups;
+    delete _connection;
+}
@@ -0,0 +1,59 @@
+#include "../../inc/SharedBuffer.hpp"
+
+static const std::string g_empty;
+
+const size_t SharedBuffer::BLOCK_OVERHEAD = sizeof(SharedBuffer::Block);
+
+SharedBuffer::SharedBuffer() : _block(NULL) {}
+
+SharedBuffer::SharedBuffer(const std::string& data) : _block(new Block()) {
+    _block->refs = 1;
+    _block->writable = false;
+    _block->data = data;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) : _block(other._block) {
+    if (_block) {
+        ++_block->refs;
+    }
+}
+
+SharedBuffer& SharedBuffer::operator=(const SharedBuffer& other) {
+    if (other._block) {
+        ++other._block->refs;
+    }
+    _release();
+    _block = other._block;
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer() {
+    _release();
+}
+
+void SharedBuffer::_release() {
+    if (_block && --_block->refs == 0) {
+        delete _block;
+    }
+    _block = NULL;
+}
+
+SharedBuffer SharedBuffer::makeWritable(size_t reserve) {
+    SharedBuffer buf;
+    buf._block = new Block();
+    buf._block->refs = 1;
+    buf._block->writable = true;
+    buf._block->data.reserve(reserve);
+    return buf;
+}
+
+const std::string& SharedBuffer::data() const { return _block ? _block->data : g_empty; }
+
+size_t SharedBuffer::size() const { return _block ? _block->data.size() : 0; }
+
+bool SharedBuffer::empty() const { return size() == 0; }
+
+//only the owner of a writable block appends to it, shared lines are never modified
+bool SharedBuffer::isWritable() const { return _block && _block->writable && _block->refs == 1; }
+
+std::string& SharedBuffer::writableData() { return _block->data; }
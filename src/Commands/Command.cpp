@@ -9,6 +9,9 @@ parsedCmd parseInput(const std::string& input, Client* client) {
     result.srcClient = client; // assigned the source client so the command knows who sent it
 
     std::string token; 
+    if (!input.empty() && input[0] == '@') {
+        iss >> token; // message tags, which no command reads
+    }
     if (iss >> result.cmd) {
         while (iss >> token) {
             if (token[0] == ':') {  // example: PRIVMSG #general :hello there  
@@ -44,7 +47,16 @@ std::vector<std::string> splitByComma(const std::string& arg) {
     return result;
 }
 
-bool isValidChannelName(const std::string& name) {
+bool isNum(const char* input) {
+    for (size_t i = 0; input[i] != '\0'; i++) {
+        if (!std::isdigit(input[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isValidChannelName(const std::string& name, size_t maxLength) {
     char prefix = name[0];
     if (prefix != '#' && prefix != '!' && prefix != '+' && prefix != '@') {
         return false;
@@ -55,174 +67,208 @@ bool isValidChannelName(const std::string& name) {
             return false;
         }
     }
-    if (name.length() > 50 ) { //TBD i don't know exactly a clear length limit
+    if (name.length() > maxLength) { // channel_name_max in the config
         return false;
     }
     return true;
 }
 
-bool _handleClientMessage(Server& server, Client* client, const std::string& cmd) {
-    parsedCmd parsed = parseInput(cmd, client);
-    cmds CommandEnum = getCommandEnum(parsed.cmd);
-    if (!client->checkRegistered() && 
-        (CommandEnum != PASS && 
-        CommandEnum != NICK && 
-        CommandEnum != USER && 
-        CommandEnum != CAP && 
-        CommandEnum != QUIT && 
-        CommandEnum != PING)) {
-            std::string clientName = (client->getNickFlag()) ? client->getNickname() : "*";
-            std::string errorMsg = ERR_NOTREGISTERED(clientName);
-            client->queueMessage(errorMsg);
-            return true;
-        }
-    if (CommandEnum == PRIVMSG || 
-        CommandEnum == JOIN || 
-        CommandEnum == PART || 
-        CommandEnum == MODE || 
-        CommandEnum == WHO || 
-        CommandEnum == WHOIS || 
-        CommandEnum == NICK || 
-        CommandEnum == QUIT || 
-        CommandEnum == INVITE) {
-            client->setLastActivityTime(std::time(NULL));
-        }
-    switch (CommandEnum) {
-        case PASS: { // PASS blablabli
-            PassCommand passCommand;
-            passCommand.execute(server, parsed);
-            break;
-        }
-        case NICK:{  // NICK tudor
-            NickCommand nickCommand;
-            nickCommand.execute(server, parsed);
-            break;
-        }
-        case USER: { // USER
-            UserCommand userCommand;
-            userCommand.execute(server, parsed);
-            break;
-        }
-        case PRIVMSG: {
-            PrivmsgCommand privmsgCommand;
-            privmsgCommand.execute(server, parsed);
-            break;
-        }
-        case JOIN: { // JOIN #general,#strict,#channel  blablabli,lalala
-            JoinCommand joinCommand;
-            joinCommand.execute(server, parsed);
-            break;
-        }
-        case PART: { // PART #general :reason(optional)
-            PartCommand partCommand;
-            partCommand.execute(server, parsed);
-            break;
-        }
-        case QUIT: { // QUIT :reason(optional)
-            QuitCommand quitCommand;
-            quitCommand.execute(server, parsed);
-            return false;
-        }
-        case KICK: { // KICK #general,#strict tudor,grisha :just because(optional)
-            KickCommand kickCommand;
-            kickCommand.execute(server, parsed);
-            break;
-        }
-        case INVITE: { // INVITE grisha #general
-            InviteCommand inviteCommand;
-            inviteCommand.execute(server, parsed);
-            break;
-        }
-        case TOPIC: { // TOPIC #general -- you get the topic   TOPIC #general :caFts -- you set the topic ( can also be empty)
-            TopicCommand topicCommand;
-            topicCommand.execute(server, parsed);
-            break;
-        }
-        case MODE: { 
-            ModeCommand modeCommand;
-            modeCommand.execute(server, parsed);
-            break;
-        }
-        /*
-        | Mode | Command to Enable      | Command to Disable      |
-|------|-----------------------|------------------------|
-| i    | MODE #chan +i         | MODE #chan -i          |
-| k    | MODE #chan +k pass    | MODE #chan -k          |
-| o    | MODE #chan +o nick    | MODE #chan -o nick     |
-| l    | MODE #chan +l 5       | MODE #chan -l          |
-| t    | MODE #chan +t         | MODE #chan -t          |
-        */
-        case PING: {
-            PingCommand pingCommand;
-            pingCommand.execute(server, parsed);
-            break;
-        }
-        // ctrl + Z to susspend a client process and write "fg" (forground) to restore the client session
-        case CAP: {
-            CapCommand capCommand;
-            capCommand.execute(server, parsed);
-            break;
-        }
-        case WHO: {
-            WhoCommand whoCommand;
-            whoCommand.execute(server, parsed);
-            break;
+//every command handler is stateless, so one instance of each serves all clients
+static PassCommand g_pass;
+static NickCommand g_nick;
+static UserCommand g_user;
+static JoinCommand g_join;
+static PartCommand g_part;
+static PrivmsgCommand g_privmsg;
+static QuitCommand g_quit;
+static KickCommand g_kick;
+static InviteCommand g_invite;
+static TopicCommand g_topic;
+static ModeCommand g_mode;
+static PingCommand g_ping;
+static PongCommand g_pong;
+static CapCommand g_cap;
+static WhoCommand g_who;
+static WhoIsCommand g_whois;
+static ListCommand g_list;
+static ChathistoryCommand g_chathistory;
+static OperCommand g_oper;
+static RehashCommand g_rehash;
+static StatsCommand g_stats;
+
+//adding a command means adding its class and one row here
+//cost is in flood bucket tokens: PONG answers our own PING and QUIT ends the
+//connection, so both are free; a message to a channel is paid per channel
+static const CommandEntry g_commands[] = {
+    // name       handler     minParams  registration  activity  closes  cost  channelCost
+    { "PASS",     &g_pass,    1,         false,        false,    false,  1,    0 },
+    { "NICK",     &g_nick,    0,         false,        true,     false,  2,    0 },
+    { "USER",     &g_user,    4,         false,        false,    false,  1,    0 },
+    { "JOIN",     &g_join,    1,         true,         true,     false,  1,    2 },   // JOIN #general,#strict,#channel  blablabli,lalala
+    { "PART",     &g_part,    1,         true,         true,     false,  0,    1 },   // PART #general :reason(optional)
+    { "PRIVMSG",  &g_privmsg, 2,         true,         true,     false,  1,    2 },
+    { "QUIT",     &g_quit,    0,         false,        true,     true,   0,    0 },   // QUIT :reason(optional)
+    { "KICK",     &g_kick,    2,         true,         false,    false,  0,    2 },   // KICK #general,#strict tudor,grisha :just because(optional)
+    { "INVITE",   &g_invite,  2,         true,         true,     false,  2,    0 },   // INVITE grisha #general
+    { "TOPIC",    &g_topic,   1,         true,         false,    false,  1,    0 },   // TOPIC #general [:new topic]
+    { "MODE",     &g_mode,    1,         true,         true,     false,  1,    0 },   // MODE #chan +i | +k pass | +o nick | +l 5 | +t
+    { "PING",     &g_ping,    0,         false,        false,    false,  1,    0 },
+    { "PONG",     &g_pong,    1,         false,        false,    false,  0,    0 },   // PONG :<token from our PING>
+    { "CAP",      &g_cap,     1,         false,        false,    false,  1,    0 },
+    { "WHO",      &g_who,     0,         true,         true,     false,  2,    0 },
+    { "WHOIS",    &g_whois,   0,         true,         true,     false,  2,    0 },
+    { "LIST",     &g_list,    0,         true,         true,     false,  3,    0 },   // LIST [>5,<100,#chan*,T<60]
+    { "CHATHISTORY", &g_chathistory, 4,  true,         true,     false,  3,    0 },   // CHATHISTORY LATEST #chan * 50
+    { "OPER",     &g_oper,    2,         true,         true,     false,  4,    0 },   // OPER admin secret
+    { "REHASH",   &g_rehash,  0,         true,         true,     false,  4,    0 },
+    { "STATS",    &g_stats,   0,         true,         true,     false,  2,    0 }    // STATS f|m|l|e
+};
+
+static const size_t COMMAND_COUNT = sizeof(g_commands) / sizeof(g_commands[0]);
+static const size_t COMMAND_SLOTS = 128; // power of two, keeps the table at most 1/4 full
+
+//cheap hash on length, first and last char; collisions fall through to the next slot
+static size_t hashVerb(const char* verb, size_t len) {
+    return (len * 31 + static_cast<unsigned char>(verb[0]) * 7
+            + static_cast<unsigned char>(verb[len - 1])) & (COMMAND_SLOTS - 1);
+}
+
+//open addressing index over g_commands, filled once on the first lookup
+static const CommandEntry* const* commandIndex() {
+    static const CommandEntry* slots[COMMAND_SLOTS];
+    static bool built = false;
+    if (!built) {
+        for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+            size_t slot = hashVerb(g_commands[i].name, std::strlen(g_commands[i].name));
+            while (slots[slot] != NULL) {
+                slot = (slot + 1) & (COMMAND_SLOTS - 1);
+            }
+            slots[slot] = &g_commands[i];
         }
-        case WHOIS: {
-            WhoIsCommand whoIsCommand;
-            whoIsCommand.execute(server, parsed);
-            break;
+        built = true;
+    }
+    return slots;
+}
+
+const CommandEntry* findCommand(const std::string& verb) {
+    if (verb.empty()) {
+        return NULL;
+    }
+    const CommandEntry* const* slots = commandIndex();
+    size_t slot = hashVerb(verb.c_str(), verb.length());
+    while (slots[slot] != NULL) {
+        if (verb == slots[slot]->name) {
+            return slots[slot];
         }
-        case UNKNOWN: {
-            break;
+        slot = (slot + 1) & (COMMAND_SLOTS - 1);
+    }
+    return NULL;
+}
+
+static CommandStats* commandStatsTable() {
+    static CommandStats stats[COMMAND_COUNT + 1];
+    static bool named = false;
+    if (!named) {
+        for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+            stats[i].name = g_commands[i].name;
         }
-        default: {
-            //client->queueMessage(":ircserver 421 " + client->getNickname() + " " + parsed.cmd + " :Unknown command\r\n");
-            break;
+        stats[COMMAND_COUNT].name = "unknown";
+        named = true;
+    }
+    return stats;
+}
+
+size_t commandStatsCount() { return COMMAND_COUNT + 1; }
+
+const CommandStats& commandStatsAt(size_t i) { return commandStatsTable()[i]; }
+
+//unknown commands cost a token as well, or they would be a free way to flood
+unsigned int commandCost(const CommandEntry* entry, const parsedCmd& parsed) {
+    if (entry == NULL) {
+        return 1;
+    }
+    unsigned int cost = entry->cost;
+    if (entry->channelCost != 0 && !parsed.args.empty()) {
+        const std::string& targets = parsed.args[0];
+        for (size_t start = 0; start <= targets.length(); ) {
+            size_t comma = targets.find(',', start);
+            if (comma == std::string::npos) {
+                comma = targets.length();
+            }
+            if (comma > start && (targets[start] == '#' || targets[start] == '&')) {
+                cost += entry->channelCost;
+            }
+            start = comma + 1;
         }
     }
-    if (parsed.srcClient->checkRegistered() && !parsed.srcClient->getWelcomeMsg()) {
-        parsed.srcClient->setSigOnTime(std::time(NULL));
-        parsed.srcClient->setWelcomeMsg(true);
-        parsed.srcClient->queueMessage(RPL_WELCOME(parsed.srcClient->getNickname(), parsed.srcClient->getUsername(), parsed.srcClient->getHostname()));
+    return cost;
+}
+
+static bool dispatch(Server& server, Client* client, const CommandEntry* entry, const parsedCmd& parsed) {
+    std::string clientName = (client->getNickFlag()) ? client->getNickname() : "*";
+    //until the welcome, which waits for the hostname and ident lookups, the
+    //host may still change: nothing that joins or talks runs before it
+    if (!client->getWelcomeMsg() && (entry == NULL || entry->needsRegistration)) {
+        sendReply(*client, ERR_NOTREGISTERED, clientName);
+        return true;
+    }
+    if (entry == NULL) {
+        //client->queueMessage(":ircserver 421 " + client->getNickname() + " " + parsed.cmd + " :Unknown command\r\n");
+        return true;
+    }
+    if (parsed.args.size() < entry->minParams) {
+        sendReply(*client, ERR_NEEDMOREPARAMS, clientName, parsed.cmd);
+        return true;
+    }
+    if (entry->countsActivity) {
+        client->setLastActivityTime(Clock::now());
+    }
+    entry->handler->execute(server, parsed);
+    if (entry->closesConnection) {
+        return false;
+    }
+    //with a hostname or ident lookup still running, the server welcomes the client once it is done
+    //and while it negotiates capabilities, once it sent CAP END
+    if (parsed.srcClient->checkRegistered() && !parsed.srcClient->getWelcomeMsg()
+        && parsed.srcClient->getPendingLookups() == 0 && !parsed.srcClient->isNegotiatingCaps()) {
+        server.registerClient(parsed.srcClient);
     }
     return true;
 }
 
-cmds getCommandEnum(const std::string& cmd) {
-    if (cmd == "PASS") return PASS;
-    if (cmd == "NICK") return NICK;
-    if (cmd == "USER") return USER;
-    if (cmd == "JOIN") return JOIN;
-    if (cmd == "PART") return PART;
-    if (cmd == "PRIVMSG") return PRIVMSG;
-    if (cmd == "QUIT") return QUIT;
-    if (cmd == "KICK") return KICK;
-    if (cmd == "INVITE") return INVITE;
-    if (cmd == "TOPIC") return TOPIC;
-    if (cmd == "MODE") return MODE;
-    if (cmd == "PING") return PING;
-    if (cmd == "CAP") return CAP;
-    if (cmd == "WHO") return WHO;
-    if (cmd == "WHOIS") return WHOIS;
-    return UNKNOWN;
+//Counts every line against its command, refusals included. Timing is two
+//reads of the monotonic clock; the loop clock only moves once per pass, far
+//too coarse for a single command
+bool _handleClientMessage(Server& server, Client* client, const std::string& cmd) {
+    parsedCmd parsed = parseInput(cmd, client);
+    const CommandEntry* entry = findCommand(parsed.cmd);
+    client->chargeFlood(commandCost(entry, parsed));
+    bool timed = server.getConfig().commandStats;
+    unsigned long started = timed ? Clock::nanos() : 0;
+    unsigned long queued = Client::getQueuedTotal();
+    bool keep = dispatch(server, client, entry, parsed);
+    CommandStats& stats = commandStatsTable()[entry ? entry - g_commands : COMMAND_COUNT];
+    ++stats.calls;
+    stats.bytesIn += cmd.length();
+    stats.bytesOut += Client::getQueuedTotal() - queued;
+    if (timed) {
+        stats.latency.record(Clock::nanos() - started);
+    }
+    return keep;
 }
 
 void PassCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
-    if (_parsedCmd.args.size() != 1) {
+    if (_parsedCmd.args.size() > 1) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_NEEDMOREPARAMS(clientName, _parsedCmd.cmd);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_NEEDMOREPARAMS, clientName, _parsedCmd.cmd);
         return;
     } else if (_parsedCmd.srcClient->checkRegistered()) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_ALREADYREGISTERED(clientName);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_ALREADYREGISTERED, clientName);
         return;
     } else if (_parsedCmd.args[0] != server.getPass()) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_PASSWDMISMATCH(clientName);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_PASSWDMISMATCH, clientName);
         return;
     }
     _parsedCmd.srcClient->setAuth(true);
@@ -247,11 +293,16 @@ bool NickCommand::validChars(const std::string _nick) const {
     return true;
 }
 
+//nicks collide under casemapping, but a client may change the case of its own nick
+static bool nickTaken(Server& server, const Client& client, const std::string& nickname) {
+    Client* holder = server.getClientByNick(nickname);
+    return holder != NULL && (holder != &client || nickname == client.getNickname());
+}
+
 void NickCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     if (_parsedCmd.args.size() < 1) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_NONICKNAMEGIVEN(clientName);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_NONICKNAMEGIVEN, clientName);
         return;
     } else if (_parsedCmd.args.size() > 1) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
@@ -259,26 +310,28 @@ void NickCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
         for (std::vector<std::string>::const_iterator it = _parsedCmd.args.begin(); it != _parsedCmd.args.end(); ++it) {
             cmd += *it;
         }
-        std::string errorMsg = ERR_ERRONEUSNICKNAME(clientName, cmd);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_ERRONEUSNICKNAME, clientName, cmd);
         return;
     } else if (_parsedCmd.args[0].length() > 30) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_ERRONEUSNICKNAME(clientName, _parsedCmd.args[0]);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_ERRONEUSNICKNAME, clientName, _parsedCmd.args[0]);
         return;
     } else if (!validChars(_parsedCmd.args[0])) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_ERRONEUSNICKNAME(clientName, _parsedCmd.args[0]);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_ERRONEUSNICKNAME, clientName, _parsedCmd.args[0]);
         return;
-    } else if (server.getClientByNick(_parsedCmd.args[0])) {
+    } else if (nickTaken(server, *_parsedCmd.srcClient, _parsedCmd.args[0])) {
         std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
-        std::string errorMsg = ERR_NICKNAMEINUSE(clientName, _parsedCmd.args[0]);
-        _parsedCmd.srcClient->queueMessage(errorMsg);
+        sendReply(*_parsedCmd.srcClient, ERR_NICKNAMEINUSE, clientName, _parsedCmd.args[0]);
         return;
     }
-    _parsedCmd.srcClient->setNickname(_parsedCmd.args[0]);
+    if (_parsedCmd.srcClient->getNickFlag()) { // channels keep ops, invites and the NAMES cache by nickname
+        const std::vector<Channel*>& joined = _parsedCmd.srcClient->getJoinedChannels();
+        for (std::vector<Channel*>::const_iterator it = joined.begin(); it != joined.end(); ++it) {
+            (*it)->renameClient(_parsedCmd.srcClient->getNickname(), _parsedCmd.args[0]);
+        }
+    }
+    server.setClientNick(_parsedCmd.srcClient, _parsedCmd.args[0]);
     _parsedCmd.srcClient->setNickFlag(true);
 }
 
@@ -286,12 +339,12 @@ void UserCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     (void)server;
     std::string clientName = (_parsedCmd.srcClient->getNickFlag()) ? _parsedCmd.srcClient->getNickname() : "*";
     if (_parsedCmd.srcClient->checkRegistered()) {
-        _parsedCmd.srcClient->queueMessage(ERR_ALREADYREGISTERED(clientName));
+        sendReply(*_parsedCmd.srcClient, ERR_ALREADYREGISTERED, clientName);
         return;
     }
 
-    if (_parsedCmd.args.size() < 4 || _parsedCmd.args[3][0] != ':') {
-        _parsedCmd.srcClient->queueMessage(ERR_NEEDMOREPARAMS(clientName, _parsedCmd.cmd));
+    if (_parsedCmd.args[3][0] != ':') {
+        sendReply(*_parsedCmd.srcClient, ERR_NEEDMOREPARAMS, clientName, _parsedCmd.cmd);
         return;
     }
 
@@ -317,12 +370,6 @@ void UserCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
 //PRIVMSG
 void PrivmsgCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
-    //check if we have a min of 2 args
-    if (_parsedCmd.args.size() < 2) {
-        // std::string errorMessage = ":ircserver 461 " + sender->getNickname() + " PRIVMSG: Not enough parameters!\r\n";
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), "PRIVMSG"));
-        return;
-    }
     std::string targetsString = _parsedCmd.args[0]; // channel or client
     std::string message = _parsedCmd.args[1]; //message
     
@@ -330,31 +377,38 @@ void PrivmsgCommand::execute(Server& server, const parsedCmd& _parsedCmd) const
         message = message.substr(1); //eliminate the ':'
     }
     if (message.empty()) {
-        sender->queueMessage(ERR_NOTEXTTOSEND(sender->getNickname()));
+        sendReply(*sender, ERR_NOTEXTTOSEND, sender->getNickname());
         return;
     }
     //parse multiple targets, separated by commas
     std::vector<std::string> targets = parseTargets(targetsString);
     // check if we have any targets
     if (targets.empty()) {
-        sender->queueMessage(ERR_NORECIPIENT(sender->getNickname(), _parsedCmd.cmd));
+        sendReply(*sender, ERR_NORECIPIENT, sender->getNickname(), _parsedCmd.cmd);
         return;
     }
-    for (std::vector<std::string>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
-        const std::string target = *it;
-        if (target.empty()) {
-            continue;   // if one target is empty just skip it
+    // every target is serialized once; recipients reached through several targets
+    // get a single copy unless the server is configured otherwise
+    FanoutPlan plan(server.getPrivmsgDedupe() ? FanoutPlan::DELIVER_ONCE : FanoutPlan::DELIVER_PER_TARGET);
+    std::string prefix = ":" + sender->getNickname() + "!" + sender->getUsername() +
+                                    "@" + sender->getHostname() + " PRIVMSG ";
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const std::string& target = targets[i];
+        if (i >= server.getPrivmsgTargetMax()) { // advertised as TARGMAX in RPL_ISUPPORT
+            sendReply(*sender, ERR_TOOMANYTARGETS, sender->getNickname(), target);
+            continue;
         }
         //now we decide if target is a channel or a client/user
         if (target[0] == '#' || target[0] == '+' || target[0] == '!' || target[0] == '&') {
             // target == channel
-            handleChannelMessage(server, sender, target, message);
+            handleChannelMessage(server, plan, sender, prefix, target, message);
         }
         else {
             //target == user
-            handlePrivateMessage(server, sender, target, message);
+            handlePrivateMessage(server, plan, sender, prefix, target, message);
         }
     }
+    plan.deliver();
 }
 
 std::vector<std::string> PrivmsgCommand::parseTargets(const std::string& targetsString) const {
@@ -383,31 +437,38 @@ std::vector<std::string> PrivmsgCommand::parseTargets(const std::string& targets
     return targets;
 }
 
-void PrivmsgCommand::handleChannelMessage(Server& server, Client* sender,
+void PrivmsgCommand::handleChannelMessage(Server& server, FanoutPlan& plan, Client* sender,
+                                            const std::string& prefix,
                                             const std::string& channelName, 
                                                 const std::string& message) const {
     Channel* channel = server.getChannel(channelName);
     if (channel == NULL) {
-        sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
         return;
     }
     //check if sender is part of channel
     if (!channel->hasClient(sender->getNickname())) {
-        sender->queueMessage(ERR_CANNOTSENDTOCHAN(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_CANNOTSENDTOCHAN, sender->getNickname(), channelName);
+        return;
+    }
+    //banned members may stay but not speak, operators are exempt
+    if (channel->isBanned(*sender) && !channel->isOperator(sender->getNickname())) {
+        sendReply(*sender, ERR_CANNOTSENDTOCHAN, sender->getNickname(), channelName);
         return;
     }
     // Format: :<sender_nick>!<user>@<host> PRIVMSG <channel> :<message>    
-    std::string prefix = ":" + sender->getNickname() + "!" + sender->getUsername() +
-                                    "@" + sender->getHostname() + " PRIVMSG " + 
-                                    channelName + " :";
-    std::vector<std::string> messages = splitMessage(prefix, message);
-    for (size_t i = 0; i < messages.size(); i++) {
-        channel->broadcast(messages[i], sender->getNickname());//send the message to all the channel members but the sender
+    std::vector<SharedBuffer> lines = splitMessage(prefix + channelName + " :", message, server.getConfig().maxLineLength);
+    unsigned long now = Clock::wallMs();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        channel->recordMessage(lines[i], now);
     }
+    size_t group = plan.addGroup(lines);
+    plan.addChannel(*channel, group, sender); //send the message to all the channel members but the sender
 }
 
+//debug log only, nothing is parsed below that level
 void PrivmsgCommand::infoDCC(const std::string& message) const {
-    if (message.find("DCC SEND") == std::string::npos) {
+    if (!Log::enabled(LOG_DEBUG) || message.find("DCC SEND") == std::string::npos) {
         return;
     }
 
@@ -429,62 +490,49 @@ void PrivmsgCommand::infoDCC(const std::string& message) const {
         int port = std::atoi(portStr.c_str());
         int size = std::atoi(sizeStr.c_str());
 
-        std::cout << "DCC SEND Request:\n";
-        std::cout << "- File: " << filename << "\n";
-        std::cout << "- IP: " << ip << "\n";
-        std::cout << "- Port: " << port << "\n";
-        std::cout << "- Size: " << size << " bytes\n";
+        LOG(LOG_DEBUG, "DCC SEND request: file " << filename << ", ip " << ip << ", port " << port
+            << ", size " << size << " bytes");
     } else {
-        std::cerr << "error in DCC SEND message\n";
+        LOG(LOG_DEBUG, "malformed DCC SEND message");
     }
 }
 
-std::vector<std::string> PrivmsgCommand::splitMessage(const std::string& prefix, const std::string& message) const {
-    const size_t IRC_MAX_SIZE = 512;
-    std::vector<std::string> messages;
+std::vector<SharedBuffer> PrivmsgCommand::splitMessage(const std::string& prefix, const std::string& message, size_t maxLength) const {
+    std::vector<SharedBuffer> messages;
 
-    size_t message_max_size = IRC_MAX_SIZE - prefix.size() - 2;
+    size_t message_max_size = (prefix.size() + 2 < maxLength) ? maxLength - prefix.size() - 2 : 1;
     size_t pos = 0;
     while (pos < message.size()) {
         size_t len = std::min(message_max_size, message.size() - pos);
-        messages.push_back(prefix + message.substr(pos, len) + "\r\n");
+        messages.push_back(SharedBuffer(prefix + message.substr(pos, len) + "\r\n"));
         pos += len;
     }
 
     return messages;
 }
 
-void PrivmsgCommand::handlePrivateMessage(Server& server, Client* sender,
+void PrivmsgCommand::handlePrivateMessage(Server& server, FanoutPlan& plan, Client* sender,
+                                            const std::string& prefix,
                                             const std::string& targetNick,
                                             const std::string& message) const {
     Client* target = server.getClientByNick(targetNick);
     //if target doesn't exist
     if (target == NULL) {
-        sender->queueMessage(ERR_NOSUCHNICK(sender->getNickname(), targetNick));
+        sendReply(*sender, ERR_NOSUCHNICK, sender->getNickname(), targetNick);
         return;
     }
     if (message.find("\x01" "DCC SEND") != std::string::npos) {
         infoDCC(message);
     }
     // Format: :<sender_nick>!<user>@<host> PRIVMSG <target_nick> :<message>
-    std::string prefix = ":" + sender->getNickname() + "!" + sender->getUsername() + 
-                                    "@" + sender->getHostname() + " PRIVMSG " + 
-                                    targetNick + " :";
-    std::vector<std::string> messages = splitMessage(prefix, message);
-    for (size_t i = 0; i < messages.size(); i++) {
-        target->queueMessage(messages[i]);
-    }
+    size_t group = plan.addGroup(splitMessage(prefix + targetNick + " :", message, server.getConfig().maxLineLength));
+    plan.addRecipient(target, group);
 }
 
 //PART
 
 void PartCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
-    if (_parsedCmd.args.size() < 1) {
-        // std::string errorMessage = ":ircserver 461 " + sender->getNickname() + " PART :Not enough parameters\r\n";
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
-        return;
-    }
     //split channels by comma
     std::vector<std::string> channels = splitByComma(_parsedCmd.args[0]);
 
@@ -506,14 +554,15 @@ void PartCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
         }
         Channel* channel = server.getChannel(channelName);
         if (channel == NULL) {
-            sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+            sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
             continue;
         }
         if (!channel->hasClient(sender->getNickname())) {
-            sender->queueMessage(ERR_NOTONCHANNEL(sender->getNickname(), channelName));
+            sendReply(*sender, ERR_NOTONCHANNEL, sender->getNickname(), channelName);
             continue;
         }
         channel->removeClient(sender->getNickname());
+        server.getEventLog().record(EV_PART, sender->getConnectionId(), sender->getNickname(), channelName, reason);
         //broadcast parting
         std::string partMsg = ":" + sender->getNickname() + "!" + sender->getUsername() 
                                 + "@" + sender->getHostname() + " PART " + channelName + " :" + reason;
@@ -538,10 +587,6 @@ void PartCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
 
 void KickCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
-    if (_parsedCmd.args.size() < 2) {
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
-        return;
-    }
     //sepparate the channels and the users by ','
     std::vector<std::string> channels = splitByComma(_parsedCmd.args[0]);
     std::vector<std::string> users = splitByComma(_parsedCmd.args[1]);
@@ -571,7 +616,7 @@ void KickCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
             kickFromChannel(server, sender, channels[i], users[0], reason);
         }
     } else {  // if we have for example 2 channels and 3 users
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
         return;
     }
 }
@@ -582,25 +627,24 @@ void KickCommand::kickFromChannel(Server& server, Client* sender,
                                   const std::string& reason) const {
     Channel* channel = server.getChannel(channelName);
     if (!channel) {
-        sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->hasClient(sender->getNickname())) {
-        sender->queueMessage(ERR_NOTONCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOTONCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->isOperator(sender->getNickname())) {
-        sender->queueMessage(ERR_CHANOPRIVSNEEDED(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_CHANOPRIVSNEEDED, sender->getNickname(), channelName);
         return;
     }
     if (!channel->hasClient(targetNick)) {
-        sender->queueMessage(ERR_USRNOTINCHANNEL( sender->getNickname(), targetNick, channelName));
+        sendReply(*sender, ERR_USRNOTINCHANNEL, sender->getNickname(), targetNick, channelName);
         return;
     }
     //!!! ALSO can't kick yourself out of the channel
     if (sender->getNickname() == targetNick) {
-        std::string errorMessage = ":ircserver 482 " + sender->getNickname() + " " + channelName + " :You can't kick yourself, use PART instead\r\n"; //exception(can't use macro for this special case)
-        sender->queueMessage(errorMessage);
+        sendReply(*sender, ERR_CANNOTKICKSELF, sender->getNickname(), channelName);
         return;
     }
     // Format: :kicker!user@host KICK <channel> <target> :reason
@@ -609,32 +653,28 @@ void KickCommand::kickFromChannel(Server& server, Client* sender,
     channel->broadcast(kickMsg);
     // now remove the target from channel
     channel->removeClient(targetNick);
+    server.getEventLog().record(EV_KICK, sender->getConnectionId(), sender->getNickname(), channelName, targetNick, reason);
 }
 //TOPIC
 void TopicCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
-    if (_parsedCmd.args.size() < 1) {
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
-        return;
-    }
-
     std::string channelName = _parsedCmd.args[0];
     Channel* channel = server.getChannel(channelName);
     if (!channel) { 
-        sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->hasClient(sender->getNickname())) {
-        sender->queueMessage(ERR_NOTONCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOTONCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (_parsedCmd.args.size() == 1) { // if the user calls just TOPIC #channel 
         if (!channel->getTopic().empty()) { // if the topic on said channel is not empty
-            sender->queueMessage(RPL_TOPIC(sender->getNickname(), channel->getName(), channel->getTopic()));
+            sendReply(*sender, RPL_TOPIC, sender->getNickname(), channel->getName(), channel->getTopic());
             return;
         }
         else {
-            sender->queueMessage(RPL_NOTOPIC(sender->getNickname(), channel->getName()));
+            sendReply(*sender, RPL_NOTOPIC, sender->getNickname(), channel->getName());
             return;
         }
 
@@ -645,7 +685,7 @@ void TopicCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     }
     if (channel->isTopicLocked() && !channel->isOperator(sender->getNickname())) {
         // std::string errorMessage = ":ircserver 482 " + sender->getNickname() +  " " + channel->getName() + " :You're not channel operator\r\n";
-        sender->queueMessage(ERR_CHANOPRIVSNEEDED(sender->getNickname(), channel->getName()));
+        sendReply(*sender, ERR_CHANOPRIVSNEEDED, sender->getNickname(), channel->getName());
         return;
     }
     channel->setTopic(newTopic, sender->getNickname());//can also be empty , which just erases the previous topic; for now setTopic sends a confirmation to server
@@ -657,8 +697,8 @@ void TopicCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
 void JoinCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
     
-    if (_parsedCmd.args.size() < 1 || _parsedCmd.args[0].empty()) {
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+    if (_parsedCmd.args[0].empty()) {
+        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
         return;
     }
     std::vector<std::string> channels = splitByComma(_parsedCmd.args[0]);
@@ -670,8 +710,8 @@ void JoinCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
         std::string channelName = channels[i];
         std::string key = (i < keys.size()) ? keys[i] : "";
         //validate channel name;
-        if (!isValidChannelName(channelName)) {
-            sender->queueMessage(ERR_BADCHANMASK(sender->getNickname(), channelName));
+        if (!isValidChannelName(channelName, server.getConfig().channelNameMax)) {
+            sendReply(*sender, ERR_BADCHANMASK, sender->getNickname(), channelName);
             continue;
         }
         Channel* channel = server.getOrCreateChannel(channelName);
@@ -679,25 +719,31 @@ void JoinCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
         if (channel->hasClient(sender->getNickname())) {
             continue;
         }
-        //invite only, sender not invited
-        if (channel->isInviteOnly() && !channel->isInvited(sender->getNickname())) {
-            sender->queueMessage(ERR_INVITEONLYCHAN(sender->getNickname(), channelName));
+        //banned, unless an exception (+e) covers the sender
+        if (channel->isBanned(*sender)) {
+            sendReply(*sender, ERR_BANNEDFROMCHAN, sender->getNickname(), channelName);
+            continue;
+        }
+        //invite only, sender neither invited nor matching an invite exception (+I)
+        if (channel->isInviteOnly() && !channel->isInvited(sender->getNickname()) && !channel->isInviteException(*sender)) {
+            sendReply(*sender, ERR_INVITEONLYCHAN, sender->getNickname(), channelName);
             continue;
         }
         //full
         if (channel->isFull()) {
-            sender->queueMessage(ERR_CHANNELISFULL(sender->getNickname(), channelName));
+            sendReply(*sender, ERR_CHANNELISFULL, sender->getNickname(), channelName);
             continue;
         }
         //key/password protected
         if (channel->hasPassword() && !channel->verifyPassword(key)) {
-            sender->queueMessage(ERR_BADCHANNELKEY(sender->getNickname(), channelName));
+            sendReply(*sender, ERR_BADCHANNELKEY, sender->getNickname(), channelName);
             continue;
         }
         //add the sender
         channel->addClient(sender);
-        //if first user, make operator
-        if (channel->getClientCount() == 1) {
+        server.getEventLog().record(EV_JOIN, sender->getConnectionId(), sender->getNickname(), channelName);
+        //if first user, make operator (operators are never restored, a nick alone proves nothing)
+        if (channel->getClientCount() == 1 && channel->getOperatorCount() == 0) {
             channel->addOperator(sender->getNickname());
         }
         //broadcast JOIN
@@ -705,14 +751,16 @@ void JoinCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
         channel->broadcast(joinMsg);
         //send topic
          if (!channel->getTopic().empty()) {
-            sender->queueMessage(RPL_TOPIC(sender->getNickname(), channelName, channel->getTopic()));
+            sendReply(*sender, RPL_TOPIC, sender->getNickname(), channelName, channel->getTopic());
         } else {
-            sender->queueMessage(RPL_NOTOPIC(sender->getNickname(), channelName));
+            sendReply(*sender, RPL_NOTOPIC, sender->getNickname(), channelName);
         }
         //send list of user's names from channel
-        std::string nameList = channel->getNameList();
-        sender->queueMessage(RPL_NAMEREPLY(sender->getNickname(), channelName, nameList));
-        sender->queueMessage(RPL_ENDOFNAMES(sender->getNickname(), channelName));
+        const std::vector<std::string>& nameChunks = channel->getNameChunks();
+        for (size_t n = 0; n < nameChunks.size(); ++n) {
+            sendReply(*sender, RPL_NAMEREPLY, sender->getNickname(), channelName, nameChunks[n]);
+        }
+        sendReply(*sender, RPL_ENDOFNAMES, sender->getNickname(), channelName);
     }
 }
 
@@ -720,42 +768,37 @@ void JoinCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
 
 void InviteCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
-    if (_parsedCmd.args.size() < 2) {
-        //461 ERR_NEEDMOREPARAMS
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
-        return;
-    }
     std::string targetNick = _parsedCmd.args[0];
     std::string channelName = _parsedCmd.args[1];
     Channel* channel = server.getChannel(channelName);
     if (!channel) {
-        sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->hasClient(sender->getNickname())) {
-        sender->queueMessage(ERR_NOTONCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOTONCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->isOperator(sender->getNickname())) {
-        sender->queueMessage(ERR_CHANOPRIVSNEEDED(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_CHANOPRIVSNEEDED, sender->getNickname(), channelName);
         return;
     }
     Client* target = server.getClientByNick(targetNick);
     if (!target) {
-        sender->queueMessage(ERR_NOSUCHNICK(sender->getNickname(), targetNick));
+        sendReply(*sender, ERR_NOSUCHNICK, sender->getNickname(), targetNick);
         return;
     }
     if (channel->hasClient(targetNick)) {
         //443 ERR_USERONCHANNEL
-        sender->queueMessage(ERR_USERONCHANNEL(sender->getNickname(), targetNick, channelName));
+        sendReply(*sender, ERR_USERONCHANNEL, sender->getNickname(), targetNick, channelName);
         return;
     }
     if (channel->isInviteOnly() && !channel->isOperator(sender->getNickname())) {
-        sender->queueMessage(ERR_CHANOPRIVSNEEDED(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_CHANOPRIVSNEEDED, sender->getNickname(), channelName);
         return;
     }
     channel->invite(targetNick);
-    sender->queueMessage(RPL_INVITING(sender->getNickname(), targetNick, channelName));
+    sendReply(*sender, RPL_INVITING, sender->getNickname(), targetNick, channelName);
     // Send invite to target
     std::string inviteMsg = ":" + sender->getNickname() + "!" + sender->getUsername() + "@" 
                                 + sender->getHostname() + " INVITE " + targetNick + " :" 
@@ -776,28 +819,27 @@ void QuitCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     } else {
         reason = "Client exited";
     }
+    sender->setQuitReason(reason);
     std::string quitMsg = ":" + sender->getNickname() + "!" + sender->getUsername() + "@" + sender->getHostname()
                             + " :QUIT " + reason + "\r\n";
     //find all channels in which the client is a user
-    std::set<Channel*> channels = server.getChannels();
-    for (std::set<Channel*>::const_iterator ch = channels.begin(); ch != channels.end(); ++ch) {
+    std::vector<Channel*> channels = sender->getJoinedChannels(); // copy, removeClient edits the list
+    for (std::vector<Channel*>::const_iterator ch = channels.begin(); ch != channels.end(); ++ch) {
         Channel* channel = *ch;
-        if (channel->hasClient(sender->getNickname())) {
-            channel->broadcast(quitMsg, sender->getNickname());
-            channel->removeClient(sender->getNickname());
-            //same as in part, promote new op if needed
-            if (channel->getClientCount() > 0 && channel->getOperatorCount() == 0) {
-                Client* newOP = channel->getFirstClient();
-                if (newOP) {
-                    channel->addOperator(newOP->getNickname());
-                    channel->broadcast("\n" + newOP->getNickname() + " has become an opperator\r\n");
-                }
-            }
-            //same as in part, if the client leaves behind an empty channel, we delete the channel
-            if (channel->getClientCount() == 0) {
-                server.removeChannel(channel->getName());
+        channel->broadcast(quitMsg, sender->getNickname());
+        channel->removeClient(sender->getNickname());
+        //same as in part, promote new op if needed
+        if (channel->getClientCount() > 0 && channel->getOperatorCount() == 0) {
+            Client* newOP = channel->getFirstClient();
+            if (newOP) {
+                channel->addOperator(newOP->getNickname());
+                channel->broadcast("\n" + newOP->getNickname() + " has become an opperator\r\n");
             }
         }
+        //same as in part, if the client leaves behind an empty channel, we delete the channel
+        if (channel->getClientCount() == 0) {
+            server.removeChannel(channel->getName());
+        }
     }
     server.disconnectClient(_parsedCmd.srcClient->getClientFd());
 }
@@ -807,10 +849,10 @@ void QuitCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
 void PingCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     (void)server;
     if (_parsedCmd.args.empty()) {
-        _parsedCmd.srcClient->queueMessage(ERR_NOORIGIN(_parsedCmd.srcClient->getNickname()));
+        sendReply(*_parsedCmd.srcClient, ERR_NOORIGIN, _parsedCmd.srcClient->getNickname());
         return;
     } // else if (_parsedCmd.args[0][0] != ':') {
-    //     _parsedCmd.srcClient->queueMessage(ERR_NEEDMOREPARAMS(_parsedCmd.srcClient->getNickname(), _parsedCmd.cmd));
+    //     sendReply(*_parsedCmd.srcClient, ERR_NEEDMOREPARAMS, _parsedCmd.srcClient->getNickname(), _parsedCmd.cmd);
     //     return;
     // }
 
@@ -819,36 +861,202 @@ void PingCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     _parsedCmd.srcClient->queueMessage("PONG :" + token + "\r\n");
 }
 
+//OPER
+
+void OperCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    Client* sender = _parsedCmd.srcClient;
+    const OperBlock* oper = server.getConfig().findOper(_parsedCmd.args[0]);
+    if (oper == NULL || !oper->hosts.matches(sender->getHostname())) {
+        sendReply(*sender, ERR_NOOPERHOST, sender->getNickname());
+        return;
+    }
+    if (oper->password != _parsedCmd.args[1]) {
+        sendReply(*sender, ERR_PASSWDMISMATCH, sender->getNickname());
+        return;
+    }
+    sender->setServerOperator(true);
+    sendReply(*sender, RPL_YOUREOPER, sender->getNickname());
+    sender->queueMessage(":" + sender->getNickname() + " MODE " + sender->getNickname() + " :+o\r\n");
+}
+
+//REHASH
+
+void RehashCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    Client* sender = _parsedCmd.srcClient;
+    if (!sender->isServerOperator()) {
+        sendReply(*sender, ERR_NOPRIVILEGES, sender->getNickname());
+        return;
+    }
+    sendReply(*sender, RPL_REHASHING, sender->getNickname(), server.getConfigPath());
+    std::string error;
+    if (!server.rehash(error)) {
+        sender->queueMessage(":ircserver NOTICE " + sender->getNickname() + " :Rehash failed, keeping the old configuration: " + error + "\r\n");
+    }
+}
+
+//STATS
+
+//STATS f: the flood control settings and totals, then every client whose input is held back right now
+static void statsFlood(Server& server, Client& to) {
+    const Config& config = server.getConfig();
+    const FloodStats& totals = server.getFloodStats();
+    std::ostringstream line;
+    line << "burst " << config.floodBurst << ", " << config.floodRate << "/s, "
+         << totals.deferred << " deferred, " << totals.excessFlood << " dropped for excess flood";
+    sendReply(to, RPL_STATSDEBUG, to.getNickname(), "f", line.str());
+    unsigned long now = Clock::monotonicMs();
+    std::vector<Client*> clients = server.getAllClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        Client* client = clients[i];
+        if (client->getFloodSinceMs() == 0) {
+            continue;
+        }
+        line.str("");
+        line << (client->getNickFlag() ? client->getNickname() : "*") << "[" << client->getClientFd() << "] held for "
+             << (now - client->getFloodSinceMs()) / 1000 << "s, " << client->getRecvQueueBytes() << " bytes waiting, "
+             << client->getFloodTokens() / 1000 << " tokens, deferred " << client->getFloodDeferrals() << " times";
+        sendReply(to, RPL_STATSDEBUG, to.getNickname(), "f", line.str());
+    }
+}
+
+//STATS m: calls, traffic and latency percentiles of every command used so far
+static void statsCommands(Client& to) {
+    std::ostringstream line;
+    for (size_t i = 0; i < commandStatsCount(); ++i) {
+        const CommandStats& stats = commandStatsAt(i);
+        if (stats.calls == 0) {
+            continue;
+        }
+        line.str("");
+        line << stats.name << " " << stats.calls << " calls, " << stats.bytesIn << " bytes in, "
+             << stats.bytesOut << " bytes out";
+        const LatencyHistogram& latency = stats.latency;
+        if (latency.count() != 0) {
+            line << ", us p50 " << latency.percentile(0.5) / 1000 << " p90 " << latency.percentile(0.9) / 1000
+                 << " p99 " << latency.percentile(0.99) / 1000 << " max " << latency.max() / 1000;
+        }
+        sendReply(to, RPL_STATSDEBUG, to.getNickname(), "m", line.str());
+    }
+}
+
+//STATS l: traffic of every connection, with its keepalive lag
+static void statsLinks(Server& server, Client& to) {
+    std::ostringstream line;
+    std::vector<Client*> clients = server.getAllClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        Client* client = clients[i];
+        line.str("");
+        line << (client->getNickFlag() ? client->getNickname() : "*") << "[" << client->getClientFd() << "] sendq "
+             << client->getSendQueueBytes() << ", out " << client->getMsgsOut() << " lines " << client->getBytesOut()
+             << " bytes, in " << client->getMsgsIn() << " lines " << client->getBytesIn() << " bytes";
+        if (client->getWelcomeMsg()) {
+            line << ", open " << Clock::now() - client->getSignOnTime() << "s";
+        }
+        if (client->getLagMs() >= 0) {
+            line << ", lag " << client->getLagMs() << "ms";
+        }
+        sendReply(to, RPL_STATSDEBUG, to.getNickname(), "l", line.str());
+    }
+}
+
+//STATS e: event loop load over the last second, ten seconds and minute
+static void statsLoop(Server& server, Client& to) {
+    const LoopStats& loop = server.getLoopStats();
+    static const size_t windows[] = { 1, 10, 60 };
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+        LoopStats::Window sum = loop.sum(windows[w], Clock::monotonicMs());
+        line.str("");
+        line << windows[w] << "s: " << sum.passes << " passes, " << sum.wakeups << " with events, "
+             << (sum.wakeups ? static_cast<double>(sum.events) / sum.wakeups : 0.0) << " events per wakeup (max "
+             << sum.maxEvents << "), busy " << sum.busyNs / 1e6 << " ms (timers " << sum.timersNs / 1e6
+             << ", accept " << sum.acceptNs / 1e6 << ", recv " << sum.recvNs / 1e6 << ", dispatch "
+             << sum.dispatchNs / 1e6 << ", send " << sum.sendNs / 1e6 << "), longest pass " << sum.maxPassNs / 1e6
+             << " ms, " << sum.overBudget << " over budget, backlog up to " << sum.maxBacklogBytes << " bytes in "
+             << sum.maxBacklogClients << " clients";
+        sendReply(to, RPL_STATSDEBUG, to.getNickname(), "e", line.str());
+    }
+    line.str("");
+    line << "now: " << loop.getBacklogBytes() << " bytes queued to " << loop.getBacklogClients()
+         << " clients, budget " << server.getConfig().loopBudgetMs << " ms";
+    sendReply(to, RPL_STATSDEBUG, to.getNickname(), "e", line.str());
+}
+
+//operators only
+void StatsCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    Client* sender = _parsedCmd.srcClient;
+    if (!sender->isServerOperator()) {
+        sendReply(*sender, ERR_NOPRIVILEGES, sender->getNickname());
+        return;
+    }
+    std::string query = _parsedCmd.args.empty() ? "*" : _parsedCmd.args[0].substr(0, 1);
+    if (query == "f") {
+        statsFlood(server, *sender);
+    } else if (query == "m") {
+        statsCommands(*sender);
+    } else if (query == "l") {
+        statsLinks(server, *sender);
+    } else if (query == "e") {
+        statsLoop(server, *sender);
+    }
+    sendReply(*sender, RPL_ENDOFSTATS, sender->getNickname(), query);
+}
+
+//PONG
+
+//only the answer to our own keepalive PING counts, its token is the time it was sent
+void PongCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    (void)server;
+    Client* sender = _parsedCmd.srcClient;
+    if (sender->getPingSentMs() == 0) {
+        return;
+    }
+    std::ostringstream expected;
+    expected << sender->getPingSentMs();
+    if (_parsedCmd.args.back() == expected.str()) {
+        sender->setPongReceived(Clock::monotonicMs());
+    }
+}
+
 //MODE
 
+//RPL_BANLIST / RPL_EXCEPTLIST / RPL_INVITELIST entries followed by the matching end reply
+static void sendChannelList(Client& sender, const Channel& channel, char mode) {
+    Numeric entry = (mode == 'e') ? RPL_EXCEPTLIST : (mode == 'I') ? RPL_INVITELIST : RPL_BANLIST;
+    Numeric end = (mode == 'e') ? RPL_ENDOFEXCEPTLIST : (mode == 'I') ? RPL_ENDOFINVITELIST : RPL_ENDOFBANLIST;
+    const std::vector<MaskSet::Entry*>& entries = channel.getList(mode).getEntries();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        sendReply(sender, entry, sender.getNickname(), channel.getName(), entries[i]->mask.getPattern(),
+                  entries[i]->setter, static_cast<long>(entries[i]->setAt));
+    }
+    sendReply(sender, end, sender.getNickname(), channel.getName());
+}
+
 void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     Client* sender = _parsedCmd.srcClient;
     std::string modules = "+";
-    if (_parsedCmd.args.size() < 1) {
-        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
-        return;
-    }
     if (_parsedCmd.args.size() == 1) {
         if (_parsedCmd.args[0][0] != '#') {
             Client* target = server.getClientByNick(_parsedCmd.args[0]);
             if (!target) {
-                sender->queueMessage(ERR_NOSUCHNICK(sender->getNickname(), _parsedCmd.args[0]));
+                sendReply(*sender, ERR_NOSUCHNICK, sender->getNickname(), _parsedCmd.args[0]);
                 return;
             } else {
                 if (target->getInvisible()) {
                     modules += "i";
                 }
-                // if (target is op) {
-                //     moduel += "o";
-                // }
-                sender->queueMessage(RPL_UMODEIS(target->getNickname(), modules));
+                if (target->isServerOperator()) {
+                    modules += "o";
+                }
+                sendReply(*sender, RPL_UMODEIS, target->getNickname(), modules);
                 return;
             }
         } else {
             std::string modules = "+";
             Channel* target = server.getChannel(_parsedCmd.args[0]);
             if (!target) {
-                sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), _parsedCmd.args[0]));
+                sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), _parsedCmd.args[0]);
                 return;
             }
             if (target->isInviteOnly())
@@ -859,7 +1067,7 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
                 modules += "t";
             if (target->getUserLimit() != 0)
                 modules += "l";
-            sender->queueMessage(RPL_CHANNELMODEIS(sender->getNickname(), target->getName(), modules));
+            sendReply(*sender, RPL_CHANNELMODEIS, sender->getNickname(), target->getName(), modules);
             return;
         }
     }
@@ -867,8 +1075,7 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     if (_parsedCmd.args[0][0] != '#') {
         if (_parsedCmd.args[1] == "+i" || _parsedCmd.args[1] == "-i") {
             if (_parsedCmd.srcClient->getNickname() != _parsedCmd.args[0]) {
-                std::string errorMsg = ERR_USERDONTMATCH(_parsedCmd.srcClient->getNickname());
-                _parsedCmd.srcClient->queueMessage(errorMsg);
+                sendReply(*_parsedCmd.srcClient, ERR_USERDONTMATCH, _parsedCmd.srcClient->getNickname());
                 return;
             }
             std::string replyMsg = ":" + _parsedCmd.srcClient->getNickname() + "!" + _parsedCmd.srcClient->getUsername() + "@" + _parsedCmd.srcClient->getHostname() + " MODE " + _parsedCmd.args[0] + " :" + _parsedCmd.args[1] + "\r\n";
@@ -886,18 +1093,30 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     std::string channelName = _parsedCmd.args[0];
     Channel* channel = server.getChannel(channelName);
     if (!channel) {
-        sender->queueMessage(ERR_NOSUCHCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOSUCHCHANNEL, sender->getNickname(), channelName);
+        return;
+    }
+    //"MODE #chan b" only lists, anyone may ask
+    std::string listQuery = (!_parsedCmd.args[1].empty() && _parsedCmd.args[1][0] == '+') ? _parsedCmd.args[1].substr(1) : _parsedCmd.args[1];
+    if (_parsedCmd.args.size() == 2 && (listQuery == "b" || listQuery == "e" || listQuery == "I")) {
+        sendChannelList(*sender, *channel, listQuery[0]);
         return;
     }
     if (!channel->hasClient(sender->getNickname())) {
-        sender->queueMessage(ERR_NOTONCHANNEL(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_NOTONCHANNEL, sender->getNickname(), channelName);
         return;
     }
     if (!channel->isOperator(sender->getNickname())) {
-        sender->queueMessage(ERR_CHANOPRIVSNEEDED(sender->getNickname(), channelName));
+        sendReply(*sender, ERR_CHANOPRIVSNEEDED, sender->getNickname(), channelName);
         return;
     }
     std::string flags = _parsedCmd.args[1];
+    //recorded as asked for, the loop below may stop part way on a bad parameter
+    std::string request = flags;
+    for (size_t i = 2; i < _parsedCmd.args.size(); ++i) {
+        request += " " + _parsedCmd.args[i];
+    }
+    server.getEventLog().record(EV_MODE, sender->getConnectionId(), sender->getNickname(), channelName, request);
     char direction = '\0';
     char mode;
     size_t index = 2;
@@ -956,7 +1175,7 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
                 } else {
                     if (index > _parsedCmd.args.size()) {
                         // std::string errorMessage = ":ircserver 461 " + sender->getNickname() + " MODE :Not enough parameters\r\n";
-                        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+                        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
                         return;
                     }
                     std::string argument = _parsedCmd.args[index];
@@ -973,12 +1192,12 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
             case 'o': {
                 if (index > _parsedCmd.args.size()) {
                     // std::string errorMessage = ":ircserver 461 " + sender->getNickname() + " MODE :Not enough parameters\r\n";
-                    sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+                    sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
                     return; 
                 }
                 std::string target = _parsedCmd.args[index];
                 if (!channel->hasClient(target)) {
-                    sender->queueMessage(ERR_USRNOTINCHANNEL( sender->getNickname(), target, channelName));
+                    sendReply(*sender, ERR_USRNOTINCHANNEL, sender->getNickname(), target, channelName);
                     return;
                 }
                 if (direction == '+') {
@@ -1010,12 +1229,12 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
                     }
                 } else {
                     if (index > _parsedCmd.args.size()) {
-                        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+                        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
                         return; 
                     }
                     std::string number = _parsedCmd.args[index];
                     if (!isNum(number.c_str())) {
-                        sender->queueMessage(ERR_NEEDMOREPARAMS(sender->getNickname(), _parsedCmd.cmd));
+                        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
                     }
                     std::stringstream ss(number);
                     size_t limit;
@@ -1030,6 +1249,52 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
                 }
                 break;
             }
+            case 'H': {
+                size_t length = server.getHistoryLength();
+                if (direction == '+') {
+                    if (index >= _parsedCmd.args.size() || !isNum(_parsedCmd.args[index].c_str())) {
+                        sendReply(*sender, ERR_NEEDMOREPARAMS, sender->getNickname(), _parsedCmd.cmd);
+                        return;
+                    }
+                    length = std::min<size_t>(std::strtoul(_parsedCmd.args[index++].c_str(), NULL, 10), ChannelHistory::MAX_CAPACITY);
+                }
+                channel->setHistoryLength(length);
+                std::ostringstream change;
+                change << " MODE " << channelName << " " << direction << mode;
+                if (direction == '+') {
+                    change << " " << length;
+                }
+                sender->queueMessage(":ircserver" + change.str() + "\r\n");
+                channel->broadcast(":" + sender->getNickname() + "!" + sender->getUsername() + "@" + sender->getHostname()
+                                   + change.str() + "\r\n", sender->getNickname());
+                break;
+            }
+            case 'b':
+            case 'e':
+            case 'I': {
+                if (index >= _parsedCmd.args.size()) {
+                    sendChannelList(*sender, *channel, mode);
+                    break;
+                }
+                std::string mask = MaskSet::normalize(_parsedCmd.args[index++]);
+                bool changed;
+                if (direction == '-') {
+                    changed = channel->removeListEntry(mode, mask);
+                } else if (channel->getList(mode).size() >= Channel::MAX_LIST_ENTRIES) {
+                    sendReply(*sender, ERR_BANLISTFULL, sender->getNickname(), channelName, mask);
+                    break;
+                } else {
+                    changed = channel->addListEntry(mode, mask, sender->getNickname());
+                }
+                if (changed) {
+                    std::string replySenderMsg = ":ircserver MODE " + channelName + " " + direction + mode + " " + mask + "\r\n";
+                    sender->queueMessage(replySenderMsg);
+                    std::string broadMsg = ":" + sender->getNickname() + "!" + sender->getUsername() + "@" + sender->getHostname()
+                                           + " MODE " + channelName + " " + direction + mode + " " + mask + "\r\n";
+                    channel->broadcast(broadMsg, sender->getNickname());
+                }
+                break;
+            }
             default: {
                 break;
             }
@@ -1037,101 +1302,244 @@ void ModeCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     }
 }
 
-void CapCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
-    (void)server;
-    _parsedCmd.srcClient->queueMessage("CAP * LS :\r\n");
+//what CAP LS offers; CHATHISTORY replies use batch, server-time and the
+//msgid tag of message-tags only as far as the client enabled them
+static const struct {
+    const char* name;
+    unsigned char bit;
+} g_caps[] = {
+    { "batch", Client::CAP_BATCH },
+    { "draft/chathistory", Client::CAP_CHATHISTORY },
+    { "message-tags", Client::CAP_MESSAGE_TAGS },
+    { "server-time", Client::CAP_SERVER_TIME },
+};
+static const size_t CAP_COUNT = sizeof(g_caps) / sizeof(g_caps[0]);
+
+static std::string capNames(unsigned char caps) {
+    std::string names;
+    for (size_t i = 0; i < CAP_COUNT; ++i) {
+        if (caps & g_caps[i].bit) {
+            names += names.empty() ? "" : " ";
+            names += g_caps[i].name;
+        }
+    }
+    return names;
 }
 
-bool isVisible(Client& srcClient, Client& targetClient, bool isChannel, Server& server) {
-    if (&srcClient == &targetClient) {
-        return true;
+//"a -b c": the caps after the request, false if any name is unknown; nothing
+//changes unless the whole request can be granted
+static bool applyCapRequest(const std::string& request, unsigned char& caps) {
+    std::istringstream iss(request);
+    std::string token;
+    unsigned char result = caps;
+    while (iss >> token) {
+        bool off = (token[0] == '-');
+        std::string name = off ? token.substr(1) : token;
+        size_t i = 0;
+        while (i < CAP_COUNT && name != g_caps[i].name) {
+            ++i;
+        }
+        if (i == CAP_COUNT) {
+            return false;
+        }
+        result = off ? (result & ~g_caps[i].bit) : (result | g_caps[i].bit);
     }
+    caps = result;
+    return true;
+}
 
-    if (isChannel) {
-        return true;
+//CAP LS, LIST, REQ and END. LS or REQ before registration holds the welcome
+//back until CAP END
+void CapCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    (void)server;
+    Client* client = _parsedCmd.srcClient;
+    std::string nick = client->getNickFlag() ? client->getNickname() : "*";
+    std::string sub = _parsedCmd.args[0];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "LS") {
+        client->setNegotiatingCaps(!client->getWelcomeMsg());
+        client->queueMessage(":ircserver CAP " + nick + " LS :" + capNames(0xff) + "\r\n");
+    } else if (sub == "LIST") {
+        client->queueMessage(":ircserver CAP " + nick + " LIST :" + capNames(client->getCaps()) + "\r\n");
+    } else if (sub == "REQ") {
+        std::string request = (_parsedCmd.args.size() > 1) ? _parsedCmd.args[1] : "";
+        if (!request.empty() && request[0] == ':') {
+            request.erase(0, 1);
+        }
+        client->setNegotiatingCaps(!client->getWelcomeMsg());
+        unsigned char caps = client->getCaps();
+        if (!applyCapRequest(request, caps)) {
+            client->queueMessage(":ircserver CAP " + nick + " NAK :" + request + "\r\n");
+            return;
+        }
+        client->setCaps(caps);
+        client->queueMessage(":ircserver CAP " + nick + " ACK :" + request + "\r\n");
+    } else if (sub == "END") {
+        client->setNegotiatingCaps(false);
+    } else {
+        sendReply(*client, ERR_INVALIDCAPCMD, nick, _parsedCmd.args[0]);
     }
+}
 
-    std::set<Channel*> allChannels = server.getChannels();
-    for (std::set<Channel*>::iterator it = allChannels.begin(); it != allChannels.end(); ++it) {
-            if ((*it)->hasClient(targetClient.getNickname()) && 
-            (*it)->hasClient(srcClient.getNickname())) {
-                return true;
-            }
+//channel shown in a WHO reply that was not asked for a channel: the first one the
+//target is on, or for invisible users the first one shared with the asker
+static const Channel* whoChannelFor(const Client& srcClient, const Client& targetClient) {
+    const std::vector<Channel*>& joined = targetClient.getJoinedChannels();
+    for (std::vector<Channel*>::const_iterator it = joined.begin(); it != joined.end(); ++it) {
+        if (!targetClient.getInvisible() || (*it)->hasClient(srcClient.getNickname())) {
+            return *it;
         }
+    }
+    return NULL;
+}
+
+//the text a WHO mask is matched against, written into a reused string
+static void whoSubject(const WhoQuery& query, const Client& target, std::string& out) {
+    switch (query.field) {
+        case WhoQuery::MATCH_HOST:
+            out.assign(target.getHostname());
+            break;
+        case WhoQuery::MATCH_FULL:
+            out.assign(target.getNickname());
+            out += '!';
+            out += target.getUsername();
+            out += '@';
+            out += target.getHostname();
+            break;
+        default:
+            out.assign(target.getNickname());
+            break;
+    }
+}
 
-    if (!targetClient.getInvisible()) {
+//sends one RPL_WHOREPLY if the target passes the filters; false once the reply limit is hit
+bool WhoCommand::offer(WhoQuery& query, Client& target, const Channel* channel) const {
+    if (!target.getWelcomeMsg() || (query.opsOnly && !target.isServerOperator())) {
         return true;
     }
-    
-    return false;
+    if (channel == NULL) {
+        if (&target != query.src && target.getInvisible() && !target.sharesChannelWith(*query.src)) {
+            return true;
+        }
+        channel = whoChannelFor(*query.src, target);
+    }
+    if (query.sent == query.limit) {
+        query.truncated = true;
+        return false;
+    }
+    ++query.sent;
+    bool op = channel && channel->isOperator(target.getNickname());
+    sendReply(*query.src, RPL_WHOREPLY, query.src->getNickname(),
+        channel ? channel->getName() : std::string("*"),
+        target.getUsername(),
+        target.getHostname(),
+        target.getNickname(),
+        op ? "@" : "",
+        target.getRealname());
+    return true;
 }
 
-std::string isClientOperator(Client& client, std::set<Channel*> allChannels) {
-    for (std::set<Channel*>::iterator it = allChannels.begin(); it != allChannels.end(); ++it) {
-        if ((*it)->isOperator(client.getNickname())) {
-            return "@";
+//Walks the index entries whose key starts with keyPrefix; the range only holds
+//clients sharing the mask's literal anchor, so the cost follows the result count.
+//Candidates are matched against the compiled mask a batch at a time
+template <typename Index>
+void WhoCommand::walkIndex(const Index& index, const std::string& keyPrefix, WhoQuery& query) const {
+    static const size_t WHO_BATCH = 64;
+    std::vector<Client*> batch;
+    std::vector<std::string> subjects(WHO_BATCH);
+    std::vector<bool> verdicts;
+    typename Index::const_iterator it = index.lower_bound(keyPrefix);
+    while (it != index.end() && !query.truncated) {
+        batch.clear();
+        for (; it != index.end() && batch.size() < WHO_BATCH; ++it) {
+            if (it->first.compare(0, keyPrefix.length(), keyPrefix) != 0) {
+                it = index.end();
+                break;
+            }
+            whoSubject(query, *it->second, subjects[batch.size()]);
+            batch.push_back(it->second);
+        }
+        subjects.resize(batch.size());
+        query.mask.matchBatch(subjects, verdicts);
+        subjects.resize(WHO_BATCH);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (verdicts[i] && !offer(query, *batch[i], NULL)) {
+                break;
+            }
         }
     }
-    return "";
 }
 
-void WhoCommand::showUserInfo(Client& srcClient, Client& targetClient, Server& server, bool isChannel) const {
-    if (isVisible(srcClient, targetClient, isChannel, server)) {
-        srcClient.queueMessage(
-            RPL_WHOREPLY(srcClient.getNickname(),
-            getClientAllChannels(targetClient, srcClient, server),
-            targetClient.getUsername(),
-            targetClient.getHostname(),
-            targetClient.getNickname(),
-            isClientOperator(targetClient, server.getChannels()),
-            targetClient.getRealname()));
+//Picks the index to walk: masks containing '!' or '@' match nick!user@host, masks
+//containing '.' or ':' (never part of a nick) match the hostname, anything else
+//the nickname. Only a mask without any literal anchor scans every client
+void WhoCommand::whoMask(Server& server, WhoQuery& query) const {
+    const std::string& pattern = query.mask.getPattern();
+    std::string prefix = query.mask.getLiteralPrefix(); // already casemapped, like the index keys
+    std::string suffix = query.mask.getLiteralSuffix();
+    if (!query.mask.hasWildcards()) {
+        suffix = prefix;
+    }
+    if (pattern.find_first_of("!@") != std::string::npos) {
+        query.field = WhoQuery::MATCH_FULL;
+        prefix = prefix.substr(0, prefix.find('!')); // the nick part of the anchor
+        size_t at = suffix.rfind('@');
+        suffix = (at == std::string::npos) ? suffix : suffix.substr(at + 1); // the host part
+    } else if (pattern.find_first_of(".:") != std::string::npos) {
+        query.field = WhoQuery::MATCH_HOST;
+    } else {
+        query.field = WhoQuery::MATCH_NICK;
+        suffix.clear(); // nicks are only indexed by prefix
+    }
+
+    if (query.field == WhoQuery::MATCH_HOST && prefix.length() >= suffix.length() && !prefix.empty()) {
+        walkIndex(server.getHostIndex(), prefix, query);
+    } else if (query.field != WhoQuery::MATCH_NICK && suffix.length() > prefix.length()) {
+        walkIndex(server.getReversedHostIndex(), std::string(suffix.rbegin(), suffix.rend()), query);
+    } else if (query.field != WhoQuery::MATCH_HOST) {
+        walkIndex(server.getNickIndex(), prefix, query); // an empty prefix walks every client
+    } else {
+        walkIndex(server.getNickIndex(), "", query);
     }
 }
 
 void WhoCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
-    if (_parsedCmd.args.size() > 1) {
-        _parsedCmd.srcClient->queueMessage(ERR_NEEDMOREPARAMS(_parsedCmd.srcClient->getNickname(), _parsedCmd.cmd));
+    if (_parsedCmd.args.size() > 2) {
+        sendReply(*_parsedCmd.srcClient, ERR_NEEDMOREPARAMS, _parsedCmd.srcClient->getNickname(), _parsedCmd.cmd);
         return;
     }
-    if (_parsedCmd.args.size() == 0) {
-        std::vector<Client*> allClients = server.getAllClients();
-        for (std::vector<Client*>::iterator it = allClients.begin(); it != allClients.end(); ++it) {
-            showUserInfo(*_parsedCmd.srcClient, **it, server, false);
-        }
-    } else {
-        if (_parsedCmd.args[0][0] == '#') {
-            Channel* channel = server.getChannel(_parsedCmd.args[0]);
-            if (channel != NULL) {
-                std::vector<Client*> allClients = channel->getUsers();
-                for (std::vector<Client*>::iterator it = allClients.begin(); it != allClients.end(); ++it) {
-                    showUserInfo(*_parsedCmd.srcClient, **it, server, true);
-                }
-            }
-        } else {
-            Client* client = server.getClientByNick(_parsedCmd.args[0]);
-            if (client != NULL) {
-                showUserInfo(*_parsedCmd.srcClient, *client, server, false);
+    WhoQuery query;
+    query.src = _parsedCmd.srcClient;
+    query.mask.compile((_parsedCmd.args.empty() || _parsedCmd.args[0] == "0") ? "*" : _parsedCmd.args[0]);
+    query.opsOnly = _parsedCmd.args.size() == 2 && _parsedCmd.args[1].find('o') != std::string::npos;
+    query.field = WhoQuery::MATCH_NICK;
+    query.limit = server.getWhoMaxReplies();
+    query.sent = 0;
+    query.truncated = false;
+
+    const std::string& pattern = query.mask.getPattern();
+    if (pattern[0] == '#' || pattern[0] == '&' || pattern[0] == '+' || pattern[0] == '!') {
+        Channel* channel = server.getChannel(pattern);
+        if (channel != NULL) {
+            const std::vector<Client*>& members = channel->getUsers();
+            for (size_t i = 0; i < members.size() && offer(query, *members[i], channel); ++i) {
             }
         }
+    } else {
+        whoMask(server, query);
     }
-
-    _parsedCmd.srcClient->queueMessage(RPL_ENDOFWHO(_parsedCmd.srcClient->getNickname()));
+    if (query.truncated) {
+        sendReply(*query.src, ERR_TOOMANYMATCHES, query.src->getNickname(), "WHO", pattern);
+    }
+    sendReply(*query.src, RPL_ENDOFWHO, query.src->getNickname(), pattern);
 }
 
-std::string getClientAllChannels(Client& targetClient, Client& srcClient, Server& server) {
+std::string getClientAllChannels(Client& targetClient, Client& srcClient) {
     std::string resChannels;
-    std::set<Channel*> allChannels = server.getChannels();
-    if (!targetClient.getInvisible()) {
-        for (std::set<Channel*>::iterator it = allChannels.begin(); it != allChannels.end(); ++it) {
-            if ((*it)->hasClient(targetClient.getNickname())) {
-                resChannels += (*it)->getName() + " ";
-            }
-        }
-    } else {
-        for (std::set<Channel*>::iterator it = allChannels.begin(); it != allChannels.end(); ++it) {
-            if ((*it)->hasClient(srcClient.getNickname()) && (*it)->hasClient(targetClient.getNickname())) {
-                resChannels += (*it)->getName() + " ";
-            }
+    const std::vector<Channel*>& joined = targetClient.getJoinedChannels();
+    for (std::vector<Channel*>::const_iterator it = joined.begin(); it != joined.end(); ++it) {
+        if (!targetClient.getInvisible() || (*it)->hasClient(srcClient.getNickname())) {
+            resChannels += (*it)->getName() + " ";
         }
     }
     if (!resChannels.empty() && resChannels[resChannels.size() - 1] == ' ') {
@@ -1142,25 +1550,150 @@ std::string getClientAllChannels(Client& targetClient, Client& srcClient, Server
 
 void WhoIsCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
     if (_parsedCmd.args.size() > 1) {
-        _parsedCmd.srcClient->queueMessage(ERR_NEEDMOREPARAMS(_parsedCmd.srcClient->getNickname(), _parsedCmd.cmd));
+        sendReply(*_parsedCmd.srcClient, ERR_NEEDMOREPARAMS, _parsedCmd.srcClient->getNickname(), _parsedCmd.cmd);
         return;
     } else if (_parsedCmd.args.size() < 1) {
-        _parsedCmd.srcClient->queueMessage(ERR_NONICKNAMEGIVEN(_parsedCmd.srcClient->getNickname()));
+        sendReply(*_parsedCmd.srcClient, ERR_NONICKNAMEGIVEN, _parsedCmd.srcClient->getNickname());
         return;
     }
 
     if (!server.getClientByNick(_parsedCmd.args[0])) {
-        _parsedCmd.srcClient->queueMessage(ERR_NOSUCHNICK(_parsedCmd.srcClient->getNickname(), _parsedCmd.args[0]));
+        sendReply(*_parsedCmd.srcClient, ERR_NOSUCHNICK, _parsedCmd.srcClient->getNickname(), _parsedCmd.args[0]);
     } else {
         Client* targetClient = server.getClientByNick(_parsedCmd.args[0]);
-        _parsedCmd.srcClient->queueMessage(RPL_WHOISUSER(_parsedCmd.srcClient->getNickname(), targetClient->getNickname(), targetClient->getUsername(), targetClient->getHostname(), targetClient->getRealname()));
-        _parsedCmd.srcClient->queueMessage(RPL_WHOISSERVER(_parsedCmd.srcClient->getNickname(), targetClient->getNickname()));
-        std::string channels = getClientAllChannels(*targetClient, *_parsedCmd.srcClient, server);
+        sendReply(*_parsedCmd.srcClient, RPL_WHOISUSER, _parsedCmd.srcClient->getNickname(), targetClient->getNickname(), targetClient->getUsername(), targetClient->getHostname(), targetClient->getRealname());
+        sendReply(*_parsedCmd.srcClient, RPL_WHOISSERVER, _parsedCmd.srcClient->getNickname(), targetClient->getNickname());
+        std::string channels = getClientAllChannels(*targetClient, *_parsedCmd.srcClient);
         if (!channels.empty()) {
-            _parsedCmd.srcClient->queueMessage(RPL_WHOISCHANNELS(_parsedCmd.srcClient->getNickname(), targetClient->getNickname(), channels));
+            sendReply(*_parsedCmd.srcClient, RPL_WHOISCHANNELS, _parsedCmd.srcClient->getNickname(), targetClient->getNickname(), channels);
         }
-        _parsedCmd.srcClient->queueMessage(RPL_WHOISIDLE(_parsedCmd.srcClient->getNickname(), targetClient->getNickname(), targetClient->getIdleTime(), std::time(NULL) - targetClient->getSignOnTime()));
+        sendReply(*_parsedCmd.srcClient, RPL_WHOISIDLE, _parsedCmd.srcClient->getNickname(), targetClient->getNickname(), targetClient->getIdleTime(), Clock::now() - targetClient->getSignOnTime());
     }
 
-    _parsedCmd.srcClient->queueMessage(RPL_ENDOFWHOIS(_parsedCmd.srcClient->getNickname(), _parsedCmd.args[0]));
+    sendReply(*_parsedCmd.srcClient, RPL_ENDOFWHOIS, _parsedCmd.srcClient->getNickname(), _parsedCmd.args[0]);
+}
+
+//LIST
+
+void ListCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    Client* sender = _parsedCmd.srcClient;
+    ListFilter* filter = new ListFilter();
+    if (!_parsedCmd.args.empty() && !filter->parse(_parsedCmd.args[0], Clock::now())) {
+        delete filter;
+        sendReply(*sender, RPL_LISTSTART, sender->getNickname());
+        sendReply(*sender, RPL_LISTEND, sender->getNickname());
+        return;
+    }
+    sender->setPendingList(filter); // a LIST still in progress is replaced
+    server.pumpList(sender);
+}
+
+//CHATHISTORY
+
+void ChathistoryCommand::fail(Client& client, const std::string& code, const std::string& context,
+                              const std::string& description) const {
+    client.queueMessage(":ircserver FAIL CHATHISTORY " + code + " " + context + " :" + description + "\r\n");
+}
+
+//Replays source[from, to), inside a chathistory batch for clients that enabled
+//batch, each line tagged with what the client enabled of server-time and
+//message-tags. The tag prefix is queued in front of the recorded buffer itself,
+//so lines from the ring are never copied; writev joins both into one line
+template <typename Source>
+void ChathistoryCommand::sendBatch(Client& client, const std::string& target, const Source& source,
+                                   size_t from, size_t to) const {
+    static unsigned long batchCounter = 0;
+    std::ostringstream ref;
+    bool batch = client.hasCap(Client::CAP_BATCH);
+    if (batch) {
+        ref << "hist" << ++batchCounter;
+        client.queueMessage(":ircserver BATCH +" + ref.str() + " chathistory " + target + "\r\n");
+    }
+    bool time = client.hasCap(Client::CAP_SERVER_TIME);
+    bool msgid = client.hasCap(Client::CAP_MESSAGE_TAGS);
+    HistoryEntry entry;
+    for (size_t i = from; i < to; ++i) {
+        source.read(i, entry);
+        if (batch || time || msgid) {
+            std::ostringstream tags;
+            char separator = '@';
+            if (batch) {
+                tags << separator << "batch=" << ref.str();
+                separator = ';';
+            }
+            if (time) {
+                tags << separator << "time=" << ChannelHistory::formatTime(entry.timeMs);
+                separator = ';';
+            }
+            if (msgid) {
+                tags << separator << "msgid=" << entry.msgid;
+            }
+            tags << ' ';
+            client.queueShared(SharedBuffer(tags.str()), false);
+        }
+        client.queueShared(entry.line);
+    }
+    if (batch) {
+        client.queueMessage(":ircserver BATCH -" + ref.str() + "\r\n");
+    }
+}
+
+void ChathistoryCommand::execute(Server& server, const parsedCmd& _parsedCmd) const {
+    Client* sender = _parsedCmd.srcClient;
+    std::string sub = _parsedCmd.args[0];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    const std::string& target = _parsedCmd.args[1];
+    const std::string& refArg = _parsedCmd.args[2];
+    HistoryQuery query;
+    if (sub == "LATEST") {
+        query.kind = HistoryQuery::LATEST;
+    } else if (sub == "BEFORE") {
+        query.kind = HistoryQuery::BEFORE;
+    } else if (sub == "AFTER") {
+        query.kind = HistoryQuery::AFTER;
+    } else if (sub == "AROUND") {
+        query.kind = HistoryQuery::AROUND;
+    } else {
+        fail(*sender, "INVALID_PARAMS", sub, "Unknown subcommand");
+        return;
+    }
+    Channel* channel = server.getChannel(target);
+    if (channel == NULL || !channel->hasClient(sender->getNickname())) {
+        fail(*sender, "INVALID_TARGET", sub + " " + target, "Messages could not be retrieved");
+        return;
+    }
+    if (!isNum(_parsedCmd.args[3].c_str()) || _parsedCmd.args[3].empty()) {
+        fail(*sender, "INVALID_PARAMS", sub, "Invalid limit");
+        return;
+    }
+    query.limit = std::min<size_t>(std::strtoul(_parsedCmd.args[3].c_str(), NULL, 10), server.getChathistoryMax());
+
+    //the reference is msgid=<id>, timestamp=<server-time>, or * for LATEST
+    query.anchored = (refArg != "*");
+    query.byTime = false;
+    query.key = 0;
+    if (!query.anchored && query.kind != HistoryQuery::LATEST) {
+        fail(*sender, "INVALID_PARAMS", sub, "Only LATEST takes *");
+        return;
+    } else if (refArg.compare(0, 6, "msgid=") == 0 && isNum(refArg.c_str() + 6) && refArg.length() > 6) {
+        query.key = std::strtoul(refArg.c_str() + 6, NULL, 10);
+    } else if (refArg.compare(0, 10, "timestamp=") == 0 && ChannelHistory::parseTime(refArg.substr(10), query.key)) {
+        query.byTime = true;
+    } else if (query.anchored) {
+        fail(*sender, "INVALID_MSGREFTYPE", sub + " " + refArg, "Invalid message reference");
+        return;
+    }
+
+    //the ring answers unless the range runs into its oldest line and the
+    //persistent store holds more than the ring does
+    const ChannelHistory& history = channel->getHistory();
+    const HistoryStore* store = channel->getStore();
+    size_t from, to;
+    selectHistory(history, query, from, to);
+    if (from == 0 && store != NULL && store->size() > history.size()) {
+        selectHistory(*store, query, from, to);
+        sendBatch(*sender, channel->getName(), *store, from, to);
+    } else {
+        sendBatch(*sender, channel->getName(), history, from, to);
+    }
 }
@@ -0,0 +1,58 @@
+#include "../../inc/Fanout.hpp"
+#include "../../inc/Channel.hpp"
+#include <functional>
+
+FanoutPlan::FanoutPlan(DuplicateMode mode) : _mode(mode) {}
+
+size_t FanoutPlan::addGroup(const std::vector<SharedBuffer>& lines) {
+    _groups.push_back(lines);
+    return _groups.size() - 1;
+}
+
+void FanoutPlan::addRecipient(Client* client, size_t group) {
+    Recipient r;
+    r.client = client;
+    r.group = group;
+    r.order = _recipients.size();
+    _recipients.push_back(r);
+}
+
+void FanoutPlan::addChannel(const Channel& channel, size_t group, const Client* except) {
+    const std::vector<Client*>& members = channel.getUsers();
+    _recipients.reserve(_recipients.size() + members.size());
+    for (std::vector<Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+        if (*it && *it != except) {
+            addRecipient(*it, group);
+        }
+    }
+}
+
+size_t FanoutPlan::getRecipientCount() const {
+    return _recipients.size();
+}
+
+bool FanoutPlan::_byClientThenOrder(const Recipient& a, const Recipient& b) {
+    if (a.client != b.client) {
+        return std::less<Client*>()(a.client, b.client);
+    }
+    return a.order < b.order;
+}
+
+void FanoutPlan::deliver() {
+    if (_mode == DELIVER_ONCE) {
+        //equal clients end up next to each other, the first target that reached them first
+        std::sort(_recipients.begin(), _recipients.end(), _byClientThenOrder);
+    }
+    Client* previous = NULL;
+    for (std::vector<Recipient>::const_iterator it = _recipients.begin(); it != _recipients.end(); ++it) {
+        if (_mode == DELIVER_ONCE && it->client == previous) {
+            continue;
+        }
+        previous = it->client;
+        const std::vector<SharedBuffer>& lines = _groups[it->group];
+        for (size_t i = 0; i < lines.size(); ++i) {
+            it->client->queueShared(lines[i]);
+        }
+    }
+    _recipients.clear();
+}
@@ -0,0 +1,95 @@
+#include "../../inc/Reply.hpp"
+#include "../../inc/Client.hpp"
+
+struct NumericFormat {
+    const char* code;
+    const char* format;
+};
+
+static const char SERVER_PREFIX[] = ":ircserver ";
+
+//indexed by Numeric: row i comes from the i-th NUMERIC_TABLE entry
+#define NUMERIC_ROW(id, code, format) { code, format },
+static const NumericFormat g_numerics[] = {
+    NUMERIC_TABLE(NUMERIC_ROW)
+};
+#undef NUMERIC_ROW
+
+//fail to compile when a row is lost or a code is not three digits
+typedef char numericTableMatchesEnum[sizeof(g_numerics) / sizeof(g_numerics[0]) == NUMERIC_COUNT ? 1 : -1];
+#define NUMERIC_CODE_CHECK(id, code, format) typedef char id##_codeHasThreeDigits[sizeof(code) == 4 ? 1 : -1];
+NUMERIC_TABLE(NUMERIC_CODE_CHECK)
+#undef NUMERIC_CODE_CHECK
+
+ReplyArg::ReplyArg() : _data(""), _len(0) {
+    _digits[0] = '\0';
+}
+
+ReplyArg::ReplyArg(const std::string& str) : _data(str.data()), _len(str.length()) {
+    _digits[0] = '\0';
+}
+
+ReplyArg::ReplyArg(const char* str) : _data(str), _len(std::strlen(str)) {
+    _digits[0] = '\0';
+}
+
+//digits are written back to front, _data stays NULL so copies stay valid
+ReplyArg::ReplyArg(long value) : _data(NULL), _len(0) {
+    char tmp[sizeof(_digits)];
+    size_t pos = sizeof(tmp);
+    unsigned long mag = (value < 0) ? 0UL - static_cast<unsigned long>(value) : static_cast<unsigned long>(value);
+    do {
+        tmp[--pos] = static_cast<char>('0' + mag % 10);
+        mag /= 10;
+    } while (mag != 0);
+    if (value < 0) {
+        tmp[--pos] = '-';
+    }
+    _len = sizeof(tmp) - pos;
+    std::memcpy(_digits, tmp + pos, _len);
+}
+
+ReplyArg::ReplyArg(const ReplyArg& other) : _data(other._data), _len(other._len) {
+    std::memcpy(_digits, other._digits, sizeof(_digits));
+}
+
+const char* ReplyArg::data() const { return _data ? _data : _digits; }
+
+size_t ReplyArg::length() const { return _len; }
+
+void sendReply(Client& to, Numeric id,
+               const ReplyArg& a1, const ReplyArg& a2, const ReplyArg& a3, const ReplyArg& a4,
+               const ReplyArg& a5, const ReplyArg& a6, const ReplyArg& a7) {
+    const ReplyArg* args[7] = { &a1, &a2, &a3, &a4, &a5, &a6, &a7 };
+    const NumericFormat& numeric = g_numerics[id];
+
+    //first pass: exact size, so the append below never reallocates
+    size_t total = (sizeof(SERVER_PREFIX) - 1) + 4 + 2;
+    for (const char* f = numeric.format; *f; ++f) {
+        if (f[0] == '%' && f[1] >= '1' && f[1] <= '7') {
+            total += args[f[1] - '1']->length();
+            ++f;
+        } else {
+            ++total;
+        }
+    }
+
+    //second pass: copy literal runs and arguments into the send buffer
+    std::string& out = to.prepareSend(total);
+    out.append(SERVER_PREFIX, sizeof(SERVER_PREFIX) - 1);
+    out.append(numeric.code, 3);
+    out += ' ';
+    const char* run = numeric.format;
+    const char* f = numeric.format;
+    for (; *f; ++f) {
+        if (f[0] == '%' && f[1] >= '1' && f[1] <= '7') {
+            out.append(run, f - run);
+            const ReplyArg* arg = args[f[1] - '1'];
+            out.append(arg->data(), arg->length());
+            ++f;
+            run = f + 1;
+        }
+    }
+    out.append(run, f - run);
+    out.append("\r\n", 2);
+}
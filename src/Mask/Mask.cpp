@@ -0,0 +1,166 @@
+#include "../../inc/Mask.hpp"
+#include <cstring>
+
+//rfc1459 casemapping as a lookup table, built on first use
+static const unsigned char* foldTable() {
+    static unsigned char table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (int c = 0; c < 256; ++c) {
+            table[c] = static_cast<unsigned char>(c);
+        }
+        for (int c = 'A'; c <= 'Z'; ++c) {
+            table[c] = static_cast<unsigned char>(c - 'A' + 'a');
+        }
+        table['['] = '{';
+        table[']'] = '}';
+        table['\\'] = '|';
+        table['~'] = '^';
+        ready = true;
+    }
+    return table;
+}
+
+char Mask::fold(char c) {
+    return static_cast<char>(foldTable()[static_cast<unsigned char>(c)]);
+}
+
+std::string Mask::fold(const std::string& str) {
+    const unsigned char* table = foldTable();
+    std::string res(str);
+    for (size_t i = 0; i < res.length(); ++i) {
+        res[i] = static_cast<char>(table[static_cast<unsigned char>(res[i])]);
+    }
+    return res;
+}
+
+//compares a literal (already folded) with the subject folded on the fly
+static bool sameFolded(const unsigned char* table, const std::string& literal, const char* str) {
+    for (size_t i = 0; i < literal.length(); ++i) {
+        if (literal[i] != static_cast<char>(table[static_cast<unsigned char>(str[i])])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Mask::Mask() : _minLength(0), _kind(MATCH_ALL) {
+    compile("*");
+}
+
+Mask::Mask(const std::string& pattern) : _minLength(0), _kind(MATCH_ALL) {
+    compile(pattern);
+}
+
+void Mask::compile(const std::string& pattern) {
+    _pattern = pattern;
+    _folded.clear();
+    _folded.reserve(pattern.length());
+    _minLength = 0;
+    const unsigned char* table = foldTable();
+    for (size_t i = 0; i < pattern.length(); ++i) {
+        char c = pattern[i];
+        if (c == '*') {
+            if (!_folded.empty() && _folded[_folded.length() - 1] == '*') {
+                continue;
+            }
+        } else {
+            ++_minLength;
+        }
+        _folded += static_cast<char>(table[static_cast<unsigned char>(c)]);
+    }
+
+    size_t first = _folded.find_first_of("*?");
+    if (first == std::string::npos) {
+        _kind = MATCH_EXACT;
+        _prefix = _folded;
+        _suffix.clear();
+        _middle.clear();
+        return;
+    }
+    size_t last = _folded.find_last_of("*?");
+    _prefix = _folded.substr(0, first);
+    _suffix = _folded.substr(last + 1);
+    _middle = _folded.substr(first, last + 1 - first);
+    if (_middle == "*") {
+        _kind = _prefix.empty() ? (_suffix.empty() ? MATCH_ALL : MATCH_SUFFIX)
+                                : (_suffix.empty() ? MATCH_PREFIX : MATCH_GLOB);
+    } else {
+        _kind = MATCH_GLOB;
+    }
+}
+
+const std::string& Mask::getPattern() const { return _pattern; }
+
+const std::string& Mask::getLiteralPrefix() const { return _prefix; }
+
+const std::string& Mask::getLiteralSuffix() const { return _suffix; }
+
+bool Mask::hasWildcards() const { return _kind != MATCH_EXACT; }
+
+//glob walk of _middle over the part of the subject between prefix and suffix,
+//backtracking only to the most recent '*'
+bool Mask::_matchMiddle(const char* str, size_t len) const {
+    const unsigned char* table = foldTable();
+    const char* mask = _middle.data();
+    size_t mlen = _middle.length();
+    size_t m = 0, s = 0, star = std::string::npos, mark = 0;
+    while (s < len) {
+        char c = static_cast<char>(table[static_cast<unsigned char>(str[s])]);
+        if (m < mlen && (mask[m] == '?' || mask[m] == c)) {
+            ++m;
+            ++s;
+        } else if (m < mlen && mask[m] == '*') {
+            star = m++;
+            mark = s;
+        } else if (star != std::string::npos) {
+            m = star + 1;
+            s = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (m < mlen && mask[m] == '*') {
+        ++m;
+    }
+    return m == mlen;
+}
+
+bool Mask::matches(const char* str, size_t len) const {
+    if (len < _minLength) {
+        return false;
+    }
+    const unsigned char* table = foldTable();
+    switch (_kind) {
+        case MATCH_ALL:
+            return true;
+        case MATCH_EXACT:
+            return len == _prefix.length() && sameFolded(table, _prefix, str);
+        case MATCH_PREFIX:
+            return sameFolded(table, _prefix, str);
+        case MATCH_SUFFIX:
+            return sameFolded(table, _suffix, str + len - _suffix.length());
+        default:
+            break;
+    }
+    if (!sameFolded(table, _prefix, str) || !sameFolded(table, _suffix, str + len - _suffix.length())) {
+        return false;
+    }
+    return _matchMiddle(str + _prefix.length(), len - _prefix.length() - _suffix.length());
+}
+
+bool Mask::matches(const std::string& str) const {
+    return matches(str.data(), str.length());
+}
+
+size_t Mask::matchBatch(const std::vector<std::string>& subjects, std::vector<bool>& verdicts) const {
+    verdicts.assign(subjects.size(), false);
+    size_t hits = 0;
+    for (size_t i = 0; i < subjects.size(); ++i) {
+        if (matches(subjects[i].data(), subjects[i].length())) {
+            verdicts[i] = true;
+            ++hits;
+        }
+    }
+    return hits;
+}
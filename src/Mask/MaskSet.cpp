@@ -0,0 +1,133 @@
+#include "../../inc/MaskSet.hpp"
+#include <algorithm>
+
+MaskSet::MaskSet() : _buckets(16), _exactCount(0) {}
+
+MaskSet::~MaskSet() {
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        delete _entries[i];
+    }
+}
+
+//FNV-1a, the keys are short hostnames
+size_t MaskSet::_hash(const std::string& foldedHost) {
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < foldedHost.length(); ++i) {
+        h ^= static_cast<unsigned char>(foldedHost[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//a mask goes to a bucket when everything after its last '@' is literal text
+bool MaskSet::_exactHostOf(const Mask& mask, std::string& host) {
+    const std::string& literal = mask.hasWildcards() ? mask.getLiteralSuffix() : mask.getLiteralPrefix();
+    size_t at = literal.rfind('@');
+    if (at == std::string::npos) {
+        return false;
+    }
+    host = literal.substr(at + 1);
+    return true;
+}
+
+std::vector<MaskSet::Entry*>& MaskSet::_bucketFor(const std::string& foldedHost) {
+    return _buckets[_hash(foldedHost) & (_buckets.size() - 1)];
+}
+
+void MaskSet::_rehash(size_t bucketCount) {
+    std::vector<std::vector<Entry*> > buckets(bucketCount);
+    _buckets.swap(buckets);
+    std::string host;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i]->exactHost && _exactHostOf(_entries[i]->mask, host)) {
+            _bucketFor(host).push_back(_entries[i]);
+        }
+    }
+}
+
+std::string MaskSet::normalize(const std::string& pattern) {
+    size_t bang = pattern.find('!');
+    size_t at = pattern.find('@');
+    if (bang == std::string::npos && at == std::string::npos) {
+        return pattern + "!*@*";
+    }
+    if (bang == std::string::npos) {
+        return "*!" + pattern;
+    }
+    if (at == std::string::npos) {
+        return pattern + "@*";
+    }
+    return pattern;
+}
+
+bool MaskSet::add(const std::string& pattern, const std::string& setter, std::time_t setAt) {
+    std::string folded = Mask::fold(pattern);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (Mask::fold(_entries[i]->mask.getPattern()) == folded) {
+            return false;
+        }
+    }
+    Entry* entry = new Entry();
+    entry->mask.compile(pattern);
+    entry->setter = setter;
+    entry->setAt = setAt;
+    std::string host;
+    entry->exactHost = _exactHostOf(entry->mask, host);
+    _entries.push_back(entry);
+    if (entry->exactHost) {
+        if (++_exactCount > _buckets.size()) { // keep chains around one entry long
+            _rehash(_buckets.size() * 2);
+        } else {
+            _bucketFor(host).push_back(entry);
+        }
+    } else {
+        _wildcards.push_back(entry);
+    }
+    return true;
+}
+
+bool MaskSet::remove(const std::string& pattern) {
+    std::string folded = Mask::fold(pattern);
+    for (std::vector<Entry*>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        if (Mask::fold((*it)->mask.getPattern()) != folded) {
+            continue;
+        }
+        Entry* entry = *it;
+        std::string host;
+        std::vector<Entry*>& from = entry->exactHost && _exactHostOf(entry->mask, host) ? _bucketFor(host) : _wildcards;
+        from.erase(std::find(from.begin(), from.end(), entry));
+        if (entry->exactHost) {
+            --_exactCount;
+        }
+        _entries.erase(it);
+        delete entry;
+        return true;
+    }
+    return false;
+}
+
+const std::vector<MaskSet::Entry*>& MaskSet::getEntries() const { return _entries; }
+
+size_t MaskSet::size() const { return _entries.size(); }
+
+bool MaskSet::empty() const { return _entries.empty(); }
+
+bool MaskSet::matches(const std::string& fullName, const std::string& foldedHost) const {
+    if (_entries.empty()) {
+        return false;
+    }
+    if (_exactCount != 0) {
+        const std::vector<Entry*>& bucket = _buckets[_hash(foldedHost) & (_buckets.size() - 1)];
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            if (bucket[i]->mask.matches(fullName)) {
+                return true;
+            }
+        }
+    }
+    for (size_t i = 0; i < _wildcards.size(); ++i) {
+        if (_wildcards[i]->mask.matches(fullName)) {
+            return true;
+        }
+    }
+    return false;
+}
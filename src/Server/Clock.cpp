@@ -0,0 +1,26 @@
+#include "../../inc/Clock.hpp"
+
+unsigned long Clock::_monotonicMs = 0;
+std::time_t Clock::_wall = 0;
+unsigned long Clock::_wallMs = 0;
+
+void Clock::update() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    _monotonicMs = static_cast<unsigned long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    _wall = ts.tv_sec;
+    _wallMs = static_cast<unsigned long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+unsigned long Clock::monotonicMs() { return _monotonicMs; }
+
+std::time_t Clock::now() { return _wall; }
+
+unsigned long Clock::wallMs() { return _wallMs; }
+
+unsigned long Clock::nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long>(ts.tv_sec) * 1000000000UL + ts.tv_nsec;
+}
@@ -0,0 +1,335 @@
+#include "../../inc/Config.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+static const size_t DEFAULT_SENDQ = 1024 * 1024;
+static const size_t DEFAULT_RECVQ = 8192;
+
+//numeric settings, each with the range it is clamped to
+struct NumberSetting {
+    const char* name;
+    size_t Config::*field;
+    size_t min;
+    size_t max;
+};
+
+static const NumberSetting g_numbers[] = {
+    { "listen_backlog",        &Config::listenBacklog,       1,    65535 },
+    { "poll_timeout_ms",       &Config::pollTimeoutMs,       0,    60000 },
+    { "loop_budget_ms",        &Config::loopBudgetMs,        0,    60000 },
+    { "stats_interval_ms",     &Config::statsIntervalMs,     10,   60000 },
+    { "recv_chunk",            &Config::recvChunk,           512,  1024 * 1024 },
+    { "max_line_length",       &Config::maxLineLength,       512,  16384 },
+    { "channel_name_max",      &Config::channelNameMax,      2,    200 },
+    { "ping_frequency",        &Config::pingFrequency,       5,    86400 },
+    { "ping_timeout",          &Config::pingTimeout,         5,    86400 },
+    { "flood_burst",           &Config::floodBurst,          0,    100000 },
+    { "flood_rate",            &Config::floodRate,           1,    100000 },
+    { "flood_disconnect",      &Config::floodDisconnect,     1,    3600 },
+    { "max_per_host",          &Config::maxPerHost,          1,    1000000 },
+    { "max_per_network",       &Config::maxPerNetwork,       1,    1000000 },
+    { "network_ipv4_bits",     &Config::networkV4Bits,       8,    32 },
+    { "network_ipv6_bits",     &Config::networkV6Bits,       16,   128 },
+    { "throttle_burst",        &Config::throttleBurst,       0,    100000 },
+    { "throttle_period",       &Config::throttlePeriod,      1,    86400 },
+    { "host_table_size",       &Config::hostTableSize,       64,   16 * 1024 * 1024 },
+    { "ident_port",            &Config::identPort,           1,    65535 },
+    { "lookup_timeout",        &Config::lookupTimeout,       1,    60 },
+    { "dns_cache_ttl",         &Config::dnsCacheTtl,         0,    86400 },
+    { "dns_cache_size",        &Config::dnsCacheSize,        0,    1000000 },
+    { "resolver_threads",      &Config::resolverThreads,     1,    64 },
+    { "registration_timeout",  &Config::registrationTimeout, 1,    3600 },
+    { "max_unregistered",      &Config::maxUnregistered,     1,    1000000 },
+    { "max_unregistered_per_host", &Config::maxUnregisteredPerHost, 1, 1000000 },
+    { "unregistered_sendq",    &Config::unregisteredSendq,   1024, 1024 * 1024 },
+    { "unregistered_recvq",    &Config::unregisteredRecvq,   512,  1024 * 1024 },
+    { "who_max_replies",       &Config::whoMaxReplies,       1,    100000 },
+    { "privmsg_target_max",    &Config::privmsgTargetMax,    1,    100 },
+    { "history_length",        &Config::historyLength,       0,    10000 },
+    { "history_memory_cap",    &Config::historyMemoryCap,    0,    static_cast<size_t>(-1) },
+    { "chathistory_max",       &Config::chathistoryMax,      1,    10000 },
+    { "history_segment_bytes", &Config::historySegmentBytes, 4096, static_cast<size_t>(-1) },
+    { "history_sync_ms",       &Config::historySyncMs,       10,   60000 },
+    { "event_segment_bytes",   &Config::eventSegmentBytes,   65536, 1024 * 1024 * 1024 },
+    { "event_segments",        &Config::eventSegments,       0,    1000000 }
+};
+
+static const size_t NUMBER_COUNT = sizeof(g_numbers) / sizeof(g_numbers[0]);
+
+static ConnectionClass defaultClass() {
+    ConnectionClass cls;
+    cls.name = "default";
+    cls.hosts.compile("*");
+    cls.sendq = DEFAULT_SENDQ;
+    cls.recvq = DEFAULT_RECVQ;
+    return cls;
+}
+
+Config::Config() : listenBacklog(128), logLevel(LOG_INFO), pollTimeoutMs(0), loopBudgetMs(50), statsIntervalMs(100), recvChunk(10240), maxLineLength(512),
+    channelNameMax(50), pingFrequency(120), pingTimeout(60),
+    floodBurst(20), floodRate(2), floodDisconnect(30),
+    maxPerHost(16), maxPerNetwork(64), networkV4Bits(24), networkV6Bits(64),
+    throttleBurst(10), throttlePeriod(60), hostTableSize(65536),
+    dnsLookup(true), identLookup(false), identPort(113), lookupTimeout(5),
+    dnsCacheTtl(300), dnsCacheSize(4096), resolverThreads(2),
+    registrationTimeout(30), maxUnregistered(1024), maxUnregisteredPerHost(8),
+    unregisteredSendq(16384), unregisteredRecvq(2048), whoMaxReplies(200), privmsgTargetMax(4), privmsgDedupe(true), commandStats(true),
+    historyLength(100), historyMemoryCap(16 * 1024 * 1024), chathistoryMax(100),
+    historySegmentBytes(4 * 1024 * 1024), historyRetentionMs(30UL * 24 * 3600 * 1000),
+    historyDir("history"), historySyncMs(1000), stateDir("state"),
+    eventDir("events"), eventSegmentBytes(4 * 1024 * 1024), eventSegments(64) {
+    classes.push_back(defaultClass());
+}
+
+static bool parseNumber(const std::string& value, size_t& out) {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    out = std::strtoul(value.c_str(), NULL, 10);
+    return true;
+}
+
+static bool parseBool(const std::string& value, bool& out) {
+    if (value == "yes" || value == "on" || value == "true") {
+        out = true;
+    } else if (value == "no" || value == "off" || value == "false") {
+        out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//"none" switches a directory (or file) setting off
+static std::string parseDir(const std::string& value) {
+    return value == "none" ? std::string() : value;
+}
+
+//a top level "key value" line
+static bool applySetting(Config& config, const std::string& key, const std::string& value, std::string& error) {
+    for (size_t i = 0; i < NUMBER_COUNT; ++i) {
+        if (key != g_numbers[i].name) {
+            continue;
+        }
+        size_t number;
+        if (!parseNumber(value, number)) {
+            error = key + " expects a number";
+            return false;
+        }
+        config.*g_numbers[i].field = std::max(g_numbers[i].min, std::min(number, g_numbers[i].max));
+        return true;
+    }
+    bool* flag = (key == "privmsg_dedupe") ? &config.privmsgDedupe
+               : (key == "command_stats") ? &config.commandStats
+               : (key == "dns_lookup") ? &config.dnsLookup
+               : (key == "ident_lookup") ? &config.identLookup : NULL;
+    if (flag) {
+        if (!parseBool(value, *flag)) {
+            error = key + " expects yes or no";
+            return false;
+        }
+    } else if (key == "log_level") {
+        if (!Log::parseLevel(value, config.logLevel)) {
+            error = key + " expects error, warn, info or debug";
+            return false;
+        }
+    } else if (key == "metrics_listen") {
+        config.metricsListen = parseDir(value);
+    } else if (key == "log_file") {
+        config.logFile = parseDir(value);
+    } else if (key == "history_retention_days") {
+        size_t days;
+        if (!parseNumber(value, days)) {
+            error = key + " expects a number";
+            return false;
+        }
+        config.historyRetentionMs = static_cast<unsigned long>(days) * 24 * 3600 * 1000;
+    } else if (key == "history_dir") {
+        config.historyDir = parseDir(value);
+    } else if (key == "state_dir") {
+        config.stateDir = parseDir(value);
+    } else if (key == "event_dir") {
+        config.eventDir = parseDir(value);
+    } else if (key == "stats_shm") {
+        config.statsShm = parseDir(value);
+    } else if (key == "dns_stub") {
+        config.dnsStub = parseDir(value);
+    } else {
+        error = "unknown setting " + key;
+        return false;
+    }
+    return true;
+}
+
+static bool applyClassSetting(ConnectionClass& cls, const std::string& key, const std::string& value, std::string& error) {
+    if (key == "hosts") {
+        cls.hosts.compile(value);
+    } else if (key == "sendq" || key == "recvq") {
+        if (!parseNumber(value, key == "sendq" ? cls.sendq : cls.recvq)) {
+            error = key + " expects a number";
+            return false;
+        }
+    } else {
+        error = "unknown class setting " + key;
+        return false;
+    }
+    return true;
+}
+
+static bool applyOperSetting(OperBlock& oper, const std::string& key, const std::string& value, std::string& error) {
+    if (key == "password") {
+        oper.password = value;
+    } else if (key == "hosts") {
+        oper.hosts.compile(value);
+    } else {
+        error = "unknown oper setting " + key;
+        return false;
+    }
+    return true;
+}
+
+bool Config::load(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + ": cannot open";
+        return false;
+    }
+    enum { TOP, IN_CLASS, IN_OPER } block = TOP;
+    bool ownClasses = false; // the first class block replaces the built-in default
+    std::string line;
+    for (size_t lineNo = 1; std::getline(file, line); ++lineNo) {
+        std::ostringstream where;
+        where << path << ":" << lineNo << ": ";
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::string key, value, extra;
+        if (!(words >> key)) {
+            continue;
+        }
+        words >> value >> extra;
+        if (key == "}" && value.empty()) {
+            if (block == TOP) {
+                error = where.str() + "unexpected }";
+                return false;
+            }
+            if (block == IN_OPER && opers.back().password.empty()) {
+                error = where.str() + "oper " + opers.back().name + " has no password";
+                return false;
+            }
+            block = TOP;
+            continue;
+        }
+        if ((key == "class" || key == "oper") && extra == "{") {
+            if (block != TOP) {
+                error = where.str() + "blocks do not nest";
+                return false;
+            }
+            if (key == "class") {
+                if (!ownClasses) {
+                    classes.clear();
+                    ownClasses = true;
+                }
+                classes.push_back(defaultClass());
+                classes.back().name = value;
+                block = IN_CLASS;
+            } else {
+                OperBlock oper;
+                oper.name = value;
+                oper.hosts.compile("*");
+                opers.push_back(oper);
+                block = IN_OPER;
+            }
+            continue;
+        }
+        if (value.empty() || !extra.empty()) {
+            error = where.str() + "expected \"" + key + " <value>\"";
+            return false;
+        }
+        std::string message;
+        bool ok = (block == IN_CLASS) ? applyClassSetting(classes.back(), key, value, message)
+                : (block == IN_OPER) ? applyOperSetting(opers.back(), key, value, message)
+                : applySetting(*this, key, value, message);
+        if (!ok) {
+            error = where.str() + message;
+            return false;
+        }
+    }
+    if (block != TOP) {
+        error = path + ": missing } at end of file";
+        return false;
+    }
+    if (classes.back().hosts.getPattern() != "*") {
+        classes.push_back(defaultClass());
+    }
+    return true;
+}
+
+void Config::keepStartupSettings(const Config& live, std::vector<std::string>& changed) {
+    if (listenBacklog != live.listenBacklog) {
+        changed.push_back("listen_backlog");
+        listenBacklog = live.listenBacklog;
+    }
+    if (metricsListen != live.metricsListen) {
+        changed.push_back("metrics_listen");
+        metricsListen = live.metricsListen;
+    }
+    if (logFile != live.logFile) {
+        changed.push_back("log_file");
+        logFile = live.logFile;
+    }
+    if (historyDir != live.historyDir) {
+        changed.push_back("history_dir");
+        historyDir = live.historyDir;
+    }
+    if (historySyncMs != live.historySyncMs) {
+        changed.push_back("history_sync_ms");
+        historySyncMs = live.historySyncMs;
+    }
+    if (hostTableSize != live.hostTableSize) {
+        changed.push_back("host_table_size");
+        hostTableSize = live.hostTableSize;
+    }
+    if (resolverThreads != live.resolverThreads) {
+        changed.push_back("resolver_threads");
+        resolverThreads = live.resolverThreads;
+    }
+    if (dnsStub != live.dnsStub) {
+        changed.push_back("dns_stub");
+        dnsStub = live.dnsStub;
+    }
+    if (stateDir != live.stateDir) {
+        changed.push_back("state_dir");
+        stateDir = live.stateDir;
+    }
+    if (eventDir != live.eventDir) {
+        changed.push_back("event_dir");
+        eventDir = live.eventDir;
+    }
+    if (statsShm != live.statsShm) {
+        changed.push_back("stats_shm");
+        statsShm = live.statsShm;
+    }
+}
+
+const ConnectionClass& Config::classFor(const std::string& host) const {
+    for (size_t i = 0; i + 1 < classes.size(); ++i) {
+        if (classes[i].hosts.matches(host)) {
+            return classes[i];
+        }
+    }
+    return classes.back();
+}
+
+const OperBlock* Config::findOper(const std::string& name) const {
+    for (size_t i = 0; i < opers.size(); ++i) {
+        if (opers[i].name == name) {
+            return &opers[i];
+        }
+    }
+    return NULL;
+}
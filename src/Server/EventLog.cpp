@@ -0,0 +1,188 @@
+#include "../../inc/EventLog.hpp"
+#include "../../inc/Clock.hpp"
+#include "../../inc/Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const size_t RECORD_SIZE = sizeof(EventRecord);
+
+static size_t stringSlots(size_t len) {
+    return (std::min<size_t>(len, EVENT_STRING_MAX) + RECORD_SIZE - 1) / RECORD_SIZE;
+}
+
+static std::string segmentPath(const std::string& dir, unsigned long seq) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "events-%08lu.bin", seq);
+    return dir + "/" + name;
+}
+
+//sequence numbers of the segments in dir, oldest first
+static std::vector<unsigned long> listSegments(const std::string& dir) {
+    std::vector<unsigned long> seqs;
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) {
+        return seqs;
+    }
+    while (struct dirent* entry = readdir(handle)) {
+        unsigned long seq;
+        char tail;
+        if (std::sscanf(entry->d_name, "events-%lu.bi%c", &seq, &tail) == 2 && tail == 'n') {
+            seqs.push_back(seq);
+        }
+    }
+    closedir(handle);
+    std::sort(seqs.begin(), seqs.end());
+    return seqs;
+}
+
+EventLog::EventLog() : _fd(-1), _map(NULL), _mapped(0), _used(0), _seq(0),
+    _segmentBytes(4 * 1024 * 1024), _segmentsKept(0), _nextString(1) {}
+
+EventLog::~EventLog() {
+    close();
+}
+
+bool EventLog::isOpen() const { return _map != NULL; }
+
+void EventLog::setLimits(size_t segmentBytes, size_t segmentsKept) {
+    _segmentBytes = segmentBytes;
+    _segmentsKept = segmentsKept;
+}
+
+//a restart never appends to an old segment, it starts the next one
+bool EventLog::open(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        LOG(LOG_ERROR, "events: cannot create " << dir << ": " << strerror(errno));
+        return false;
+    }
+    _dir = dir;
+    std::vector<unsigned long> seqs = listSegments(dir);
+    _seq = seqs.empty() ? 0 : seqs.back();
+    if (!_startSegment()) {
+        return false;
+    }
+    _prune();
+    return true;
+}
+
+void EventLog::close() {
+    if (_map) {
+        _seal();
+    }
+}
+
+bool EventLog::_startSegment() {
+    std::string path = segmentPath(_dir, ++_seq);
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd == -1) {
+        LOG(LOG_ERROR, "events: cannot open " << path << ": " << strerror(errno));
+        return false;
+    }
+    if (ftruncate(_fd, _segmentBytes) == -1) {
+        LOG(LOG_ERROR, "events: cannot size " << path << ": " << strerror(errno));
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    void* addr = mmap(NULL, _segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG(LOG_ERROR, "events: cannot map " << path << ": " << strerror(errno));
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _map = static_cast<char*>(addr);
+    _mapped = _segmentBytes;
+    EventHeader* header = reinterpret_cast<EventHeader*>(_map);
+    std::memcpy(header->magic, EVENT_MAGIC, sizeof(header->magic));
+    header->version = EVENT_VERSION;
+    header->recordSize = RECORD_SIZE;
+    header->seq = _seq;
+    header->createdMs = Clock::wallMs();
+    _used = sizeof(EventHeader);
+    _strings.clear();
+    _nextString = 1;
+    return true;
+}
+
+//unmaps the segment and gives back the unused tail
+void EventLog::_seal() {
+    munmap(_map, _mapped);
+    _map = NULL;
+    if (ftruncate(_fd, _used) == -1) {
+        LOG(LOG_WARN, "events: cannot trim segment " << _seq << ": " << strerror(errno));
+    }
+    ::close(_fd);
+    _fd = -1;
+}
+
+void EventLog::_prune() {
+    if (_segmentsKept == 0) {
+        return;
+    }
+    std::vector<unsigned long> seqs = listSegments(_dir);
+    for (size_t i = 0; i + _segmentsKept < seqs.size(); ++i) {
+        unlink(segmentPath(_dir, seqs[i]).c_str());
+    }
+}
+
+EventRecord* EventLog::_slot() {
+    EventRecord* record = reinterpret_cast<EventRecord*>(_map + _used);
+    _used += RECORD_SIZE;
+    return record;
+}
+
+unsigned int EventLog::_intern(const std::string& str) {
+    if (str.empty()) {
+        return 0;
+    }
+    std::map<std::string, unsigned int>::iterator it = _strings.find(str);
+    if (it != _strings.end()) {
+        return it->second;
+    }
+    unsigned int id = _nextString++;
+    size_t len = std::min<size_t>(str.length(), EVENT_STRING_MAX);
+    EventRecord* record = _slot();
+    record->timeMs = Clock::wallMs();
+    record->type = EV_STRING;
+    record->len = static_cast<unsigned short>(len);
+    record->args[0] = id;
+    std::memcpy(_map + _used, str.data(), len); // the fresh file is zero filled, so is the padding
+    _used += stringSlots(len) * RECORD_SIZE;
+    _strings.insert(std::make_pair(str, id));
+    return id;
+}
+
+//rotates first if the record and every string it might define do not fit,
+//so a record never refers to a string in another segment
+void EventLog::record(EventType type, unsigned int conn, const std::string& a, const std::string& b,
+                      const std::string& c, const std::string& d) {
+    if (!_map) {
+        return;
+    }
+    size_t worst = 5 + stringSlots(a.length()) + stringSlots(b.length()) + stringSlots(c.length()) + stringSlots(d.length());
+    if (_used + worst * RECORD_SIZE > _mapped) {
+        _seal();
+        if (!_startSegment()) {
+            LOG(LOG_ERROR, "events: recording stopped");
+            return;
+        }
+        _prune();
+    }
+    unsigned int args[4] = { _intern(a), _intern(b), _intern(c), _intern(d) };
+    EventRecord* record = _slot();
+    record->timeMs = Clock::wallMs();
+    record->conn = conn;
+    record->type = static_cast<unsigned short>(type);
+    record->len = 0;
+    std::memcpy(record->args, args, sizeof(args));
+}
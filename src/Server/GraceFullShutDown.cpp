@@ -8,20 +8,27 @@ void Server::CleanClient(int i) {
 
     if (_clients.count(fd)) {
         Client* client = _clients[fd];
-        for (std::set<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        LOG(LOG_DEBUG, "Client " << fd << " released (" << client->getMemoryFootprint() << " bytes)");
+        std::vector<Channel*> joined = client->getJoinedChannels(); // copy, removeClient edits the list
+        for (std::vector<Channel*>::iterator it = joined.begin(); it != joined.end(); ++it) {
             (*it)->removeClient(client->getNickname());
         }
+        _unindexClient(client);
 
         delete client;
         _clients.erase(fd);
+    } else {
+        _metrics.forget(fd); // a scrape
     }
 
     close(fd);
-    _poll_fds.erase(_poll_fds.begin() + i);
+    _removePollSlot(i);
 }
 
 void Server::CleanAllClients(){
-    for (size_t i = _poll_fds.size() - 1; i > 0;i--)//we start claenin from end since last cleand should be the serv
+    if (_poll_fds.empty()) // never started listening, e.g. a bad config file
+        return;
+    for (size_t i = _poll_fds.size() - 1; i >= FIRST_CLIENT_SLOT;i--)//we start claenin from end since last cleand should be the serv
         CleanClient(i);
     close(_poll_fds[0].fd);
     _clients.clear();
@@ -40,6 +47,12 @@ void Server::CleanAllChannels() {
 }
 
 Server::~Server() {
+    _journal.close(); // shutting down is not dropping the channels
+    CleanAllClients(); // before the channels, a client leaves the ones it joined
     CleanAllChannels();
-    CleanAllClients();
+    _metrics.close();
+    _statsSegment.close();
+    _events.record(EV_STOP, 0);
+    _events.close();
+    Log::stop();
 }
@@ -0,0 +1,72 @@
+#include "../../inc/Histogram.hpp"
+#include <cstring>
+
+static const unsigned long SUB_COUNT = 1UL << LatencyHistogram::SUB_BITS;
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::reset() {
+    std::memset(_counts, 0, sizeof(_counts));
+    _total = 0;
+    _sum = 0;
+    _max = 0;
+}
+
+//values below 2 * SUB_COUNT have a bucket each; above, the top SUB_BITS + 1
+//bits of the value pick the bucket
+size_t LatencyHistogram::bucketOf(unsigned long value) {
+    if (value < 2 * SUB_COUNT) {
+        return value;
+    }
+    unsigned int msb = 63 - __builtin_clzl(value);
+    unsigned int shift = msb - SUB_BITS;
+    size_t i = (shift + 1) * SUB_COUNT + (value >> shift) - SUB_COUNT;
+    return i < BUCKETS ? i : BUCKETS - 1;
+}
+
+unsigned long LatencyHistogram::bucketUpperBound(size_t i) {
+    if (i < 2 * SUB_COUNT) {
+        return i;
+    }
+    unsigned int shift = i / SUB_COUNT - 1;
+    unsigned long low = (i % SUB_COUNT + SUB_COUNT) << shift;
+    return low + (1UL << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long value) {
+    ++_counts[bucketOf(value)];
+    ++_total;
+    _sum += value;
+    if (value > _max) {
+        _max = value;
+    }
+}
+
+unsigned long LatencyHistogram::count() const { return _total; }
+
+unsigned long LatencyHistogram::sum() const { return _sum; }
+
+unsigned long LatencyHistogram::max() const { return _max; }
+
+unsigned long LatencyHistogram::bucketCount(size_t i) const { return _counts[i]; }
+
+unsigned long LatencyHistogram::percentile(double q) const {
+    if (_total == 0) {
+        return 0;
+    }
+    unsigned long wanted = static_cast<unsigned long>(q * _total + 0.5);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    unsigned long seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += _counts[i];
+        if (seen >= wanted) {
+            unsigned long bound = bucketUpperBound(i);
+            return bound < _max ? bound : _max;
+        }
+    }
+    return _max;
+}
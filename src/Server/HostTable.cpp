@@ -0,0 +1,211 @@
+#include "../../inc/HostTable.hpp"
+#include <cstring>
+#include <netinet/in.h>
+
+HostKey HostKey::fromSockaddr(const struct sockaddr* addr) {
+    HostKey key;
+    std::memset(key.bytes, 0, sizeof(key.bytes));
+    key.prefix = 128;
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = reinterpret_cast<const struct sockaddr_in6*>(addr);
+        std::memcpy(key.bytes, &in6->sin6_addr, sizeof(key.bytes));
+    } else {
+        const struct sockaddr_in* in = reinterpret_cast<const struct sockaddr_in*>(addr);
+        key.bytes[10] = 0xff;
+        key.bytes[11] = 0xff;
+        std::memcpy(key.bytes + 12, &in->sin_addr, 4);
+    }
+    return key;
+}
+
+bool HostKey::isV4() const {
+    static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    return std::memcmp(bytes, mapped, sizeof(mapped)) == 0;
+}
+
+HostKey HostKey::network(unsigned int v4Bits, unsigned int v6Bits) const {
+    HostKey net = *this;
+    unsigned int bits = isV4() ? 96 + v4Bits : v6Bits;
+    if (bits > 128) {
+        bits = 128;
+    }
+    for (unsigned int i = 0; i < 16; ++i) {
+        if (bits >= 8 * (i + 1)) {
+            continue;
+        }
+        unsigned int keep = (bits > 8 * i) ? bits - 8 * i : 0;
+        net.bytes[i] &= static_cast<unsigned char>(0xff00 >> keep);
+    }
+    net.prefix = static_cast<unsigned char>(bits);
+    return net;
+}
+
+bool HostKey::operator==(const HostKey& other) const {
+    return prefix == other.prefix && std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+HostTable::HostTable() : _mask(0), _used(0), _lingerHead(0), _lingerCount(0), _burst(0), _periodMs(0) {}
+
+void HostTable::reserve(size_t capacity) {
+    size_t size = 16;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    Entry empty;
+    std::memset(&empty, 0, sizeof(empty));
+    _slots.assign(size, empty);
+    _mask = size - 1;
+    _used = 0;
+    _lingering.assign(size, empty.key);
+    _lingerHead = 0;
+    _lingerCount = 0;
+}
+
+void HostTable::setThrottle(unsigned long burst, unsigned long periodMs) {
+    _burst = burst;
+    _periodMs = periodMs;
+}
+
+//FNV-1a over the address and prefix
+size_t HostTable::_hash(const HostKey& key) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(key.bytes); ++i) {
+        hash = (hash ^ key.bytes[i]) * 16777619u;
+    }
+    return (hash ^ key.prefix) * 16777619u;
+}
+
+size_t HostTable::_home(const HostKey& key) const {
+    return _hash(key) & _mask;
+}
+
+HostTable::Entry* HostTable::find(const HostKey& key) {
+    if (_slots.empty()) {
+        return NULL;
+    }
+    for (size_t slot = _home(key); _slots[slot].used; slot = (slot + 1) & _mask) {
+        if (_slots[slot].key == key) {
+            return &_slots[slot];
+        }
+    }
+    return NULL;
+}
+
+HostTable::Entry* HostTable::acquire(const HostKey& key, unsigned long nowMs) {
+    Entry* entry = find(key);
+    if (entry || _slots.empty()) {
+        return entry;
+    }
+    //kept at most 3/4 full so probes stay short
+    if ((_used + 1) * 4 > _slots.size() * 3) {
+        return NULL;
+    }
+    size_t slot = _home(key);
+    while (_slots[slot].used) {
+        slot = (slot + 1) & _mask;
+    }
+    Entry& fresh = _slots[slot];
+    fresh.key = key;
+    fresh.connections = 0;
+    fresh.unregistered = 0;
+    fresh.tokens = _burst * 1000;
+    fresh.refilledMs = nowMs;
+    fresh.used = true;
+    fresh.lingering = false;
+    ++_used;
+    return &fresh;
+}
+
+//backward shift deletion: later members of the cluster that would be found
+//from here move into the hole, so no lookup ever stops short of them
+void HostTable::_erase(size_t hole) {
+    _slots[hole].used = false;
+    --_used;
+    for (size_t slot = (hole + 1) & _mask; _slots[slot].used; slot = (slot + 1) & _mask) {
+        size_t home = _home(_slots[slot].key);
+        //the entry may move if its home is not cyclically within (hole, slot]
+        bool movable = (hole <= slot) ? (home <= hole || home > slot) : (home <= hole && home > slot);
+        if (movable) {
+            _slots[hole] = _slots[slot];
+            _slots[slot].used = false;
+            hole = slot;
+        }
+    }
+}
+
+void HostTable::_refill(Entry& entry, unsigned long nowMs) const {
+    unsigned long full = _burst * 1000;
+    if (_periodMs == 0 || entry.tokens >= full) {
+        entry.tokens = full;
+        entry.refilledMs = nowMs;
+        return;
+    }
+    unsigned long earned = (nowMs - entry.refilledMs) * full / _periodMs;
+    if (earned == 0) {
+        return;
+    }
+    entry.tokens = (entry.tokens + earned < full) ? entry.tokens + earned : full;
+    entry.refilledMs = nowMs;
+}
+
+bool HostTable::_idle(Entry& entry, unsigned long nowMs) const {
+    if (entry.connections != 0) {
+        return false;
+    }
+    _refill(entry, nowMs);
+    return entry.tokens >= _burst * 1000;
+}
+
+bool HostTable::takeToken(Entry& entry, unsigned long nowMs) const {
+    if (_burst == 0) {
+        return true; // throttle off
+    }
+    _refill(entry, nowMs);
+    if (entry.tokens < 1000) {
+        return false;
+    }
+    entry.tokens -= 1000;
+    return true;
+}
+
+//an entry is on the ring at most once, so the ring never holds more keys
+//than the table has slots
+void HostTable::release(const HostKey& key, unsigned long nowMs) {
+    Entry* entry = find(key);
+    if (entry == NULL || entry->connections != 0) {
+        return;
+    }
+    if (_idle(*entry, nowMs)) {
+        _erase(entry - &_slots[0]);
+    } else if (!entry->lingering && _lingerCount < _lingering.size()) {
+        entry->lingering = true;
+        _lingering[(_lingerHead + _lingerCount) & _mask] = key;
+        ++_lingerCount;
+    }
+}
+
+//Hosts that left but were still throttled stay until their bucket refilled.
+//The ring is walked from its oldest end only: keys that connected again or
+//went away are skipped, refilled ones dropped, and the first one still
+//throttled ends the walk, so an accept never pays for the whole table.
+bool HostTable::makeRoom(size_t count, unsigned long nowMs) {
+    while (_lingerCount != 0) {
+        Entry* entry = find(_lingering[_lingerHead]);
+        if (entry && entry->connections == 0 && !_idle(*entry, nowMs)) {
+            break;
+        }
+        _lingerHead = (_lingerHead + 1) & _mask;
+        --_lingerCount;
+        if (entry) {
+            entry->lingering = false;
+            if (entry->connections == 0) {
+                _erase(entry - &_slots[0]);
+            }
+        }
+    }
+    return (_used + count) * 4 <= _slots.size() * 3;
+}
+
+size_t HostTable::size() const { return _used; }
+
+size_t HostTable::capacity() const { return _slots.size(); }
@@ -0,0 +1,248 @@
+#include "../../inc/Log.hpp"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+//a bounded multi-producer ring: each slot carries a sequence number telling
+//whose turn it is, so producers only race on the head counter
+struct LogSlot {
+    volatile unsigned long seq;
+    unsigned char level;
+    unsigned short len;
+    long wallSec;
+    long wallMs;
+    char text[Log::LINE_MAX];
+};
+
+static const unsigned long RING_SLOTS = 4096; // power of two
+static const unsigned int IDLE_SLEEP_MS = 20;
+
+static LogSlot g_ring[RING_SLOTS];
+static volatile unsigned long g_head = 0;     // next slot a producer claims
+static unsigned long g_tail = 0;              // next slot the writer reads
+static volatile unsigned long g_dropped = 0;
+static volatile bool g_running = false;
+static volatile bool g_stopping = false;
+static bool g_atexit = false;
+static pthread_t g_writer;
+static int g_fd = STDOUT_FILENO;
+
+static const char* const g_levelNames[] = { "error", "warn", "info", "debug" };
+
+volatile int Log::_level = LOG_INFO;
+
+static void writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t done = write(fd, data, len);
+        if (done <= 0) {
+            return;
+        }
+        data += done;
+        len -= done;
+    }
+}
+
+//"2026-01-31 23:59:59.123 [info] text\n"
+static void formatLine(std::string& out, LogLevel level, long wallSec, long wallMs, const char* text, size_t len) {
+    time_t sec = static_cast<time_t>(wallSec);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char stamp[40];
+    size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    stamp[n++] = '.';
+    stamp[n++] = static_cast<char>('0' + wallMs / 100);
+    stamp[n++] = static_cast<char>('0' + wallMs / 10 % 10);
+    stamp[n++] = static_cast<char>('0' + wallMs % 10);
+    out.append(stamp, n);
+    out += " [";
+    out += g_levelNames[level];
+    out += "] ";
+    out.append(text, len);
+    out += '\n';
+}
+
+static void* writerLoop(void*) {
+    std::string batch;
+    while (true) {
+        bool stopping = g_stopping;
+        for (;;) {
+            LogSlot& slot = g_ring[g_tail & (RING_SLOTS - 1)];
+            if (slot.seq != g_tail + 1) {
+                break;
+            }
+            __sync_synchronize(); // read the text only after seeing the producer's seq
+            formatLine(batch, static_cast<LogLevel>(slot.level), slot.wallSec, slot.wallMs, slot.text, slot.len);
+            __sync_synchronize();
+            slot.seq = g_tail + RING_SLOTS;
+            ++g_tail;
+        }
+        unsigned long dropped = __sync_lock_test_and_set(&g_dropped, 0UL);
+        if (dropped != 0) {
+            char note[64];
+            size_t len = snprintf(note, sizeof(note), "log: %lu lines dropped, the ring was full", dropped);
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            formatLine(batch, LOG_WARN, now.tv_sec, now.tv_nsec / 1000000, note, len);
+        }
+        if (!batch.empty()) {
+            writeAll(g_fd, batch.data(), batch.size());
+            batch.clear();
+        } else if (stopping) {
+            return NULL;
+        } else {
+            struct timespec idle;
+            idle.tv_sec = 0;
+            idle.tv_nsec = IDLE_SLEEP_MS * 1000000L;
+            nanosleep(&idle, NULL);
+        }
+    }
+}
+
+bool Log::start(const std::string& path) {
+    if (g_running) {
+        return true;
+    }
+    for (unsigned long i = 0; i < RING_SLOTS; ++i) {
+        g_ring[i].seq = i;
+    }
+    g_head = 0;
+    g_tail = 0;
+    if (!path.empty()) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            LOG(LOG_ERROR, "log: cannot open " << path << ": " << strerror(errno));
+            return false;
+        }
+        g_fd = fd;
+    }
+    g_stopping = false;
+    g_running = (pthread_create(&g_writer, NULL, &writerLoop, NULL) == 0);
+    if (!g_running) {
+        LOG(LOG_WARN, "log: writer thread failed to start, logging from the event loop");
+    } else if (!g_atexit) {
+        atexit(&Log::stop); // the exit(EXIT_FAILURE) paths still get their last lines out
+        g_atexit = true;
+    }
+    return true;
+}
+
+void Log::stop() {
+    if (!g_running) {
+        return;
+    }
+    g_stopping = true;
+    pthread_join(g_writer, NULL);
+    g_running = false;
+    if (g_fd != STDOUT_FILENO) {
+        close(g_fd);
+        g_fd = STDOUT_FILENO;
+    }
+}
+
+void Log::setLevel(LogLevel level) {
+    _level = level;
+}
+
+bool Log::parseLevel(const std::string& name, LogLevel& level) {
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; ++i) {
+        if (name == g_levelNames[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Log::push(LogLevel level, const char* text, size_t len) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (!g_running) {
+        std::string line;
+        formatLine(line, level, now.tv_sec, now.tv_nsec / 1000000, text, len);
+        writeAll(level <= LOG_WARN ? STDERR_FILENO : g_fd, line.data(), line.size());
+        return;
+    }
+    unsigned long pos = g_head;
+    LogSlot* slot;
+    for (;;) {
+        slot = &g_ring[pos & (RING_SLOTS - 1)];
+        long diff = static_cast<long>(slot->seq - pos);
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&g_head, pos, pos + 1)) {
+                break;
+            }
+            pos = g_head;
+        } else if (diff < 0) {
+            __sync_fetch_and_add(&g_dropped, 1UL); // the writer is a whole ring behind
+            return;
+        } else {
+            pos = g_head;
+        }
+    }
+    slot->level = static_cast<unsigned char>(level);
+    slot->len = static_cast<unsigned short>(len);
+    slot->wallSec = now.tv_sec;
+    slot->wallMs = now.tv_nsec / 1000000;
+    std::memcpy(slot->text, text, len);
+    __sync_synchronize(); // the text must be visible before the writer sees seq
+    slot->seq = pos + 1;
+}
+
+LogLine::LogLine(LogLevel level) : _level(level), _len(0) {}
+
+LogLine::~LogLine() {
+    Log::push(_level, _buf, _len);
+}
+
+LogLine& LogLine::_append(const char* data, size_t len) {
+    size_t room = sizeof(_buf) - _len;
+    if (len > room) {
+        len = room;
+    }
+    std::memcpy(_buf + _len, data, len);
+    _len += len;
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const char* str) {
+    return _append(str, std::strlen(str));
+}
+
+LogLine& LogLine::operator<<(const std::string& str) {
+    return _append(str.data(), str.length());
+}
+
+LogLine& LogLine::operator<<(char c) {
+    return _append(&c, 1);
+}
+
+LogLine& LogLine::operator<<(int value) {
+    return *this << static_cast<long>(value);
+}
+
+LogLine& LogLine::operator<<(unsigned int value) {
+    return *this << static_cast<unsigned long>(value);
+}
+
+LogLine& LogLine::operator<<(long value) {
+    if (value < 0) {
+        *this << '-';
+        return *this << (0UL - static_cast<unsigned long>(value));
+    }
+    return *this << static_cast<unsigned long>(value);
+}
+
+LogLine& LogLine::operator<<(unsigned long value) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    do {
+        digits[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return _append(digits + pos, sizeof(digits) - pos);
+}
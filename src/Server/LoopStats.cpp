@@ -0,0 +1,120 @@
+#include "../../inc/LoopStats.hpp"
+#include "../../inc/Log.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+LoopStats::LoopStats() : _lastBacklogBytes(0), _lastBacklogClients(0), _lastWarnSecond(0), _suppressed(0) {
+    std::memset(_slots, 0, sizeof(_slots));
+    for (size_t i = 0; i < SECONDS; ++i) {
+        _slotSecond[i] = static_cast<unsigned long>(-1);
+    }
+    std::memset(&_pass, 0, sizeof(_pass));
+}
+
+//a slot left over from a minute ago is cleared before it is reused
+LoopStats::Window& LoopStats::_slotFor(unsigned long second) {
+    size_t i = second % SECONDS;
+    if (_slotSecond[i] != second) {
+        std::memset(&_slots[i], 0, sizeof(_slots[i]));
+        _slotSecond[i] = second;
+    }
+    return _slots[i];
+}
+
+LoopStats::Pass& LoopStats::begin(unsigned long nowNs, int events) {
+    std::memset(&_pass, 0, sizeof(_pass));
+    _pass.startNs = nowNs;
+    _pass.events = events > 0 ? events : 0;
+    return _pass;
+}
+
+LoopStats::Pass& LoopStats::pass() { return _pass; }
+
+//"12.3", for the budget warning
+static std::string ms(unsigned long ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%lu.%lu", ns / 1000000, ns / 100000 % 10);
+    return text;
+}
+
+void LoopStats::end(unsigned long nowNs, unsigned long nowMs, unsigned long budgetNs,
+                    unsigned long backlogBytes, unsigned long backlogClients) {
+    unsigned long passNs = nowNs - _pass.startNs;
+    unsigned long second = nowMs / 1000;
+    Window& slot = _slotFor(second);
+    ++slot.passes;
+    if (_pass.events != 0) {
+        ++slot.wakeups;
+    }
+    slot.events += _pass.events;
+    if (_pass.events > slot.maxEvents) {
+        slot.maxEvents = _pass.events;
+    }
+    slot.busyNs += passNs;
+    if (passNs > slot.maxPassNs) {
+        slot.maxPassNs = passNs;
+    }
+    slot.timersNs += _pass.timersNs;
+    slot.acceptNs += _pass.acceptNs;
+    slot.recvNs += _pass.recvNs;
+    slot.dispatchNs += _pass.dispatchNs;
+    slot.sendNs += _pass.sendNs;
+    if (backlogBytes > slot.maxBacklogBytes) {
+        slot.maxBacklogBytes = backlogBytes;
+    }
+    if (backlogClients > slot.maxBacklogClients) {
+        slot.maxBacklogClients = backlogClients;
+    }
+    _lastBacklogBytes = backlogBytes;
+    _lastBacklogClients = backlogClients;
+    if (budgetNs == 0 || passNs <= budgetNs) {
+        return;
+    }
+    ++slot.overBudget;
+    if (second == _lastWarnSecond) {
+        ++_suppressed;
+        return;
+    }
+    LOG(LOG_WARN, "loop: pass took " << ms(passNs) << " ms, over the " << budgetNs / 1000000 << " ms budget (timers "
+        << ms(_pass.timersNs) << ", accept " << ms(_pass.acceptNs) << ", recv " << ms(_pass.recvNs)
+        << ", dispatch " << ms(_pass.dispatchNs) << ", send " << ms(_pass.sendNs) << " ms; " << _pass.events
+        << " events, " << backlogBytes << " bytes queued to " << backlogClients << " clients)");
+    if (_suppressed != 0) {
+        LOG(LOG_WARN, "loop: " << _suppressed << " more passes over budget since the last warning");
+        _suppressed = 0;
+    }
+    _lastWarnSecond = second;
+}
+
+LoopStats::Window LoopStats::sum(size_t seconds, unsigned long nowMs) const {
+    Window total;
+    std::memset(&total, 0, sizeof(total));
+    unsigned long now = nowMs / 1000;
+    for (size_t back = 1; back <= seconds && back < SECONDS && back <= now; ++back) {
+        size_t i = (now - back) % SECONDS;
+        if (_slotSecond[i] != now - back) {
+            continue;
+        }
+        const Window& slot = _slots[i];
+        total.passes += slot.passes;
+        total.wakeups += slot.wakeups;
+        total.events += slot.events;
+        total.maxEvents = slot.maxEvents > total.maxEvents ? slot.maxEvents : total.maxEvents;
+        total.busyNs += slot.busyNs;
+        total.maxPassNs = slot.maxPassNs > total.maxPassNs ? slot.maxPassNs : total.maxPassNs;
+        total.timersNs += slot.timersNs;
+        total.acceptNs += slot.acceptNs;
+        total.recvNs += slot.recvNs;
+        total.dispatchNs += slot.dispatchNs;
+        total.sendNs += slot.sendNs;
+        total.overBudget += slot.overBudget;
+        total.maxBacklogBytes = slot.maxBacklogBytes > total.maxBacklogBytes ? slot.maxBacklogBytes : total.maxBacklogBytes;
+        total.maxBacklogClients = slot.maxBacklogClients > total.maxBacklogClients ? slot.maxBacklogClients : total.maxBacklogClients;
+    }
+    return total;
+}
+
+unsigned long LoopStats::getBacklogBytes() const { return _lastBacklogBytes; }
+
+unsigned long LoopStats::getBacklogClients() const { return _lastBacklogClients; }
@@ -0,0 +1,178 @@
+#include "../../inc/MetricsListener.hpp"
+#include "../../inc/Server.hpp"
+#include <sys/stat.h>
+#include <sys/un.h>
+
+MetricsListener::MetricsListener() : _fd(-1) {}
+
+MetricsListener::~MetricsListener() {
+    close();
+}
+
+//"9100" listens on 127.0.0.1:9100, "address:port" on that address
+bool MetricsListener::_listenTcp(const std::string& spec) {
+    std::string::size_type colon = spec.rfind(':');
+    std::string address = colon == std::string::npos ? "127.0.0.1" : spec.substr(0, colon);
+    std::string port = colon == std::string::npos ? spec : spec.substr(colon + 1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    unsigned long number = std::strtoul(port.c_str(), NULL, 10);
+    if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos || number == 0 || number > 65535
+        || inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        LOG(LOG_ERROR, "metrics_listen " << spec << ": expected a port, an address:port or a socket path");
+        return false;
+    }
+    addr.sin_port = htons(static_cast<unsigned short>(number));
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    int option = 1;
+    if (_fd == -1 || setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option)) == -1
+        || bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        LOG(LOG_ERROR, "metrics_listen " << spec << ": " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+//a socket left behind by an earlier run is replaced, any other file is not
+bool MetricsListener::_listenUnix(const std::string& path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG(LOG_ERROR, "metrics_listen " << path << ": path too long");
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+    _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_fd == -1 || bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        LOG(LOG_ERROR, "metrics_listen " << path << ": " << strerror(errno));
+        return false;
+    }
+    _path = path;
+    return true;
+}
+
+bool MetricsListener::open(const std::string& spec) {
+    bool bound = spec[0] == '/' ? _listenUnix(spec) : _listenTcp(spec);
+    if (!bound || listen(_fd, static_cast<int>(MAX_SESSIONS)) == -1 || fcntl(_fd, F_SETFL, O_NONBLOCK) == -1) {
+        if (bound) {
+            LOG(LOG_ERROR, "metrics_listen " << spec << ": " << strerror(errno));
+        }
+        close();
+        return false;
+    }
+    LOG(LOG_INFO, "Metrics are served on " << spec);
+    return true;
+}
+
+void MetricsListener::close() {
+    for (std::map<int, Session>::iterator it = _sessions.begin(); it != _sessions.end(); ++it) {
+        ::close(it->first);
+    }
+    _sessions.clear();
+    if (_fd != -1) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    if (!_path.empty()) {
+        unlink(_path.c_str());
+        _path.clear();
+    }
+}
+
+int MetricsListener::getFd() const { return _fd; }
+
+int MetricsListener::accept(unsigned long nowMs) {
+    int fd = ::accept(_fd, NULL, NULL);
+    if (fd == -1) {
+        return -1;
+    }
+    if (_sessions.size() >= MAX_SESSIONS || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        ::close(fd);
+        return -1;
+    }
+    Session& session = _sessions[fd];
+    session.sent = 0;
+    session.openedMs = nowMs;
+    return fd;
+}
+
+void MetricsListener::expired(unsigned long nowMs, std::vector<int>& fds) const {
+    for (std::map<int, Session>::const_iterator it = _sessions.begin(); it != _sessions.end(); ++it) {
+        if (nowMs - it->second.openedMs >= SESSION_TIMEOUT_MS) {
+            fds.push_back(it->first);
+        }
+    }
+}
+
+static std::string httpResponse(const char* status, const std::string& body, bool head) {
+    std::ostringstream out;
+    out << "HTTP/1.1 " << status << "\r\n"
+        << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n\r\n";
+    if (!head) {
+        out << body;
+    }
+    return out.str();
+}
+
+//only the request line matters, the headers are read and ignored
+static std::string answer(const std::string& request, const Server& server) {
+    std::istringstream line(request.substr(0, request.find_first_of("\r\n")));
+    std::string method, target, version;
+    line >> method >> target >> version;
+    if (version.compare(0, 5, "HTTP/") != 0) {
+        return httpResponse("400 Bad Request", "bad request\n", false);
+    }
+    bool head = method == "HEAD";
+    if (method != "GET" && !head) {
+        return httpResponse("405 Method Not Allowed", "only GET and HEAD\n", false);
+    }
+    if (target.substr(0, target.find('?')) != "/metrics") {
+        return httpResponse("404 Not Found", "try /metrics\n", head);
+    }
+    return httpResponse("200 OK", server.renderMetrics(), head);
+}
+
+bool MetricsListener::serve(int fd, short revents, const Server& server) {
+    std::map<int, Session>::iterator found = _sessions.find(fd);
+    if (found == _sessions.end() || (revents & (POLLERR | POLLNVAL))) {
+        return false;
+    }
+    Session& session = found->second;
+    if (session.response.empty()) {
+        char chunk[2048];
+        ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+        if (bytes <= 0) {
+            return bytes == -1 && errno == EAGAIN;
+        }
+        session.request.append(chunk, bytes);
+        if (session.request.find("\r\n\r\n") != std::string::npos || session.request.find("\n\n") != std::string::npos) {
+            session.response = answer(session.request, server);
+        } else if (session.request.size() > MAX_REQUEST) {
+            session.response = httpResponse("431 Request Header Fields Too Large", "request too large\n", false);
+        } else {
+            return true;
+        }
+    }
+    //a scrape is tens of kilobytes, it normally goes out right away
+    ssize_t bytes = send(fd, session.response.data() + session.sent, session.response.size() - session.sent, MSG_NOSIGNAL);
+    if (bytes == -1) {
+        return errno == EAGAIN;
+    }
+    session.sent += bytes;
+    return session.sent < session.response.size();
+}
+
+bool MetricsListener::wantsWrite(int fd) const {
+    std::map<int, Session>::const_iterator found = _sessions.find(fd);
+    return found != _sessions.end() && !found->second.response.empty();
+}
+
+void MetricsListener::forget(int fd) {
+    _sessions.erase(fd);
+}
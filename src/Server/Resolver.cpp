@@ -0,0 +1,392 @@
+#include "../../inc/Resolver.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+static const size_t HOSTNAME_MAX = 63;  // longer names are ignored, the address is shown instead
+static const size_t IDENT_USER_MAX = 10;
+
+ResolverBackend::~ResolverBackend() {}
+
+bool SystemResolver::reverse(const in_addr& addr, std::string& hostname) {
+    sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr = addr;
+    char host[NI_MAXHOST];
+    if (getnameinfo(reinterpret_cast<sockaddr*>(&sa), sizeof(sa), host, sizeof(host), NULL, 0, NI_NAMEREQD) != 0) {
+        return false;
+    }
+    hostname = host;
+    return true;
+}
+
+bool SystemResolver::forward(const std::string& hostname, std::vector<in_addr>& addrs) {
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    if (getaddrinfo(hostname.c_str(), NULL, &hints, &result) != 0) {
+        return false;
+    }
+    for (addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        addrs.push_back(reinterpret_cast<sockaddr_in*>(ai->ai_addr)->sin_addr);
+    }
+    freeaddrinfo(result);
+    return true;
+}
+
+bool StubResolver::load(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + ": cannot open";
+        return false;
+    }
+    std::string line;
+    for (size_t lineNo = 1; std::getline(file, line); ++lineNo) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::string type, first, second;
+        if (!(words >> type)) {
+            continue;
+        }
+        words >> first >> second;
+        const std::string& address = (type == "ptr") ? first : second;
+        const std::string& hostname = (type == "ptr") ? second : first;
+        in_addr addr;
+        if ((type != "ptr" && type != "a") || hostname.empty() || inet_pton(AF_INET, address.c_str(), &addr) != 1) {
+            std::ostringstream where;
+            where << path << ":" << lineNo << ": expected \"ptr <ipv4 address> <hostname>\" or \"a <hostname> <ipv4 address>\"";
+            error = where.str();
+            return false;
+        }
+        if (type == "ptr") {
+            _names[addr.s_addr] = hostname;
+        } else {
+            _addrs.insert(std::make_pair(hostname, addr.s_addr));
+        }
+    }
+    return true;
+}
+
+bool StubResolver::reverse(const in_addr& addr, std::string& hostname) {
+    std::map<in_addr_t, std::string>::const_iterator it = _names.find(addr.s_addr);
+    if (it == _names.end()) {
+        return false;
+    }
+    hostname = it->second;
+    return true;
+}
+
+bool StubResolver::forward(const std::string& hostname, std::vector<in_addr>& addrs) {
+    typedef std::multimap<std::string, in_addr_t>::const_iterator Iter;
+    std::pair<Iter, Iter> range = _addrs.equal_range(hostname);
+    for (Iter it = range.first; it != range.second; ++it) {
+        in_addr addr;
+        addr.s_addr = it->second;
+        addrs.push_back(addr);
+    }
+    return range.first != range.second;
+}
+
+Resolver::Resolver() : _stopping(false), _backend(NULL) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_wake, NULL);
+    _pipe[0] = -1;
+    _pipe[1] = -1;
+}
+
+Resolver::~Resolver() {
+    stop();
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool Resolver::start(size_t threads, ResolverBackend* backend) {
+    _backend = backend;
+    if (pipe(_pipe) != 0) {
+        _pipe[0] = -1;
+        _pipe[1] = -1;
+        return false;
+    }
+    fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(_pipe[1], F_SETFL, O_NONBLOCK);
+    _stopping = false;
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &Resolver::_run, this) != 0) {
+            break;
+        }
+        _threads.push_back(thread);
+    }
+    return !_threads.empty();
+}
+
+//lookups still running are waited for; getnameinfo() cannot be interrupted
+void Resolver::stop() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_wake);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+    for (int i = 0; i < 2; ++i) {
+        if (_pipe[i] >= 0) {
+            close(_pipe[i]);
+            _pipe[i] = -1;
+        }
+    }
+    delete _backend;
+    _backend = NULL;
+}
+
+bool Resolver::isRunning() const {
+    return !_threads.empty();
+}
+
+int Resolver::getWakeFd() const {
+    return _pipe[0];
+}
+
+void Resolver::submit(const Query& query) {
+    pthread_mutex_lock(&_mutex);
+    _queries.push_back(query);
+    pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Resolver::takeAnswers(std::vector<Answer>& out) {
+    char drain[256];
+    while (read(_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+    pthread_mutex_lock(&_mutex);
+    out.insert(out.end(), _answers.begin(), _answers.end());
+    _answers.clear();
+    pthread_mutex_unlock(&_mutex);
+}
+
+void* Resolver::_run(void* self) {
+    static_cast<Resolver*>(self)->_loop();
+    return NULL;
+}
+
+void Resolver::_loop() {
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (_queries.empty() && !_stopping) {
+            pthread_cond_wait(&_wake, &_mutex);
+        }
+        if (_stopping) {
+            pthread_mutex_unlock(&_mutex);
+            return;
+        }
+        Query query = _queries.front();
+        _queries.pop_front();
+        pthread_mutex_unlock(&_mutex);
+
+        Answer answer = _resolve(query);
+
+        pthread_mutex_lock(&_mutex);
+        bool wasEmpty = _answers.empty(); // otherwise the loop is already woken
+        _answers.push_back(answer);
+        if (wasEmpty) {
+            char byte = 0;
+            ssize_t ignored = write(_pipe[1], &byte, 1);
+            (void)ignored;
+        }
+    }
+}
+
+Resolver::Answer Resolver::_resolve(const Query& query) {
+    Answer answer;
+    answer.kind = query.kind;
+    answer.id = query.id;
+    answer.fd = query.fd;
+    answer.addr = query.peer.sin_addr.s_addr;
+    if (query.kind == DNS) {
+        answer.found = _lookupHost(query.peer.sin_addr, answer.value);
+    } else {
+        answer.found = _lookupIdent(query, answer.value);
+    }
+    return answer;
+}
+
+//a name goes into prefixes and ban masks, so only plain hostnames are taken
+static bool isValidHostname(const std::string& name) {
+    if (name.empty() || name.length() > HOSTNAME_MAX || name[0] == '.' || name[0] == '-') {
+        return false;
+    }
+    bool letter = false; // all digits and dots would pass for an address
+    for (size_t i = 0; i < name.length(); ++i) {
+        char c = name[i];
+        if (std::isalpha(static_cast<unsigned char>(c))) {
+            letter = true;
+        } else if (!std::isdigit(static_cast<unsigned char>(c)) && c != '.' && c != '-') {
+            return false;
+        }
+    }
+    return letter;
+}
+
+//forward confirmed: the name must resolve back to the address, or anyone
+//controlling their own reverse zone could claim any hostname
+bool Resolver::_lookupHost(const in_addr& addr, std::string& hostname) {
+    std::string name;
+    if (!_backend->reverse(addr, name) || !isValidHostname(name)) {
+        return false;
+    }
+    std::vector<in_addr> addrs;
+    if (!_backend->forward(name, addrs)) {
+        return false;
+    }
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        if (addrs[i].s_addr == addr.s_addr) {
+            hostname = name;
+            return true;
+        }
+    }
+    return false;
+}
+
+//waits for events on fd until the deadline, false on timeout or error
+static bool waitFor(int fd, short events, unsigned long deadlineMs) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long now = ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+    if (now >= deadlineMs) {
+        return false;
+    }
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    return poll(&pfd, 1, static_cast<int>(deadlineMs - now)) == 1 && (pfd.revents & events);
+}
+
+//"<their port> , <our port> : USERID : <os> : <user>"
+static bool parseIdentReply(const std::string& reply, std::string& user) {
+    std::vector<std::string> fields;
+    std::istringstream parts(reply);
+    std::string field;
+    while (std::getline(parts, field, ':')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 4 || fields[1].find("USERID") == std::string::npos) {
+        return false;
+    }
+    std::string id = fields[3];
+    for (size_t i = 4; i < fields.size(); ++i) {
+        id += ":" + fields[i];  // the user id itself may contain colons
+    }
+    size_t start = id.find_first_not_of(" \t");
+    size_t end = id.find_last_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return false;
+    }
+    id = id.substr(start, end - start + 1);
+    for (size_t i = 0; i < id.length(); ++i) {
+        if (id[i] <= ' ' || id[i] == '@' || id[i] == '!' || id[i] == ':' || static_cast<unsigned char>(id[i]) >= 0x7f) {
+            return false;
+        }
+    }
+    user = id.substr(0, IDENT_USER_MAX);
+    return !user.empty();
+}
+
+//RFC 1413: connect back to the client's ident port from our own address and ask
+//who owns the connection
+bool Resolver::_lookupIdent(const Query& query, std::string& user) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long deadline = ts.tv_sec * 1000UL + ts.tv_nsec / 1000000 + query.timeoutMs;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    sockaddr_in local = query.local;
+    local.sin_port = 0;
+    sockaddr_in remote = query.peer;
+    remote.sin_port = htons(static_cast<unsigned short>(query.identPort));
+    bool ok = bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == 0
+        && (connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) == 0 || errno == EINPROGRESS)
+        && waitFor(fd, POLLOUT, deadline);
+    int soError = 0;
+    socklen_t len = sizeof(soError);
+    if (ok && (getsockopt(fd, SOL_SOCKET, SO_ERROR, &soError, &len) != 0 || soError != 0)) {
+        ok = false;
+    }
+    if (ok) {
+        std::ostringstream request;
+        request << ntohs(query.peer.sin_port) << " , " << ntohs(query.local.sin_port) << "\r\n";
+        std::string line = request.str();
+        ok = send(fd, line.data(), line.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(line.size());
+    }
+    std::string reply;
+    while (ok && reply.find('\n') == std::string::npos && reply.size() < 512) {
+        char buf[512];
+        if (!waitFor(fd, POLLIN, deadline)) {
+            ok = false;
+            break;
+        }
+        ssize_t got = recv(fd, buf, sizeof(buf), 0);
+        if (got <= 0) {
+            break;
+        }
+        reply.append(buf, got);
+    }
+    close(fd);
+    return ok && parseIdentReply(reply, user);
+}
+
+bool Resolver::cached(in_addr_t addr, unsigned long nowMs, std::string& hostname) {
+    std::map<in_addr_t, CacheEntry>::iterator it = _cache.find(addr);
+    if (it == _cache.end()) {
+        return false;
+    }
+    if (it->second.expiresMs <= nowMs) {
+        _cache.erase(it);
+        return false;
+    }
+    hostname = it->second.hostname;
+    return true;
+}
+
+//a full cache first forgets what expired, then an arbitrary entry
+void Resolver::remember(in_addr_t addr, const std::string& hostname, unsigned long nowMs,
+                        unsigned long ttlMs, size_t maxEntries) {
+    if (ttlMs == 0 || maxEntries == 0) {
+        return;
+    }
+    if (_cache.size() >= maxEntries && _cache.find(addr) == _cache.end()) {
+        for (std::map<in_addr_t, CacheEntry>::iterator it = _cache.begin(); it != _cache.end(); ) {
+            if (it->second.expiresMs <= nowMs) {
+                _cache.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        while (_cache.size() >= maxEntries) {
+            _cache.erase(_cache.begin());
+        }
+    }
+    CacheEntry& entry = _cache[addr];
+    entry.hostname = hostname;
+    entry.expiresMs = nowMs + ttlMs;
+}
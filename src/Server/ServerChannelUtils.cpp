@@ -10,34 +10,49 @@ Channel* Server::getChannel(const std::string& name) {
     return NULL;
 }
 
+//a new channel gets the default history length and, with persistence on,
+//its store, which refills the ring with what the channel said before.
+//From here on its metadata changes go to the journal
+Channel* Server::_newChannel(const std::string& name) {
+    Channel* channel = new Channel(name);
+    channel->getHistory().setCapacity(_config.historyLength);
+    if (_historyCatalog.isOpen()) {
+        channel->attachStore(HistoryStore::open(_historyCatalog, name, _historyLimits, &_historySyncer));
+    }
+    _journal.recordCreate(*channel);
+    channel->setJournal(&_journal);
+    return channel;
+}
+
 Channel* Server::getOrCreateChannel(const std::string& name) {
     for (std::set<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
         if ((*it)->getName() == name) {
             return *it;
         }
     }
-    Channel* newChannel = new Channel(name);
+    Channel* newChannel = _newChannel(name);
     _channels.insert(newChannel);
-    std::cout << GREEN << "Channel " << name << " created succesfully" << RESET << std::endl;
+    LOG(LOG_DEBUG, "Channel " << name << " created succesfully");
     return newChannel;
 }
 
 bool Server::addChannel(const std::string& name) {
     for(std::set<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
         if ((*it)->getName() == name) {
-            std::cout << ORANGE << "Channel already exits" << RESET << std::endl;
+            LOG(LOG_DEBUG, "Channel already exits");
             return false;
         }
     }
-    Channel* newChannel = new Channel(name);
+    Channel* newChannel = _newChannel(name);
     _channels.insert(newChannel);
-    std::cout << GREEN << "Channel " << name << " created succesfully" << RESET << std::endl;
+    LOG(LOG_DEBUG, "Channel " << name << " created succesfully");
     return true;
 }
 
 void Server::removeChannel(const std::string& channelName) {
     for (std::set<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
         if ((*it)->getName() == channelName) {
+            _journal.recordDrop(channelName);
             delete *it;
             _channels.erase(it);
             break;
@@ -47,6 +62,38 @@ void Server::removeChannel(const std::string& channelName) {
 
 std::set<Channel*> Server::getChannels() const { return _channels; }
 
+static const size_t LIST_PAGE_BYTES = 8192;   // sendq level a LIST page fills up to
+static const std::time_t LIST_SNAPSHOT_AGE = 1; // seconds a changed directory may still be served
+
+//Queues the next page of the client's pending LIST. SendData calls back here
+//once the sendq drained below a page, so a listing of every channel never sits
+//in memory at once and always resumes behind the last name sent.
+void Server::pumpList(Client* client) {
+    ListFilter* filter = client->getPendingList();
+    if (filter == NULL) {
+        return;
+    }
+    _directory.refresh(_channels, Clock::now(), LIST_SNAPSHOT_AGE);
+    if (!filter->started) {
+        sendReply(*client, RPL_LISTSTART, client->getNickname());
+        filter->started = true;
+    }
+    size_t first = filter->resumeAfter.empty() ? 0 : _directory.upperBound(filter->resumeAfter);
+    size_t i = first;
+    for (; i < _directory.size() && client->getSendQueueBytes() < LIST_PAGE_BYTES; ++i) {
+        if (_directory.accepts(i, *filter)) {
+            sendReply(*client, RPL_LIST, client->getNickname(), _directory.name(i),
+                      static_cast<long>(_directory.at(i).users), _directory.topic(i));
+        }
+    }
+    if (i == _directory.size()) {
+        sendReply(*client, RPL_LISTEND, client->getNickname());
+        client->setPendingList(NULL);
+    } else if (i > first) {
+        filter->resumeAfter = _directory.name(i - 1);
+    }
+}
+
 
 bool Server::isOpOnAnyChannel(const std::string& nick) const {
     for (std::set<Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
@@ -1,14 +1,148 @@
 #include "../../inc/Server.hpp"
 
 Client* Server::getClientByNick(const std::string& nickname) {
-    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second->getNickname() == nickname) {
-            return it->second;
+    std::map<std::string, Client*>::iterator it = _nicks.find(Mask::fold(nickname));
+    return (it != _nicks.end()) ? it->second : NULL;
+}
+
+//Nick changes go through here so the nick index follows the client.
+//Index keys are casemapped, the same form compiled masks compare in
+void Server::setClientNick(Client* client, const std::string& nickname) {
+    std::map<std::string, Client*>::iterator it = _nicks.find(Mask::fold(client->getNickname()));
+    if (it != _nicks.end() && it->second == client) {
+        _nicks.erase(it);
+    }
+    if (client->getWelcomeMsg()) {
+        _events.record(EV_NICK, client->getConnectionId(), client->getNickname(), nickname);
+    }
+    client->setNickname(nickname);
+    _nicks[Mask::fold(nickname)] = client;
+}
+
+static std::string reversedHost(const std::string& host) {
+    std::string folded = Mask::fold(host);
+    return std::string(folded.rbegin(), folded.rend());
+}
+
+static void eraseFromIndex(std::multimap<std::string, Client*>& index, const std::string& key, Client* client) {
+    std::pair<std::multimap<std::string, Client*>::iterator, std::multimap<std::string, Client*>::iterator> range = index.equal_range(key);
+    for (std::multimap<std::string, Client*>::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == client) {
+            index.erase(it);
+            return;
         }
     }
+}
+
+void Server::_indexClient(Client* client) {
+    _hosts.insert(std::make_pair(Mask::fold(client->getHostname()), client));
+    _reversedHosts.insert(std::make_pair(reversedHost(client->getHostname()), client));
+}
+
+//Decides on a new connection before a Client exists for it; on success the
+//host and network counters include it, and it counts as unregistered until
+//registerClient(). Returns the reason for a refusal, NULL to accept
+const char* Server::_admit(const HostKey& host, const HostKey& network, unsigned long nowMs) {
+    if (_unregistered >= _config.maxUnregistered) {
+        return "Too many unregistered connections";
+    }
+    if (!_hostTable.makeRoom(2, nowMs)) {
+        return "Server is busy";
+    }
+    HostTable::Entry* hostEntry = _hostTable.acquire(host, nowMs);
+    HostTable::Entry* netEntry = _hostTable.acquire(network, nowMs);
+    const char* refusal = NULL;
+    if (!_hostTable.takeToken(*hostEntry, nowMs)) {
+        refusal = "Connecting too fast, throttled";
+    } else if (hostEntry->connections >= _config.maxPerHost) {
+        refusal = "Too many connections from your host";
+    } else if (netEntry->connections >= _config.maxPerNetwork) {
+        refusal = "Too many connections from your network";
+    } else if (hostEntry->unregistered >= _config.maxUnregisteredPerHost) {
+        refusal = "Too many unregistered connections from your host";
+    }
+    if (refusal) {
+        _hostTable.release(network, nowMs); // a throttled host keeps its entry until the bucket refills
+        _hostTable.release(host, nowMs);
+        return refusal;
+    }
+    ++hostEntry->connections;
+    ++hostEntry->unregistered;
+    ++netEntry->connections;
+    ++_unregistered;
     return NULL;
 }
 
+//registration done and the lookups finished: the connection is welcomed,
+//leaves the unregistered caps, gets its class limits and the keepalive deadline
+//takes over from the registration deadline. Without an ident answer the
+//username is marked with ~, as it is only what the client claims
+void Server::registerClient(Client* client) {
+    if (_config.identLookup) {
+        client->setUsername(client->getIdentUser().empty() ? "~" + client->getUsername() : client->getIdentUser());
+    }
+    client->setSigOnTime(Clock::now());
+    client->setWelcomeMsg(true);
+    HostTable::Entry* hostEntry = _hostTable.find(client->getAddress());
+    if (hostEntry) {
+        --hostEntry->unregistered;
+    }
+    --_unregistered;
+    _applyClass(client);
+    _events.record(EV_REGISTER, client->getConnectionId(), client->getNickname(), client->getUsername(), client->getHostname());
+    client->releaseLookups();
+    _armDeadline(client, Client::DEADLINE_KEEPALIVE, Clock::monotonicMs(), _config.pingFrequency * 1000);
+    sendReply(*client, RPL_WELCOME, client->getNickname(), client->getUsername(), client->getHostname());
+    sendReply(*client, RPL_ISUPPORT, client->getNickname(), getISupport());
+}
+
+//the host indexes are keyed by hostname, so they follow the change. Only the
+//lookups call this, and they finish before the welcome; commands that join
+//channels are refused until then, so no ban verdict or prefix has seen the
+//old host yet
+void Server::setClientHost(Client* client, const std::string& hostname) {
+    eraseFromIndex(_hosts, Mask::fold(client->getHostname()), client);
+    eraseFromIndex(_reversedHosts, reversedHost(client->getHostname()), client);
+    client->setHostname(hostname);
+    _indexClient(client);
+}
+
+void Server::_unindexClient(Client* client) {
+    _events.record(EV_DISCONNECT, client->getConnectionId(), client->getNickname(),
+                   client->getQuitReason().empty() ? "Connection closed" : client->getQuitReason());
+    std::map<std::string, Client*>::iterator it = _nicks.find(Mask::fold(client->getNickname()));
+    if (it != _nicks.end() && it->second == client) {
+        _nicks.erase(it);
+    }
+    eraseFromIndex(_hosts, Mask::fold(client->getHostname()), client);
+    eraseFromIndex(_reversedHosts, reversedHost(client->getHostname()), client);
+    unsigned long now = Clock::monotonicMs();
+    HostTable::Entry* hostEntry = _hostTable.find(client->getAddress());
+    HostTable::Entry* netEntry = _hostTable.find(client->getNetwork());
+    if (hostEntry) {
+        --hostEntry->connections;
+        if (!client->getWelcomeMsg()) {
+            --hostEntry->unregistered;
+        }
+    }
+    if (netEntry) {
+        --netEntry->connections;
+    }
+    if (!client->getWelcomeMsg()) {
+        --_unregistered;
+    }
+    _hostTable.release(client->getAddress(), now);
+    _hostTable.release(client->getNetwork(), now);
+}
+
+const std::map<std::string, Client*>& Server::getNickIndex() const { return _nicks; }
+
+const std::multimap<std::string, Client*>& Server::getHostIndex() const { return _hosts; }
+
+const std::multimap<std::string, Client*>& Server::getReversedHostIndex() const { return _reversedHosts; }
+
+size_t Server::getWhoMaxReplies() const { return _config.whoMaxReplies; }
+
 //This is callback for the client side to activate event for POLLOUT
 // You can activate and deactivate event
 
@@ -27,4 +161,136 @@ std::vector<Client*> Server::getAllClients() const {
         clients.push_back(it->second);
     }
     return clients;
-}
\ No newline at end of file
+}
+//a broken dns_stub file is a startup error like a broken config; without
+//worker threads nothing is looked up and clients keep their addresses
+void Server::_startResolver() {
+    ResolverBackend* backend = NULL;
+    if (_config.dnsStub.empty()) {
+        backend = new SystemResolver();
+    } else {
+        StubResolver* stub = new StubResolver();
+        std::string error;
+        if (!stub->load(_config.dnsStub, error)) {
+            delete stub;
+            LOG(LOG_ERROR, "dns_stub " << error);
+            exit(EXIT_FAILURE);
+        }
+        backend = stub;
+    }
+    if (!_resolver.start(_config.resolverThreads, backend) && _resolver.getWakeFd() < 0) {
+        LOG(LOG_ERROR, "resolver pipe has failed");
+        exit(EXIT_FAILURE);
+    }
+    if (!_resolver.isRunning()) {
+        LOG(LOG_WARN, "resolver threads failed to start, hostnames are not looked up");
+    }
+}
+
+//Starts the hostname and ident lookups for a new connection. A cached
+//hostname is used right away; anything else goes to the resolver threads and
+//the welcome waits for the answers, or for lookup_timeout
+void Server::_startLookups(Client* client, const sockaddr_in& peer) {
+    unsigned long now = Clock::monotonicMs();
+    unsigned char pending = 0;
+    if (_config.dnsLookup) {
+        std::string hostname;
+        if (!_resolver.cached(peer.sin_addr.s_addr, now, hostname)) {
+            pending |= Client::LOOKUP_DNS;
+            client->queueMessage(":ircserver NOTICE * :*** Looking up your hostname...\r\n");
+        } else if (!hostname.empty()) {
+            setClientHost(client, hostname);
+            client->queueMessage(":ircserver NOTICE * :*** Found your hostname (cached)\r\n");
+        } else {
+            client->queueMessage(":ircserver NOTICE * :*** Couldn't look up your hostname (cached), using your IP address instead\r\n");
+        }
+    }
+    if (_config.identLookup) {
+        pending |= Client::LOOKUP_IDENT;
+        client->queueMessage(":ircserver NOTICE * :*** Checking Ident\r\n");
+    }
+    if (pending == 0 || !_resolver.isRunning()) {
+        return;
+    }
+    Resolver::Query query;
+    query.id = ++_lookupSerial;
+    query.fd = client->getClientFd();
+    query.peer = peer;
+    socklen_t len = sizeof(query.local);
+    if (getsockname(query.fd, reinterpret_cast<sockaddr*>(&query.local), &len) != 0) {
+        std::memset(&query.local, 0, sizeof(query.local));
+        query.local.sin_family = AF_INET;
+    }
+    query.identPort = static_cast<unsigned int>(_config.identPort);
+    query.timeoutMs = static_cast<unsigned int>(_config.lookupTimeout * 1000);
+    if (pending & Client::LOOKUP_DNS) {
+        query.kind = Resolver::DNS;
+        _resolver.submit(query);
+    }
+    if (pending & Client::LOOKUP_IDENT) {
+        query.kind = Resolver::IDENT;
+        _resolver.submit(query);
+    }
+    client->setLookups(query.id, pending);
+    _armDeadline(client, Client::DEADLINE_LOOKUP, now, _config.lookupTimeout * 1000);
+}
+
+//The resolver's pipe is readable. Every hostname answer is cached, even for a
+//client that has gone or timed out meanwhile; the id tells whether the answer
+//is still wanted, as the fd may belong to a newer connection by now
+void Server::_collectLookups() {
+    unsigned long now = Clock::monotonicMs();
+    _answers.clear();
+    _resolver.takeAnswers(_answers);
+    for (size_t i = 0; i < _answers.size(); ++i) {
+        const Resolver::Answer& answer = _answers[i];
+        if (answer.kind == Resolver::DNS) {
+            _resolver.remember(answer.addr, answer.found ? answer.value : std::string(), now,
+                               _config.dnsCacheTtl * 1000, _config.dnsCacheSize);
+        }
+        std::map<int, Client*>::iterator it = _clients.find(answer.fd);
+        if (it == _clients.end() || it->second->getLookupId() != answer.id) {
+            continue;
+        }
+        Client* client = it->second;
+        unsigned char lookup = (answer.kind == Resolver::DNS) ? Client::LOOKUP_DNS : Client::LOOKUP_IDENT;
+        if (!(client->getPendingLookups() & lookup)) {
+            continue;
+        }
+        if (answer.kind == Resolver::DNS && answer.found) {
+            setClientHost(client, answer.value);
+            client->queueMessage(":ircserver NOTICE * :*** Found your hostname\r\n");
+        } else if (answer.kind == Resolver::DNS) {
+            client->queueMessage(":ircserver NOTICE * :*** Couldn't look up your hostname, using your IP address instead\r\n");
+        } else if (answer.found) {
+            client->setIdentUser(answer.value);
+            client->queueMessage(":ircserver NOTICE * :*** Got Ident response\r\n");
+        } else {
+            client->queueMessage(":ircserver NOTICE * :*** No Ident response\r\n");
+        }
+        _finishLookups(client, lookup);
+    }
+}
+
+void Server::_finishLookups(Client* client, unsigned char done) {
+    client->clearLookups(done);
+    if (client->getPendingLookups() != 0) {
+        return;
+    }
+    _disarmDeadline(client, Client::DEADLINE_LOOKUP);
+    if (client->checkRegistered() && !client->getWelcomeMsg() && !client->isNegotiatingCaps()) {
+        registerClient(client);
+    }
+}
+
+//from the lookup deadline: whatever has not answered yet is given up on
+void Server::lookupTimeout(Client* client) {
+    unsigned char pending = client->getPendingLookups();
+    if (pending & Client::LOOKUP_DNS) {
+        client->queueMessage(":ircserver NOTICE * :*** Couldn't look up your hostname, using your IP address instead\r\n");
+    }
+    if (pending & Client::LOOKUP_IDENT) {
+        client->queueMessage(":ircserver NOTICE * :*** No Ident response\r\n");
+    }
+    _finishLookups(client, pending);
+}
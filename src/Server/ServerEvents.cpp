@@ -1,22 +1,48 @@
 #include "../../inc/Server.hpp"
 
 void Server::requestPollOut(int client_fd, bool enable) {
-    for (std::vector<pollfd>::iterator it = _poll_fds.begin(); it != _poll_fds.end(); ++it) {
-        if (it->fd == client_fd) {
-            if (enable) { 
-                it->events |= POLLOUT;
-            } else {
-                it->events &= ~POLLOUT;
-            }
-            break;
-        }
+    if (client_fd < 0 || client_fd >= static_cast<int>(_poll_slot.size()) || _poll_slot[client_fd] < 0) {
+        return;
+    }
+    pollfd& entry = _poll_fds[_poll_slot[client_fd]];
+    if (enable) { 
+        entry.events |= POLLOUT;
+    } else {
+        entry.events &= ~POLLOUT;
+    }
+}
+
+void Server::_addPollSlot(int fd) {
+    if (fd >= static_cast<int>(_poll_slot.size())) {
+        _poll_slot.resize(fd + 1, -1);
+    }
+    pollfd new_conexion;
+    new_conexion.fd = fd;
+    new_conexion.events = POLLIN;
+    new_conexion.revents = 0;
+    _poll_slot[fd] = _poll_fds.size();
+    _poll_fds.push_back(new_conexion);
+}
+
+//the last pollfd takes the freed slot, so removal is O(1) and only one index changes
+void Server::_removePollSlot(size_t i) {
+    int fd = _poll_fds[i].fd;
+    if (i + 1 != _poll_fds.size()) {
+        _poll_fds[i] = _poll_fds.back();
+        _poll_slot[_poll_fds[i].fd] = i;
     }
+    _poll_fds.pop_back();
+    _poll_slot[fd] = -1;
 }
 
+//timeout in ms, -1 to wait for an event or a signal only
 int Server::listenPoll(struct pollfd *fds, nfds_t nfds, int timeout){ 
     int poll_ret = 0;
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
     while (true){
-        poll_ret = poll(fds, nfds, timeout);
+        poll_ret = ppoll(fds, nfds, timeout < 0 ? NULL : &ts, &_pollMask);
         if (poll_ret == -1) {
             return -1;
         }
@@ -25,16 +51,36 @@ int Server::listenPoll(struct pollfd *fds, nfds_t nfds, int timeout){
     return poll_ret;
 }
 
+//Refused before a Client exists: a flood of connections that never register
+//must not cost more than the accept and this one line
+static void refuseConnection(int fd, const char* reason) {
+    std::string error = std::string("ERROR :Closing Link: ") + reason + "\r\n";
+    send(fd, error.data(), error.size(), MSG_NOSIGNAL);
+    close(fd);
+}
+
 void Server::AddToPollStrct(int new_socket, sockaddr_in client_addr){
     _makeNonBlock(new_socket);
-    std::string client_ip = inet_ntoa(client_addr.sin_addr);
+    HostKey host = HostKey::fromSockaddr(reinterpret_cast<sockaddr*>(&client_addr));
+    HostKey network = host.network(_config.networkV4Bits, _config.networkV6Bits);
+    const char* refusal = _admit(host, network, Clock::monotonicMs());
+    if (refusal) {
+        refuseConnection(new_socket, refusal);
+        return;
+    }
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
     Client* new_client = new Client(new_socket, client_ip, this);
+    new_client->setAddress(host, network);
+    new_client->setConnectionId(++_connectionSerial);
+    _events.record(EV_CONNECT, new_client->getConnectionId(), client_ip);
+    new_client->resetFlood(_config.floodBurst, Clock::monotonicMs());
     _clients.insert(std::make_pair(new_socket, new_client));
-    pollfd new_conexion;
-    new_conexion.fd = new_socket;
-    new_conexion.events = POLLIN;
-    new_conexion.revents = 0;
-    _poll_fds.push_back(new_conexion);
+    _indexClient(new_client);
+    _applyClass(new_client);
+    _addPollSlot(new_socket);
+    _startLookups(new_client, client_addr);
+    _armDeadline(new_client, Client::DEADLINE_KEEPALIVE, Clock::monotonicMs(), _config.registrationTimeout * 1000);
 }
 
 void Server::handleNewServConnect(){
@@ -42,27 +88,33 @@ void Server::handleNewServConnect(){
     socklen_t addr_len = sizeof(client_addr);
     int new_socket = accept(_poll_fds[0].fd, reinterpret_cast<sockaddr *>(&client_addr), &addr_len);
     if (new_socket == -1){
-        std::cerr << "Error: accept has failed" << std::endl;
+        LOG(LOG_ERROR, "accept has failed");
         return;
     }
     AddToPollStrct(new_socket, client_addr);
 }
 
 bool Server::RecvData(int i, Client *curr){
-    char buffer[10240] = {0};
-    ssize_t bytes_read = recv(_poll_fds[i].fd, buffer, sizeof(buffer), 0);
+    unsigned long started = Clock::nanos();
+    ssize_t bytes_read = recv(_poll_fds[i].fd, &_recvChunk[0], _recvChunk.size(), 0);
+    _loopStats.pass().recvNs += Clock::nanos() - started;
     if (bytes_read > 0) {
+        curr->setLastHeardMs(Clock::monotonicMs());
         // std::cout << "recv data: " << std::string(buffer, bytes_read) << std::endl;
-        curr->appendRecvData(buffer, bytes_read);
-        std::string cmd;
-        while (!(cmd = curr->extractLineFromRecv()).empty()) {
-            if (!_handleClientMessage(*this, curr, cmd)) {
-                return false;
-            }
+        curr->appendRecvData(&_recvChunk[0], bytes_read);
+        if (!_processInput(curr)) {
+            return false;
+        }
+        //what is left is an unterminated line, or input held back by flood control
+        if (curr->isRecvQueueExceeded()) {
+            LOG(LOG_INFO, "Client " << _poll_fds[i].fd << " dropped: recvq exceeded");
+            curr->setQuitReason("RecvQ exceeded");
+            CleanClient(i);
+            return false;
         }
         return true;
     } else if (bytes_read == 0) {
-        std::cout << "Client has been disconnected !" << std::endl;
+        LOG(LOG_DEBUG, "Client has been disconnected !");
         CleanClient(i);
         return false;
     } else if(bytes_read == -1){
@@ -76,48 +128,52 @@ bool Server::SendData(int i, Client *curr){
     if (!curr->hasData()) {
         return true;
     }
-    std::string& data_to_send = curr->getSendBuf();
-
-    // std::cout << "curr->getSendBuf(): " << curr->getSendBuf() << std::endl;
-
-    ssize_t bytes = send(_poll_fds[i].fd, data_to_send.data(), data_to_send.size(), 0);
+    struct iovec iov[64];
+    size_t count = curr->fillIovec(iov, sizeof(iov) / sizeof(iov[0]));
 
-    // if (bytes > 0) {
-    //     std::cout << "sent " << bytes << " bytes: " << data_to_send.substr(0, bytes) << std::endl;
-    // }
+    unsigned long started = Clock::nanos();
+    ssize_t bytes = writev(_poll_fds[i].fd, iov, count);
+    _loopStats.pass().sendNs += Clock::nanos() - started;
 
     if (bytes == -1) {
-        std::cerr << "Could not send data" << std::endl;
+        LOG(LOG_DEBUG, "Could not send data");
         CleanClient(i);
         return false;
     }
 
     curr->helpSenderEvent(bytes);
+    if (curr->hasPendingList()) {
+        pumpList(curr);
+    }
 
     return true;
 }
 
 void Server::HandlePollREvents() {
-    size_t i = 1;
+    size_t i = FIRST_CLIENT_SLOT;
     while (i < _poll_fds.size()) {
         int fd = _poll_fds[i].fd;
-        Client* curr = _clients[fd];
+        std::map<int, Client*>::iterator found = _clients.find(fd);
+        Client* curr = found == _clients.end() ? NULL : found->second;
         bool clientRemoved = false;
 
-        if (_poll_fds[i].revents & (POLLHUP | POLLNVAL | POLLERR)) {
-            std::cout << "Client has been disconnected !" << std::endl;
+        if (!curr) {
+            if (_poll_fds[i].revents) {
+                clientRemoved = !_serveMetrics(i);
+            }
+        } else if (_poll_fds[i].revents & (POLLHUP | POLLNVAL | POLLERR)) {
+            LOG(LOG_DEBUG, "Client has been disconnected !");
             CleanClient(i);
             clientRemoved = true;
         } else if (_poll_fds[i].revents & POLLIN) {
-            if (!RecvData(i, curr)) {
-                CleanClient(i);
-                clientRemoved = true;
-            }
+            clientRemoved = !RecvData(i, curr);
         } else if (_poll_fds[i].revents & POLLOUT) {
-            if (!SendData(i, curr)) {
-                CleanClient(i);
-                clientRemoved = true;
-            }
+            clientRemoved = !SendData(i, curr);
+        }
+        //RecvData/SendData (or QUIT) may have dropped the client already; its slot
+        //now holds another fd, which must not be cleaned in its place
+        if (clientRemoved && _poll_slot[fd] >= 0) {
+            CleanClient(_poll_slot[fd]);
         }
 
         if (!clientRemoved) {
@@ -127,27 +183,62 @@ void Server::HandlePollREvents() {
 }
 
 void Server::runPoll() {
-    pollfd server_fd;
-    server_fd.fd = _listening_socket;
-    server_fd.events = POLLIN;
-    server_fd.revents = 0;
-    const int timeout_ms = 100;
-    _poll_fds.push_back(server_fd); // first elem of the pollfd will be the server which will be waiting for new events
+    _addPollSlot(_listening_socket); // first elem of the pollfd will be the server which will be waiting for new events
+    _addPollSlot(_resolver.getWakeFd());
+    if (_metrics.getFd() != -1) {
+        _addPollSlot(_metrics.getFd());
+    } else {
+        pollfd unused = { -1, 0, 0 }; // poll() skips negative fds
+        _poll_fds.push_back(unused);
+    }
     while (!sig_received) {
-        int ret =listenPoll(_poll_fds.data(), _poll_fds.size(), timeout_ms);
-        if (ret < 0) {
-            if (sig_received) {
-                break;
+        //sleep until the next timer is due; poll_timeout_ms, when set, caps the wait
+        long timeout = _timers.nextTimeout(Clock::monotonicMs());
+        long cap = static_cast<long>(_config.pollTimeoutMs);
+        if (cap != 0 && (timeout < 0 || timeout > cap)) {
+            timeout = cap;
+        }
+        int ret =listenPoll(_poll_fds.data(), _poll_fds.size(), static_cast<int>(timeout));
+        int pollErrno = errno; // timers and a reload below make syscalls of their own
+        Clock::update();
+        LoopStats::Pass& pass = _loopStats.begin(Clock::nanos(), ret);
+        _timers.advance(Clock::monotonicMs());
+        _resumeDeferred();
+        unsigned long phase = Clock::nanos();
+        pass.timersNs = phase - pass.startNs - pass.dispatchNs; // resumed input counts as dispatch
+        if (rehash_received) {
+            rehash_received = 0;
+            std::string error;
+            if (!rehash(error)) {
+                LOG(LOG_ERROR, "reload failed, keeping the old configuration: " << error);
+            }
+        }
+        if (ret < 0 && (sig_received || pollErrno != EINTR)) {
+            if (!sig_received) {
+                LOG(LOG_ERROR, "poll has failed: " << strerror(pollErrno));
             }
-            std::cerr << "Error: poll has failed" << std::endl;
             break;
         }
-        if (_poll_fds[0].revents & POLLIN) {
-            if (_poll_fds[0].fd == _listening_socket) {
-                // handle new client conexions
-                handleNewServConnect();
+        //after EINTR the revents are stale; the pass still counts for the timers and a reload
+        if (ret >= 0) {
+            if (_poll_fds[0].revents & POLLIN) {
+                if (_poll_fds[0].fd == _listening_socket) {
+                    // handle new client conexions
+                    handleNewServConnect();
+                }
+            }
+            if (_poll_fds[1].revents & POLLIN) {
+                _collectLookups();
+            }
+            if (_poll_fds[2].revents & POLLIN) {
+                _acceptMetrics();
             }
+            pass.acceptNs = Clock::nanos() - phase;
+            HandlePollREvents();
         }
-        HandlePollREvents();
+        _reapDrops();
+        _journal.maybeSnapshot(_channels);
+        _loopStats.end(Clock::nanos(), Clock::monotonicMs(), _config.loopBudgetMs * 1000000,
+                       Client::getBacklogBytes(), Client::getBacklogClients());
     }
 }
@@ -5,16 +5,14 @@ void Server::disconnectClient(int client_fd) {
 
     std::map<int, Client*>::iterator clientIt = _clients.find(client_fd);
     if (clientIt != _clients.end()) {
+        _unindexClient(clientIt->second);
         delete clientIt->second;
         _clients.erase(clientIt);
     }
 
-    for (std::vector<pollfd>::iterator it = _poll_fds.begin(); it != _poll_fds.end(); ++it) {
-        if (it->fd == client_fd) {
-            std::cout << "Client has been disconnected !" << std::endl;
-            _poll_fds.erase(it);
-            break;
-        }
+    if (client_fd < static_cast<int>(_poll_slot.size()) && _poll_slot[client_fd] >= 0) {
+        LOG(LOG_DEBUG, "Client has been disconnected !");
+        _removePollSlot(_poll_slot[client_fd]);
     }
 }
 
@@ -22,10 +20,289 @@ void Server::_makeNonBlock(int sock_fd)
 {
     if (fcntl(sock_fd, F_SETFL, O_NONBLOCK) < 0)
     {
-        std::cerr << "Erorr: fcntl(F_SETFL, O_NONBLOCK) failed";
+        LOG(LOG_ERROR, "fcntl(F_SETFL, O_NONBLOCK) failed on fd " << sock_fd << ": " << strerror(errno));
     }
 }
 
+size_t Server::getPrivmsgTargetMax() const {
+    return _config.privmsgTargetMax;
+}
+
+bool Server::getPrivmsgDedupe() const {
+    return _config.privmsgDedupe;
+}
+
+size_t Server::getHistoryLength() const {
+    return _config.historyLength;
+}
+
+size_t Server::getChathistoryMax() const {
+    return _config.chathistoryMax;
+}
+
+TimerWheel& Server::getTimers() {
+    return _timers;
+}
+
+EventLog& Server::getEventLog() {
+    return _events;
+}
+
+const Config& Server::getConfig() const {
+    return _config;
+}
+
+const std::string& Server::getConfigPath() const {
+    return _configPath;
+}
+
+bool Server::loadConfig(const std::string& path) {
+    std::string error;
+    Config config;
+    if (!config.load(path, error)) {
+        LOG(LOG_ERROR, error);
+        return false;
+    }
+    _config = config;
+    _configPath = path;
+    _applyConfig();
+    return true;
+}
+
+//Parses the file into a separate Config and swaps it in only when all of it is
+//valid; connections stay up and pick up their new class limits right away
+bool Server::rehash(std::string& error) {
+    if (_configPath.empty()) {
+        error = "no configuration file was given at startup";
+        return false;
+    }
+    Config config;
+    if (!config.load(_configPath, error)) {
+        return false;
+    }
+    std::vector<std::string> changed;
+    config.keepStartupSettings(_config, changed);
+    for (size_t i = 0; i < changed.size(); ++i) {
+        LOG(LOG_WARN, changed[i] << " only changes on restart");
+    }
+    _config = config;
+    _applyConfig();
+    LOG(LOG_INFO, "Configuration reloaded from " << _configPath);
+    return true;
+}
+
+//pushes the settings that live outside _config to where they are used
+void Server::_applyConfig() {
+    Log::setLevel(_config.logLevel);
+    ChannelHistory::setMemoryCap(_config.historyMemoryCap);
+    _historyLimits.segmentBytes = _config.historySegmentBytes;
+    _historyLimits.retentionMs = _config.historyRetentionMs;
+    _recvChunk.resize(_config.recvChunk);
+    _hostTable.setThrottle(_config.throttleBurst, _config.throttlePeriod * 1000);
+    _events.setLimits(_config.eventSegmentBytes, _config.eventSegments);
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        _applyClass(it->second);
+    }
+}
+
+void Server::_applyClass(Client* client) {
+    if (!client->getWelcomeMsg()) {
+        client->setQueueLimits(_config.unregisteredSendq, _config.unregisteredRecvq);
+        return;
+    }
+    const ConnectionClass& cls = _config.classFor(client->getHostname());
+    client->setQueueLimits(cls.sendq, cls.recvq);
+}
+
+void Server::scheduleDrop(Client* client, const std::string& reason) {
+    _drops.push_back(std::make_pair(client->getClientFd(), reason));
+}
+
+//closes the clients dropped by the server during this pass, telling their
+//channels why; a dropped fd may already be gone (QUIT, hangup), then its slot is -1
+void Server::_reapDrops() {
+    for (size_t i = 0; i < _drops.size(); ++i) {
+        int fd = _drops[i].first;
+        if (fd >= static_cast<int>(_poll_slot.size()) || _poll_slot[fd] < 0) {
+            continue;
+        }
+        Client* client = _clients[fd];
+        LOG(LOG_INFO, "Client " << fd << " dropped: " << _drops[i].second);
+        client->setQuitReason(_drops[i].second);
+        if (client->checkRegistered()) {
+            SharedBuffer quit(":" + client->getNickname() + "!" + client->getUsername() + "@" + client->getHostname()
+                              + " QUIT :" + _drops[i].second + "\r\n");
+            const std::vector<Channel*>& joined = client->getJoinedChannels();
+            for (size_t c = 0; c < joined.size(); ++c) {
+                joined[c]->broadcast(quit, client->getNickname());
+            }
+        }
+        if (!client->hasData()) { // never cut into a half sent line
+            std::string error = "ERROR :Closing Link: " + _drops[i].second + "\r\n";
+            send(fd, error.data(), error.size(), MSG_NOSIGNAL);
+        }
+        CleanClient(_poll_slot[fd]);
+    }
+    _drops.clear();
+}
+
+//what each Client::DEADLINE_* runs once it is due
+static void (Server::* const g_deadlineActions[Client::DEADLINE_COUNT])(Client*) = {
+    &Server::keepalive,
+    &Server::resumeInput,
+    &Server::lookupTimeout
+};
+
+//A client has one timer on the wheel instead of one per purpose: it is due at
+//the earliest armed deadline, and whatever is armed or disarmed moves it
+void Server::_armDeadline(Client* client, int which, unsigned long nowMs, unsigned long delayMs) {
+    unsigned long due = nowMs + delayMs;
+    client->setDeadline(which, due != 0 ? due : 1);
+    _scheduleClientTimer(client, nowMs);
+}
+
+void Server::_disarmDeadline(Client* client, int which) {
+    if (client->getDeadline(which) != 0) {
+        client->setDeadline(which, 0);
+        _scheduleClientTimer(client, Clock::monotonicMs());
+    }
+}
+
+void Server::_scheduleClientTimer(Client* client, unsigned long nowMs) {
+    unsigned long next = client->nextDeadline();
+    if (next == 0) {
+        _timers.cancel(client->getTimer());
+    } else {
+        _timers.schedule(client->getTimer(), nowMs, next > nowMs ? next - nowMs : 0);
+    }
+}
+
+//from the client's timer: runs every deadline that is due, each disarmed
+//first so its action may arm it again. None of the actions deletes the client
+void Server::clientDeadline(Client* client) {
+    unsigned long now = Clock::monotonicMs();
+    for (int which = 0; which < Client::DEADLINE_COUNT; ++which) {
+        unsigned long due = client->getDeadline(which);
+        if (due != 0 && due <= now) {
+            client->setDeadline(which, 0);
+            (this->*g_deadlineActions[which])(client);
+        }
+    }
+    _scheduleClientTimer(client, now);
+}
+
+//Runs from the client's keepalive deadline. A client heard from within the ping
+//interval is only rescheduled for the rest of it, so receiving data never
+//touches the wheel; a silent one gets a PING, and once more silent until the
+//deadline it is dropped
+void Server::keepalive(Client* client) {
+    unsigned long now = Clock::monotonicMs();
+    if (!client->getWelcomeMsg()) {
+        scheduleDrop(client, "Registration timeout");
+        return;
+    }
+    unsigned long interval = _config.pingFrequency * 1000;
+    unsigned long sent = client->getPingSentMs();
+    if (sent != 0 && client->getLastHeardMs() < sent) {
+        std::ostringstream reason;
+        reason << "Ping timeout: " << (now - sent) / 1000 << " seconds";
+        scheduleDrop(client, reason.str());
+        return;
+    }
+    unsigned long silent = now - client->getLastHeardMs();
+    if (silent < interval) {
+        _armDeadline(client, Client::DEADLINE_KEEPALIVE, now, interval - silent);
+        return;
+    }
+    std::ostringstream ping;
+    ping << "PING :" << now << "\r\n";
+    client->queueMessage(ping.str());
+    client->setPingSent(now);
+    _armDeadline(client, Client::DEADLINE_KEEPALIVE, now, _config.pingTimeout * 1000);
+}
+
+//the dispatch phase of the loop pass, for STATS e
+bool Server::_processInput(Client* client) {
+    unsigned long now = Clock::monotonicMs();
+    unsigned long started = Clock::nanos();
+    bool alive = _runInput(client, now);
+    _loopStats.pass().dispatchNs += Clock::nanos() - started;
+    return alive;
+}
+
+//Runs the complete lines in the client's receive buffer while its flood bucket
+//allows. Whatever is left stays buffered, deferred rather than dropped, and the
+//flood deadline picks it up once the bucket refilled; a client that stays
+//throttled for flood_disconnect seconds is dropped. False when the client is gone
+bool Server::_runInput(Client* client, unsigned long now) {
+    std::string cmd;
+    while (_config.floodBurst == 0 || client->refillFlood(_config.floodBurst, _config.floodRate, now)) {
+        if (!client->extractLine(cmd)) {
+            client->setFloodSince(0);
+            return true;
+        }
+        if (cmd.empty()) {
+            continue;
+        }
+        if (!_handleClientMessage(*this, client, cmd)) {
+            return false;
+        }
+    }
+    if (!client->hasLine()) {
+        client->setFloodSince(0);
+        return true;
+    }
+    if (client->getFloodSinceMs() == 0) {
+        client->setFloodSince(now);
+        ++_floodStats.deferred;
+    } else if (now - client->getFloodSinceMs() >= _config.floodDisconnect * 1000) {
+        ++_floodStats.excessFlood;
+        scheduleDrop(client, "Excess Flood");
+        return true;
+    }
+    if (client->getDeadline(Client::DEADLINE_FLOOD) == 0) {
+        _armDeadline(client, Client::DEADLINE_FLOOD, now, client->floodWaitMs(_config.floodRate));
+    }
+    return true;
+}
+
+//from the flood deadline; the lines run after the wheel is done, so a QUIT among
+//them never deletes a client while the wheel still walks its timers
+void Server::resumeInput(Client* client) {
+    _resumes.push_back(client->getClientFd());
+}
+
+void Server::_resumeDeferred() {
+    for (size_t i = 0; i < _resumes.size(); ++i) {
+        int fd = _resumes[i];
+        if (fd >= static_cast<int>(_poll_slot.size()) || _poll_slot[fd] < 0) {
+            continue;
+        }
+        if (!_processInput(_clients[fd]) && _poll_slot[fd] >= 0) {
+            CleanClient(_poll_slot[fd]);
+        }
+    }
+    _resumes.clear();
+}
+
+const FloodStats& Server::getFloodStats() const {
+    return _floodStats;
+}
+
+const LoopStats& Server::getLoopStats() const {
+    return _loopStats;
+}
+
+//RPL_ISUPPORT tokens sent after RPL_WELCOME
+std::string Server::getISupport() const {
+    std::ostringstream oss;
+    oss << "CASEMAPPING=rfc1459 CHANMODES=beI,k,Hl,it CHATHISTORY=" << _config.chathistoryMax
+        << " ELIST=CMNTU EXCEPTS INVEX MSGREFTYPES=msgid,timestamp SAFELIST"
+        << " MAXLIST=b:" << Channel::MAX_LIST_ENTRIES << ",e:" << Channel::MAX_LIST_ENTRIES << ",I:" << Channel::MAX_LIST_ENTRIES
+        << " TARGMAX=PRIVMSG:" << _config.privmsgTargetMax;
+    return oss.str();
+}
+
 void Server::setPort(int port) {
     _port = port;
 }
@@ -0,0 +1,212 @@
+#include "../../inc/Server.hpp"
+#include <cstdio>
+
+//a scrape that never finished is closed before a new one is taken
+void Server::_acceptMetrics() {
+    std::vector<int> stale;
+    _metrics.expired(Clock::monotonicMs(), stale);
+    for (size_t i = 0; i < stale.size(); ++i) {
+        if (_poll_slot[stale[i]] >= 0) {
+            CleanClient(_poll_slot[stale[i]]);
+        }
+    }
+    int fd = _metrics.accept(Clock::monotonicMs());
+    if (fd != -1) {
+        _addPollSlot(fd);
+    }
+}
+
+bool Server::_serveMetrics(size_t i) {
+    int fd = _poll_fds[i].fd;
+    if (!_metrics.serve(fd, _poll_fds[i].revents, *this)) {
+        return false;
+    }
+    requestPollOut(fd, _metrics.wantsWrite(fd));
+    return true;
+}
+
+//histogram bounds in the exposition, nanoseconds and as printed (seconds)
+static const struct {
+    unsigned long ns;
+    const char* le;
+} g_latencyBounds[] = {
+    { 1000, "0.000001" }, { 5000, "0.000005" }, { 10000, "0.00001" }, { 50000, "0.00005" },
+    { 100000, "0.0001" }, { 500000, "0.0005" }, { 1000000, "0.001" }, { 5000000, "0.005" },
+    { 10000000, "0.01" }, { 50000000, "0.05" }, { 100000000, "0.1" }, { 1000000000, "1" },
+};
+static const size_t LATENCY_BOUND_COUNT = sizeof(g_latencyBounds) / sizeof(g_latencyBounds[0]);
+
+static void family(std::ostringstream& out, const char* name, const char* type, const char* help) {
+    out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+}
+
+static void metric(std::ostringstream& out, const char* name, const char* type, const char* help, unsigned long value) {
+    family(out, name, type, help);
+    out << name << ' ' << value << '\n';
+}
+
+//exact, "%g" would round a counter of nanoseconds
+static std::string seconds(unsigned long ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%lu.%09lu", ns / 1000000000, ns % 1000000000);
+    return text;
+}
+
+//A recorded value counts towards a bound once its whole histogram bucket lies
+//at or below it, so a cumulative count can lag by the 12.5% bucket width.
+static void latencyHistogram(std::ostringstream& out, const CommandStats& stats) {
+    const LatencyHistogram& latency = stats.latency;
+    const char* name = "ircserv_command_duration_seconds";
+    unsigned long cumulative = 0;
+    size_t bucket = 0;
+    for (size_t b = 0; b < LATENCY_BOUND_COUNT; ++b) {
+        for (; bucket < LatencyHistogram::BUCKETS
+               && LatencyHistogram::bucketUpperBound(bucket) <= g_latencyBounds[b].ns; ++bucket) {
+            cumulative += latency.bucketCount(bucket);
+        }
+        out << name << "_bucket{command=\"" << stats.name << "\",le=\"" << g_latencyBounds[b].le << "\"} "
+            << cumulative << '\n';
+    }
+    out << name << "_bucket{command=\"" << stats.name << "\",le=\"+Inf\"} " << latency.count() << '\n'
+        << name << "_sum{command=\"" << stats.name << "\"} " << seconds(latency.sum()) << '\n'
+        << name << "_count{command=\"" << stats.name << "\"} " << latency.count() << '\n';
+}
+
+//resident and virtual size from /proc, 0 where it cannot be read
+static void memoryUsage(unsigned long& resident, unsigned long& size) {
+    resident = 0;
+    size = 0;
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return;
+    }
+    unsigned long pages = 0, residentPages = 0;
+    if (std::fscanf(statm, "%lu %lu", &pages, &residentPages) == 2) {
+        unsigned long pageSize = static_cast<unsigned long>(sysconf(_SC_PAGESIZE));
+        resident = residentPages * pageSize;
+        size = pages * pageSize;
+    }
+    std::fclose(statm);
+}
+
+//The Prometheus text exposition. Everything here is a running total or a
+//size kept up to date by the loop; a scrape reads them and walks the command
+//table, never the clients or channels. Rates are left to rate() on the
+//counters.
+std::string Server::renderMetrics() const {
+    std::ostringstream out;
+    metric(out, "ircserv_connections", "gauge", "Open client connections.", _clients.size());
+    metric(out, "ircserv_clients_registered", "gauge", "Clients that completed registration.",
+           _clients.size() - _unregistered);
+    metric(out, "ircserv_connections_accepted_total", "counter", "Client connections accepted since startup.",
+           _connectionSerial);
+    metric(out, "ircserv_channels", "gauge", "Channels.", _channels.size());
+
+    unsigned long messagesIn = 0, bytesIn = 0;
+    for (size_t i = 0; i < commandStatsCount(); ++i) {
+        messagesIn += commandStatsAt(i).calls;
+        bytesIn += commandStatsAt(i).bytesIn;
+    }
+    metric(out, "ircserv_messages_received_total", "counter", "Lines received from clients.", messagesIn);
+    metric(out, "ircserv_received_bytes_total", "counter", "Bytes of the lines received, without line endings.", bytesIn);
+    metric(out, "ircserv_messages_sent_total", "counter", "Lines queued to clients.", Client::getLinesTotal());
+    metric(out, "ircserv_sent_bytes_total", "counter", "Bytes queued to clients.", Client::getQueuedTotal());
+    metric(out, "ircserv_sendq_bytes", "gauge", "Bytes queued to clients and not yet written.", Client::getBacklogBytes());
+    metric(out, "ircserv_sendq_clients", "gauge", "Clients with output queued.", Client::getBacklogClients());
+    metric(out, "ircserv_flood_deferred_total", "counter", "Times a client's input was held back by flood control.",
+           _floodStats.deferred);
+    metric(out, "ircserv_flood_disconnects_total", "counter", "Clients dropped for staying throttled.",
+           _floodStats.excessFlood);
+
+    family(out, "ircserv_command_calls_total", "counter", "Commands run, by command.");
+    for (size_t i = 0; i < commandStatsCount(); ++i) {
+        if (commandStatsAt(i).calls != 0) {
+            out << "ircserv_command_calls_total{command=\"" << commandStatsAt(i).name << "\"} "
+                << commandStatsAt(i).calls << '\n';
+        }
+    }
+    family(out, "ircserv_command_sent_bytes_total", "counter", "Bytes queued in reply to each command.");
+    for (size_t i = 0; i < commandStatsCount(); ++i) {
+        if (commandStatsAt(i).calls != 0) {
+            out << "ircserv_command_sent_bytes_total{command=\"" << commandStatsAt(i).name << "\"} "
+                << commandStatsAt(i).bytesOut << '\n';
+        }
+    }
+    family(out, "ircserv_command_duration_seconds", "histogram", "Time to run each command, while command_stats is on.");
+    for (size_t i = 0; i < commandStatsCount(); ++i) {
+        if (commandStatsAt(i).latency.count() != 0) {
+            latencyHistogram(out, commandStatsAt(i));
+        }
+    }
+
+    LoopStats::Window loop = _loopStats.sum(10, Clock::monotonicMs());
+    family(out, "ircserv_loop_busy_ratio", "gauge", "Share of the last 10 seconds the event loop was busy.");
+    out << "ircserv_loop_busy_ratio " << seconds(loop.busyNs / 10) << '\n';
+    family(out, "ircserv_loop_max_pass_seconds", "gauge", "Longest event loop pass in the last 10 seconds.");
+    out << "ircserv_loop_max_pass_seconds " << seconds(loop.maxPassNs) << '\n';
+    metric(out, "ircserv_loop_passes_over_budget", "gauge", "Loop passes over loop_budget_ms in the last 10 seconds.",
+           loop.overBudget);
+
+    unsigned long resident, size;
+    memoryUsage(resident, size);
+    metric(out, "ircserv_resident_memory_bytes", "gauge", "Resident memory size.", resident);
+    metric(out, "ircserv_virtual_memory_bytes", "gauge", "Virtual memory size.", size);
+    return out.str();
+}
+
+void ServerTimer::expire() {
+    (server->*action)();
+}
+
+//The same totals as /metrics, rewritten in the shared memory segment under its
+//seqlock every stats_interval_ms. Percentiles are worked out here so ircstat
+//only has to copy the page.
+void Server::_publishStats() {
+    StatsPage& page = _statsSegment.begin();
+    page.updatedMs = Clock::wallMs();
+    page.intervalMs = _config.statsIntervalMs;
+    page.connections = _clients.size();
+    page.registered = _clients.size() - _unregistered;
+    page.channels = _channels.size();
+    page.accepted = _connectionSerial;
+    page.messagesIn = 0;
+    page.bytesIn = 0;
+    page.messagesOut = Client::getLinesTotal();
+    page.bytesOut = Client::getQueuedTotal();
+    page.floodDeferred = _floodStats.deferred;
+    page.floodDisconnects = _floodStats.excessFlood;
+    page.sendqBytes = Client::getBacklogBytes();
+    page.sendqClients = Client::getBacklogClients();
+    LoopStats::Window loop = _loopStats.sum(1, Clock::monotonicMs());
+    page.loop.passes = loop.passes;
+    page.loop.wakeups = loop.wakeups;
+    page.loop.events = loop.events;
+    page.loop.busyNs = loop.busyNs;
+    page.loop.maxPassNs = loop.maxPassNs;
+    page.loop.timersNs = loop.timersNs;
+    page.loop.acceptNs = loop.acceptNs;
+    page.loop.recvNs = loop.recvNs;
+    page.loop.dispatchNs = loop.dispatchNs;
+    page.loop.sendNs = loop.sendNs;
+    page.loop.overBudget = loop.overBudget;
+    page.loop.maxBacklogBytes = loop.maxBacklogBytes;
+    size_t count = std::min(commandStatsCount(), static_cast<size_t>(STATS_COMMAND_MAX));
+    for (size_t i = 0; i < count; ++i) {
+        const CommandStats& stats = commandStatsAt(i);
+        StatsCommandSlot& out = page.commands[i];
+        std::strncpy(out.name, stats.name, STATS_NAME_MAX - 1);
+        out.calls = stats.calls;
+        out.bytesIn = stats.bytesIn;
+        out.bytesOut = stats.bytesOut;
+        out.latencyCount = stats.latency.count();
+        out.latencySumNs = stats.latency.sum();
+        out.p50Ns = stats.latency.percentile(0.5);
+        out.p99Ns = stats.latency.percentile(0.99);
+        out.maxNs = stats.latency.max();
+        page.messagesIn += stats.calls;
+        page.bytesIn += stats.bytesIn;
+    }
+    page.commandCount = count;
+    _statsSegment.commit();
+    _timers.schedule(_statsTimer, Clock::monotonicMs(), _config.statsIntervalMs);
+}
@@ -1,16 +1,20 @@
 #include "../../inc/Server.hpp"
 
-Server::Server() {}
+Server::Server() : _unregistered(0), _connectionSerial(0), _lookupSerial(0) {
+    _floodStats.deferred = 0;
+    _floodStats.excessFlood = 0;
+    _applyConfig();
+}
 
 void Server::createSocket() {
     _listening_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (_listening_socket == -1){
-        std::cerr << "Socket couldn't be created" << std::endl;
+        LOG(LOG_ERROR, "Socket couldn't be created");
         exit(EXIT_FAILURE);
     }
     int option = 1;
     if (setsockopt(_listening_socket, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option)) < 0){
-        std::cerr << "Error: error SO_REUSEADDR has failed" << std::endl;
+        LOG(LOG_ERROR, "SO_REUSEADDR has failed");
         exit(EXIT_FAILURE);
     }
     _makeNonBlock(_listening_socket);
@@ -25,24 +29,73 @@ void Server::initAdress(){
 
     // bind port w server
     if (bind(_listening_socket, reinterpret_cast<sockaddr *>(&serverAdress), sizeof(serverAdress)) == -1){
-        std::cerr << "Error: bind has failed: " << strerror(errno) << std::endl;
+        LOG(LOG_ERROR, "bind has failed: " << strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
 void Server::startListen(){
-    if (listen(_listening_socket, 5) == -1){
-        std::cerr << "Error: listen has failed" << std::endl;
+    if (listen(_listening_socket, static_cast<int>(_config.listenBacklog)) == -1){
+        LOG(LOG_ERROR, "listen has failed");
         exit(EXIT_FAILURE);
     }
     // replc port 8080 w all ports
-    std::cout << "Server is now listening on port " << _port << "...." << std::endl;
+    LOG(LOG_INFO, "Server is now listening on port " << _port << "....");
 }
 
 
+//SIGINT/SIGTERM/SIGHUP stay blocked outside of poll(), which unblocks them
+//atomically, so a signal can never slip in just before an unbounded sleep.
+//Blocked before the worker threads start so they inherit it and the signals
+//always land on the loop
 void Server::startServer(){
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &_pollMask);
+    if (!Log::start(_config.logFile)) {
+        exit(EXIT_FAILURE);
+    }
+    Clock::update();
+    _timers.start(Clock::monotonicMs());
+    _hostTable.reserve(_config.hostTableSize);
     createSocket();
     initAdress();
     startListen();
+    if (!_config.metricsListen.empty() && !_metrics.open(_config.metricsListen)) {
+        LOG(LOG_WARN, "metrics are not served");
+    }
+    _startResolver();
+    if (!_config.historyDir.empty() && !_historyCatalog.scan(_config.historyDir)) {
+        LOG(LOG_WARN, "history is not persisted");
+    }
+    if (_historyCatalog.isOpen() && !_historySyncer.start(static_cast<int>(_config.historySyncMs))) {
+        LOG(LOG_WARN, "history sync thread failed to start, syncing on close only");
+    }
+    if (!_config.stateDir.empty() && !_journal.open(_config.stateDir, *this)) {
+        LOG(LOG_WARN, "channel state is not persisted");
+    }
+    if (!_config.eventDir.empty()) {
+        if (_events.open(_config.eventDir)) {
+            std::ostringstream port;
+            port << _port;
+            _events.record(EV_START, 0, port.str());
+        } else {
+            LOG(LOG_WARN, "events are not recorded");
+        }
+    }
+    if (!_config.statsShm.empty()) {
+        std::ostringstream name;
+        name << '/' << _config.statsShm << '-' << _port;
+        if (_statsSegment.open(name.str(), _port, Clock::wallMs())) {
+            _statsTimer.server = this;
+            _statsTimer.action = &Server::_publishStats;
+            _publishStats();
+        } else {
+            LOG(LOG_WARN, "stats are not published");
+        }
+    }
     runPoll();
 }
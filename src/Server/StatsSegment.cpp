@@ -0,0 +1,65 @@
+#include "../../inc/StatsSegment.hpp"
+#include "../../inc/Log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+StatsSegment::StatsSegment() : _page(NULL) {}
+
+StatsSegment::~StatsSegment() {
+    close();
+}
+
+//world readable, ircstat may run as another user
+bool StatsSegment::open(const std::string& name, unsigned long port, unsigned long startedMs) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        LOG(LOG_ERROR, "stats segment " << name << ": " << strerror(errno));
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(StatsPage)) == 0) {
+        map = mmap(NULL, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        LOG(LOG_ERROR, "stats segment " << name << ": " << strerror(errno));
+        shm_unlink(name.c_str());
+        return false;
+    }
+    _name = name;
+    _page = static_cast<StatsPage*>(map);
+    //the segment comes zeroed, sequence starts even
+    std::memcpy(_page->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+    _page->version = STATS_VERSION;
+    _page->size = sizeof(StatsPage);
+    _page->pid = static_cast<unsigned long>(getpid());
+    _page->port = port;
+    _page->startedMs = startedMs;
+    LOG(LOG_INFO, "Stats are published in shared memory " << name);
+    return true;
+}
+
+void StatsSegment::close() {
+    if (!_page) {
+        return;
+    }
+    munmap(_page, sizeof(StatsPage));
+    shm_unlink(_name.c_str());
+    _page = NULL;
+}
+
+bool StatsSegment::isOpen() const { return _page != NULL; }
+
+StatsPage& StatsSegment::begin() {
+    ++_page->sequence;
+    __sync_synchronize();
+    return *_page;
+}
+
+void StatsSegment::commit() {
+    __sync_synchronize();
+    ++_page->sequence;
+}
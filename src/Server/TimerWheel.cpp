@@ -0,0 +1,197 @@
+#include "../../inc/TimerWheel.hpp"
+#include <algorithm>
+
+Timer::Timer() : _wheel(NULL), _expires(0), _level(0), _slot(0) {
+    prev = NULL;
+    next = NULL;
+}
+
+Timer::~Timer() {
+    cancel();
+}
+
+bool Timer::isPending() const { return _wheel != NULL; }
+
+void Timer::cancel() {
+    if (_wheel) {
+        _wheel->cancel(*this);
+    }
+}
+
+TimerWheel::TimerWheel() : _now(0), _count(0) {
+    for (unsigned int level = 0; level < LEVELS; ++level) {
+        _occupied[level] = 0;
+        for (unsigned int slot = 0; slot < SLOTS; ++slot) {
+            _slots[level][slot].prev = &_slots[level][slot];
+            _slots[level][slot].next = &_slots[level][slot];
+        }
+    }
+}
+
+void TimerWheel::start(unsigned long nowMs) {
+    _now = nowMs / TICK_MS;
+}
+
+//the level is picked by how far away the timer is, the slot by the digit of its
+//expiry tick at that level
+void TimerWheel::_insert(Timer& timer) {
+    unsigned long delta = timer._expires - _now;
+    unsigned int level = 0;
+    while (level + 1 < LEVELS && delta >= (1UL << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    unsigned int slot = (timer._expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+    TimerLink& head = _slots[level][slot];
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+    timer._level = static_cast<unsigned char>(level);
+    timer._slot = static_cast<unsigned char>(slot);
+    _occupied[level] |= 1UL << slot;
+}
+
+void TimerWheel::_remove(Timer& timer) {
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = NULL;
+    timer.next = NULL;
+    TimerLink& head = _slots[timer._level][timer._slot];
+    if (head.next == &head) {
+        _occupied[timer._level] &= ~(1UL << timer._slot);
+    }
+}
+
+void TimerWheel::schedule(Timer& timer, unsigned long nowMs, unsigned long delayMs) {
+    if (timer._wheel) {
+        timer._wheel->cancel(timer);
+    }
+    const unsigned long maxDelay = (1UL << (SLOT_BITS * LEVELS)) - 1;
+    //rounded up, a timer never fires early; and never before the next tick
+    unsigned long due = (nowMs + delayMs + TICK_MS - 1) / TICK_MS;
+    if (due <= _now) {
+        due = _now + 1;
+    }
+    timer._expires = std::min(due, _now + maxDelay);
+    timer._wheel = this;
+    _insert(timer);
+    ++_count;
+}
+
+void TimerWheel::cancel(Timer& timer) {
+    if (timer._wheel != this) {
+        return;
+    }
+    _remove(timer);
+    timer._wheel = NULL;
+    --_count;
+}
+
+//re-files one higher-level slot, its timers are now close enough for the levels below
+void TimerWheel::_cascade(unsigned int level) {
+    unsigned int slot = (_now >> (SLOT_BITS * level)) & (SLOTS - 1);
+    TimerLink& head = _slots[level][slot];
+    TimerLink* link = head.next;
+    head.prev = &head;
+    head.next = &head;
+    _occupied[level] &= ~(1UL << slot);
+    while (link != &head) {
+        TimerLink* next = link->next;
+        _insert(*static_cast<Timer*>(link));
+        link = next;
+    }
+}
+
+//the slot is moved to a local list first: an expiring timer may schedule or
+//cancel others, including ones due on this same tick
+size_t TimerWheel::_fireSlot(unsigned int slot) {
+    TimerLink& head = _slots[0][slot];
+    if (head.next == &head) {
+        return 0;
+    }
+    TimerLink due;
+    due.next = head.next;
+    due.prev = head.prev;
+    due.next->prev = &due;
+    due.prev->next = &due;
+    head.next = &head;
+    head.prev = &head;
+    _occupied[0] &= ~(1UL << slot);
+
+    size_t fired = 0;
+    while (due.next != &due) {
+        Timer& timer = *static_cast<Timer*>(due.next);
+        timer.prev->next = timer.next;
+        timer.next->prev = timer.prev;
+        timer.prev = NULL;
+        timer.next = NULL;
+        timer._wheel = NULL;
+        --_count;
+        ++fired;
+        timer.expire();
+    }
+    return fired;
+}
+
+size_t TimerWheel::advance(unsigned long nowMs) {
+    unsigned long target = nowMs / TICK_MS;
+    size_t fired = 0;
+    while (_now < target) {
+        if (_count == 0) {
+            _now = target;
+            break;
+        }
+        //nothing in level 0: skip straight to the next wrap, where a cascade may refill it
+        if (_occupied[0] == 0) {
+            unsigned long wrap = _now | (SLOTS - 1);
+            if (wrap >= target) {
+                _now = target;
+                break;
+            }
+            _now = wrap;
+        }
+        ++_now;
+        for (unsigned int level = 1; level < LEVELS; ++level) {
+            if ((_now & ((1UL << (SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            _cascade(level);
+        }
+        fired += _fireSlot(_now & (SLOTS - 1));
+    }
+    return fired;
+}
+
+//distance, in slots, from the current digit to the next used one; the current
+//slot itself only comes round again after a full turn
+static unsigned long nextUsed(unsigned long occupied, unsigned int digit, unsigned int slots) {
+    for (unsigned int step = 1; step <= slots; ++step) {
+        if (occupied & (1UL << ((digit + step) & (slots - 1)))) {
+            return step;
+        }
+    }
+    return 0;
+}
+
+//A level-0 slot is due on its tick; a higher slot only needs the loop awake
+//when it cascades, at the start of its period. The earliest of these is the
+//poll timeout, so an idle wheel lets the loop sleep until the next event.
+long TimerWheel::nextTimeout(unsigned long nowMs) const {
+    if (_count == 0) {
+        return -1;
+    }
+    unsigned long best = static_cast<unsigned long>(-1);
+    for (unsigned int level = 0; level < LEVELS; ++level) {
+        if (_occupied[level] == 0) {
+            continue;
+        }
+        unsigned int shift = SLOT_BITS * level;
+        unsigned long step = nextUsed(_occupied[level], (_now >> shift) & (SLOTS - 1), SLOTS);
+        unsigned long tick = ((_now >> shift) + step) << shift;
+        best = std::min(best, tick);
+    }
+    unsigned long dueMs = best * TICK_MS;
+    return (dueMs > nowMs) ? static_cast<long>(dueMs - nowMs) : 0;
+}
+
+size_t TimerWheel::size() const { return _count; }
@@ -0,0 +1,73 @@
+#include "Test.hpp"
+#include "../inc/Server.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void removeDir(const std::string& dir) {
+    const char* files[] = { "channels.snapshot", "channels.snapshot.tmp", "channels.journal" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        unlink((dir + "/" + files[i]).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+//what one server recorded is what the next one restores: modes, topic, key and
+//lists come back, dropped channels and operators do not, and a record cut off
+//by a crash mid-write is ignored
+void testChannelJournalReplay() {
+    char path[] = "/tmp/ircserv-journal-XXXXXX";
+    if (mkdtemp(path) == NULL) {
+        CHECK(!"mkdtemp failed");
+        return;
+    }
+    std::string dir = path;
+    {
+        Server server;
+        ChannelJournal journal;
+        CHECK(journal.open(dir, server));
+        Channel* channel = server.getOrCreateChannel("#a");
+        channel->setJournal(&journal);
+        journal.recordCreate(*channel);
+        channel->setTopic("hi there", "alice");
+        channel->setPassword("k");
+        channel->addListEntry('b', "*!*@bad.example", "alice");
+        channel->addListEntry('b', "troll!*@*", "alice");
+        channel->setUserLimit(5);
+        channel->setInviteOnly(true);
+        channel->addOperator("alice");
+        Channel* gone = server.getOrCreateChannel("#gone");
+        gone->setJournal(&journal);
+        journal.recordCreate(*gone);
+        journal.recordDrop("#gone");
+        server.removeChannel("#gone");
+        journal.close();
+    }
+    int fd = open((dir + "/channels.journal").c_str(), O_WRONLY | O_APPEND);
+    CHECK(fd != -1);
+    if (fd != -1) {
+        const char torn[] = { 40, 0, 0, 0, ChannelJournal::REC_TOPIC, 2, 0 };
+        CHECK(write(fd, torn, sizeof(torn)) == static_cast<ssize_t>(sizeof(torn)));
+        close(fd);
+    }
+    {
+        Server server;
+        ChannelJournal journal;
+        CHECK(journal.open(dir, server));
+        Channel* channel = server.getChannel("#a");
+        CHECK(channel != NULL);
+        if (channel) {
+            CHECK(channel->getTopic() == "hi there");
+            CHECK(channel->getPassword() == "k");
+            CHECK(channel->getList('b').size() == 2);
+            CHECK(channel->isInviteOnly());
+            CHECK(channel->getUserLimit() == 5);
+            CHECK(!channel->isOperator("alice"));
+            CHECK(channel->getOperatorCount() == 0);
+        }
+        CHECK(server.getChannel("#gone") == NULL);
+        journal.close();
+    }
+    removeDir(dir);
+}
@@ -0,0 +1,74 @@
+#include "Test.hpp"
+#include "../inc/Server.hpp"
+#include "../inc/Fanout.hpp"
+#include <sys/uio.h>
+
+//everything queued on a client, in order
+static std::string queued(const Client& client) {
+    struct iovec iov[64];
+    size_t count = client.fillIovec(iov, 64);
+    std::string out;
+    for (size_t i = 0; i < count; ++i) {
+        out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return out;
+}
+
+static std::vector<SharedBuffer> group(const std::string& line) {
+    return std::vector<SharedBuffer>(1, SharedBuffer(line));
+}
+
+//PRIVMSG #a,#b,carol from alice: #a holds alice, bob and carol, #b bob and
+//dave. The sender is skipped, a client reached twice gets the first target
+//only, and per-target mode keeps one copy per target.
+void testFanoutDeduplication() {
+    Server server;
+    Client alice(-1, "a.example", &server), bob(-1, "b.example", &server);
+    Client carol(-1, "c.example", &server), dave(-1, "d.example", &server);
+    alice.setNickname("alice");
+    bob.setNickname("bob");
+    carol.setNickname("carol");
+    dave.setNickname("dave");
+    Channel a("#a"), b("#b");
+    a.addClient(&alice);
+    a.addClient(&bob);
+    a.addClient(&carol);
+    b.addClient(&bob);
+    b.addClient(&dave);
+
+    FanoutPlan once(FanoutPlan::DELIVER_ONCE);
+    size_t toA = once.addGroup(group("to #a\r\n"));
+    size_t toB = once.addGroup(group("to #b\r\n"));
+    size_t toCarol = once.addGroup(group("to carol\r\n"));
+    once.addChannel(a, toA, &alice);
+    once.addChannel(b, toB, &alice);
+    once.addRecipient(&carol, toCarol);
+    CHECK(once.getRecipientCount() == 5);
+    once.deliver();
+    CHECK(once.getRecipientCount() == 0);
+    CHECK(queued(alice).empty());
+    CHECK(queued(bob) == "to #a\r\n");
+    CHECK(queued(carol) == "to #a\r\n");
+    CHECK(queued(dave) == "to #b\r\n");
+
+    FanoutPlan each(FanoutPlan::DELIVER_PER_TARGET);
+    toA = each.addGroup(group("A\r\n"));
+    toB = each.addGroup(group("B\r\n"));
+    each.addChannel(a, toA, &alice);
+    each.addChannel(b, toB, &alice);
+    each.deliver();
+    CHECK(queued(bob) == "to #a\r\nA\r\nB\r\n");
+    CHECK(queued(carol) == "to #a\r\nA\r\n");
+    CHECK(queued(dave) == "to #b\r\nB\r\n");
+
+    //the lines are shared between recipients, not copied
+    struct iovec bobIov[8], daveIov[8];
+    CHECK(bob.fillIovec(bobIov, 8) == 3 && dave.fillIovec(daveIov, 8) == 2);
+    CHECK(bobIov[2].iov_base == daveIov[1].iov_base);
+
+    a.removeClient("alice");
+    a.removeClient("bob");
+    a.removeClient("carol");
+    b.removeClient("bob");
+    b.removeClient("dave");
+}
@@ -0,0 +1,91 @@
+#include "Test.hpp"
+#include "../inc/HostTable.hpp"
+#include <cstring>
+#include <vector>
+
+static HostKey host(unsigned int n) {
+    HostKey key;
+    std::memset(key.bytes, 0, sizeof(key.bytes));
+    key.bytes[10] = 0xff;
+    key.bytes[11] = 0xff;
+    key.bytes[12] = 10;
+    key.bytes[13] = static_cast<unsigned char>(n >> 16);
+    key.bytes[14] = static_cast<unsigned char>(n >> 8);
+    key.bytes[15] = static_cast<unsigned char>(n);
+    key.prefix = 128;
+    return key;
+}
+
+//a full small table is emptied in a scrambled order: backward shift deletion
+//must leave every remaining key reachable from its home slot
+void testHostTableErase() {
+    HostTable table;
+    table.reserve(64);
+    table.setThrottle(0, 0);
+    unsigned int seed = 12345;
+    for (int round = 0; round < 200; ++round) {
+        std::vector<unsigned int> keys;
+        for (unsigned int i = 0; i < 48; ++i) {
+            seed = seed * 1103515245 + 12345;
+            keys.push_back((seed >> 8) % 1000);
+            HostTable::Entry* entry = table.acquire(host(keys.back()), 0);
+            CHECK(entry != NULL);
+            if (entry) {
+                ++entry->connections;
+            }
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            size_t pick = i + (seed >> 8) % (keys.size() - i);
+            std::swap(keys[i], keys[pick]);
+            HostTable::Entry* entry = table.find(host(keys[i]));
+            CHECK(entry != NULL);
+            if (entry == NULL) {
+                continue;
+            }
+            if (--entry->connections == 0) {
+                table.release(host(keys[i]), 0);
+                CHECK(table.find(host(keys[i])) == NULL);
+            }
+            for (size_t j = i + 1; j < keys.size(); ++j) {
+                CHECK(table.find(host(keys[j])) != NULL);
+            }
+        }
+        CHECK(table.size() == 0);
+    }
+}
+
+//with the throttle on, a host that leaves with its bucket not yet full stays
+//until it refilled, and makeRoom() drops it then
+void testHostTableLingering() {
+    HostTable table;
+    table.reserve(16);
+    table.setThrottle(2, 1000);
+    for (unsigned int i = 0; i < 12; ++i) {
+        CHECK(table.makeRoom(1, 0));
+        HostTable::Entry* entry = table.acquire(host(i), 0);
+        CHECK(entry != NULL && table.takeToken(*entry, 0));
+        ++entry->connections;
+    }
+    CHECK(!table.makeRoom(1, 0));
+    for (unsigned int i = 0; i < 12; ++i) {
+        --table.find(host(i))->connections;
+        table.release(host(i), 10);
+    }
+    CHECK(table.size() == 12);
+    CHECK(!table.makeRoom(1, 100));
+    CHECK(table.size() == 12);
+    //one token of two back after 500ms
+    CHECK(table.makeRoom(1, 600));
+    CHECK(table.size() == 0);
+
+    //a host that reconnected while waiting is skipped, not dropped
+    HostTable::Entry* entry = table.acquire(host(1), 1000);
+    table.takeToken(*entry, 1000);
+    table.release(host(1), 1000);
+    entry = table.find(host(1));
+    CHECK(entry != NULL);
+    ++entry->connections;
+    CHECK(table.makeRoom(1, 5000));
+    CHECK(table.find(host(1)) != NULL);
+}
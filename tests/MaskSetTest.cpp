@@ -0,0 +1,49 @@
+#include "Test.hpp"
+#include "../inc/MaskSet.hpp"
+
+static bool matches(const MaskSet& set, const std::string& nick, const std::string& user, const std::string& host) {
+    return set.matches(nick + "!" + user + "@" + host, Mask::fold(host));
+}
+
+//exact host masks live in hash buckets, the rest in a list; both must agree
+//with plain glob matching under rfc1459 casemapping
+void testMaskSetMatching() {
+    MaskSet set;
+    CHECK(set.add("*!*@Bad.Example.org", "op", 0));
+    CHECK(set.add("troll!*@*", "op", 0));
+    CHECK(set.add("*!*@*.spam.net", "op", 0));
+    CHECK(set.add("n[i]ck!~u?er@*", "op", 0));
+    CHECK(!set.add("*!*@bad.example.ORG", "op", 0)); // the same mask, folded
+    CHECK(set.size() == 4);
+
+    CHECK(matches(set, "alice", "a", "bad.example.org"));
+    CHECK(matches(set, "alice", "a", "BAD.EXAMPLE.ORG"));
+    CHECK(!matches(set, "alice", "a", "notbad.example.org"));
+    CHECK(matches(set, "TROLL", "x", "anywhere.com"));
+    CHECK(matches(set, "bob", "b", "host.spam.net"));
+    CHECK(!matches(set, "bob", "b", "spam.net"));
+    CHECK(matches(set, "N{I}CK", "~user", "h.com")); // [] and {} fold together
+    CHECK(!matches(set, "nick", "~us", "h.com"));
+    CHECK(!matches(set, "carol", "c", "good.example.org"));
+
+    CHECK(set.remove("*!*@BAD.example.org"));
+    CHECK(!matches(set, "alice", "a", "bad.example.org"));
+    CHECK(!set.remove("*!*@bad.example.org"));
+    CHECK(set.size() == 3);
+
+    //many exact hosts force the buckets to grow; every one must still be found
+    MaskSet many;
+    for (int i = 0; i < 500; ++i) {
+        std::string host = "h" + std::string(1, static_cast<char>('a' + i % 26)) + std::string(i / 26 + 1, 'x') + ".net";
+        many.add("*!*@" + host, "op", 0);
+    }
+    for (int i = 0; i < 500; ++i) {
+        std::string host = "h" + std::string(1, static_cast<char>('a' + i % 26)) + std::string(i / 26 + 1, 'x') + ".net";
+        CHECK(matches(many, "n", "u", host));
+    }
+    CHECK(!matches(many, "n", "u", "hzz.org"));
+
+    CHECK(MaskSet::normalize("nick") == "nick!*@*");
+    CHECK(MaskSet::normalize("user@host") == "*!user@host");
+    CHECK(MaskSet::normalize("n!u@h") == "n!u@h");
+}
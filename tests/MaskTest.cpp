@@ -0,0 +1,77 @@
+#include "Test.hpp"
+#include "../inc/Mask.hpp"
+#include <cstdlib>
+#include <cstring>
+
+//each shape the compiler picks a different path for
+void testMaskMatching() {
+    CHECK(Mask("*").matches(""));
+    CHECK(Mask("*").matches("anything"));
+    CHECK(Mask("***").matches("x"));
+    CHECK(Mask("nick").matches("NICK"));
+    CHECK(!Mask("nick").matches("nicks"));
+    CHECK(!Mask("nick").matches("nic"));
+    CHECK(Mask("nick*").matches("nickname"));
+    CHECK(!Mask("nick*").matches("nic"));
+    CHECK(Mask("*.example.com").matches("irc.EXAMPLE.com"));
+    CHECK(!Mask("*.example.com").matches("example.com"));
+    CHECK(Mask("a*z").matches("az"));
+    CHECK(Mask("a*z").matches("abcz"));
+    CHECK(!Mask("a*z").matches("abcza"));
+    CHECK(Mask("a?c").matches("abc"));
+    CHECK(!Mask("a?c").matches("ac"));
+    CHECK(Mask("*!*@*.evil.net").matches("bob!~b@host.evil.net"));
+    CHECK(!Mask("*!*@*.evil.net").matches("bob!~b@evil.net"));
+    CHECK(Mask("n?ck*!*user*@host4*.*.net").matches("nick1!~user12@host42.dsl.net"));
+    CHECK(Mask("*a*a*a*").matches("banana is a"));
+    CHECK(!Mask("*a*a*a*a*").matches("banana"));
+    //rfc1459: [ ] \ ~ are the upper case of { } | ^
+    CHECK(Mask("[x]\\~").matches("{X}|^"));
+    CHECK(Mask("{x}|^").matches("[X]\\~"));
+    CHECK(Mask::fold("A[]\\~") == "a{}|^");
+    CHECK(Mask("a*b").getLiteralPrefix() == "a" && Mask("a*b").getLiteralSuffix() == "b");
+    CHECK(!Mask("abc").hasWildcards() && Mask("a?c").hasWildcards());
+
+    Mask mask("*.net");
+    std::vector<std::string> subjects;
+    subjects.push_back("a.net");
+    subjects.push_back("a.org");
+    subjects.push_back(".NET");
+    std::vector<bool> verdicts;
+    CHECK(mask.matchBatch(subjects, verdicts) == 2);
+    CHECK(verdicts.size() == 3 && verdicts[0] && !verdicts[1] && verdicts[2]);
+}
+
+//plain recursive glob, obviously right and slow
+static bool reference(const char* mask, const char* str) {
+    if (*mask == '\0') {
+        return *str == '\0';
+    }
+    if (*mask == '*') {
+        return reference(mask + 1, str) || (*str != '\0' && reference(mask, str + 1));
+    }
+    return *str != '\0' && (*mask == '?' || Mask::fold(*mask) == Mask::fold(*str)) && reference(mask + 1, str + 1);
+}
+
+static std::string randomText(const char* alphabet, size_t maxLength) {
+    std::string text;
+    size_t length = std::rand() % (maxLength + 1);
+    for (size_t i = 0; i < length; ++i) {
+        text += alphabet[std::rand() % std::strlen(alphabet)];
+    }
+    return text;
+}
+
+//small alphabets so random patterns and subjects actually match now and then
+void testMaskReference() {
+    std::srand(7);
+    for (int round = 0; round < 20000; ++round) {
+        std::string pattern = randomText("ab*?A[{", 8);
+        std::string subject = randomText("abAB[{", 10);
+        bool expected = reference(pattern.c_str(), subject.c_str());
+        if (Mask(pattern).matches(subject) != expected) {
+            CHECK(Mask(pattern).matches(subject) == expected);
+            std::cerr << "  pattern \"" << pattern << "\" subject \"" << subject << "\"" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#include "Test.hpp"
+#include "../inc/Server.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+static std::vector<std::string> tokensOf(const Channel& channel) {
+    std::vector<std::string> tokens;
+    const std::vector<std::string>& chunks = channel.getNameChunks();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        std::istringstream in(chunks[i]);
+        std::string token;
+        while (in >> token) {
+            tokens.push_back(token);
+        }
+    }
+    std::sort(tokens.begin(), tokens.end());
+    return tokens;
+}
+
+static bool chunksFit(const Channel& channel) {
+    //":ircserver 353 <30 char nick> = <channel> :<names>\r\n" within 512
+    size_t budget = 512 - std::strlen(":ircserver 353 ") - 30 - 3 - 2 - 2 - channel.getName().length();
+    const std::vector<std::string>& chunks = channel.getNameChunks();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].empty() || chunks[i].length() > budget || chunks[i][0] == ' '
+            || chunks[i][chunks[i].length() - 1] == ' ' || chunks[i].find("  ") != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string randomNick(int serial) {
+    std::ostringstream nick;
+    nick << "n" << serial << std::string(std::rand() % 20, 'x');
+    return nick.str();
+}
+
+//joins, parts, op changes and renames in a random order; after each one the
+//patched chunks must hold exactly the members, "@" on the operators, every
+//line within the 353 budget and no empty line left over
+void testNamesChunkPatching() {
+    Server server;
+    Channel channel("#names");
+    std::vector<Client*> members;
+    std::map<std::string, bool> expected; // nick -> operator
+    int serial = 0;
+    std::srand(30);
+    for (int step = 0; step < 5000; ++step) {
+        int action = std::rand() % 10;
+        if (members.size() < 20 || (action < 4 && members.size() < 400)) {
+            Client* client = new Client(-1, "h.example", &server);
+            client->setNickname(randomNick(serial++));
+            channel.addClient(client);
+            members.push_back(client);
+            expected[client->getNickname()] = false;
+            continue;
+        }
+        size_t pick = std::rand() % members.size();
+        Client* client = members[pick];
+        std::string nick = client->getNickname();
+        if (action < 6) {
+            channel.removeClient(nick);
+            expected.erase(nick);
+            members.erase(members.begin() + pick);
+            delete client;
+        } else if (action < 8) {
+            bool op = !expected[nick];
+            if (op) {
+                channel.addOperator(nick);
+            } else {
+                channel.removeOperator(nick);
+            }
+            expected[nick] = op;
+        } else {
+            std::string renamed = randomNick(serial++);
+            channel.renameClient(nick, renamed);
+            client->setNickname(renamed);
+            expected[renamed] = expected[nick];
+            expected.erase(nick);
+        }
+        std::vector<std::string> want;
+        for (std::map<std::string, bool>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+            want.push_back(it->second ? "@" + it->first : it->first);
+        }
+        std::sort(want.begin(), want.end());
+        if (tokensOf(channel) != want || !chunksFit(channel)) {
+            CHECK(tokensOf(channel) == want);
+            CHECK(chunksFit(channel));
+            break;
+        }
+    }
+    CHECK(channel.getNameChunks().size() > 3);
+    for (size_t i = 0; i < members.size(); ++i) {
+        channel.removeClient(members[i]->getNickname());
+        delete members[i];
+    }
+    CHECK(channel.getNameChunks().empty());
+}
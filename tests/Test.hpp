@@ -0,0 +1,25 @@
+#pragma once
+#include <iostream>
+
+//Behaviour tests for the parts of the server that are easiest to get subtly
+//wrong. Each test is a plain function listed in unit_tests.cpp; CHECK reports a
+//failed condition and lets the test go on, main() exits non-zero if any did.
+extern int g_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        ++g_failures; \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+    } \
+} while (0)
+
+void testMaskMatching();
+void testMaskReference();
+void testMaskSetMatching();
+void testChannelJournalReplay();
+void testTimerWheelCascade();
+void testTimerWheelCancel();
+void testHostTableErase();
+void testHostTableLingering();
+void testFanoutDeduplication();
+void testNamesChunkPatching();
@@ -0,0 +1,81 @@
+#include "Test.hpp"
+#include "../inc/TimerWheel.hpp"
+
+struct RecordingTimer : public Timer {
+    const unsigned long* clock;
+    unsigned long dueMs;
+    unsigned long firedMs;
+    int fired;
+    void expire() {
+        firedMs = *clock;
+        ++fired;
+    }
+};
+
+//delays on every level fire once, on their tick: level 0 directly, the others
+//after being cascaded down as the wheel turns
+void testTimerWheelCascade() {
+    static const unsigned long delays[] = {
+        0, 5, 10, 639, 640, 641, 5000, 40950, 41000, 99999, 2621440, 2700000, 10000000
+    };
+    static const size_t COUNT = sizeof(delays) / sizeof(delays[0]);
+    unsigned long now = 1000003;
+    TimerWheel wheel;
+    wheel.start(now);
+    RecordingTimer timers[COUNT];
+    for (size_t i = 0; i < COUNT; ++i) {
+        timers[i].clock = &now;
+        timers[i].dueMs = now + delays[i];
+        timers[i].fired = 0;
+        wheel.schedule(timers[i], now, delays[i]);
+    }
+    CHECK(wheel.size() == COUNT);
+    unsigned long end = now + delays[COUNT - 1] + 100;
+    while (now < end) {
+        long wait = wheel.nextTimeout(now);
+        if (wait < 0) {
+            break;
+        }
+        //the wheel may wake early to cascade, never late
+        for (size_t i = 0; i < COUNT; ++i) {
+            CHECK(timers[i].fired || timers[i].dueMs + TimerWheel::TICK_MS >= now + wait);
+        }
+        now += (wait > 0) ? wait : 1;
+        wheel.advance(now);
+    }
+    CHECK(wheel.size() == 0);
+    for (size_t i = 0; i < COUNT; ++i) {
+        CHECK(timers[i].fired == 1);
+        CHECK(timers[i].firedMs >= timers[i].dueMs);
+        CHECK(timers[i].firedMs < timers[i].dueMs + 2 * TimerWheel::TICK_MS);
+    }
+}
+
+//cancelled and rescheduled timers leave nothing behind in the slots
+void testTimerWheelCancel() {
+    unsigned long now = 0;
+    TimerWheel wheel;
+    wheel.start(now);
+    RecordingTimer a, b;
+    a.clock = b.clock = &now;
+    a.fired = b.fired = 0;
+    wheel.schedule(a, now, 100000);
+    wheel.schedule(b, now, 50);
+    wheel.cancel(a);
+    CHECK(!a.isPending());
+    wheel.schedule(b, now, 3000);
+    CHECK(wheel.size() == 1);
+    for (now = 0; now <= 200000; now += TimerWheel::TICK_MS) {
+        wheel.advance(now);
+    }
+    CHECK(a.fired == 0);
+    CHECK(b.fired == 1 && b.firedMs >= 3000 && b.firedMs < 3000 + 2 * TimerWheel::TICK_MS);
+    {
+        RecordingTimer scoped;
+        scoped.clock = &now;
+        scoped.fired = 0;
+        wheel.schedule(scoped, now, 10);
+    }
+    CHECK(wheel.size() == 0);
+    CHECK(wheel.nextTimeout(now) == -1);
+}
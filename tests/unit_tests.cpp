@@ -0,0 +1,38 @@
+#include "Test.hpp"
+#include "../inc/Server.hpp"
+#include <cstdlib>
+
+int g_failures = 0;
+
+//set by the signal handlers in the server's main.cpp, which is not linked here
+volatile sig_atomic_t sig_received = 0;
+volatile sig_atomic_t rehash_received = 0;
+
+static const struct {
+    const char* name;
+    void (*run)();
+} g_tests[] = {
+    { "mask matching", &testMaskMatching },
+    { "mask against a reference matcher", &testMaskReference },
+    { "mask set matching", &testMaskSetMatching },
+    { "channel journal replay", &testChannelJournalReplay },
+    { "timer wheel cascade", &testTimerWheelCascade },
+    { "timer wheel cancel", &testTimerWheelCancel },
+    { "host table erase", &testHostTableErase },
+    { "host table lingering entries", &testHostTableLingering },
+    { "fan-out de-duplication", &testFanoutDeduplication },
+    { "NAMES chunk patching", &testNamesChunkPatching },
+};
+
+int main() {
+    for (size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); ++i) {
+        int before = g_failures;
+        g_tests[i].run();
+        std::cout << (g_failures == before ? "ok   " : "FAIL ") << g_tests[i].name << std::endl;
+    }
+    if (g_failures != 0) {
+        std::cout << g_failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}